@@ -0,0 +1,816 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "bc_encoder.h"
+#include "common.h"
+#include "profiler.h"
+
+#include <cstring>
+
+namespace bc {
+    // Bump when the encoder output changes so that stale cache entries are not reused.
+    static constexpr uint32_t kCacheVersion = 1;
+
+    static constexpr uint32_t kNumLeastSquaresIterations = 2;
+    static constexpr uint32_t kNumPowerIterations = 8;
+
+    static constexpr uint8_t kBC7Weights4[] = {
+        0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+    };
+
+    uint32_t getBlockSizeInBytes(Format format) {
+        switch (format) {
+        case Format::BC1:
+        case Format::BC4:
+            return 8;
+        case Format::BC5:
+        case Format::BC7:
+            return 16;
+        default:
+            Assert_ShouldNotBeCalled();
+            return 0;
+        }
+    }
+
+    cudau::ArrayElementType getArrayElementType(Format format) {
+        switch (format) {
+        case Format::BC1:
+            return cudau::ArrayElementType::BC1_UNorm;
+        case Format::BC4:
+            return cudau::ArrayElementType::BC4_UNorm;
+        case Format::BC5:
+            return cudau::ArrayElementType::BC5_UNorm;
+        case Format::BC7:
+            return cudau::ArrayElementType::BC7_UNorm;
+        default:
+            Assert_ShouldNotBeCalled();
+            return cudau::ArrayElementType::BC1_UNorm;
+        }
+    }
+
+    const char* getFormatName(Format format) {
+        static const char* names[] = { "BC1", "BC4", "BC5", "BC7" };
+        return names[static_cast<uint32_t>(format)];
+    }
+
+    const char* getQualityName(Quality quality) {
+        static const char* names[] = { "Fast", "Normal", "High" };
+        return names[static_cast<uint32_t>(quality)];
+    }
+
+    uint32_t getChannelMask(Format format) {
+        switch (format) {
+        case Format::BC1:
+            return 0b0111;
+        case Format::BC4:
+            return 0b0001;
+        case Format::BC5:
+            return 0b0011;
+        case Format::BC7:
+            return 0b1111;
+        default:
+            Assert_ShouldNotBeCalled();
+            return 0;
+        }
+    }
+
+
+
+    static inline float dot4(__m128 a, __m128 b) {
+        return _mm_cvtss_f32(_mm_dp_ps(a, b, 0xF1));
+    }
+
+    static inline __m128 clamp255(__m128 v) {
+        return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    }
+
+    static inline int32_t roundToInt(float v) {
+        return static_cast<int32_t>(std::floor(v + 0.5f));
+    }
+
+    // Endpoints along the principal axis (or the bounding box diagonal for Quality::Fast)
+    // of the masked texels, clamped to [0, 255].
+    static void fitEndpoints(const __m128 texels[16], __m128 mask, Quality quality, __m128* e0, __m128* e1) {
+        __m128 mean = _mm_setzero_ps();
+        __m128 minValue = _mm_set1_ps(255.0f);
+        __m128 maxValue = _mm_setzero_ps();
+        for (uint32_t i = 0; i < 16; ++i) {
+            mean = _mm_add_ps(mean, texels[i]);
+            minValue = _mm_min_ps(minValue, texels[i]);
+            maxValue = _mm_max_ps(maxValue, texels[i]);
+        }
+        mean = _mm_mul_ps(mean, _mm_set1_ps(1.0f / 16));
+
+        __m128 axis = _mm_mul_ps(_mm_sub_ps(maxValue, minValue), mask);
+        if (quality != Quality::Fast) {
+            float cov[4][4] = {};
+            for (uint32_t i = 0; i < 16; ++i) {
+                float d[4];
+                _mm_storeu_ps(d, _mm_mul_ps(_mm_sub_ps(texels[i], mean), mask));
+                for (uint32_t r = 0; r < 4; ++r)
+                    for (uint32_t c = 0; c < 4; ++c)
+                        cov[r][c] += d[r] * d[c];
+            }
+            __m128 covRows[4];
+            for (uint32_t r = 0; r < 4; ++r)
+                covRows[r] = _mm_loadu_ps(cov[r]);
+
+            for (uint32_t it = 0; it < kNumPowerIterations; ++it) {
+                __m128 next = _mm_setr_ps(dot4(covRows[0], axis), dot4(covRows[1], axis),
+                                          dot4(covRows[2], axis), dot4(covRows[3], axis));
+                __m128 absNext = _mm_andnot_ps(_mm_set1_ps(-0.0f), next);
+                absNext = _mm_max_ps(absNext, _mm_shuffle_ps(absNext, absNext, _MM_SHUFFLE(1, 0, 3, 2)));
+                absNext = _mm_max_ps(absNext, _mm_shuffle_ps(absNext, absNext, _MM_SHUFFLE(2, 3, 0, 1)));
+                float maxComp = _mm_cvtss_f32(absNext);
+                if (maxComp < 1e-6f)
+                    break;
+                axis = _mm_mul_ps(next, _mm_set1_ps(1.0f / maxComp));
+            }
+        }
+
+        float sqLength = dot4(axis, axis);
+        if (sqLength < 1e-6f) {
+            *e0 = clamp255(mean);
+            *e1 = *e0;
+            return;
+        }
+        axis = _mm_mul_ps(axis, _mm_set1_ps(1.0f / std::sqrt(sqLength)));
+
+        float minT = INFINITY;
+        float maxT = -INFINITY;
+        for (uint32_t i = 0; i < 16; ++i) {
+            float t = dot4(_mm_sub_ps(texels[i], mean), axis);
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        *e0 = clamp255(_mm_add_ps(mean, _mm_mul_ps(axis, _mm_set1_ps(minT))));
+        *e1 = clamp255(_mm_add_ps(mean, _mm_mul_ps(axis, _mm_set1_ps(maxT))));
+    }
+
+    // Solves min sum |(1 - t_i) * e0 + t_i * e1 - x_i|^2 for e0 and e1 given the interpolation weights t_i.
+    static bool solveLeastSquares(const __m128 texels[16], const float weights[16], __m128* e0, __m128* e1) {
+        float a = 0, b = 0, c = 0;
+        __m128 x0 = _mm_setzero_ps();
+        __m128 x1 = _mm_setzero_ps();
+        for (uint32_t i = 0; i < 16; ++i) {
+            float t = weights[i];
+            float s = 1 - t;
+            a += s * s;
+            b += s * t;
+            c += t * t;
+            x0 = _mm_add_ps(x0, _mm_mul_ps(texels[i], _mm_set1_ps(s)));
+            x1 = _mm_add_ps(x1, _mm_mul_ps(texels[i], _mm_set1_ps(t)));
+        }
+        float det = a * c - b * b;
+        if (std::fabs(det) < 1e-6f)
+            return false;
+        float recDet = 1.0f / det;
+        *e0 = clamp255(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(x0, _mm_set1_ps(c)), _mm_mul_ps(x1, _mm_set1_ps(b))),
+                                  _mm_set1_ps(recDet)));
+        *e1 = clamp255(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(x1, _mm_set1_ps(a)), _mm_mul_ps(x0, _mm_set1_ps(b))),
+                                  _mm_set1_ps(recDet)));
+        return true;
+    }
+
+
+
+    struct BC1Traits {
+        static constexpr uint32_t numIndices = 4;
+        struct Endpoints {
+            uint16_t colors[2];
+        };
+
+        static uint16_t quantize(__m128 e) {
+            float rgba[4];
+            _mm_storeu_ps(rgba, e);
+            uint32_t r = std::min(roundToInt(rgba[0] * (31.0f / 255)), 31);
+            uint32_t g = std::min(roundToInt(rgba[1] * (63.0f / 255)), 63);
+            uint32_t b = std::min(roundToInt(rgba[2] * (31.0f / 255)), 31);
+            return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+        }
+        static void expand(uint16_t c, int32_t rgb[3]) {
+            uint32_t r = (c >> 11) & 0x1F;
+            uint32_t g = (c >> 5) & 0x3F;
+            uint32_t b = c & 0x1F;
+            rgb[0] = (r << 3) | (r >> 2);
+            rgb[1] = (g << 2) | (g >> 4);
+            rgb[2] = (b << 3) | (b >> 2);
+        }
+
+        static Endpoints quantize(__m128 e0, __m128 e1, __m128 /*mask*/) {
+            return Endpoints{ { quantize(e0), quantize(e1) } };
+        }
+        // Always the 4-color palette, pack() takes care of the endpoint order.
+        static void buildPalette(const Endpoints &ep, __m128 palette[numIndices]) {
+            int32_t c0[3], c1[3];
+            expand(ep.colors[0], c0);
+            expand(ep.colors[1], c1);
+            palette[0] = _mm_setr_ps(c0[0], c0[1], c0[2], 0);
+            palette[1] = _mm_setr_ps(c1[0], c1[1], c1[2], 0);
+            palette[2] = _mm_setr_ps((2 * c0[0] + c1[0]) / 3, (2 * c0[1] + c1[1]) / 3, (2 * c0[2] + c1[2]) / 3, 0);
+            palette[3] = _mm_setr_ps((c0[0] + 2 * c1[0]) / 3, (c0[1] + 2 * c1[1]) / 3, (c0[2] + 2 * c1[2]) / 3, 0);
+        }
+        static float weight(uint32_t index) {
+            static const float weights[] = { 0.0f, 1.0f, 1.0f / 3, 2.0f / 3 };
+            return weights[index];
+        }
+
+        static void pack(Endpoints ep, uint8_t indices[16], uint8_t* dst) {
+            if (ep.colors[0] == ep.colors[1]) {
+                std::fill_n(indices, 16, 0);
+            }
+            else if (ep.colors[0] < ep.colors[1]) {
+                std::swap(ep.colors[0], ep.colors[1]);
+                static const uint8_t remap[] = { 1, 0, 3, 2 };
+                for (uint32_t i = 0; i < 16; ++i)
+                    indices[i] = remap[indices[i]];
+            }
+            uint32_t indexBits = 0;
+            for (uint32_t i = 0; i < 16; ++i)
+                indexBits |= indices[i] << (2 * i);
+            std::memcpy(dst + 0, &ep.colors[0], 2);
+            std::memcpy(dst + 2, &ep.colors[1], 2);
+            std::memcpy(dst + 4, &indexBits, 4);
+        }
+    };
+
+    struct BC7Mode6Traits {
+        static constexpr uint32_t numIndices = 16;
+        struct Endpoints {
+            uint8_t values[2][4]; // 7 bits each
+            uint8_t pBits[2];
+        };
+
+        // JP: エンドポイント毎に共有されるPビットは両方の候補を試して誤差の小さい方を選ぶ。
+        // EN: Tries both candidates of the P-bit shared by each endpoint and keeps the one with lower error.
+        static void quantize(__m128 e, __m128 mask, uint8_t values[4], uint8_t* pBit) {
+            float rgba[4];
+            _mm_storeu_ps(rgba, e);
+            std::fill_n(values, 4, 0);
+            *pBit = 0;
+            float bestError = INFINITY;
+            for (uint32_t p = 0; p < 2; ++p) {
+                uint8_t candidate[4];
+                float diffs[4];
+                for (uint32_t c = 0; c < 4; ++c) {
+                    int32_t q = roundToInt((rgba[c] - p) * 0.5f);
+                    candidate[c] = static_cast<uint8_t>(std::min(std::max(q, 0), 127));
+                    diffs[c] = (candidate[c] << 1 | p) - rgba[c];
+                }
+                __m128 diff = _mm_mul_ps(_mm_loadu_ps(diffs), mask);
+                float error = dot4(diff, diff);
+                if (error < bestError) {
+                    bestError = error;
+                    std::copy_n(candidate, 4, values);
+                    *pBit = p;
+                }
+            }
+        }
+
+        static Endpoints quantize(__m128 e0, __m128 e1, __m128 mask) {
+            Endpoints ep;
+            quantize(e0, mask, ep.values[0], &ep.pBits[0]);
+            quantize(e1, mask, ep.values[1], &ep.pBits[1]);
+            return ep;
+        }
+        static void buildPalette(const Endpoints &ep, __m128 palette[numIndices]) {
+            int32_t e0[4], e1[4];
+            for (uint32_t c = 0; c < 4; ++c) {
+                e0[c] = ep.values[0][c] << 1 | ep.pBits[0];
+                e1[c] = ep.values[1][c] << 1 | ep.pBits[1];
+            }
+            for (uint32_t i = 0; i < numIndices; ++i) {
+                int32_t w = kBC7Weights4[i];
+                float rgba[4];
+                for (uint32_t c = 0; c < 4; ++c)
+                    rgba[c] = static_cast<float>(((64 - w) * e0[c] + w * e1[c] + 32) >> 6);
+                palette[i] = _mm_loadu_ps(rgba);
+            }
+        }
+        static float weight(uint32_t index) {
+            return kBC7Weights4[index] / 64.0f;
+        }
+
+        static void pack(Endpoints ep, uint8_t indices[16], uint8_t* dst) {
+            // JP: 先頭テクセルのインデックスの最上位ビットは暗黙的に0なので、必要ならエンドポイントを入れ替える。
+            // EN: The MSB of the first texel's index is implicitly 0, so swap the endpoints if necessary.
+            if (indices[0] >= 8) {
+                std::swap(ep.values[0], ep.values[1]);
+                std::swap(ep.pBits[0], ep.pBits[1]);
+                for (uint32_t i = 0; i < 16; ++i)
+                    indices[i] = 15 - indices[i];
+            }
+
+            std::fill_n(dst, 16, 0);
+            uint32_t bitPos = 0;
+            auto writeBits = [&](uint32_t value, uint32_t numBits) {
+                for (uint32_t i = 0; i < numBits; ++i, ++bitPos)
+                    dst[bitPos / 8] |= ((value >> i) & 0x1) << (bitPos % 8);
+            };
+            writeBits(1 << 6, 7);
+            for (uint32_t c = 0; c < 4; ++c) {
+                writeBits(ep.values[0][c], 7);
+                writeBits(ep.values[1][c], 7);
+            }
+            writeBits(ep.pBits[0], 1);
+            writeBits(ep.pBits[1], 1);
+            writeBits(indices[0], 3);
+            for (uint32_t i = 1; i < 16; ++i)
+                writeBits(indices[i], 4);
+        }
+    };
+
+    template <typename Traits>
+    static float assignIndices(const __m128 texels[16], __m128 mask, const typename Traits::Endpoints &ep,
+                               uint8_t indices[16]) {
+        __m128 palette[Traits::numIndices];
+        Traits::buildPalette(ep, palette);
+        float totalError = 0.0f;
+        for (uint32_t i = 0; i < 16; ++i) {
+            float bestError = INFINITY;
+            for (uint32_t j = 0; j < Traits::numIndices; ++j) {
+                __m128 diff = _mm_mul_ps(_mm_sub_ps(texels[i], palette[j]), mask);
+                float error = dot4(diff, diff);
+                if (error < bestError) {
+                    bestError = error;
+                    indices[i] = static_cast<uint8_t>(j);
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    template <typename Traits>
+    static void encodeColorBlock(const __m128 texels[16], __m128 mask, Quality quality, uint8_t* dst) {
+        __m128 e0, e1;
+        fitEndpoints(texels, mask, quality, &e0, &e1);
+        typename Traits::Endpoints ep = Traits::quantize(e0, e1, mask);
+        uint8_t indices[16];
+        float error = assignIndices<Traits>(texels, mask, ep, indices);
+
+        if (quality == Quality::High) {
+            for (uint32_t it = 0; it < kNumLeastSquaresIterations && error > 0.0f; ++it) {
+                float weights[16];
+                for (uint32_t i = 0; i < 16; ++i)
+                    weights[i] = Traits::weight(indices[i]);
+                if (!solveLeastSquares(texels, weights, &e0, &e1))
+                    break;
+                typename Traits::Endpoints newEp = Traits::quantize(e0, e1, mask);
+                uint8_t newIndices[16];
+                float newError = assignIndices<Traits>(texels, mask, newEp, newIndices);
+                if (newError >= error)
+                    break;
+                error = newError;
+                ep = newEp;
+                std::copy_n(newIndices, 16, indices);
+            }
+        }
+
+        Traits::pack(ep, indices, dst);
+    }
+
+
+
+    static void buildBC4Palette(uint32_t r0, uint32_t r1, int32_t palette[8]) {
+        palette[0] = r0;
+        palette[1] = r1;
+        if (r0 > r1) {
+            for (uint32_t i = 2; i < 8; ++i)
+                palette[i] = ((8 - i) * r0 + (i - 1) * r1 + 3) / 7;
+        }
+        else {
+            for (uint32_t i = 2; i < 6; ++i)
+                palette[i] = ((6 - i) * r0 + (i - 1) * r1 + 2) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    static float assignBC4Indices(const float values[16], uint32_t r0, uint32_t r1, uint8_t indices[16]) {
+        int32_t palette[8];
+        buildBC4Palette(r0, r1, palette);
+        float totalError = 0.0f;
+        for (uint32_t i = 0; i < 16; ++i) {
+            float bestError = INFINITY;
+            for (uint32_t j = 0; j < 8; ++j) {
+                float diff = values[i] - palette[j];
+                if (diff * diff < bestError) {
+                    bestError = diff * diff;
+                    indices[i] = static_cast<uint8_t>(j);
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    // Always uses the 8-value mode (r0 > r1).
+    static void encodeBC4Block(const float values[16], Quality quality, uint8_t* dst) {
+        float minValue = values[0];
+        float maxValue = values[0];
+        for (uint32_t i = 1; i < 16; ++i) {
+            minValue = std::min(minValue, values[i]);
+            maxValue = std::max(maxValue, values[i]);
+        }
+        uint32_t r0 = roundToInt(maxValue);
+        uint32_t r1 = roundToInt(minValue);
+        uint8_t indices[16];
+        float error = r0 > r1 ? assignBC4Indices(values, r0, r1, indices) : 0.0f;
+
+        uint32_t numIterations = quality == Quality::Fast ? 0 :
+            (quality == Quality::Normal ? 1 : kNumLeastSquaresIterations + 2);
+        for (uint32_t it = 0; it < numIterations && error > 0.0f; ++it) {
+            float a = 0, b = 0, c = 0, x0 = 0, x1 = 0;
+            for (uint32_t i = 0; i < 16; ++i) {
+                float t = indices[i] <= 1 ? indices[i] : (indices[i] - 1) / 7.0f;
+                float s = 1 - t;
+                a += s * s;
+                b += s * t;
+                c += t * t;
+                x0 += s * values[i];
+                x1 += t * values[i];
+            }
+            float det = a * c - b * b;
+            if (std::fabs(det) < 1e-6f)
+                break;
+            int32_t newR0 = std::min(std::max(roundToInt((c * x0 - b * x1) / det), 0), 255);
+            int32_t newR1 = std::min(std::max(roundToInt((a * x1 - b * x0) / det), 0), 255);
+            if (newR0 <= newR1)
+                break;
+            uint8_t newIndices[16];
+            float newError = assignBC4Indices(values, newR0, newR1, newIndices);
+            if (newError >= error)
+                break;
+            error = newError;
+            r0 = newR0;
+            r1 = newR1;
+            std::copy_n(newIndices, 16, indices);
+        }
+
+        if (r0 <= r1) {
+            r1 = r0;
+            std::fill_n(indices, 16, 0);
+        }
+        uint64_t indexBits = 0;
+        for (uint32_t i = 0; i < 16; ++i)
+            indexBits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+        dst[0] = static_cast<uint8_t>(r0);
+        dst[1] = static_cast<uint8_t>(r1);
+        std::memcpy(dst + 2, &indexBits, 6);
+    }
+
+
+
+    static void encodeBlock(const __m128 texels[16], Format format, Quality quality, uint8_t* dst) {
+        switch (format) {
+        case Format::BC1:
+            encodeColorBlock<BC1Traits>(texels, _mm_setr_ps(1, 1, 1, 0), quality, dst);
+            break;
+        case Format::BC4:
+        case Format::BC5: {
+            uint32_t numChannels = format == Format::BC4 ? 1 : 2;
+            float rgbas[16][4];
+            for (uint32_t i = 0; i < 16; ++i)
+                _mm_storeu_ps(rgbas[i], texels[i]);
+            for (uint32_t c = 0; c < numChannels; ++c) {
+                float values[16];
+                for (uint32_t i = 0; i < 16; ++i)
+                    values[i] = rgbas[i][c];
+                encodeBC4Block(values, quality, dst + 8 * c);
+            }
+            break;
+        }
+        case Format::BC7:
+            encodeColorBlock<BC7Mode6Traits>(texels, _mm_set1_ps(1), quality, dst);
+            break;
+        default:
+            Assert_ShouldNotBeCalled();
+            break;
+        }
+    }
+
+    void encode(const uint8_t* srcRGBA8, uint32_t width, uint32_t height,
+                Format format, Quality quality, uint32_t numThreads, std::vector<uint8_t>* blocks) {
+        Assert(srcRGBA8 && width > 0 && height > 0, "Invalid source image.");
+        uint32_t numBlocksX = (width + 3) / 4;
+        uint32_t numBlocksY = (height + 3) / 4;
+        uint32_t blockSize = getBlockSizeInBytes(format);
+        blocks->resize(static_cast<size_t>(numBlocksX) * numBlocksY * blockSize);
+
+        PROFILER_ZONE("BC Encode");
+        parallelFor(numBlocksY, numThreads, [&](uint32_t rowBegin, uint32_t rowEnd) {
+            PROFILER_ZONE("BC Encode Rows");
+            __m128 texels[16];
+            for (uint32_t by = rowBegin; by < rowEnd; ++by) {
+                for (uint32_t bx = 0; bx < numBlocksX; ++bx) {
+                    for (uint32_t i = 0; i < 16; ++i) {
+                        uint32_t x = std::min(4 * bx + i % 4, width - 1);
+                        uint32_t y = std::min(4 * by + i / 4, height - 1);
+                        int32_t texel;
+                        std::memcpy(&texel, srcRGBA8 + 4 * (static_cast<size_t>(y) * width + x), sizeof(texel));
+                        texels[i] = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(texel)));
+                    }
+                    size_t blockIdx = static_cast<size_t>(by) * numBlocksX + bx;
+                    encodeBlock(texels, format, quality, blocks->data() + blockIdx * blockSize);
+                }
+            }
+        });
+    }
+
+
+
+    struct CacheFileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        Format format;
+        Quality quality;
+        uint64_t hash;
+        uint64_t size;
+    };
+
+    // FNV-1a over the settings and the pixels.
+    static uint64_t calcCacheKey(const uint8_t* srcRGBA8, uint32_t width, uint32_t height,
+                                 Format format, Quality quality) {
+        uint64_t hash = 14695981039346656037ull;
+        auto hashBytes = [&hash](const void* data, size_t size) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        uint32_t settings[] = { kCacheVersion, width, height,
+                                static_cast<uint32_t>(format), static_cast<uint32_t>(quality) };
+        hashBytes(settings, sizeof(settings));
+        hashBytes(srcRGBA8, 4 * static_cast<size_t>(width) * height);
+        return hash;
+    }
+
+    bool encodeCached(const std::filesystem::path &cacheDir,
+                      const uint8_t* srcRGBA8, uint32_t width, uint32_t height,
+                      Format format, Quality quality, uint32_t numThreads, std::vector<uint8_t>* blocks) {
+        CacheFileHeader header;
+        std::memcpy(header.magic, "BCC0", 4);
+        header.version = kCacheVersion;
+        header.width = width;
+        header.height = height;
+        header.format = format;
+        header.quality = quality;
+        header.hash = calcCacheKey(srcRGBA8, width, height, format, quality);
+        header.size = static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * getBlockSizeInBytes(format);
+
+        char filename[32];
+        snprintf(filename, sizeof(filename), "%016llx.bc", static_cast<unsigned long long>(header.hash));
+        std::filesystem::path cachePath = cacheDir / filename;
+
+        {
+            std::ifstream ifs(cachePath, std::ios::in | std::ios::binary);
+            CacheFileHeader cachedHeader;
+            if (ifs.read(reinterpret_cast<char*>(&cachedHeader), sizeof(cachedHeader)) &&
+                std::memcmp(&cachedHeader, &header, sizeof(header)) == 0) {
+                blocks->resize(header.size);
+                if (ifs.read(reinterpret_cast<char*>(blocks->data()), header.size))
+                    return true;
+            }
+        }
+
+        encode(srcRGBA8, width, height, format, quality, numThreads, blocks);
+
+        // JP: キャッシュの書き込みに失敗してもエンコード結果自体は有効なので無視する。
+        // EN: Failing to write the cache does not invalidate the encoded result, so just ignore it.
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+        std::filesystem::path tempPath = cachePath;
+        tempPath += ".tmp";
+        {
+            std::ofstream ofs(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(blocks->data()), blocks->size());
+            if (!ofs)
+                return false;
+        }
+        std::filesystem::rename(tempPath, cachePath, ec);
+        if (ec)
+            std::filesystem::remove(tempPath, ec);
+
+        return false;
+    }
+
+
+
+    static void decodeBC1Block(const uint8_t* src, uint8_t texels[16][4]) {
+        uint16_t c0, c1;
+        uint32_t indexBits;
+        std::memcpy(&c0, src + 0, 2);
+        std::memcpy(&c1, src + 2, 2);
+        std::memcpy(&indexBits, src + 4, 4);
+        int32_t rgb0[3], rgb1[3];
+        BC1Traits::expand(c0, rgb0);
+        BC1Traits::expand(c1, rgb1);
+        int32_t palette[4][4];
+        for (uint32_t c = 0; c < 3; ++c) {
+            palette[0][c] = rgb0[c];
+            palette[1][c] = rgb1[c];
+            if (c0 > c1) {
+                palette[2][c] = (2 * rgb0[c] + rgb1[c]) / 3;
+                palette[3][c] = (rgb0[c] + 2 * rgb1[c]) / 3;
+            }
+            else {
+                palette[2][c] = (rgb0[c] + rgb1[c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        palette[0][3] = palette[1][3] = palette[2][3] = 255;
+        palette[3][3] = c0 > c1 ? 255 : 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t index = (indexBits >> (2 * i)) & 0x3;
+            for (uint32_t c = 0; c < 4; ++c)
+                texels[i][c] = static_cast<uint8_t>(palette[index][c]);
+        }
+    }
+
+    static void decodeBC4Block(const uint8_t* src, uint8_t texels[16][4], uint32_t channel) {
+        int32_t palette[8];
+        buildBC4Palette(src[0], src[1], palette);
+        uint64_t indexBits = 0;
+        std::memcpy(&indexBits, src + 2, 6);
+        for (uint32_t i = 0; i < 16; ++i)
+            texels[i][channel] = static_cast<uint8_t>(palette[(indexBits >> (3 * i)) & 0x7]);
+    }
+
+    // Returns false (leaving the texels untouched) for modes other than 6.
+    static bool decodeBC7Block(const uint8_t* src, uint8_t texels[16][4]) {
+        uint32_t bitPos = 0;
+        auto readBits = [&](uint32_t numBits) {
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < numBits; ++i, ++bitPos)
+                value |= ((src[bitPos / 8] >> (bitPos % 8)) & 0x1) << i;
+            return value;
+        };
+        if (readBits(7) != (1 << 6))
+            return false;
+        BC7Mode6Traits::Endpoints ep;
+        for (uint32_t c = 0; c < 4; ++c) {
+            ep.values[0][c] = static_cast<uint8_t>(readBits(7));
+            ep.values[1][c] = static_cast<uint8_t>(readBits(7));
+        }
+        ep.pBits[0] = static_cast<uint8_t>(readBits(1));
+        ep.pBits[1] = static_cast<uint8_t>(readBits(1));
+        __m128 palette[16];
+        BC7Mode6Traits::buildPalette(ep, palette);
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t index = readBits(i == 0 ? 3 : 4);
+            float rgba[4];
+            _mm_storeu_ps(rgba, palette[index]);
+            for (uint32_t c = 0; c < 4; ++c)
+                texels[i][c] = static_cast<uint8_t>(rgba[c]);
+        }
+        return true;
+    }
+
+    bool decode(const uint8_t* blocks, uint32_t width, uint32_t height, Format format,
+                std::vector<uint8_t>* dstRGBA8) {
+        uint32_t numBlocksX = (width + 3) / 4;
+        uint32_t numBlocksY = (height + 3) / 4;
+        uint32_t blockSize = getBlockSizeInBytes(format);
+        dstRGBA8->resize(4 * static_cast<size_t>(width) * height);
+
+        bool success = true;
+        for (uint32_t by = 0; by < numBlocksY; ++by) {
+            for (uint32_t bx = 0; bx < numBlocksX; ++bx) {
+                const uint8_t* src = blocks + (static_cast<size_t>(by) * numBlocksX + bx) * blockSize;
+                uint8_t texels[16][4] = {};
+                for (uint32_t i = 0; i < 16; ++i)
+                    texels[i][3] = 255;
+                switch (format) {
+                case Format::BC1:
+                    decodeBC1Block(src, texels);
+                    break;
+                case Format::BC4:
+                    decodeBC4Block(src, texels, 0);
+                    break;
+                case Format::BC5:
+                    decodeBC4Block(src, texels, 0);
+                    decodeBC4Block(src + 8, texels, 1);
+                    break;
+                case Format::BC7:
+                    if (!decodeBC7Block(src, texels)) {
+                        std::memset(texels, 0, sizeof(texels));
+                        success = false;
+                    }
+                    break;
+                default:
+                    Assert_ShouldNotBeCalled();
+                    break;
+                }
+
+                for (uint32_t i = 0; i < 16; ++i) {
+                    uint32_t x = 4 * bx + i % 4;
+                    uint32_t y = 4 * by + i / 4;
+                    if (x >= width || y >= height)
+                        continue;
+                    std::memcpy(dstRGBA8->data() + 4 * (static_cast<size_t>(y) * width + x), texels[i], 4);
+                }
+            }
+        }
+
+        return success;
+    }
+
+
+
+    float calcPSNR(const uint8_t* refRGBA8, const uint8_t* testRGBA8, uint32_t width, uint32_t height,
+                   uint32_t channelMask) {
+        double sumSqError = 0.0;
+        uint64_t numSamples = 0;
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i) {
+            for (uint32_t c = 0; c < 4; ++c) {
+                if ((channelMask & (1 << c)) == 0)
+                    continue;
+                double diff = static_cast<double>(refRGBA8[4 * i + c]) - testRGBA8[4 * i + c];
+                sumSqError += diff * diff;
+                ++numSamples;
+            }
+        }
+        if (numSamples == 0 || sumSqError == 0.0)
+            return INFINITY;
+        double mse = sumSqError / numSamples;
+        return static_cast<float>(10 * std::log10(255.0 * 255.0 / mse));
+    }
+
+    bool runSelfTest() {
+        constexpr uint32_t width = 64;
+        constexpr uint32_t height = 64;
+        // Minimum PSNR for the smooth and the noisy image, per format.
+        constexpr float minPSNRs[][2] = {
+            { 36.0f, 25.0f }, // BC1
+            { 48.0f, 40.0f }, // BC4
+            { 48.0f, 40.0f }, // BC5
+            { 38.0f, 25.0f }, // BC7
+        };
+
+        std::vector<uint8_t> images[2];
+        std::mt19937 rng(51312);
+        std::uniform_int_distribution<int32_t> noise(-24, 24);
+        for (uint32_t imgIdx = 0; imgIdx < 2; ++imgIdx) {
+            std::vector<uint8_t> &image = images[imgIdx];
+            image.resize(4 * width * height);
+            for (uint32_t y = 0; y < height; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    int32_t values[] = {
+                        static_cast<int32_t>(4 * x),
+                        static_cast<int32_t>(4 * y),
+                        static_cast<int32_t>(2 * (x + y)),
+                        static_cast<int32_t>(255 - 2 * x)
+                    };
+                    for (uint32_t c = 0; c < 4; ++c) {
+                        int32_t v = values[c] + (imgIdx == 1 ? noise(rng) : 0);
+                        image[4 * (y * width + x) + c] = static_cast<uint8_t>(std::min(std::max(v, 0), 255));
+                    }
+                }
+            }
+        }
+
+        bool success = true;
+        std::vector<uint8_t> blocks;
+        std::vector<uint8_t> decoded;
+        for (uint32_t fmtIdx = 0; fmtIdx <= static_cast<uint32_t>(Format::BC7); ++fmtIdx) {
+            Format format = static_cast<Format>(fmtIdx);
+            for (uint32_t qIdx = 0; qIdx <= static_cast<uint32_t>(Quality::High); ++qIdx) {
+                Quality quality = static_cast<Quality>(qIdx);
+                float psnrs[2];
+                for (uint32_t imgIdx = 0; imgIdx < 2; ++imgIdx) {
+                    encode(images[imgIdx].data(), width, height, format, quality, 0, &blocks);
+                    if (!decode(blocks.data(), width, height, format, &decoded))
+                        success = false;
+                    psnrs[imgIdx] = calcPSNR(images[imgIdx].data(), decoded.data(), width, height,
+                                             getChannelMask(format));
+                    if (psnrs[imgIdx] < minPSNRs[fmtIdx][imgIdx])
+                        success = false;
+                }
+                hpprintf("%s %-6s: smooth %6.2f dB, noisy %6.2f dB\n",
+                         getFormatName(format), getQualityName(quality), psnrs[0], psnrs[1]);
+            }
+        }
+
+        return success;
+    }
+}
@@ -0,0 +1,69 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+
+#include "../cuda_util.h"
+
+// For ingest-time block compression of RGBA8 images into formats cudau::Array can hold directly
+namespace bc {
+    enum class Format : uint32_t {
+        BC1 = 0, // RGB, alpha is ignored (opaque)
+        BC4, // R
+        BC5, // RG
+        BC7, // RGBA, mode 6 only
+    };
+
+    enum class Quality : uint32_t {
+        Fast = 0, // bounding box endpoints
+        Normal, // principal axis endpoints
+        High, // principal axis endpoints followed by least squares refinement
+    };
+
+    uint32_t getBlockSizeInBytes(Format format);
+    cudau::ArrayElementType getArrayElementType(Format format);
+    const char* getFormatName(Format format);
+    const char* getQualityName(Quality quality);
+
+    // Encodes 4x4 blocks in row-major order. Partial blocks at the right/bottom edges replicate edge texels.
+    // Rows of blocks are split across numThreads threads (0 means std::thread::hardware_concurrency()).
+    void encode(const uint8_t* srcRGBA8, uint32_t width, uint32_t height,
+                Format format, Quality quality, uint32_t numThreads, std::vector<uint8_t>* blocks);
+    // Same as encode() but reuses the result stored in cacheDir when the same image was encoded
+    // with the same settings before. Returns true on a cache hit.
+    bool encodeCached(const std::filesystem::path &cacheDir,
+                      const uint8_t* srcRGBA8, uint32_t width, uint32_t height,
+                      Format format, Quality quality, uint32_t numThreads, std::vector<uint8_t>* blocks);
+    // BC7 decoding supports only mode 6, which is the only mode encode() emits.
+    // Returns false when a block of another BC7 mode is found; such blocks decode to transparent black.
+    bool decode(const uint8_t* blocks, uint32_t width, uint32_t height, Format format,
+                std::vector<uint8_t>* dstRGBA8);
+
+    // channelMask: bit i selects channel i (R, G, B, A).
+    float calcPSNR(const uint8_t* refRGBA8, const uint8_t* testRGBA8, uint32_t width, uint32_t height,
+                   uint32_t channelMask);
+    uint32_t getChannelMask(Format format);
+
+    // Encodes and decodes synthetic images with every format and quality preset, prints PSNR and returns
+    // whether every combination reached its minimum PSNR.
+    bool runSelfTest();
+}
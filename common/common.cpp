@@ -56,6 +56,78 @@ float sRGB_degamma_s(float value) {
     return std::pow((value + 0.055f) / 1.055f, 2.4f);
 }
 
+float sRGB_gamma_s(float value) {
+    Assert(value >= 0, "Input value must be equal to or greater than 0: %g", value);
+    if (value <= 0.0031308f)
+        return value * 12.92f;
+    return 1.055f * std::pow(value, 1 / 2.4f) - 0.055f;
+}
+
+// JP: ̐Kxɑ΂log2(x)B[sqrt(1/2), sqrt(2))ɐKA
+//     log(m) = 2 * atanh((m - 1) / (m + 1))̋ŋߎB
+// EN: log2(x) for positive normalized x. Normalizes the mantissa into [sqrt(1/2), sqrt(2))
+//     and approximates log(m) = 2 * atanh((m - 1) / (m + 1)) with its series.
+static inline __m128 log2_ps(__m128 x) {
+    __m128i xi = _mm_castps_si128(x);
+    __m128i expBits = _mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007FFFFF)),
+                                             _mm_set1_epi32(0x3F800000)));
+    __m128 e = _mm_cvtepi32_ps(expBits);
+    __m128 tooLarge = _mm_cmpge_ps(m, _mm_set1_ps(1.41421356f));
+    m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), tooLarge);
+    e = _mm_add_ps(e, _mm_and_ps(tooLarge, _mm_set1_ps(1.0f)));
+
+    __m128 z = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+    __m128 z2 = _mm_mul_ps(z, z);
+    __m128 p = _mm_set1_ps(1.0f / 9);
+    p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.0f / 7));
+    p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.0f / 5));
+    p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.0f / 3));
+    p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.0f));
+    __m128 lnm = _mm_mul_ps(_mm_mul_ps(p, z), _mm_set1_ps(2.0f));
+
+    return _mm_add_ps(e, _mm_mul_ps(lnm, _mm_set1_ps(1.44269504f)));
+}
+
+// JP: 2^xB͎wrbgɒڏ݁A[-0.5, 0.5]eC[WJŋߎB
+// EN: 2^x. Writes the integer part directly into exponent bits and approximates
+//     the fractional part in [-0.5, 0.5] with a Taylor polynomial.
+static inline __m128 exp2_ps(__m128 x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+    __m128 ip = _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 t = _mm_mul_ps(_mm_sub_ps(x, ip), _mm_set1_ps(0.693147181f));
+    __m128 p = _mm_set1_ps(1.0f / 720);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.0f / 120));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.0f / 24));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.0f / 6));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.5f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.0f));
+    __m128i scale = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(ip), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+static inline __m128 pow_ps(__m128 x, float y) {
+    // JP: x = 0̏ꍇlog2`Ȃ̂ōŏ̐Kɒu0ɒׂB
+    // EN: log2 is undefined at x = 0, so substitute the smallest normalized value which flushes to 0.
+    x = _mm_max_ps(x, _mm_set1_ps(1.17549435e-38f));
+    return exp2_ps(_mm_mul_ps(log2_ps(x), _mm_set1_ps(y)));
+}
+
+__m128 sRGB_degamma_ps(__m128 value) {
+    value = _mm_max_ps(value, _mm_setzero_ps());
+    __m128 linearPart = _mm_mul_ps(value, _mm_set1_ps(1 / 12.92f));
+    __m128 powPart = pow_ps(_mm_mul_ps(_mm_add_ps(value, _mm_set1_ps(0.055f)), _mm_set1_ps(1 / 1.055f)), 2.4f);
+    return _mm_blendv_ps(powPart, linearPart, _mm_cmple_ps(value, _mm_set1_ps(0.04045f)));
+}
+
+__m128 sRGB_gamma_ps(__m128 value) {
+    value = _mm_max_ps(value, _mm_setzero_ps());
+    __m128 linearPart = _mm_mul_ps(value, _mm_set1_ps(12.92f));
+    __m128 powPart = _mm_sub_ps(_mm_mul_ps(pow_ps(value, 1 / 2.4f), _mm_set1_ps(1.055f)), _mm_set1_ps(0.055f));
+    return _mm_blendv_ps(powPart, linearPart, _mm_cmple_ps(value, _mm_set1_ps(0.0031308f)));
+}
+
 
 
 void SlotFinder::initialize(uint32_t numSlots) {
@@ -291,11 +291,40 @@ std::shared_ptr<T> make_shared_with_deleter(const Deleter &deleter, ArgTypes&&..
                               deleter);
 }
 
+// Splits [0, numItems) into contiguous ranges and calls func(begin, end) for each range on its own thread.
+// numThreads == 0 means std::thread::hardware_concurrency(). numThreads == 1 runs on the calling thread.
+template <typename Func>
+void parallelFor(uint32_t numItems, uint32_t numThreads, const Func &func) {
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    numThreads = std::min(numThreads, numItems);
+    if (numThreads <= 1) {
+        func(0u, numItems);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    uint32_t itemsPerThread = (numItems + numThreads - 1) / numThreads;
+    for (uint32_t begin = 0; begin < numItems; begin += itemsPerThread) {
+        uint32_t end = std::min(begin + itemsPerThread, numItems);
+        threads.emplace_back([&func, begin, end]() {
+            func(begin, end);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
 std::filesystem::path getExecutableDirectory();
 
 std::string readTxtFile(const std::filesystem::path& filepath);
 
 float sRGB_degamma_s(float value);
+float sRGB_gamma_s(float value);
+// 4-wide variants that replace std::pow by a polynomial exp2(y * log2(x)).
+__m128 sRGB_degamma_ps(__m128 value);
+__m128 sRGB_gamma_ps(__m128 value);
 
 
 
@@ -35,10 +35,19 @@
 #   undef RGB
 #endif
 
+#if !defined(Platform_Windows)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
 #include "dds_loader.h"
 
 #include <algorithm>
-#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cuda.h>
 
 #ifdef _DEBUG
 #   define ENABLE_ASSERT
@@ -229,73 +238,304 @@ namespace dds {
 
 
 
-    uint8_t** load(const char* filepath, int32_t* width, int32_t* height, int32_t* mipCount, size_t** sizes, Format* format) {
-        std::ifstream ifs(filepath);
-        if (!ifs.is_open()) {
+    static constexpr uint32_t makeFourCC(char a, char b, char c, char d) {
+        return (static_cast<uint32_t>(a) << 0) | (static_cast<uint32_t>(b) << 8) |
+            (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+    }
+
+    static bool isBlockCompressed(Format format) {
+        return format == Format::BC1_UNorm || format == Format::BC1_UNorm_sRGB ||
+            format == Format::BC2_UNorm || format == Format::BC2_UNorm_sRGB ||
+            format == Format::BC3_UNorm || format == Format::BC3_UNorm_sRGB ||
+            format == Format::BC4_UNorm || format == Format::BC4_SNorm ||
+            format == Format::BC5_UNorm || format == Format::BC5_SNorm ||
+            format == Format::BC6H_UF16 || format == Format::BC6H_SF16 ||
+            format == Format::BC7_UNorm || format == Format::BC7_UNorm_sRGB;
+    }
+
+    // Legacy headers express block compressed formats only by FourCC.
+    static bool getFormatFromFourCC(uint32_t fourCC, Format* format) {
+        switch (fourCC) {
+        case makeFourCC('D', 'X', 'T', '1'):
+            *format = Format::BC1_UNorm;
+            return true;
+        case makeFourCC('D', 'X', 'T', '2'):
+        case makeFourCC('D', 'X', 'T', '3'):
+            *format = Format::BC2_UNorm;
+            return true;
+        case makeFourCC('D', 'X', 'T', '4'):
+        case makeFourCC('D', 'X', 'T', '5'):
+            *format = Format::BC3_UNorm;
+            return true;
+        case makeFourCC('A', 'T', 'I', '1'):
+        case makeFourCC('B', 'C', '4', 'U'):
+            *format = Format::BC4_UNorm;
+            return true;
+        case makeFourCC('B', 'C', '4', 'S'):
+            *format = Format::BC4_SNorm;
+            return true;
+        case makeFourCC('A', 'T', 'I', '2'):
+        case makeFourCC('B', 'C', '5', 'U'):
+            *format = Format::BC5_UNorm;
+            return true;
+        case makeFourCC('B', 'C', '5', 'S'):
+            *format = Format::BC5_SNorm;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    uint32_t getBlockSize(Format format) {
+        if (format == Format::BC1_UNorm || format == Format::BC1_UNorm_sRGB ||
+            format == Format::BC4_UNorm || format == Format::BC4_SNorm)
+            return 8;
+        return 16;
+    }
+
+
+
+    MappedImage::MappedImage() :
+        m_mappedBase(nullptr), m_mappedSize(0), m_fileHandle(0), m_mappingHandle(0),
+        m_format(Format::BC1_UNorm), m_width(0), m_height(0), m_mipCount(0), m_arraySize(0), m_numFaces(0),
+        m_hostRegistered(false) {
+    }
+
+    MappedImage::~MappedImage() {
+        close();
+    }
+
+    bool MappedImage::open(const char* filepath) {
+        close();
+
+#if defined(Platform_Windows)
+        HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
             hpprintf("Not found: %s\n", filepath);
-            return nullptr;
+            return false;
         }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* base = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!base) {
+            hpprintf("Failed to map: %s\n", filepath);
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        m_fileHandle = reinterpret_cast<uintptr_t>(file);
+        m_mappingHandle = reinterpret_cast<uintptr_t>(mapping);
+        m_mappedBase = base;
+        m_mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filepath, O_RDONLY);
+        if (fd < 0) {
+            hpprintf("Not found: %s\n", filepath);
+            return false;
+        }
+        struct stat fileStat;
+        void* base = MAP_FAILED;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+            base = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            hpprintf("Failed to map: %s\n", filepath);
+            ::close(fd);
+            return false;
+        }
+        madvise(base, fileStat.st_size, MADV_SEQUENTIAL);
+        m_fileHandle = static_cast<uintptr_t>(fd);
+        m_mappedBase = base;
+        m_mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
 
-        ifs.seekg(0, std::ios::end);
-        size_t fileSize = ifs.tellg();
+        if (!parse(filepath)) {
+            close();
+            return false;
+        }
 
-        ifs.clear();
-        ifs.seekg(0, std::ios::beg);
+        return true;
+    }
 
+    bool MappedImage::parse(const char* filepath) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(m_mappedBase);
+        if (m_mappedSize < sizeof(Header)) {
+            hpprintf("Non dds file: %s\n", filepath);
+            return false;
+        }
         Header header;
-        ifs.read((char*)&header, sizeof(Header));
-        if (header.m_magic != 0x20534444 || header.m_fourCC != 0x30315844) {
-            hpprintf("Non dds (dx10) file: %s", filepath);
-            return nullptr;
+        std::memcpy(&header, bytes, sizeof(Header));
+        if (header.m_magic != 0x20534444) {
+            hpprintf("Non dds file: %s\n", filepath);
+            return false;
         }
 
-        HeaderDX10 dx10Header;
-        ifs.read((char*)&dx10Header, sizeof(HeaderDX10));
-
-        *width = header.m_width;
-        *height = header.m_height;
-        *format = (Format)dx10Header.m_format;
-
-        if (*format != Format::BC1_UNorm && *format != Format::BC1_UNorm_sRGB &&
-            *format != Format::BC2_UNorm && *format != Format::BC2_UNorm_sRGB &&
-            *format != Format::BC3_UNorm && *format != Format::BC3_UNorm_sRGB &&
-            *format != Format::BC4_UNorm && *format != Format::BC4_SNorm &&
-            *format != Format::BC5_UNorm && *format != Format::BC5_SNorm &&
-            *format != Format::BC6H_UF16 && *format != Format::BC6H_SF16 &&
-            *format != Format::BC7_UNorm && *format != Format::BC7_UNorm_sRGB) {
-            hpprintf("No support for non block compressed formats: %s", filepath);
-            return nullptr;
+        size_t dataOffset = sizeof(Header);
+        m_arraySize = 1;
+        m_numFaces = 1;
+        if ((header.m_PFFlags & Header::PFFlags::FourCC) != 0 && header.m_fourCC == makeFourCC('D', 'X', '1', '0')) {
+            if (m_mappedSize < sizeof(Header) + sizeof(HeaderDX10)) {
+                hpprintf("Truncated dds (dx10) file: %s\n", filepath);
+                return false;
+            }
+            HeaderDX10 dx10Header;
+            std::memcpy(&dx10Header, bytes + sizeof(Header), sizeof(HeaderDX10));
+            dataOffset += sizeof(HeaderDX10);
+
+            // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+            if (dx10Header.m_dimension != 3) {
+                hpprintf("No support for non 2D textures: %s\n", filepath);
+                return false;
+            }
+            m_format = dx10Header.m_format;
+            m_arraySize = std::max<uint32_t>(1, dx10Header.m_arraySize);
+            // D3D10_RESOURCE_MISC_TEXTURECUBE
+            if (dx10Header.m_miscFlag & 0x4)
+                m_numFaces = 6;
+        }
+        else {
+            if ((header.m_PFFlags & Header::PFFlags::FourCC) == 0 ||
+                !getFormatFromFourCC(header.m_fourCC, &m_format)) {
+                hpprintf("No support for non block compressed formats: %s\n", filepath);
+                return false;
+            }
+            if ((header.m_caps2 & Header::Caps2::CubeMap) != 0) {
+                const Header::Caps2 allFaces = static_cast<Header::Caps2::Value>(
+                    Header::Caps2::CubeMapPositiveX | Header::Caps2::CubeMapNegativeX |
+                    Header::Caps2::CubeMapPositiveY | Header::Caps2::CubeMapNegativeY |
+                    Header::Caps2::CubeMapPositiveZ | Header::Caps2::CubeMapNegativeZ);
+                if ((header.m_caps2 & allFaces) != allFaces.value) {
+                    hpprintf("No support for partial cube maps: %s\n", filepath);
+                    return false;
+                }
+                m_numFaces = 6;
+            }
+        }
+        if ((header.m_caps2 & Header::Caps2::Volume) != 0) {
+            hpprintf("No support for volume textures: %s\n", filepath);
+            return false;
         }
 
-        const size_t dataSize = fileSize - (sizeof(Header) + sizeof(HeaderDX10));
+        if (!isBlockCompressed(m_format)) {
+            hpprintf("No support for non block compressed formats: %s\n", filepath);
+            return false;
+        }
 
-        *mipCount = 1;
+        m_width = header.m_width;
+        m_height = header.m_height;
+        if (m_width == 0 || m_height == 0) {
+            hpprintf("Invalid dds size %ux%u: %s\n", m_width, m_height, filepath);
+            return false;
+        }
+
+        // The header's mip count is not trusted beyond the full chain, floor(log2(max(w, h))) + 1.
+        uint32_t maxMipCount = 1;
+        for (uint32_t maxDim = std::max(m_width, m_height); maxDim > 1; maxDim >>= 1)
+            ++maxMipCount;
+        m_mipCount = 1;
         if ((header.m_flags & Header::Flags::MipMapCount) != 0)
-            *mipCount = header.m_mipmapCount;
+            m_mipCount = std::min(std::max<uint32_t>(1, header.m_mipmapCount), maxMipCount);
+
+        // Validate the total size before allocating the subresource table from header values.
+        const uint32_t blockSize = getBlockSize(m_format);
+        size_t sliceSize = 0;
+        for (uint32_t mip = 0; mip < m_mipCount; ++mip) {
+            uint32_t mipWidth = std::max<uint32_t>(1, m_width >> mip);
+            uint32_t mipHeight = std::max<uint32_t>(1, m_height >> mip);
+            sliceSize += static_cast<size_t>((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * blockSize;
+        }
+        const uint64_t numSlices = static_cast<uint64_t>(m_arraySize) * m_numFaces;
+        if (numSlices > (m_mappedSize - dataOffset) / sliceSize) {
+            hpprintf("Truncated dds file: %s\n", filepath);
+            return false;
+        }
+
+        m_subresources.resize(static_cast<size_t>(numSlices) * m_mipCount);
+        size_t offset = dataOffset;
+        for (uint32_t layer = 0; layer < m_arraySize; ++layer) {
+            for (uint32_t face = 0; face < m_numFaces; ++face) {
+                for (uint32_t mip = 0; mip < m_mipCount; ++mip) {
+                    uint32_t mipWidth = std::max<uint32_t>(1, m_width >> mip);
+                    uint32_t mipHeight = std::max<uint32_t>(1, m_height >> mip);
+                    size_t size = static_cast<size_t>((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * blockSize;
+
+                    Subresource &subres = m_subresources[(static_cast<size_t>(layer) * m_numFaces + face) * m_mipCount + mip];
+                    subres.data = bytes + offset;
+                    subres.size = size;
+                    subres.width = mipWidth;
+                    subres.height = mipHeight;
+                    offset += size;
+                }
+            }
+        }
+        // Trailing bytes after the last subresource are allowed.
+        Assert(offset <= m_mappedSize, "Data size mismatch.");
+
+        return true;
+    }
+
+    void MappedImage::close() {
+        if (!m_mappedBase)
+            return;
+
+        if (m_hostRegistered) {
+            cuMemHostUnregister(m_mappedBase);
+            m_hostRegistered = false;
+        }
+
+#if defined(Platform_Windows)
+        UnmapViewOfFile(m_mappedBase);
+        CloseHandle(reinterpret_cast<HANDLE>(m_mappingHandle));
+        CloseHandle(reinterpret_cast<HANDLE>(m_fileHandle));
+#else
+        munmap(m_mappedBase, m_mappedSize);
+        ::close(static_cast<int>(m_fileHandle));
+#endif
+        m_mappedBase = nullptr;
+        m_mappedSize = 0;
+        m_fileHandle = 0;
+        m_mappingHandle = 0;
+        m_subresources.clear();
+    }
+
+    bool MappedImage::registerHostMemory() {
+        if (!m_mappedBase)
+            return false;
+        if (m_hostRegistered)
+            return true;
+
+        CUresult res = cuMemHostRegister(m_mappedBase, m_mappedSize, CU_MEMHOSTREGISTER_READ_ONLY);
+        if (res != CUDA_SUCCESS) {
+            devPrintf("cuMemHostRegister failed (%d), copies fall back to pageable memory.\n", res);
+            return false;
+        }
+        m_hostRegistered = true;
+
+        return true;
+    }
+
+
+
+    uint8_t** load(const char* filepath, int32_t* width, int32_t* height, int32_t* mipCount, size_t** sizes, Format* format) {
+        MappedImage image;
+        if (!image.open(filepath))
+            return nullptr;
+
+        *width = image.getWidth();
+        *height = image.getHeight();
+        *format = image.getFormat();
+        *mipCount = image.getMipCount();
 
         uint8_t** data = new uint8_t * [*mipCount];
         *sizes = new size_t[*mipCount];
-        int32_t mipWidth = *width;
-        int32_t mipHeight = *height;
-        uint32_t blockSize = 16;
-        if (*format == Format::BC1_UNorm || *format == Format::BC1_UNorm_sRGB ||
-            *format == Format::BC4_UNorm || *format == Format::BC4_SNorm)
-            blockSize = 8;
-        size_t cumDataSize = 0;
         for (int i = 0; i < *mipCount; ++i) {
-            int32_t bw = (mipWidth + 3) / 4;
-            int32_t bh = (mipHeight + 3) / 4;
-            size_t mipDataSize = bw * bh * blockSize;
-
-            data[i] = new uint8_t[mipDataSize];
-            (*sizes)[i] = mipDataSize;
-            ifs.read((char*)data[i], mipDataSize);
-            cumDataSize += mipDataSize;
-
-            mipWidth = std::max<int32_t>(1, mipWidth / 2);
-            mipHeight = std::max<int32_t>(1, mipHeight / 2);
+            const Subresource &subres = image.getSubresource(0, 0, i);
+            data[i] = new uint8_t[subres.size];
+            (*sizes)[i] = subres.size;
+            std::memcpy(data[i], subres.data, subres.size);
         }
-        Assert(cumDataSize == dataSize, "Data size mismatch.");
 
         return data;
     }
@@ -18,7 +18,9 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 // For DDS image read (block compressed format)
 namespace dds {
@@ -39,6 +41,80 @@ namespace dds {
         BC7_UNorm_sRGB = 99,
     };
 
+    uint32_t getBlockSize(Format format);
+
+    struct Subresource {
+        const uint8_t* data;
+        size_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Memory-mapped DDS file. Subresources are views directly into the mapping, no host copy is made.
+    // Supports DX10 and legacy (FourCC) headers, cube maps and texture arrays of block compressed formats.
+    class MappedImage {
+        void* m_mappedBase;
+        size_t m_mappedSize;
+        uintptr_t m_fileHandle;
+        uintptr_t m_mappingHandle;
+
+        Format m_format;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_mipCount;
+        uint32_t m_arraySize;
+        uint32_t m_numFaces;
+        // layer-major, then face, then mip level, the same order as in the file
+        std::vector<Subresource> m_subresources;
+        bool m_hostRegistered;
+
+        MappedImage(const MappedImage &) = delete;
+        MappedImage &operator=(const MappedImage &) = delete;
+
+        bool parse(const char* filepath);
+
+    public:
+        MappedImage();
+        ~MappedImage();
+
+        bool open(const char* filepath);
+        // Make sure that asynchronous copies from registered memory have completed before closing.
+        void close();
+
+        // Page-locks the mapping with cuMemHostRegister (read only) so that copies from the subresources
+        // become direct DMA transfers. Returns false if the driver refuses, the mapping stays usable then.
+        bool registerHostMemory();
+
+        bool isOpen() const {
+            return m_mappedBase != nullptr;
+        }
+        Format getFormat() const {
+            return m_format;
+        }
+        uint32_t getWidth() const {
+            return m_width;
+        }
+        uint32_t getHeight() const {
+            return m_height;
+        }
+        uint32_t getMipCount() const {
+            return m_mipCount;
+        }
+        uint32_t getArraySize() const {
+            return m_arraySize;
+        }
+        bool isCubemap() const {
+            return m_numFaces == 6;
+        }
+        uint32_t getNumFaces() const {
+            return m_numFaces;
+        }
+        const Subresource &getSubresource(uint32_t layer, uint32_t face, uint32_t mipLevel) const {
+            return m_subresources[(layer * m_numFaces + face) * m_mipCount + mipLevel];
+        }
+    };
+
+    // Copies the mip chain of the first image (layer 0, face 0).
     uint8_t** load(const char* filepath, int32_t* width, int32_t* height, int32_t* mipCount, size_t** sizes, Format* format);
     void free(uint8_t** data, int32_t mipCount, size_t* sizes);
 }
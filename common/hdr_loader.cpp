@@ -0,0 +1,274 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "hdr_loader.h"
+#include "common.h"
+
+#include <cstring>
+
+#include "../ext/stb_image.h"
+
+namespace hdr {
+    // Number of floats converted per parallelFor() item.
+    static constexpr size_t kConversionBlockSize = 16384;
+
+    uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t absBits = bits & 0x7FFFFFFF;
+
+        // Infinity or NaN
+        if (absBits >= 0x7F800000)
+            return static_cast<uint16_t>(sign | (absBits > 0x7F800000 ? 0x7E00 : 0x7C00));
+        // 65520 and above round to infinity.
+        if (absBits >= 0x477FF000)
+            return static_cast<uint16_t>(sign | 0x7C00);
+        // Below the smallest normal half (2^-14), the result is subnormal or zero.
+        // 2^-25 is the midpoint between zero and the smallest subnormal and ties to zero.
+        if (absBits < 0x38800000) {
+            if (absBits <= 0x33000000)
+                return static_cast<uint16_t>(sign);
+            uint32_t exp = absBits >> 23;
+            uint32_t mant = (absBits & 0x7FFFFF) | 0x800000;
+            uint32_t shift = 126 - exp;
+            uint32_t h = mant >> shift;
+            uint32_t rem = mant & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (rem > halfway || (rem == halfway && (h & 1)))
+                ++h; // a carry into the exponent correctly yields the smallest normal.
+            return static_cast<uint16_t>(sign | h);
+        }
+
+        uint32_t h = (absBits >> 13) - (112 << 10); // rebias the exponent from 127 to 15.
+        uint32_t rem = absBits & 0x1FFF;
+        if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+            ++h;
+        return static_cast<uint16_t>(sign | h);
+    }
+
+    float halfToFloat(uint16_t value) {
+        uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+        uint32_t exp = (value >> 10) & 0x1F;
+        uint32_t mant = value & 0x3FF;
+        uint32_t bits;
+        if (exp == 0x1F) {
+            bits = sign | 0x7F800000 | (mant << 13);
+        }
+        else if (exp == 0) {
+            float f = std::ldexp(static_cast<float>(mant), -24);
+            return sign ? -f : f;
+        }
+        else {
+            bits = sign | ((exp + 112) << 23) | (mant << 13);
+        }
+        float ret;
+        std::memcpy(&ret, &bits, sizeof(ret));
+        return ret;
+    }
+
+    // Returns four halves in the low 16 bits of each lane, sign-extended so that _mm_packs_epi32 keeps the bits.
+    static __m128i floatToHalf_ps(__m128 value) {
+        const __m128i signMask = _mm_set1_epi32(0x80000000);
+        // Floats at and above 2^16 become infinity or NaN, values in [65520, 2^16) round up to infinity below.
+        const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23);
+        const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+        // Adding this float aligns the subnormal mantissa to the low bits with the FPU's round to nearest even.
+        const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+        // Rebiases the exponent and adds the rounding bias except for the tie-breaking bit.
+        const __m128i normalBias = _mm_set1_epi32(0xFFF - ((127 - 15) << 23));
+
+        __m128 justSign = _mm_and_ps(_mm_castsi128_ps(signMask), value);
+        __m128 absValue = _mm_xor_ps(value, justSign);
+        __m128i absBits = _mm_castps_si128(absValue);
+
+        __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absValue, absValue));
+        __m128i isRegular = _mm_cmpgt_epi32(f16Max, absBits);
+        __m128i infOrNaN = _mm_or_si128(_mm_and_si128(isNaN, _mm_set1_epi32(0x0200)), _mm_set1_epi32(0x7C00));
+
+        __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absBits);
+        __m128 subnormalF = _mm_add_ps(absValue, _mm_castsi128_ps(subnormalMagic));
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(subnormalF), subnormalMagic);
+
+        // -1 when the LSB of the half mantissa is odd, to round ties to even.
+        __m128i mantOdd = _mm_srai_epi32(_mm_slli_epi32(absBits, 31 - 13), 31);
+        __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absBits, normalBias), mantOdd), 13);
+
+        __m128i nonSpecial = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal),
+                                          _mm_andnot_si128(isSubnormal, normal));
+        __m128i joined = _mm_or_si128(_mm_and_si128(isRegular, nonSpecial),
+                                      _mm_andnot_si128(isRegular, infOrNaN));
+        return _mm_or_si128(joined, _mm_srai_epi32(_mm_castps_si128(justSign), 16));
+    }
+
+    static void convertFloatToHalfRange(const float* src, uint16_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i lo = floatToHalf_ps(_mm_loadu_ps(src + i));
+            __m128i hi = floatToHalf_ps(_mm_loadu_ps(src + i + 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+        }
+        for (; i < count; ++i)
+            dst[i] = floatToHalf(src[i]);
+    }
+
+    void convertFloatToHalf(const float* src, uint16_t* dst, size_t count, uint32_t numThreads) {
+        uint32_t numBlocks = static_cast<uint32_t>((count + kConversionBlockSize - 1) / kConversionBlockSize);
+        parallelFor(numBlocks, numThreads, [&](uint32_t beginBlock, uint32_t endBlock) {
+            size_t begin = beginBlock * kConversionBlockSize;
+            size_t end = std::min(endBlock * kConversionBlockSize, count);
+            convertFloatToHalfRange(src + begin, dst + begin, end - begin);
+        });
+    }
+
+    bool loadRGBA16F(const char* filepath, uint32_t* width, uint32_t* height, std::vector<uint16_t>* rgba16f) {
+        int32_t w, h, n;
+        float* data = stbi_loadf(filepath, &w, &h, &n, 4);
+        if (!data) {
+            hpprintf("Failed to load %s: %s\n", filepath, stbi_failure_reason());
+            return false;
+        }
+
+        *width = w;
+        *height = h;
+        size_t numValues = 4 * static_cast<size_t>(w) * h;
+        rgba16f->resize(numValues);
+        convertFloatToHalf(data, rgba16f->data(), numValues, 0);
+        stbi_image_free(data);
+
+        return true;
+    }
+
+    void createArray(CUcontext context, const uint16_t* rgba16f, uint32_t width, uint32_t height,
+                     cudau::Array* array) {
+        array->initialize2D(context, cudau::ArrayElementType::Float16, 4,
+                            cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
+                            width, height, 1);
+        array->write(rgba16f, sizeof(uint16_t) * 4 * width * height);
+    }
+
+
+
+    static bool isHalfNaN(uint16_t value) {
+        return (value & 0x7C00) == 0x7C00 && (value & 0x03FF) != 0;
+    }
+
+    bool runSelfTest() {
+        bool success = true;
+
+        // Every half value must survive a round trip through float, both in scalar and vectorized form.
+        {
+            std::vector<float> values(65536);
+            std::vector<uint16_t> halves(65536);
+            for (uint32_t i = 0; i < 65536; ++i)
+                values[i] = halfToFloat(static_cast<uint16_t>(i));
+            convertFloatToHalf(values.data(), halves.data(), values.size(), 1);
+            uint32_t numErrors = 0;
+            for (uint32_t i = 0; i < 65536; ++i) {
+                uint16_t expected = static_cast<uint16_t>(i);
+                uint16_t scalar = floatToHalf(values[i]);
+                bool ok = isHalfNaN(expected) ?
+                    (isHalfNaN(scalar) && isHalfNaN(halves[i])) :
+                    (scalar == expected && halves[i] == expected);
+                if (!ok)
+                    ++numErrors;
+            }
+            hpprintf("Half round trip: %u errors\n", numErrors);
+            success &= numErrors == 0;
+        }
+
+        // Rounding edge cases and random floats (uniform bit patterns, uniform values and log-uniform magnitudes)
+        // must match the reference bit for bit. Normal results must be within half an ULP.
+        {
+            std::vector<float> values = {
+                0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65519.99f, 65520.0f, -65520.0f, 65536.0f, 1e20f,
+                std::ldexp(1.0f, -14), std::ldexp(1.0f, -24), std::ldexp(1.0f, -25), std::ldexp(1.5f, -25),
+                std::ldexp(1.0f, -26), std::ldexp(3.0f, -25), std::ldexp(1023.5f, -24), std::ldexp(1.0f, -130),
+                1.0f + std::ldexp(1.0f, -11), 1.0f + std::ldexp(3.0f, -11),
+                INFINITY, -INFINITY, NAN, -NAN,
+            };
+            std::mt19937 rng(723419);
+            std::uniform_int_distribution<uint32_t> bitPattern;
+            std::uniform_real_distribution<float> uniform(-70000.0f, 70000.0f);
+            std::uniform_real_distribution<float> exponent(-26.0f, 17.0f);
+            constexpr uint32_t numRandomValues = 1 << 20;
+            for (uint32_t i = 0; i < numRandomValues; ++i) {
+                uint32_t bits = bitPattern(rng);
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                values.push_back(f);
+                values.push_back(uniform(rng));
+                values.push_back((i & 1 ? -1 : 1) * std::exp2(exponent(rng)));
+            }
+
+            std::vector<uint16_t> halves(values.size());
+            convertFloatToHalf(values.data(), halves.data(), values.size(), 0);
+            uint32_t numMismatches = 0;
+            uint32_t numInaccurate = 0;
+            float maxRelError = 0.0f;
+            for (size_t i = 0; i < values.size(); ++i) {
+                uint16_t scalar = floatToHalf(values[i]);
+                if (halves[i] != scalar)
+                    ++numMismatches;
+
+                float absValue = std::fabs(values[i]);
+                if (absValue >= std::ldexp(1.0f, -14) && absValue <= 65504.0f) {
+                    float relError = std::fabs(halfToFloat(scalar) - values[i]) / absValue;
+                    maxRelError = std::max(maxRelError, relError);
+                    if (relError > std::ldexp(1.0f, -11))
+                        ++numInaccurate;
+                }
+            }
+            hpprintf("Float to half: %u values, %u mismatches, %u inaccurate, max relative error %g\n",
+                     static_cast<uint32_t>(values.size()), numMismatches, numInaccurate, maxRelError);
+            success &= numMismatches == 0 && numInaccurate == 0;
+        }
+
+        // Throughput of the scalar reference, the vectorized conversion and the multithreaded conversion.
+        {
+            constexpr size_t numValues = 4 * 2048 * 2048;
+            std::vector<float> values(numValues);
+            std::vector<uint16_t> halves(numValues);
+            std::mt19937 rng(19384);
+            std::uniform_real_distribution<float> exponent(-8.0f, 8.0f);
+            for (size_t i = 0; i < numValues; ++i)
+                values[i] = std::exp2(exponent(rng));
+
+            const auto measure = [&](const char* name, const std::function<void()> &func) {
+                auto start = std::chrono::high_resolution_clock::now();
+                func();
+                auto end = std::chrono::high_resolution_clock::now();
+                double seconds = std::chrono::duration<double>(end - start).count();
+                hpprintf("%-20s: %8.3f ms, %7.1f Mvalues/s\n",
+                         name, 1e3 * seconds, numValues / seconds * 1e-6);
+            };
+            measure("Scalar", [&]() {
+                for (size_t i = 0; i < numValues; ++i)
+                    halves[i] = floatToHalf(values[i]);
+            });
+            measure("SSE2", [&]() {
+                convertFloatToHalf(values.data(), halves.data(), numValues, 1);
+            });
+            measure("SSE2 multithreaded", [&]() {
+                convertFloatToHalf(values.data(), halves.data(), numValues, 0);
+            });
+        }
+
+        return success;
+    }
+}
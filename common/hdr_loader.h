@@ -0,0 +1,51 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../cuda_util.h"
+
+// For ingest of high dynamic range images (e.g. environment maps) as RGBA16F,
+// which needs half the memory and bandwidth of RGBA32F.
+namespace hdr {
+    // Scalar reference conversions.
+    // floatToHalf rounds to nearest even, overflows to infinity and turns NaNs into the quiet NaN 0x7E00.
+    uint16_t floatToHalf(float value);
+    float halfToFloat(uint16_t value);
+
+    // SSE2 conversion that is bit-exact with floatToHalf().
+    // The range is split across numThreads threads (0 means std::thread::hardware_concurrency()).
+    void convertFloatToHalf(const float* src, uint16_t* dst, size_t count, uint32_t numThreads);
+
+    // Loads an image with stbi_loadf() and converts it to RGBA16F.
+    // Radiance HDR files are read as is, 8-bit images are linearized by stb_image (gamma 2.2 by default).
+    // Returns false when the file cannot be read.
+    bool loadRGBA16F(const char* filepath, uint32_t* width, uint32_t* height, std::vector<uint16_t>* rgba16f);
+
+    // Initializes a 2D array of Float16 x 4 without mipmaps and uploads the image.
+    void createArray(CUcontext context, const uint16_t* rgba16f, uint32_t width, uint32_t height,
+                     cudau::Array* array);
+
+    // Checks the vectorized conversion against the scalar reference over every half value, special values and
+    // random floats, measures its throughput, prints the results and returns whether every check passed.
+    bool runSelfTest();
+}
@@ -0,0 +1,349 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "mipmap_generator.h"
+#include "common.h"
+
+#include <cstring>
+
+namespace mipmap {
+    // Rows of a level below this pixel count are filtered on the calling thread.
+    static constexpr uint32_t kMinPixelsForThreading = 128 * 128;
+
+    static constexpr float kKaiserAlpha = 4.0f;
+    static constexpr float kKaiserRadius = 2.0f;
+
+    uint32_t calcNumLevels(uint32_t width, uint32_t height) {
+        uint32_t maxDim = std::max(width, height);
+        uint32_t numLevels = 1;
+        while (maxDim > 1) {
+            maxDim >>= 1;
+            ++numLevels;
+        }
+        return numLevels;
+    }
+
+    static float besselI0(float x) {
+        float sum = 1.0f;
+        float term = 1.0f;
+        float halfX2 = 0.25f * x * x;
+        for (uint32_t k = 1; k < 32; ++k) {
+            term *= halfX2 / (k * k);
+            sum += term;
+            if (term < 1e-7f * sum)
+                break;
+        }
+        return sum;
+    }
+
+    static float evaluateFilter(Filter filter, float t) {
+        t = std::fabs(t);
+        if (filter == Filter::Box)
+            return t < 0.5f ? 1.0f : (t == 0.5f ? 0.5f : 0.0f);
+
+        if (t >= kKaiserRadius)
+            return 0.0f;
+        float sinc = 1.0f;
+        if (t > 1e-6f) {
+            float pt = 3.14159265f * t;
+            sinc = std::sin(pt) / pt;
+        }
+        float r = t / kKaiserRadius;
+        float window = besselI0(kKaiserAlpha * std::sqrt(1 - r * r)) / besselI0(kKaiserAlpha);
+        return sinc * window;
+    }
+
+    // Normalized 1D filter taps for every destination texel along one axis, edges are clamped.
+    struct FilterTaps {
+        std::vector<uint32_t> offsets; // numDst + 1 entries into indices/weights
+        std::vector<uint32_t> indices;
+        std::vector<float> weights;
+
+        void build(Filter filter, uint32_t srcSize, uint32_t dstSize) {
+            float radius = filter == Filter::Box ? 0.5f : kKaiserRadius;
+            float scale = static_cast<float>(srcSize) / dstSize;
+
+            offsets.resize(dstSize + 1);
+            indices.clear();
+            weights.clear();
+            for (uint32_t d = 0; d < dstSize; ++d) {
+                offsets[d] = static_cast<uint32_t>(indices.size());
+                float center = (d + 0.5f) * scale;
+                int32_t sBegin = static_cast<int32_t>(std::floor(center - radius * scale));
+                int32_t sEnd = static_cast<int32_t>(std::ceil(center + radius * scale));
+                float sumWeights = 0.0f;
+                for (int32_t s = sBegin; s < sEnd; ++s) {
+                    float w = evaluateFilter(filter, (s + 0.5f - center) / scale);
+                    if (w == 0.0f)
+                        continue;
+                    indices.push_back(static_cast<uint32_t>(std::clamp<int32_t>(s, 0, srcSize - 1)));
+                    weights.push_back(w);
+                    sumWeights += w;
+                }
+                float recSum = 1.0f / sumWeights;
+                for (uint32_t i = offsets[d]; i < indices.size(); ++i)
+                    weights[i] *= recSum;
+            }
+            offsets[dstSize] = static_cast<uint32_t>(indices.size());
+        }
+    };
+
+    // Linear RGBA float texels, 16-byte aligned so that each texel maps to one __m128.
+    using LinearImage = std::vector<float4>;
+
+    static void decode(const uint8_t* src, uint32_t width, uint32_t height, bool sRGB,
+                       uint32_t numThreads, LinearImage* dst) {
+        dst->resize(static_cast<size_t>(width) * height);
+        const __m128 rec255 = _mm_set1_ps(1.0f / 255);
+        parallelFor(height, width * height >= kMinPixelsForThreading ? numThreads : 1,
+                    [&](uint32_t rowBegin, uint32_t rowEnd) {
+            for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    size_t idx = static_cast<size_t>(y) * width + x;
+                    int32_t texel;
+                    std::memcpy(&texel, src + 4 * idx, sizeof(texel));
+                    __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(texel))), rec255);
+                    if (sRGB)
+                        v = _mm_blend_ps(sRGB_degamma_ps(v), v, 0b1000);
+                    _mm_store_ps(&(*dst)[idx].x, v);
+                }
+            }
+        });
+    }
+
+    static void encode(const LinearImage &src, uint32_t width, uint32_t height, bool sRGB,
+                       uint32_t numThreads, uint8_t* dst) {
+        parallelFor(height, width * height >= kMinPixelsForThreading ? numThreads : 1,
+                    [&](uint32_t rowBegin, uint32_t rowEnd) {
+            for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    size_t idx = static_cast<size_t>(y) * width + x;
+                    __m128 v = _mm_load_ps(&src[idx].x);
+                    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+                    if (sRGB)
+                        v = _mm_blend_ps(sRGB_gamma_ps(v), v, 0b1000);
+                    __m128i iv = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(255.0f)));
+                    iv = _mm_packus_epi16(_mm_packus_epi32(iv, iv), iv);
+                    int32_t texel = _mm_cvtsi128_si32(iv);
+                    std::memcpy(dst + 4 * idx, &texel, sizeof(texel));
+                }
+            }
+        });
+    }
+
+    static void downsample(const LinearImage &src, uint32_t srcWidth, uint32_t srcHeight,
+                           Filter filter, uint32_t numThreads,
+                           LinearImage* dst, uint32_t dstWidth, uint32_t dstHeight) {
+        FilterTaps tapsX;
+        FilterTaps tapsY;
+        tapsX.build(filter, srcWidth, dstWidth);
+        tapsY.build(filter, srcHeight, dstHeight);
+
+        // Horizontal pass: srcWidth x srcHeight -> dstWidth x srcHeight
+        LinearImage temp(static_cast<size_t>(dstWidth) * srcHeight);
+        parallelFor(srcHeight, dstWidth * srcHeight >= kMinPixelsForThreading ? numThreads : 1,
+                    [&](uint32_t rowBegin, uint32_t rowEnd) {
+            for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+                const float4* srcRow = &src[static_cast<size_t>(y) * srcWidth];
+                float4* dstRow = &temp[static_cast<size_t>(y) * dstWidth];
+                for (uint32_t x = 0; x < dstWidth; ++x) {
+                    __m128 sum = _mm_setzero_ps();
+                    for (uint32_t i = tapsX.offsets[x]; i < tapsX.offsets[x + 1]; ++i) {
+                        __m128 v = _mm_load_ps(&srcRow[tapsX.indices[i]].x);
+                        sum = _mm_add_ps(sum, _mm_mul_ps(v, _mm_set1_ps(tapsX.weights[i])));
+                    }
+                    _mm_store_ps(&dstRow[x].x, sum);
+                }
+            }
+        });
+
+        // Vertical pass: dstWidth x srcHeight -> dstWidth x dstHeight
+        dst->resize(static_cast<size_t>(dstWidth) * dstHeight);
+        parallelFor(dstHeight, dstWidth * dstHeight >= kMinPixelsForThreading ? numThreads : 1,
+                    [&](uint32_t rowBegin, uint32_t rowEnd) {
+            for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+                float4* dstRow = &(*dst)[static_cast<size_t>(y) * dstWidth];
+                for (uint32_t x = 0; x < dstWidth; ++x) {
+                    __m128 sum = _mm_setzero_ps();
+                    for (uint32_t i = tapsY.offsets[y]; i < tapsY.offsets[y + 1]; ++i) {
+                        __m128 v = _mm_load_ps(&temp[static_cast<size_t>(tapsY.indices[i]) * dstWidth + x].x);
+                        sum = _mm_add_ps(sum, _mm_mul_ps(v, _mm_set1_ps(tapsY.weights[i])));
+                    }
+                    _mm_store_ps(&dstRow[x].x, sum);
+                }
+            }
+        });
+    }
+
+    void generate(const uint8_t* srcRGBA8, uint32_t width, uint32_t height, bool sRGB,
+                  Filter filter, uint32_t numThreads, std::vector<Level>* levels) {
+        Assert(srcRGBA8 && width > 0 && height > 0, "Invalid source image.");
+        if (numThreads == 0)
+            numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        uint32_t numLevels = calcNumLevels(width, height);
+        levels->resize(numLevels);
+
+        Level &baseLevel = (*levels)[0];
+        baseLevel.width = width;
+        baseLevel.height = height;
+        baseLevel.data.assign(srcRGBA8, srcRGBA8 + 4 * static_cast<size_t>(width) * height);
+
+        LinearImage prevImage;
+        LinearImage curImage;
+        decode(srcRGBA8, width, height, sRGB, numThreads, &prevImage);
+        uint32_t prevWidth = width;
+        uint32_t prevHeight = height;
+        for (uint32_t level = 1; level < numLevels; ++level) {
+            uint32_t curWidth = std::max(1u, width >> level);
+            uint32_t curHeight = std::max(1u, height >> level);
+            downsample(prevImage, prevWidth, prevHeight, filter, numThreads,
+                       &curImage, curWidth, curHeight);
+
+            Level &dstLevel = (*levels)[level];
+            dstLevel.width = curWidth;
+            dstLevel.height = curHeight;
+            dstLevel.data.resize(4 * static_cast<size_t>(curWidth) * curHeight);
+            encode(curImage, curWidth, curHeight, sRGB, numThreads, dstLevel.data.data());
+
+            std::swap(prevImage, curImage);
+            prevWidth = curWidth;
+            prevHeight = curHeight;
+        }
+    }
+
+    static double sRGBDegammaReference(double value) {
+        return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+    }
+
+    static double sRGBGammaReference(double value) {
+        return value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1 / 2.4) - 0.055;
+    }
+
+    bool runSelfTest() {
+        bool success = true;
+
+        // The vectorized sRGB curves must match the std::pow reference closely enough that every 8-bit value
+        // survives a degamma / gamma round trip.
+        {
+            float maxDegammaError = 0.0f;
+            float maxGammaError = 0.0f;
+            constexpr uint32_t numSamples = 4096;
+            for (uint32_t i = 0; i <= numSamples; i += 4) {
+                alignas(16) float values[4];
+                alignas(16) float degamma[4];
+                alignas(16) float gamma[4];
+                for (uint32_t j = 0; j < 4; ++j)
+                    values[j] = std::min(i + j, numSamples) / static_cast<float>(numSamples);
+                _mm_store_ps(degamma, sRGB_degamma_ps(_mm_load_ps(values)));
+                _mm_store_ps(gamma, sRGB_gamma_ps(_mm_load_ps(values)));
+                for (uint32_t j = 0; j < 4; ++j) {
+                    maxDegammaError = std::max(
+                        maxDegammaError, static_cast<float>(std::fabs(degamma[j] - sRGBDegammaReference(values[j]))));
+                    maxGammaError = std::max(
+                        maxGammaError, static_cast<float>(std::fabs(gamma[j] - sRGBGammaReference(values[j]))));
+                }
+            }
+
+            std::vector<uint8_t> ramp(4 * 256);
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (uint32_t c = 0; c < 4; ++c)
+                    ramp[4 * i + c] = static_cast<uint8_t>(i);
+            }
+            LinearImage linearRamp;
+            std::vector<uint8_t> roundTrip(ramp.size());
+            decode(ramp.data(), 256, 1, true, 1, &linearRamp);
+            encode(linearRamp, 256, 1, true, 1, roundTrip.data());
+            uint32_t numRoundTripErrors = 0;
+            for (uint32_t i = 0; i < ramp.size(); ++i)
+                numRoundTripErrors += roundTrip[i] != ramp[i];
+
+            hpprintf("sRGB curves: max error %g (degamma), %g (gamma), %u 8-bit round trip errors\n",
+                     maxDegammaError, maxGammaError, numRoundTripErrors);
+            success &= maxDegammaError < 1e-5f && maxGammaError < 1e-5f && numRoundTripErrors == 0;
+        }
+
+        // The box filter averages in linear space: black and white texels give the sRGB encoding of 0.5
+        // instead of 128, and alpha is averaged as is.
+        {
+            const uint8_t src[] = {
+                0, 0, 0, 0, 255, 255, 255, 255,
+                255, 255, 255, 255, 0, 0, 0, 0,
+            };
+            std::vector<Level> levels;
+            generate(src, 2, 2, true, Filter::Box, 1, &levels);
+            const uint8_t expectedRGB = static_cast<uint8_t>(std::lround(255 * sRGBGammaReference(0.5)));
+            bool ok = levels.size() == 2 && levels[1].width == 1 && levels[1].height == 1;
+            if (ok) {
+                const uint8_t* texel = levels[1].data.data();
+                ok = texel[0] == expectedRGB && texel[1] == expectedRGB && texel[2] == expectedRGB &&
+                    texel[3] == 128;
+            }
+            hpprintf("Box filter sRGB average: %s\n", ok ? "OK" : "NG");
+            success &= ok;
+        }
+
+        // Both filters have normalized weights, so a constant image must stay constant down to 1x1,
+        // including non-square chains.
+        for (Filter filter : { Filter::Box, Filter::Kaiser }) {
+            constexpr uint32_t width = 64;
+            constexpr uint32_t height = 16;
+            std::vector<uint8_t> src(4 * width * height);
+            for (uint32_t i = 0; i < width * height; ++i) {
+                src[4 * i + 0] = 200;
+                src[4 * i + 1] = 90;
+                src[4 * i + 2] = 10;
+                src[4 * i + 3] = 255;
+            }
+            std::vector<Level> levels;
+            generate(src.data(), width, height, true, filter, 1, &levels);
+            bool ok = levels.size() == calcNumLevels(width, height) &&
+                levels.back().width == 1 && levels.back().height == 1;
+            for (uint32_t level = 0; level < levels.size() && ok; ++level) {
+                ok &= levels[level].width == std::max(1u, width >> level) &&
+                    levels[level].height == std::max(1u, height >> level);
+                for (size_t i = 0; i < levels[level].data.size(); ++i)
+                    ok &= std::abs(static_cast<int32_t>(levels[level].data[i]) - src[i % 4]) <= 1;
+            }
+            hpprintf("%s filter constant image: %s\n", filter == Filter::Box ? "Box" : "Kaiser", ok ? "OK" : "NG");
+            success &= ok;
+        }
+
+        // Splitting rows across threads must not change the result.
+        {
+            constexpr uint32_t width = 256;
+            constexpr uint32_t height = 192;
+            std::mt19937 rng(590138);
+            std::uniform_int_distribution<uint32_t> texel(0, 255);
+            std::vector<uint8_t> src(4 * width * height);
+            for (uint8_t &value : src)
+                value = static_cast<uint8_t>(texel(rng));
+            std::vector<Level> singleThreaded;
+            std::vector<Level> multiThreaded;
+            generate(src.data(), width, height, true, Filter::Kaiser, 1, &singleThreaded);
+            generate(src.data(), width, height, true, Filter::Kaiser, 4, &multiThreaded);
+            bool ok = singleThreaded.size() == multiThreaded.size();
+            for (uint32_t level = 0; level < singleThreaded.size() && ok; ++level)
+                ok &= singleThreaded[level].data == multiThreaded[level].data;
+            hpprintf("Multi-threaded generation: %s\n", ok ? "OK" : "NG");
+            success &= ok;
+        }
+
+        return success;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// For host-side mipmap chain generation of RGBA8 textures
+namespace mipmap {
+    enum class Filter : uint32_t {
+        Box = 0,
+        // Kaiser-windowed sinc (alpha = 4, radius = 2 destination texels).
+        // Sharper than the box filter at the cost of more taps.
+        Kaiser,
+    };
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> data; // RGBA8, tightly packed
+    };
+
+    uint32_t calcNumLevels(uint32_t width, uint32_t height);
+
+    // Generates the full mip chain down to 1x1, including a copy of the source as level 0.
+    // When sRGB is true, RGB channels are filtered in linear space, alpha is always treated as linear.
+    // Each level is filtered from the previous one and its rows are split across numThreads threads
+    // (0 means std::thread::hardware_concurrency()).
+    void generate(const uint8_t* srcRGBA8, uint32_t width, uint32_t height, bool sRGB,
+                  Filter filter, uint32_t numThreads, std::vector<Level>* levels);
+
+    // Checks the vectorized sRGB curves against std::pow and the box/Kaiser filters on known images.
+    bool runSelfTest();
+}
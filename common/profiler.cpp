@@ -0,0 +1,297 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "profiler.h"
+#include "common.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace profiler {
+    struct Event {
+        const char* name;
+        // in nanoseconds, relative to the profiler epoch
+        uint64_t beginTime;
+        uint64_t duration;
+        uint32_t depth;
+    };
+
+    // Only the owner thread writes events. Readers copy a snapshot and discard the entries the owner may have
+    // overwritten during the copy, so writing never takes a lock.
+    struct ThreadBuffer {
+        std::vector<Event> events;
+        std::atomic<uint64_t> numWrittenEvents;
+        std::atomic<uint64_t> numClearedEvents;
+        uint32_t threadIndex;
+        uint32_t depth;
+        std::string name; // guarded by s_registryMutex
+    };
+
+    static std::atomic<bool> s_enabled(true);
+    static std::mutex s_registryMutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> s_threadBuffers;
+    static std::vector<ThreadBuffer*> s_freeThreadBuffers;
+
+    static high_resolution_clock::time_point getEpoch() {
+        static const high_resolution_clock::time_point epoch = high_resolution_clock::now();
+        return epoch;
+    }
+
+    // Returns the buffer to the free list when its thread exits.
+    struct ThreadBufferHandle {
+        ThreadBuffer* buffer;
+
+        ThreadBufferHandle() : buffer(nullptr) {}
+        ~ThreadBufferHandle() {
+            if (!buffer)
+                return;
+            std::lock_guard<std::mutex> lock(s_registryMutex);
+            s_freeThreadBuffers.push_back(buffer);
+        }
+    };
+
+    static ThreadBuffer* getThreadBuffer() {
+        thread_local ThreadBufferHandle handle;
+        if (handle.buffer)
+            return handle.buffer;
+
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        ThreadBuffer* buffer;
+        if (!s_freeThreadBuffers.empty()) {
+            buffer = s_freeThreadBuffers.back();
+            s_freeThreadBuffers.pop_back();
+        }
+        else {
+            s_threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = s_threadBuffers.back().get();
+            buffer->events.resize(kRingCapacity);
+            buffer->numWrittenEvents = 0;
+            buffer->numClearedEvents = 0;
+            buffer->threadIndex = static_cast<uint32_t>(s_threadBuffers.size() - 1);
+        }
+        buffer->depth = 0;
+        buffer->name = "Thread " + std::to_string(buffer->threadIndex);
+        handle.buffer = buffer;
+
+        return buffer;
+    }
+
+    static void takeSnapshot(const ThreadBuffer &buffer, std::vector<Event>* events) {
+        uint64_t end = buffer.numWrittenEvents.load(std::memory_order_acquire);
+        uint64_t begin = std::max(end > kRingCapacity ? end - kRingCapacity : 0,
+                                  buffer.numClearedEvents.load(std::memory_order_relaxed));
+        events->clear();
+        events->reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i)
+            events->push_back(buffer.events[i % kRingCapacity]);
+
+        // Seqlock-style validation: the fence keeps the copies above from being reordered after the reload.
+        // The writer may already be overwriting the slot of event endAfterCopy, which holds
+        // event endAfterCopy - kRingCapacity, so that one is dropped as well.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t endAfterCopy = buffer.numWrittenEvents.load(std::memory_order_relaxed);
+        uint64_t validBegin = endAfterCopy + 1 > kRingCapacity ? endAfterCopy + 1 - kRingCapacity : 0;
+        if (validBegin > begin)
+            events->erase(events->begin(), events->begin() + std::min<uint64_t>(validBegin - begin, events->size()));
+    }
+
+
+
+    void setEnabled(bool enabled) {
+        s_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setThreadName(const char* name) {
+        ThreadBuffer* buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        buffer->name = name;
+    }
+
+
+
+    Zone::Zone(const char* name) :
+        m_name(name), m_active(true), m_recording(isEnabled()) {
+        if (m_recording)
+            ++getThreadBuffer()->depth;
+        m_beginTP = high_resolution_clock::now();
+    }
+
+    float Zone::end() {
+        if (!m_active)
+            return 0.0f;
+        high_resolution_clock::time_point endTP = high_resolution_clock::now();
+        m_active = false;
+
+        if (m_recording) {
+            ThreadBuffer* buffer = getThreadBuffer();
+            --buffer->depth;
+            uint64_t index = buffer->numWrittenEvents.load(std::memory_order_relaxed);
+            Event &event = buffer->events[index % kRingCapacity];
+            event.name = m_name;
+            event.beginTime = duration_cast<nanoseconds>(m_beginTP - getEpoch()).count();
+            event.duration = duration_cast<nanoseconds>(endTP - m_beginTP).count();
+            event.depth = buffer->depth;
+            buffer->numWrittenEvents.store(index + 1, std::memory_order_release);
+        }
+
+        return duration<float, std::milli>(endTP - m_beginTP).count();
+    }
+
+
+
+    std::vector<ZoneStats> aggregate() {
+        std::map<std::string, std::vector<double>> durationsPerName;
+        {
+            std::lock_guard<std::mutex> lock(s_registryMutex);
+            std::vector<Event> events;
+            for (const std::unique_ptr<ThreadBuffer> &buffer : s_threadBuffers) {
+                takeSnapshot(*buffer, &events);
+                for (const Event &event : events)
+                    durationsPerName[event.name].push_back(event.duration * 1e-6);
+            }
+        }
+
+        std::vector<ZoneStats> stats;
+        stats.reserve(durationsPerName.size());
+        for (auto &it : durationsPerName) {
+            std::vector<double> &durations = it.second;
+            std::sort(durations.begin(), durations.end());
+            size_t count = durations.size();
+            // nearest-rank percentile
+            const auto percentile = [&durations, count](double p) {
+                size_t rank = static_cast<size_t>(std::ceil(p * count));
+                return durations[std::min(std::max<size_t>(rank, 1), count) - 1];
+            };
+
+            ZoneStats zoneStats;
+            zoneStats.name = it.first;
+            zoneStats.count = count;
+            zoneStats.totalTime = 0.0;
+            for (double d : durations)
+                zoneStats.totalTime += d;
+            zoneStats.meanTime = zoneStats.totalTime / count;
+            zoneStats.p50Time = percentile(0.50);
+            zoneStats.p90Time = percentile(0.90);
+            zoneStats.p99Time = percentile(0.99);
+            zoneStats.maxTime = durations.back();
+            stats.push_back(zoneStats);
+        }
+        std::sort(stats.begin(), stats.end(), [](const ZoneStats &a, const ZoneStats &b) {
+            return a.totalTime > b.totalTime;
+        });
+
+        return stats;
+    }
+
+    void printStatsTable(const std::vector<ZoneStats> &stats) {
+        hpprintf("%-32s %8s %10s %8s %8s %8s %8s %8s [ms]\n",
+                 "Zone", "Count", "Total", "Mean", "P50", "P90", "P99", "Max");
+        for (const ZoneStats &zoneStats : stats) {
+            hpprintf("%-32s %8llu %10.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+                     zoneStats.name.c_str(), static_cast<unsigned long long>(zoneStats.count),
+                     zoneStats.totalTime, zoneStats.meanTime,
+                     zoneStats.p50Time, zoneStats.p90Time, zoneStats.p99Time, zoneStats.maxTime);
+        }
+    }
+
+
+
+    static void writeJSONString(std::ostream &os, const char* str) {
+        os << '"';
+        for (const char* c = str; *c; ++c) {
+            switch (*c) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if (static_cast<uint8_t>(*c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+                    os << escaped;
+                }
+                else {
+                    os << *c;
+                }
+                break;
+            }
+        }
+        os << '"';
+    }
+
+    bool exportChromeTrace(const std::filesystem::path &filepath) {
+        std::ofstream ofs(filepath);
+        if (!ofs)
+            return false;
+
+        ofs << "{\"traceEvents\":[";
+        bool isFirst = true;
+        const auto beginEntry = [&ofs, &isFirst]() {
+            ofs << (isFirst ? "\n" : ",\n");
+            isFirst = false;
+        };
+
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        std::vector<Event> events;
+        for (const std::unique_ptr<ThreadBuffer> &buffer : s_threadBuffers) {
+            beginEntry();
+            ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadIndex
+                << ",\"args\":{\"name\":";
+            writeJSONString(ofs, buffer->name.c_str());
+            ofs << "}}";
+
+            takeSnapshot(*buffer, &events);
+            for (const Event &event : events) {
+                // Timestamps and durations are in microseconds.
+                char times[64];
+                snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f",
+                         event.beginTime * 1e-3, event.duration * 1e-3);
+                beginEntry();
+                ofs << "{\"name\":";
+                writeJSONString(ofs, event.name);
+                ofs << ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadIndex
+                    << "," << times << ",\"args\":{\"depth\":" << event.depth << "}}";
+            }
+        }
+        ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+        return static_cast<bool>(ofs);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(s_registryMutex);
+        for (const std::unique_ptr<ThreadBuffer> &buffer : s_threadBuffers) {
+            uint64_t numWrittenEvents = buffer->numWrittenEvents.load(std::memory_order_acquire);
+            buffer->numClearedEvents.store(numWrittenEvents, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/*
+
+   Copyright 2020 Shin Watanabe
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include "stopwatch.h"
+
+// Hierarchical CPU zone profiler on the same clock as StopWatchHiRes.
+// Completed zones are written to a per-thread ring buffer without locks, then can be exported as
+// Chrome/Perfetto trace JSON or aggregated into percentile tables.
+namespace profiler {
+    // Number of completed zones each thread keeps. Older zones are overwritten.
+    static constexpr uint32_t kRingCapacity = 1 << 16;
+
+    // Zones still measure time while disabled (Zone::end() keeps working) but are not recorded.
+    void setEnabled(bool enabled);
+    bool isEnabled();
+
+    // Names the calling thread in exported traces. Ring buffers of exited threads are reused by new threads.
+    void setThreadName(const char* name);
+
+    // Scoped zone. Zones nest per thread; name must stay valid while the profiler is used (e.g. a string literal).
+    class Zone {
+        const char* m_name;
+        high_resolution_clock::time_point m_beginTP;
+        bool m_active;
+        bool m_recording;
+
+        Zone(const Zone &) = delete;
+        Zone &operator=(const Zone &) = delete;
+
+    public:
+        explicit Zone(const char* name);
+        ~Zone() {
+            if (m_active)
+                end();
+        }
+
+        // Ends the zone before the end of the scope and returns its duration in milliseconds.
+        // Zones need to be ended in the reverse order of creation.
+        float end();
+    };
+
+    struct ZoneStats {
+        std::string name;
+        uint64_t count;
+        // in milliseconds
+        double totalTime;
+        double meanTime;
+        double p50Time;
+        double p90Time;
+        double p99Time;
+        double maxTime;
+    };
+
+    // Aggregates the zones currently held by all threads per name, sorted by total time in descending order.
+    std::vector<ZoneStats> aggregate();
+    void printStatsTable(const std::vector<ZoneStats> &stats);
+
+    // Writes the zones currently held by all threads as complete events of the Chrome trace event format,
+    // which chrome://tracing and Perfetto can open. Returns false when the file cannot be written.
+    bool exportChromeTrace(const std::filesystem::path &filepath);
+
+    // Discards the zones recorded so far.
+    void clear();
+}
+
+#define PROFILER_CONCAT_INNER(a, b) a ## b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+#define PROFILER_ZONE(name) profiler::Zone PROFILER_CONCAT(profilerZone, __LINE__)(name)
@@ -18,6 +18,12 @@
 
 #include "cuda_util.h"
 
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+
 #ifdef CUDAHPlatform_Windows_MSVC
 #   include <Windows.h>
 #   undef near
@@ -49,11 +55,1214 @@ namespace cudau {
 
 
 
+    static inline size_t alignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+
+
+    KernelAutotuner::KernelAutotuner() :
+        m_cuContext(nullptr), m_generation(0), m_initialized(false) {
+    }
+
+    KernelAutotuner::~KernelAutotuner() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void KernelAutotuner::initialize(CUcontext context, const char* cacheFilePath) {
+        if (m_initialized)
+            throw std::runtime_error("KernelAutotuner is already initialized.");
+
+        m_cuContext = context;
+        m_cacheFilePath = cacheFilePath ? cacheFilePath : "";
+
+        // JP: 最適な設定はGPUの世代によって異なるので、デバイス名とCompute Capabilityで区別する。
+        // EN: The best configuration differs between GPU generations,
+        //     so distinguish entries by the device name and the compute capability.
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        char deviceName[256];
+        CUDADRV_CHECK(cuDeviceGetName(deviceName, sizeof(deviceName), device));
+        int32_t ccMajor, ccMinor;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&ccMajor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(&ccMinor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device));
+        std::stringstream ss;
+        ss << deviceName << " sm_" << ccMajor << ccMinor;
+        m_deviceName = ss.str();
+
+        loadCache();
+
+        m_initialized = true;
+    }
+
+    void KernelAutotuner::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (const auto &it : m_trials) {
+            for (const PendingMeasurement &pending : it.second.pendingMeasurements) {
+                CUDADRV_CHECK(cuEventDestroy(pending.endEvent));
+                CUDADRV_CHECK(cuEventDestroy(pending.startEvent));
+            }
+        }
+        m_trials.clear();
+        for (CUevent event : m_freeEvents)
+            CUDADRV_CHECK(cuEventDestroy(event));
+        m_freeEvents.clear();
+        m_winners.clear();
+        m_otherDeviceEntries.clear();
+
+        m_cuContext = nullptr;
+        m_initialized = false;
+    }
+
+    CUevent KernelAutotuner::getEvent() {
+        if (!m_freeEvents.empty()) {
+            CUevent event = m_freeEvents.back();
+            m_freeEvents.pop_back();
+            return event;
+        }
+        CUevent event;
+        CUDADRV_CHECK(cuEventCreate(&event, CU_EVENT_DEFAULT));
+        return event;
+    }
+
+    // JP: 問題サイズは2の冪のバケットにまとめる。
+    // EN: Problem sizes are grouped into power-of-two buckets.
+    static uint32_t calcProblemSizeBucket(const dim3 &numItems) {
+        uint64_t numTotalItems = static_cast<uint64_t>(numItems.x) * numItems.y * numItems.z;
+        uint32_t bucket = 0;
+        while ((1ull << bucket) < numTotalItems)
+            ++bucket;
+        return bucket;
+    }
+
+    // JP: 2次元以上のカーネルには正方形に近いブロック形状を使う。
+    // EN: Use close-to-square block shapes for kernels with two or more dimensions.
+    static dim3 makeBlockShape(uint32_t numThreads, uint32_t dimensionality) {
+        if (dimensionality == 1)
+            return dim3(numThreads);
+        uint32_t log2NumThreads = 0;
+        while ((2u << log2NumThreads) <= numThreads)
+            ++log2NumThreads;
+        uint32_t dimX = std::min(1u << ((log2NumThreads + 1) / 2), 32u);
+        return dim3(dimX, numThreads / dimX);
+    }
+
+    dim3 KernelAutotuner::beginLaunch(CUstream stream, const std::string &kernelName, CUfunction kernel,
+                                      uint32_t sharedMemSize, uint32_t dimensionality, const dim3 &numItems,
+                                      const dim3 &defaultBlockDim, Measurement* measurement) {
+        *measurement = {};
+
+        std::string key = kernelName + '\t' + std::to_string(calcProblemSizeBucket(numItems));
+        auto winnerIt = m_winners.find(key);
+        if (winnerIt != m_winners.end())
+            return winnerIt->second;
+
+        auto trialIt = m_trials.find(key);
+        if (trialIt == m_trials.end()) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            int32_t minGridSize, suggestedBlockSize;
+            CUDADRV_CHECK(cuOccupancyMaxPotentialBlockSize(&minGridSize, &suggestedBlockSize, kernel,
+                                                           nullptr, sharedMemSize, 0));
+            int32_t maxBlockSize;
+            CUDADRV_CHECK(cuFuncGetAttribute(&maxBlockSize, CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK, kernel));
+
+            Trial trial;
+            const auto addCandidate = [&trial](const dim3 &blockDim) {
+                for (const dim3 &candidate : trial.candidates) {
+                    if (candidate.x == blockDim.x && candidate.y == blockDim.y && candidate.z == blockDim.z)
+                        return;
+                }
+                trial.candidates.push_back(blockDim);
+            };
+            addCandidate(makeBlockShape(suggestedBlockSize, dimensionality));
+            addCandidate(defaultBlockDim);
+            for (uint32_t numThreads = 32; numThreads <= static_cast<uint32_t>(maxBlockSize); numThreads *= 2)
+                addCandidate(makeBlockShape(numThreads, dimensionality));
+            uint32_t numCandidates = static_cast<uint32_t>(trial.candidates.size());
+            trial.numIssuedSamples.resize(numCandidates, 0);
+            trial.numResolvedSamples.resize(numCandidates, 0);
+            trial.bestTimes.resize(numCandidates, FLT_MAX);
+            trial.nextCandidateIndex = 0;
+            trialIt = m_trials.emplace(key, std::move(trial)).first;
+        }
+
+        Trial &trial = trialIt->second;
+        resolveMeasurements(key, &trial);
+        winnerIt = m_winners.find(key);
+        if (winnerIt != m_winners.end()) {
+            m_trials.erase(trialIt);
+            return winnerIt->second;
+        }
+
+        // JP: 記録中のストリームではイベントによる計測ができない。
+        // EN: Events can't measure work on a stream being captured.
+        CUstreamCaptureStatus captureStatus;
+        CUDADRV_CHECK(cuStreamIsCapturing(stream, &captureStatus));
+        uint32_t numCandidates = static_cast<uint32_t>(trial.candidates.size());
+        if (captureStatus == CU_STREAM_CAPTURE_STATUS_NONE) {
+            for (uint32_t i = 0; i < numCandidates; ++i) {
+                uint32_t candIdx = (trial.nextCandidateIndex + i) % numCandidates;
+                if (trial.numIssuedSamples[candIdx] >= NumSamplesPerCandidate)
+                    continue;
+                trial.nextCandidateIndex = (candIdx + 1) % numCandidates;
+                ++trial.numIssuedSamples[candIdx];
+                measurement->trial = &trial;
+                measurement->candidateIndex = candIdx;
+                measurement->startEvent = getEvent();
+                measurement->endEvent = getEvent();
+                CUDADRV_CHECK(cuEventRecord(measurement->startEvent, stream));
+                return trial.candidates[candIdx];
+            }
+        }
+
+        // JP: 全ての計測を発行済みで結果を待っている場合は、ここまでで最速の候補か既定値を使う。
+        // EN: When all measurements have been issued and are pending,
+        //     use the fastest candidate so far or the default.
+        dim3 blockDim = defaultBlockDim;
+        float bestTime = FLT_MAX;
+        for (uint32_t candIdx = 0; candIdx < numCandidates; ++candIdx) {
+            if (trial.bestTimes[candIdx] < bestTime) {
+                bestTime = trial.bestTimes[candIdx];
+                blockDim = trial.candidates[candIdx];
+            }
+        }
+        return blockDim;
+    }
+
+    void KernelAutotuner::endLaunch(CUstream stream, const Measurement &measurement) {
+        if (!measurement.startEvent)
+            return;
+
+        CUDADRV_CHECK(cuEventRecord(measurement.endEvent, stream));
+        auto trial = reinterpret_cast<Trial*>(measurement.trial);
+        trial->pendingMeasurements.push_back(
+            PendingMeasurement{ measurement.candidateIndex, measurement.startEvent, measurement.endEvent });
+    }
+
+    void KernelAutotuner::resolveMeasurements(const std::string &key, Trial* trial) {
+        for (auto it = trial->pendingMeasurements.begin(); it != trial->pendingMeasurements.end();) {
+            CUresult res = cuEventQuery(it->endEvent);
+            if (res == CUDA_ERROR_NOT_READY) {
+                ++it;
+                continue;
+            }
+            CUDADRV_CHECK(res);
+
+            float time;
+            CUDADRV_CHECK(cuEventElapsedTime(&time, it->startEvent, it->endEvent));
+            trial->bestTimes[it->candidateIndex] = std::min(trial->bestTimes[it->candidateIndex], time);
+            ++trial->numResolvedSamples[it->candidateIndex];
+            m_freeEvents.push_back(it->startEvent);
+            m_freeEvents.push_back(it->endEvent);
+            it = trial->pendingMeasurements.erase(it);
+        }
+
+        uint32_t numCandidates = static_cast<uint32_t>(trial->candidates.size());
+        uint32_t bestCandIdx = 0;
+        for (uint32_t candIdx = 0; candIdx < numCandidates; ++candIdx) {
+            if (trial->numResolvedSamples[candIdx] < NumSamplesPerCandidate)
+                return;
+            if (trial->bestTimes[candIdx] < trial->bestTimes[bestCandIdx])
+                bestCandIdx = candIdx;
+        }
+
+        m_winners[key] = trial->candidates[bestCandIdx];
+        ++m_generation;
+        saveCache();
+    }
+
+    void KernelAutotuner::loadCache() {
+        if (m_cacheFilePath.empty())
+            return;
+
+        std::ifstream ifs(m_cacheFilePath);
+        if (!ifs)
+            return;
+
+        // JP: 1行1エントリー: デバイス名、カーネル名、バケット、ブロックサイズX, Y, Z (タブ区切り)。
+        // EN: One entry per line: device name, kernel name, bucket, block size X, Y, Z (tab separated).
+        std::string line;
+        while (std::getline(ifs, line)) {
+            std::vector<std::string> fields;
+            std::stringstream lineStream(line);
+            std::string field;
+            while (std::getline(lineStream, field, '\t'))
+                fields.push_back(field);
+            if (fields.size() != 6)
+                continue;
+            if (fields[0] != m_deviceName) {
+                m_otherDeviceEntries.push_back(line);
+                continue;
+            }
+
+            dim3 blockDim(std::strtoul(fields[3].c_str(), nullptr, 10),
+                          std::strtoul(fields[4].c_str(), nullptr, 10),
+                          std::strtoul(fields[5].c_str(), nullptr, 10));
+            if (blockDim.x == 0 || blockDim.y == 0 || blockDim.z == 0)
+                continue;
+            m_winners[fields[1] + '\t' + fields[2]] = blockDim;
+        }
+    }
+
+    void KernelAutotuner::saveCache() const {
+        if (m_cacheFilePath.empty())
+            return;
+
+        // JP: 書き込み途中のファイルを読まないように一時ファイルに書いてから置き換える。
+        //     キャッシュの保存に失敗しても致命的ではない。
+        // EN: Write to a temporary file then replace to avoid reading a partially written file.
+        //     Failing to save the cache is not fatal.
+        std::string tmpPath = m_cacheFilePath + ".tmp";
+        {
+            std::ofstream ofs(tmpPath);
+            if (!ofs)
+                return;
+            for (const std::string &entry : m_otherDeviceEntries)
+                ofs << entry << '\n';
+            for (const auto &it : m_winners) {
+                const dim3 &blockDim = it.second;
+                ofs << m_deviceName << '\t' << it.first << '\t'
+                    << blockDim.x << '\t' << blockDim.y << '\t' << blockDim.z << '\n';
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, m_cacheFilePath, ec);
+    }
+
+
+
+    TimestampPool::TimestampPool() :
+        m_cuContext(nullptr), m_numAverageSamples(0), m_curFrameSlot(0), m_numDroppedFrames(0),
+        m_initialized(false) {
+    }
+
+    TimestampPool::~TimestampPool() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void TimestampPool::initialize(CUcontext context, uint32_t numFrames, uint32_t numAverageSamples) {
+        if (m_initialized)
+            throw std::runtime_error("TimestampPool is already initialized.");
+        if (numFrames == 0 || numAverageSamples == 0)
+            throw std::runtime_error("Invalid number of frames or samples.");
+
+        m_cuContext = context;
+        m_frames.resize(numFrames);
+        for (Frame &frame : m_frames)
+            frame.numUsedEvents = 0;
+        m_numAverageSamples = numAverageSamples;
+        // JP: 最初のbeginFrame()でスロット0から始める。
+        // EN: Start from slot 0 at the first beginFrame().
+        m_curFrameSlot = numFrames - 1;
+        m_numDroppedFrames = 0;
+
+        m_initialized = true;
+    }
+
+    void TimestampPool::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (Frame &frame : m_frames) {
+            for (CUevent event : frame.events)
+                CUDADRV_CHECK(cuEventDestroy(event));
+        }
+        m_frames.clear();
+        m_pendingFrames.clear();
+        m_scopes.clear();
+        m_scopeIndices.clear();
+
+        m_cuContext = nullptr;
+        m_initialized = false;
+    }
+
+    uint32_t TimestampPool::registerScope(const char* name) {
+        auto it = m_scopeIndices.find(name);
+        if (it != m_scopeIndices.end())
+            return it->second;
+
+        uint32_t scopeIndex = static_cast<uint32_t>(m_scopes.size());
+        Scope scope;
+        scope.name = name;
+        scope.stats = {};
+        scope.historyPosition = 0;
+        m_scopes.push_back(std::move(scope));
+        m_scopeIndices[name] = scopeIndex;
+
+        return scopeIndex;
+    }
+
+    CUevent TimestampPool::acquireEvent(Frame* frame) {
+        if (frame->numUsedEvents < frame->events.size())
+            return frame->events[frame->numUsedEvents++];
+
+        CUevent event;
+        CUDADRV_CHECK(cuEventCreate(&event, CU_EVENT_DEFAULT));
+        frame->events.push_back(event);
+        ++frame->numUsedEvents;
+        return event;
+    }
+
+    bool TimestampPool::resolveFrame(const Frame &frame) {
+        for (const Query &query : frame.queries) {
+            if (!query.endEvent)
+                continue;
+            for (CUevent event : { query.beginEvent, query.endEvent }) {
+                CUresult res = cuEventQuery(event);
+                if (res == CUDA_ERROR_NOT_READY)
+                    return false;
+                CUDADRV_CHECK(res);
+            }
+        }
+
+        // JP: 負値はこのフレームで発行されなかったことを表す。
+        // EN: A negative value indicates that the scope wasn't issued in this frame.
+        m_frameDurations.assign(m_scopes.size(), -1.0f);
+        for (const Query &query : frame.queries) {
+            if (!query.endEvent)
+                continue;
+            float time;
+            CUDADRV_CHECK(cuEventElapsedTime(&time, query.beginEvent, query.endEvent));
+            float &duration = m_frameDurations[query.scopeIndex];
+            duration = std::max(duration, 0.0f) + time;
+        }
+
+        for (uint32_t scopeIdx = 0; scopeIdx < m_scopes.size(); ++scopeIdx) {
+            Scope &scope = m_scopes[scopeIdx];
+            float duration = m_frameDurations[scopeIdx];
+            if (duration < 0.0f) {
+                scope.stats.lastTime = 0.0f;
+                continue;
+            }
+
+            scope.stats.lastTime = duration;
+            if (scope.history.size() < m_numAverageSamples)
+                scope.history.push_back(duration);
+            else
+                scope.history[scope.historyPosition] = duration;
+            scope.historyPosition = (scope.historyPosition + 1) % m_numAverageSamples;
+            float sum = 0.0f;
+            for (float time : scope.history)
+                sum += time;
+            scope.stats.averageTime = sum / scope.history.size();
+            ++scope.stats.numSamples;
+        }
+
+        return true;
+    }
+
+    void TimestampPool::beginFrame() {
+        if (!m_initialized)
+            throw std::runtime_error("TimestampPool is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: 統計が順番通りに更新されるよう、古いフレームから未完了のフレームに当たるまで解決する。
+        // EN: Resolve from the oldest frame until hitting an incomplete one so that stats are updated in order.
+        while (!m_pendingFrames.empty()) {
+            if (!resolveFrame(m_frames[m_pendingFrames.front()]))
+                break;
+            m_pendingFrames.pop_front();
+        }
+
+        m_curFrameSlot = (m_curFrameSlot + 1) % m_frames.size();
+        if (!m_pendingFrames.empty() && m_pendingFrames.front() == m_curFrameSlot) {
+            // JP: 待たずにスロットを再利用する。まだ実行中のイベントを記録し直しても問題無い。
+            // EN: Reuse the slot without waiting. Re-recording events still in flight is fine.
+            m_pendingFrames.pop_front();
+            ++m_numDroppedFrames;
+        }
+
+        Frame &frame = m_frames[m_curFrameSlot];
+        frame.numUsedEvents = 0;
+        frame.queries.clear();
+        m_pendingFrames.push_back(m_curFrameSlot);
+    }
+
+    void TimestampPool::begin(CUstream stream, uint32_t scopeIndex) {
+        CUstreamCaptureStatus captureStatus;
+        CUDADRV_CHECK(cuStreamIsCapturing(stream, &captureStatus));
+        if (captureStatus != CU_STREAM_CAPTURE_STATUS_NONE)
+            return;
+
+        Frame &frame = m_frames[m_curFrameSlot];
+        CUevent event = acquireEvent(&frame);
+        CUDADRV_CHECK(cuEventRecord(event, stream));
+        frame.queries.push_back(Query{ scopeIndex, event, nullptr });
+    }
+
+    void TimestampPool::end(CUstream stream, uint32_t scopeIndex) {
+        CUstreamCaptureStatus captureStatus;
+        CUDADRV_CHECK(cuStreamIsCapturing(stream, &captureStatus));
+        if (captureStatus != CU_STREAM_CAPTURE_STATUS_NONE)
+            return;
+
+        Frame &frame = m_frames[m_curFrameSlot];
+        for (auto it = frame.queries.rbegin(); it != frame.queries.rend(); ++it) {
+            if (it->scopeIndex != scopeIndex || it->endEvent)
+                continue;
+            CUevent event = acquireEvent(&frame);
+            CUDADRV_CHECK(cuEventRecord(event, stream));
+            it->endEvent = event;
+            return;
+        }
+    }
+
+
+
+    GraphRecorder::GraphRecorder() :
+        m_cuContext(nullptr), m_captureStream(nullptr),
+        m_curTopologyKey(0), m_curExecGraphIndex(InvalidExecGraphIndex), m_stats{},
+        m_initialized(false), m_capturing(false) {
+    }
+
+    GraphRecorder::~GraphRecorder() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void GraphRecorder::destroyExecGraph(ExecGraph* execGraph) {
+        // JP: 実行中の実行可能グラフは完了後に解放される。
+        // EN: An executable graph in flight is released after its completion.
+        CUDADRV_CHECK(cuGraphExecDestroy(execGraph->graphExec));
+        CUDADRV_CHECK(cuGraphDestroy(execGraph->graph));
+        *execGraph = {};
+    }
+
+    void GraphRecorder::initialize(CUcontext context) {
+        if (m_initialized)
+            throw std::runtime_error("GraphRecorder is already initialized.");
+
+        m_cuContext = context;
+        m_curTopologyKey = 0;
+        m_curExecGraphIndex = InvalidExecGraphIndex;
+        m_stats = {};
+
+        m_initialized = true;
+    }
+
+    void GraphRecorder::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        if (m_capturing) {
+            CUgraph graph = nullptr;
+            cuStreamEndCapture(m_captureStream, &graph);
+            if (graph)
+                CUDADRV_CHECK(cuGraphDestroy(graph));
+            m_capturedKernelNodes.clear();
+            m_captureStream = nullptr;
+            m_capturing = false;
+        }
+        invalidate();
+
+        m_cuContext = nullptr;
+        m_initialized = false;
+    }
+
+    bool GraphRecorder::select(uint64_t topologyKey) {
+        if (!m_initialized)
+            throw std::runtime_error("GraphRecorder is not initialized.");
+        if (m_capturing)
+            throw std::runtime_error("GraphRecorder is capturing.");
+
+        m_curTopologyKey = topologyKey;
+        m_curExecGraphIndex = InvalidExecGraphIndex;
+        for (uint32_t i = 0; i < m_execGraphs.size(); ++i) {
+            if (m_execGraphs[i].topologyKey == topologyKey) {
+                m_curExecGraphIndex = i;
+                break;
+            }
+        }
+
+        return m_curExecGraphIndex != InvalidExecGraphIndex;
+    }
+
+    void GraphRecorder::beginCapture(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("GraphRecorder is not initialized.");
+        if (m_capturing)
+            throw std::runtime_error("GraphRecorder is already capturing.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuStreamBeginCapture(stream, CU_STREAM_CAPTURE_MODE_THREAD_LOCAL));
+        m_captureStream = stream;
+        m_capturing = true;
+    }
+
+    void GraphRecorder::addKernelNode(uint32_t nodeID) {
+        if (!m_capturing)
+            throw std::runtime_error("GraphRecorder is not capturing.");
+
+        // JP: 記録中のストリームの依存先は直前に記録されたノードである。
+        // EN: The dependency of the capturing stream is the node recorded just before.
+        CUstreamCaptureStatus captureStatus;
+        const CUgraphNode* dependencies;
+        size_t numDependencies;
+#if CUDA_VERSION >= 13000
+        CUDADRV_CHECK(cuStreamGetCaptureInfo(m_captureStream, &captureStatus, nullptr, nullptr,
+                                             &dependencies, nullptr, &numDependencies));
+#else
+        CUDADRV_CHECK(cuStreamGetCaptureInfo_v2(m_captureStream, &captureStatus, nullptr, nullptr,
+                                                &dependencies, &numDependencies));
+#endif
+        if (numDependencies != 1)
+            throw std::runtime_error("The last recorded work is not a kernel launch.");
+        CUgraphNodeType nodeType;
+        CUDADRV_CHECK(cuGraphNodeGetType(dependencies[0], &nodeType));
+        if (nodeType != CU_GRAPH_NODE_TYPE_KERNEL)
+            throw std::runtime_error("The last recorded work is not a kernel launch.");
+        for (const std::pair<uint32_t, CUgraphNode> &node : m_capturedKernelNodes) {
+            if (node.first == nodeID)
+                throw std::runtime_error("The node ID is already used.");
+        }
+
+        m_capturedKernelNodes.emplace_back(nodeID, dependencies[0]);
+    }
+
+    void GraphRecorder::endCapture() {
+        if (!m_capturing)
+            throw std::runtime_error("GraphRecorder is not capturing.");
+
+        ExecGraph execGraph = {};
+        execGraph.topologyKey = m_curTopologyKey;
+        CUstream stream = m_captureStream;
+        m_captureStream = nullptr;
+        m_capturing = false;
+        CUresult res = cuStreamEndCapture(stream, &execGraph.graph);
+        if (res != CUDA_SUCCESS)
+            m_capturedKernelNodes.clear();
+        CUDADRV_CHECK(res);
+        ++m_stats.numCaptures;
+
+#if CUDA_VERSION >= 12000
+        res = cuGraphInstantiate(&execGraph.graphExec, execGraph.graph, 0);
+#else
+        res = cuGraphInstantiate(&execGraph.graphExec, execGraph.graph, nullptr, nullptr, 0);
+#endif
+        if (res != CUDA_SUCCESS) {
+            m_capturedKernelNodes.clear();
+            cuGraphDestroy(execGraph.graph);
+            CUDADRV_CHECK(res);
+        }
+        ++m_stats.numInstantiations;
+
+        // JP: 書き換え時は記録時の起動構成を保ったまま引数のみを差し替える。
+        // EN: Only the arguments are replaced keeping the recorded launch configuration when rewriting.
+        execGraph.kernelNodes.resize(m_capturedKernelNodes.size());
+        for (uint32_t i = 0; i < m_capturedKernelNodes.size(); ++i) {
+            KernelNode &kernelNode = execGraph.kernelNodes[i];
+            kernelNode.nodeID = m_capturedKernelNodes[i].first;
+            kernelNode.node = m_capturedKernelNodes[i].second;
+            CUDADRV_CHECK(cuGraphKernelNodeGetParams(kernelNode.node, &kernelNode.params));
+            kernelNode.params.kernelParams = nullptr;
+            kernelNode.params.extra = nullptr;
+        }
+        m_capturedKernelNodes.clear();
+
+        if (m_curExecGraphIndex != InvalidExecGraphIndex) {
+            destroyExecGraph(&m_execGraphs[m_curExecGraphIndex]);
+            m_execGraphs[m_curExecGraphIndex] = std::move(execGraph);
+        }
+        else {
+            m_curExecGraphIndex = static_cast<uint32_t>(m_execGraphs.size());
+            m_execGraphs.push_back(std::move(execGraph));
+        }
+    }
+
+    void GraphRecorder::setKernelNodeParams(uint32_t nodeID, void** kernelParams) {
+        if (m_curExecGraphIndex == InvalidExecGraphIndex)
+            throw std::runtime_error("Graph has not been captured yet.");
+
+        ExecGraph &execGraph = m_execGraphs[m_curExecGraphIndex];
+        for (const KernelNode &kernelNode : execGraph.kernelNodes) {
+            if (kernelNode.nodeID != nodeID)
+                continue;
+            CUDA_KERNEL_NODE_PARAMS params = kernelNode.params;
+            params.kernelParams = kernelParams;
+            CUDADRV_CHECK(cuGraphExecKernelNodeSetParams(execGraph.graphExec, kernelNode.node, &params));
+            ++m_stats.numPatches;
+            return;
+        }
+
+        throw std::runtime_error("The kernel node is not registered in the selected graph.");
+    }
+
+    void GraphRecorder::launch(CUstream stream) {
+        if (m_curExecGraphIndex == InvalidExecGraphIndex)
+            throw std::runtime_error("Graph has not been captured yet.");
+
+        CUDADRV_CHECK(cuGraphLaunch(m_execGraphs[m_curExecGraphIndex].graphExec, stream));
+        ++m_stats.numLaunches;
+    }
+
+    void GraphRecorder::invalidate() {
+        if (m_execGraphs.empty())
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        for (ExecGraph &execGraph : m_execGraphs)
+            destroyExecGraph(&execGraph);
+        m_execGraphs.clear();
+        m_curExecGraphIndex = InvalidExecGraphIndex;
+    }
+
+
+
+    using MemoryStatsTable = std::array<MemoryCategoryStats, static_cast<size_t>(MemoryCategory::NumCategories)>;
+
+    // JP: バッファーは複数のスレッドから確保されうるので、レジストリーはミューテックスで保護する。
+    // EN: Buffers can be allocated from multiple threads, so protect the registry with a mutex.
+    static std::mutex s_memoryStatsMutex;
+    static std::map<CUcontext, MemoryStatsTable> s_memoryStats;
+
+    const char* getMemoryCategoryName(MemoryCategory category) {
+        switch (category) {
+        case MemoryCategory::User:
+            return "User";
+        case MemoryCategory::AS:
+            return "AS";
+        case MemoryCategory::ASCompacted:
+            return "ASCompacted";
+        case MemoryCategory::Scratch:
+            return "Scratch";
+        case MemoryCategory::SBT:
+            return "SBT";
+        case MemoryCategory::Geometry:
+            return "Geometry";
+        case MemoryCategory::Texture:
+            return "Texture";
+        case MemoryCategory::Framebuffer:
+            return "Framebuffer";
+        default:
+            CUDAUAssert_ShouldNotBeCalled();
+            return "Unknown";
+        }
+    }
+
+    static MemoryStatsTable &getMemoryStatsTable(CUcontext context) {
+        auto it = s_memoryStats.find(context);
+        if (it == s_memoryStats.cend()) {
+            MemoryStatsTable table = {};
+            it = s_memoryStats.emplace(context, table).first;
+        }
+        return it->second;
+    }
+
+    void recordMemoryAllocation(CUcontext context, MemoryCategory category, size_t size) {
+        std::lock_guard<std::mutex> lock(s_memoryStatsMutex);
+        MemoryCategoryStats &stats = getMemoryStatsTable(context)[static_cast<size_t>(category)];
+        stats.numLiveBytes += size;
+        stats.numPeakBytes = std::max(stats.numPeakBytes, stats.numLiveBytes);
+        ++stats.numLiveAllocations;
+        ++stats.numTotalAllocations;
+    }
+
+    void recordMemoryRelease(CUcontext context, MemoryCategory category, size_t size) {
+        std::lock_guard<std::mutex> lock(s_memoryStatsMutex);
+        MemoryCategoryStats &stats = getMemoryStatsTable(context)[static_cast<size_t>(category)];
+        CUDAUAssert(stats.numLiveBytes >= size && stats.numLiveAllocations > 0,
+                    "Releasing more memory than recorded for category %s.", getMemoryCategoryName(category));
+        stats.numLiveBytes -= size;
+        --stats.numLiveAllocations;
+    }
+
+    MemoryCategoryStats getMemoryStats(CUcontext context, MemoryCategory category) {
+        std::lock_guard<std::mutex> lock(s_memoryStatsMutex);
+        return getMemoryStatsTable(context)[static_cast<size_t>(category)];
+    }
+
+    void resetMemoryPeaks(CUcontext context) {
+        std::lock_guard<std::mutex> lock(s_memoryStatsMutex);
+        for (MemoryCategoryStats &stats : getMemoryStatsTable(context))
+            stats.numPeakBytes = stats.numLiveBytes;
+    }
+
+    std::string dumpMemoryStatsAsJSON(CUcontext context) {
+        MemoryStatsTable table;
+        {
+            std::lock_guard<std::mutex> lock(s_memoryStatsMutex);
+            table = getMemoryStatsTable(context);
+        }
+
+        std::stringstream ss;
+        size_t numTotalLiveBytes = 0;
+        ss << "{\n";
+        ss << "  \"categories\": {\n";
+        for (uint32_t i = 0; i < table.size(); ++i) {
+            const MemoryCategoryStats &stats = table[i];
+            numTotalLiveBytes += stats.numLiveBytes;
+            ss << "    \"" << getMemoryCategoryName(static_cast<MemoryCategory>(i)) << "\": { "
+               << "\"liveBytes\": " << stats.numLiveBytes << ", "
+               << "\"peakBytes\": " << stats.numPeakBytes << ", "
+               << "\"liveAllocations\": " << stats.numLiveAllocations << ", "
+               << "\"totalAllocations\": " << stats.numTotalAllocations << " }"
+               << (i + 1 < table.size() ? "," : "") << "\n";
+        }
+        ss << "  },\n";
+        ss << "  \"totalLiveBytes\": " << numTotalLiveBytes << "\n";
+        ss << "}\n";
+
+        return ss.str();
+    }
+
+    MemoryArena::MemoryArena() :
+        m_cuContext(nullptr), m_slabSize(0), m_alignment(0), m_numUsedBytes(0),
+        m_initialized(false) {
+    }
+
+    MemoryArena::~MemoryArena() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void MemoryArena::addSlab(size_t size) {
+        Slab slab;
+        slab.size = size;
+        if (m_type == BufferType::Device)
+            CUDADRV_CHECK(cuMemAlloc(&slab.base, slab.size));
+        else // m_type == BufferType::Managed
+            CUDADRV_CHECK(cuMemAllocManaged(&slab.base, slab.size, CU_MEM_ATTACH_GLOBAL));
+        slab.freeRanges[0] = slab.size;
+        slab.numFreeBytes = slab.size;
+        m_slabs.push_back(std::move(slab));
+    }
+
+    void MemoryArena::initialize(CUcontext context, BufferType type, size_t slabSize, size_t alignment) {
+        if (m_initialized)
+            throw std::runtime_error("MemoryArena is already initialized.");
+        if (type != BufferType::Device && type != BufferType::Managed)
+            throw std::runtime_error("MemoryArena supports only Device and Managed buffer types.");
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+            throw std::runtime_error("Alignment must be a power of two.");
+
+        m_cuContext = context;
+        m_type = type;
+        m_alignment = alignment;
+        m_slabSize = alignUp(slabSize, m_alignment);
+        m_numUsedBytes = 0;
+
+        m_initialized = true;
+    }
+
+    void MemoryArena::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_slabs.size()) - 1; i >= 0; --i)
+            CUDADRV_CHECK(cuMemFree(m_slabs[i].base));
+        m_slabs.clear();
+        m_numUsedBytes = 0;
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    CUdeviceptr MemoryArena::allocate(size_t size, size_t alignment) {
+        if (!m_initialized)
+            throw std::runtime_error("MemoryArena is not initialized.");
+        if (alignment != 0 && (alignment & (alignment - 1)) != 0)
+            throw std::runtime_error("Alignment must be a power of two.");
+
+        alignment = std::max(alignment, m_alignment);
+        size = alignUp(std::max<size_t>(size, 1), m_alignment);
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: 先頭から最初に収まる空き範囲を探す(first-fit)。
+        // EN: Find the first free range which fits (first-fit).
+        for (int pass = 0; pass < 2; ++pass) {
+            for (Slab &slab : m_slabs) {
+                if (slab.numFreeBytes < size)
+                    continue;
+                for (auto it = slab.freeRanges.begin(); it != slab.freeRanges.end(); ++it) {
+                    size_t rangeOffset = it->first;
+                    size_t rangeSize = it->second;
+                    size_t offset = alignUp(slab.base + rangeOffset, alignment) - slab.base;
+                    if (offset + size > rangeOffset + rangeSize)
+                        continue;
+
+                    slab.freeRanges.erase(it);
+                    if (offset > rangeOffset)
+                        slab.freeRanges[rangeOffset] = offset - rangeOffset;
+                    if (offset + size < rangeOffset + rangeSize)
+                        slab.freeRanges[offset + size] = rangeOffset + rangeSize - (offset + size);
+                    slab.numFreeBytes -= size;
+                    m_numUsedBytes += size;
+
+                    return slab.base + offset;
+                }
+            }
+
+            // JP: スラブより大きな要求には専用のスラブを割り当てる。
+            // EN: Allocate a dedicated slab for a request larger than the slab size.
+            addSlab(std::max(m_slabSize, alignUp(size + alignment - m_alignment, m_alignment)));
+        }
+
+        CUDAUAssert_ShouldNotBeCalled();
+        return 0;
+    }
+
+    void MemoryArena::deallocate(CUdeviceptr ptr, size_t size) {
+        if (!m_initialized)
+            throw std::runtime_error("MemoryArena is not initialized.");
+
+        size = alignUp(std::max<size_t>(size, 1), m_alignment);
+
+        for (Slab &slab : m_slabs) {
+            if (ptr < slab.base || ptr >= slab.base + slab.size)
+                continue;
+
+            slab.numFreeBytes += size;
+            m_numUsedBytes -= size;
+
+            size_t offset = ptr - slab.base;
+            size_t rangeSize = size;
+            auto next = slab.freeRanges.lower_bound(offset);
+            // JP: 後ろの空き範囲と結合する。
+            // EN: Merge with the following free range.
+            if (next != slab.freeRanges.end() && next->first == offset + rangeSize) {
+                rangeSize += next->second;
+                next = slab.freeRanges.erase(next);
+            }
+            // JP: 前の空き範囲と結合する。
+            // EN: Merge with the preceding free range.
+            if (next != slab.freeRanges.begin()) {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second == offset) {
+                    prev->second += rangeSize;
+                    return;
+                }
+            }
+            slab.freeRanges[offset] = rangeSize;
+            return;
+        }
+
+        throw std::runtime_error("Given pointer does not belong to this arena.");
+    }
+
+    void MemoryArena::trim() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (auto it = m_slabs.begin(); it != m_slabs.end();) {
+            if (it->numFreeBytes == it->size) {
+                CUDADRV_CHECK(cuMemFree(it->base));
+                it = m_slabs.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+
+
+    StreamOrderedMemoryPool::StreamOrderedMemoryPool() :
+        m_cuContext(nullptr), m_memPool(nullptr), m_releaseThreshold(0),
+        m_maxCachedBytes(0), m_numCachedBytes(0), m_numAllocatedBytes(0),
+        m_initialized(false) {
+    }
+
+    StreamOrderedMemoryPool::~StreamOrderedMemoryPool() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void StreamOrderedMemoryPool::initialize(CUcontext context, uint64_t releaseThreshold, size_t maxCachedBytes) {
+        if (m_initialized)
+            throw std::runtime_error("StreamOrderedMemoryPool is already initialized.");
+
+        m_cuContext = context;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUdevice device;
+        int32_t memPoolsSupported;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(&memPoolsSupported, CU_DEVICE_ATTRIBUTE_MEMORY_POOLS_SUPPORTED, device));
+        if (!memPoolsSupported)
+            throw std::runtime_error("Stream-ordered memory allocator is not supported on this device.");
+
+        CUmemPoolProps props = {};
+        props.allocType = CU_MEM_ALLOCATION_TYPE_PINNED;
+        props.handleTypes = CU_MEM_HANDLE_TYPE_NONE;
+        props.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        props.location.id = device;
+        CUDADRV_CHECK(cuMemPoolCreate(&m_memPool, &props));
+
+        m_maxCachedBytes = maxCachedBytes;
+        m_numCachedBytes = 0;
+        m_numAllocatedBytes = 0;
+
+        m_initialized = true;
+
+        setReleaseThreshold(releaseThreshold);
+    }
+
+    void StreamOrderedMemoryPool::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (auto &kv : m_cache) {
+            for (const CachedBlock &block : kv.second) {
+                CUDADRV_CHECK(cuEventSynchronize(block.fence));
+                CUDADRV_CHECK(cuMemFreeAsync(block.pointer, 0));
+                CUDADRV_CHECK(cuEventDestroy(block.fence));
+            }
+        }
+        m_cache.clear();
+        for (CUevent fence : m_freeFences)
+            CUDADRV_CHECK(cuEventDestroy(fence));
+        m_freeFences.clear();
+
+        // JP: 破棄時に未完了の解放があってもドライバーが完了後にリソースを解放する。
+        // EN: The driver releases the resources after completion even if frees are pending at destruction.
+        CUDADRV_CHECK(cuMemPoolDestroy(m_memPool));
+        m_memPool = nullptr;
+        m_numCachedBytes = 0;
+        m_numAllocatedBytes = 0;
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    void StreamOrderedMemoryPool::setReleaseThreshold(uint64_t releaseThreshold) {
+        if (!m_initialized)
+            throw std::runtime_error("StreamOrderedMemoryPool is not initialized.");
+
+        m_releaseThreshold = releaseThreshold;
+        cuuint64_t threshold = m_releaseThreshold;
+        CUDADRV_CHECK(cuMemPoolSetAttribute(m_memPool, CU_MEMPOOL_ATTR_RELEASE_THRESHOLD, &threshold));
+    }
+
+    CUevent StreamOrderedMemoryPool::getFence() {
+        CUevent fence;
+        if (m_freeFences.empty()) {
+            CUDADRV_CHECK(cuEventCreate(&fence, CU_EVENT_DISABLE_TIMING));
+        }
+        else {
+            fence = m_freeFences.back();
+            m_freeFences.pop_back();
+        }
+        return fence;
+    }
+
+    CUdeviceptr StreamOrderedMemoryPool::allocate(size_t size, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("StreamOrderedMemoryPool is not initialized.");
+
+        size_t sizeClass = calcSizeClass(size);
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        auto it = m_cache.find(sizeClass);
+        if (it != m_cache.end() && !it->second.empty()) {
+            CachedBlock block = it->second.back();
+            it->second.pop_back();
+            // JP: 解放したストリーム上の処理が終わるまで割り当て側のストリームを待たせる。
+            //     イベントの状態は呼び出し時点で取り込まれるので、イベントはすぐに再利用できる。
+            // EN: Make the allocating stream wait for work on the freeing stream to finish.
+            //     The event state is captured at the call, so the event can be reused immediately.
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, block.fence, 0));
+            m_freeFences.push_back(block.fence);
+            m_numCachedBytes -= sizeClass;
+            return block.pointer;
+        }
+
+        CUdeviceptr ptr;
+        CUDADRV_CHECK(cuMemAllocFromPoolAsync(&ptr, sizeClass, m_memPool, stream));
+        m_numAllocatedBytes += sizeClass;
+
+        return ptr;
+    }
+
+    void StreamOrderedMemoryPool::deallocate(CUdeviceptr ptr, size_t size, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("StreamOrderedMemoryPool is not initialized.");
+
+        size_t sizeClass = calcSizeClass(size);
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        if (m_numCachedBytes + sizeClass <= m_maxCachedBytes) {
+            CachedBlock block;
+            block.pointer = ptr;
+            block.fence = getFence();
+            CUDADRV_CHECK(cuEventRecord(block.fence, stream));
+            m_cache[sizeClass].push_back(block);
+            m_numCachedBytes += sizeClass;
+            return;
+        }
+
+        CUDADRV_CHECK(cuMemFreeAsync(ptr, stream));
+        m_numAllocatedBytes -= sizeClass;
+    }
+
+    void StreamOrderedMemoryPool::trim(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("StreamOrderedMemoryPool is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (auto &kv : m_cache) {
+            for (const CachedBlock &block : kv.second) {
+                CUDADRV_CHECK(cuStreamWaitEvent(stream, block.fence, 0));
+                CUDADRV_CHECK(cuMemFreeAsync(block.pointer, stream));
+                m_freeFences.push_back(block.fence);
+                m_numAllocatedBytes -= kv.first;
+            }
+        }
+        m_cache.clear();
+        m_numCachedBytes = 0;
+
+        // JP: ストリーム上で未完了の解放分はこの時点では縮められない。
+        // EN: Frees not yet completed on the stream can't be trimmed at this point.
+        CUDADRV_CHECK(cuMemPoolTrimTo(m_memPool, m_releaseThreshold));
+    }
+
+
+
+    HostStagingPool::HostStagingPool() :
+        m_cuContext(nullptr), m_numAllocatedBytes(0),
+        m_initialized(false) {
+    }
+
+    HostStagingPool::~HostStagingPool() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void HostStagingPool::initialize(CUcontext context) {
+        if (m_initialized)
+            throw std::runtime_error("HostStagingPool is already initialized.");
+
+        m_cuContext = context;
+        m_numAllocatedBytes = 0;
+
+        m_initialized = true;
+    }
+
+    void HostStagingPool::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_blocks.size()) - 1; i >= 0; --i) {
+            Block &block = m_blocks[i];
+            CUDADRV_CHECK(cuEventSynchronize(block.fence));
+            CUDADRV_CHECK(cuEventDestroy(block.fence));
+            CUDADRV_CHECK(cuMemFreeHost(block.pointer));
+        }
+        m_blocks.clear();
+        m_numAllocatedBytes = 0;
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    uint32_t HostStagingPool::allocate(size_t size, bool writeCombined, void** pointer) {
+        if (!m_initialized)
+            throw std::runtime_error("HostStagingPool is not initialized.");
+
+        // JP: サイズを2のべき乗に切り上げて同じサイズクラスのブロックを再利用しやすくする。
+        // EN: Round the size up to a power of two to make blocks in the same size class easy to reuse.
+        size_t blockSize = 4096;
+        while (blockSize < size)
+            blockSize <<= 1;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (uint32_t i = 0; i < static_cast<uint32_t>(m_blocks.size()); ++i) {
+            Block &block = m_blocks[i];
+            if (block.inUse || block.size != blockSize || block.writeCombined != writeCombined)
+                continue;
+            CUresult res = cuEventQuery(block.fence);
+            if (res == CUDA_ERROR_NOT_READY)
+                continue;
+            CUDADRV_CHECK(res);
+
+            block.inUse = true;
+            *pointer = block.pointer;
+            return i;
+        }
+
+        Block block;
+        block.size = blockSize;
+        block.writeCombined = writeCombined;
+        block.inUse = true;
+        CUDADRV_CHECK(cuMemHostAlloc(reinterpret_cast<void**>(&block.pointer), block.size,
+                                     CU_MEMHOSTALLOC_PORTABLE | (writeCombined ? CU_MEMHOSTALLOC_WRITECOMBINED : 0)));
+        CUDADRV_CHECK(cuEventCreate(&block.fence, CU_EVENT_DISABLE_TIMING));
+        m_blocks.push_back(block);
+        m_numAllocatedBytes += block.size;
+
+        *pointer = block.pointer;
+        return static_cast<uint32_t>(m_blocks.size() - 1);
+    }
+
+    void HostStagingPool::record(uint32_t blockIndex, CUstream stream) {
+        if (blockIndex >= m_blocks.size() || !m_blocks[blockIndex].inUse)
+            throw std::runtime_error("Invalid staging block.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUDADRV_CHECK(cuEventRecord(m_blocks[blockIndex].fence, stream));
+    }
+
+    void HostStagingPool::release(uint32_t blockIndex, CUstream stream) {
+        record(blockIndex, stream);
+        m_blocks[blockIndex].inUse = false;
+    }
+
+    void HostStagingPool::wait(uint32_t blockIndex) const {
+        if (blockIndex >= m_blocks.size())
+            throw std::runtime_error("Invalid staging block.");
+
+        CUDADRV_CHECK(cuEventSynchronize(m_blocks[blockIndex].fence));
+    }
+
+
+
+    // JP: GL相互運用バッファーのメモリーはOpenGLが、ゼロコピーバッファーのメモリーはホストにあるので集計しない。
+    // EN: Don't account GL-interop buffers whose memory is owned by OpenGL
+    //     and zero-copy buffers whose memory resides on the host.
+    static inline bool isAccountedBufferType(BufferType type) {
+        return type == BufferType::Device || type == BufferType::Managed;
+    }
+
     Buffer::Buffer() :
-        m_cuContext(nullptr),
+        m_cuContext(nullptr), m_arena(nullptr), m_memoryPool(nullptr), m_allocationStream(0), m_stagingPool(nullptr),
+        m_memoryCategory(MemoryCategory::User),
         m_hostPointer(nullptr), m_devicePointer(0), m_mappedPointer(nullptr),
         m_GLBufferID(0), m_cudaGfxResource(nullptr),
-        m_initialized(false), m_persistentMappedMemory(false), m_mapped(false) {
+        m_mappedRangeOffset(0), m_mappedRangeSize(0), m_mappedRangePointer(nullptr),
+        m_stagingBlockIndex(HostStagingPool::InvalidBlockIndex), m_mapFlags(MapFlags::ReadWrite),
+        m_reservedSizeInBytes(0), m_allocationGranularity(0),
+        m_device(0),
+        m_initialized(false), m_persistentMappedMemory(false), m_mapped(false), m_rangeMapped(false),
+        m_stableAddress(false), m_concurrentManagedAccess(false) {
     }
 
     Buffer::~Buffer() {
@@ -64,16 +1273,34 @@ namespace cudau {
     Buffer::Buffer(Buffer &&b) {
         m_cuContext = b.m_cuContext;
         m_type = b.m_type;
+        m_arena = b.m_arena;
+        m_memoryPool = b.m_memoryPool;
+        m_allocationStream = b.m_allocationStream;
+        m_stagingPool = b.m_stagingPool;
+        m_memoryCategory = b.m_memoryCategory;
         m_numElements = b.m_numElements;
         m_stride = b.m_stride;
+        m_capacityInBytes = b.m_capacityInBytes;
         m_hostPointer = b.m_hostPointer;
         m_devicePointer = b.m_devicePointer;
         m_mappedPointer = b.m_mappedPointer;
         m_GLBufferID = b.m_GLBufferID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_mappedRangeOffset = b.m_mappedRangeOffset;
+        m_mappedRangeSize = b.m_mappedRangeSize;
+        m_mappedRangePointer = b.m_mappedRangePointer;
+        m_stagingBlockIndex = b.m_stagingBlockIndex;
+        m_mapFlags = b.m_mapFlags;
+        m_reservedSizeInBytes = b.m_reservedSizeInBytes;
+        m_allocationGranularity = b.m_allocationGranularity;
+        m_physicalChunks = std::move(b.m_physicalChunks);
+        m_device = b.m_device;
         m_initialized = b.m_initialized;
         m_persistentMappedMemory = b.m_persistentMappedMemory;
         m_mapped = b.m_mapped;
+        m_rangeMapped = b.m_rangeMapped;
+        m_stableAddress = b.m_stableAddress;
+        m_concurrentManagedAccess = b.m_concurrentManagedAccess;
 
         b.m_initialized = false;
     }
@@ -83,71 +1310,236 @@ namespace cudau {
 
         m_cuContext = b.m_cuContext;
         m_type = b.m_type;
+        m_arena = b.m_arena;
+        m_memoryPool = b.m_memoryPool;
+        m_allocationStream = b.m_allocationStream;
+        m_stagingPool = b.m_stagingPool;
+        m_memoryCategory = b.m_memoryCategory;
         m_numElements = b.m_numElements;
         m_stride = b.m_stride;
+        m_capacityInBytes = b.m_capacityInBytes;
         m_hostPointer = b.m_hostPointer;
         m_devicePointer = b.m_devicePointer;
         m_mappedPointer = b.m_mappedPointer;
         m_GLBufferID = b.m_GLBufferID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_mappedRangeOffset = b.m_mappedRangeOffset;
+        m_mappedRangeSize = b.m_mappedRangeSize;
+        m_mappedRangePointer = b.m_mappedRangePointer;
+        m_stagingBlockIndex = b.m_stagingBlockIndex;
+        m_mapFlags = b.m_mapFlags;
+        m_reservedSizeInBytes = b.m_reservedSizeInBytes;
+        m_allocationGranularity = b.m_allocationGranularity;
+        m_physicalChunks = std::move(b.m_physicalChunks);
+        m_device = b.m_device;
         m_initialized = b.m_initialized;
         m_persistentMappedMemory = b.m_persistentMappedMemory;
         m_mapped = b.m_mapped;
+        m_rangeMapped = b.m_rangeMapped;
+        m_stableAddress = b.m_stableAddress;
+        m_concurrentManagedAccess = b.m_concurrentManagedAccess;
+
+        b.m_initialized = false;
+
+        return *this;
+    }
+    
+    void Buffer::initialize(CUcontext context, BufferType type,
+                            size_t numElements, uint32_t stride, uint32_t glBufferID) {
+        if (m_initialized)
+            throw std::runtime_error("Buffer is already initialized.");
+
+        m_cuContext = context;
+        m_type = type;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // If using GL Interop, expect that the active device is also the display device.
+        if (m_type == BufferType::GL_Interop) {
+            CUdevice currentDevice;
+            int32_t isDisplayDevice;
+            CUDADRV_CHECK(cuCtxGetDevice(&currentDevice));
+            CUDADRV_CHECK(cuDeviceGetAttribute(&isDisplayDevice, CU_DEVICE_ATTRIBUTE_KERNEL_EXEC_TIMEOUT, currentDevice));
+            if (!isDisplayDevice)
+                throw std::runtime_error("GL Interop is only available on the display device.");
+        }
+
+        m_numElements = numElements;
+        m_stride = stride;
+
+        m_GLBufferID = glBufferID;
+
+        size_t size = m_numElements * m_stride;
+        m_capacityInBytes = size;
+
+        if (m_type == BufferType::Device) {
+            CUDADRV_CHECK(cuMemAlloc(&m_devicePointer, size));
+        }
+        else  if (m_type == BufferType::GL_Interop) {
+#if defined(CUDA_UTIL_USE_GL_INTEROP)
+            CUDADRV_CHECK(cuGraphicsGLRegisterBuffer(&m_cudaGfxResource, m_GLBufferID, CU_GRAPHICS_REGISTER_FLAGS_NONE));
+#else
+            throw std::runtime_error("Enable \"CUDA_UTIL_USE_GL_INTEROP\" at the top of the header if you use CUDA/OpenGL interoperability.");
+#endif
+        }
+        else if (m_type == BufferType::ZeroCopy) {
+            CUDADRV_CHECK(cuMemHostAlloc(&m_hostPointer, size, CU_MEMHOSTALLOC_PORTABLE | CU_MEMHOSTALLOC_DEVICEMAP));
+            CUDADRV_CHECK(cuMemHostGetDevicePointer(&m_devicePointer, m_hostPointer, 0));
+        }
+        else { // m_type == BufferType::Managed
+            CUDADRV_CHECK(cuMemAllocManaged(&m_devicePointer, size, CU_MEM_ATTACH_GLOBAL));
+            m_hostPointer = reinterpret_cast<void*>(m_devicePointer);
+            queryManagedAccessSupport();
+        }
+        if (isAccountedBufferType(m_type))
+            recordMemoryAllocation(m_cuContext, m_memoryCategory, m_capacityInBytes);
+
+        m_initialized = true;
+    }
+
+    void Buffer::initialize(MemoryArena* arena, size_t numElements, uint32_t stride) {
+        if (m_initialized)
+            throw std::runtime_error("Buffer is already initialized.");
+        if (!arena || !arena->isInitialized())
+            throw std::runtime_error("Memory arena is not initialized.");
+
+        m_cuContext = arena->getCUcontext();
+        m_type = arena->getBufferType();
+        m_arena = arena;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        m_numElements = numElements;
+        m_stride = stride;
+
+        m_GLBufferID = 0;
+
+        size_t size = m_numElements * m_stride;
+        m_capacityInBytes = size;
+        m_devicePointer = m_arena->allocate(size);
+        if (m_type == BufferType::Managed) {
+            m_hostPointer = reinterpret_cast<void*>(m_devicePointer);
+            queryManagedAccessSupport();
+        }
+        if (isAccountedBufferType(m_type))
+            recordMemoryAllocation(m_cuContext, m_memoryCategory, m_capacityInBytes);
+
+        m_initialized = true;
+    }
+
+    void Buffer::initialize(StreamOrderedMemoryPool* pool, size_t numElements, uint32_t stride, CUstream stream) {
+        if (m_initialized)
+            throw std::runtime_error("Buffer is already initialized.");
+        if (!pool || !pool->isInitialized())
+            throw std::runtime_error("Memory pool is not initialized.");
+
+        m_cuContext = pool->getCUcontext();
+        m_type = BufferType::Device;
+        m_memoryPool = pool;
+        m_allocationStream = stream;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
-        b.m_initialized = false;
+        m_numElements = numElements;
+        m_stride = stride;
 
-        return *this;
+        m_GLBufferID = 0;
+
+        // JP: サイズクラスの余りも容量として使う。
+        // EN: Use the slack of the size class as capacity as well.
+        m_capacityInBytes = StreamOrderedMemoryPool::calcSizeClass(m_numElements * m_stride);
+        m_devicePointer = m_memoryPool->allocate(m_capacityInBytes, m_allocationStream);
+        recordMemoryAllocation(m_cuContext, m_memoryCategory, m_capacityInBytes);
+
+        m_initialized = true;
     }
-    
-    void Buffer::initialize(CUcontext context, BufferType type,
-                            uint32_t numElements, uint32_t stride, uint32_t glBufferID) {
+
+    void Buffer::initializeStableAddress(CUcontext context, size_t numElements, uint32_t stride, size_t maxNumElements) {
         if (m_initialized)
             throw std::runtime_error("Buffer is already initialized.");
+        if (numElements > maxNumElements)
+            throw std::runtime_error("numElements must be <= maxNumElements.");
 
         m_cuContext = context;
-        m_type = type;
+        m_type = BufferType::Device;
 
         CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
-        // If using GL Interop, expect that the active device is also the display device.
-        if (m_type == BufferType::GL_Interop) {
-            CUdevice currentDevice;
-            int32_t isDisplayDevice;
-            CUDADRV_CHECK(cuCtxGetDevice(&currentDevice));
-            CUDADRV_CHECK(cuDeviceGetAttribute(&isDisplayDevice, CU_DEVICE_ATTRIBUTE_KERNEL_EXEC_TIMEOUT, currentDevice));
-            if (!isDisplayDevice)
-                throw std::runtime_error("GL Interop is only available on the display device.");
-        }
+        CUdevice device;
+        int32_t vmmSupported;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(&vmmSupported, CU_DEVICE_ATTRIBUTE_VIRTUAL_MEMORY_MANAGEMENT_SUPPORTED, device));
+        if (!vmmSupported)
+            throw std::runtime_error("Virtual memory management is not supported on this device.");
+
+        CUmemAllocationProp prop = {};
+        prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+        prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        prop.location.id = device;
+        CUDADRV_CHECK(cuMemGetAllocationGranularity(&m_allocationGranularity, &prop, CU_MEM_ALLOC_GRANULARITY_RECOMMENDED));
 
         m_numElements = numElements;
         m_stride = stride;
 
-        m_GLBufferID = glBufferID;
+        m_GLBufferID = 0;
 
-        size_t size = static_cast<size_t>(m_numElements) * m_stride;
+        m_reservedSizeInBytes = alignUp(std::max<size_t>(maxNumElements * m_stride, 1), m_allocationGranularity);
+        CUDADRV_CHECK(cuMemAddressReserve(&m_devicePointer, m_reservedSizeInBytes, 0, 0, 0));
+        m_stableAddress = true;
 
-        if (m_type == BufferType::Device) {
-            CUDADRV_CHECK(cuMemAlloc(&m_devicePointer, size));
-        }
-        else  if (m_type == BufferType::GL_Interop) {
-#if defined(CUDA_UTIL_USE_GL_INTEROP)
-            CUDADRV_CHECK(cuGraphicsGLRegisterBuffer(&m_cudaGfxResource, m_GLBufferID, CU_GRAPHICS_REGISTER_FLAGS_NONE));
-#else
-            throw std::runtime_error("Enable \"CUDA_UTIL_USE_GL_INTEROP\" at the top of the header if you use CUDA/OpenGL interoperability.");
-#endif
-        }
-        else if (m_type == BufferType::ZeroCopy) {
-            CUDADRV_CHECK(cuMemHostAlloc(&m_hostPointer, size, CU_MEMHOSTALLOC_PORTABLE | CU_MEMHOSTALLOC_DEVICEMAP));
-            CUDADRV_CHECK(cuMemHostGetDevicePointer(&m_devicePointer, m_hostPointer, 0));
-        }
-        else { // m_type == BufferType::Managed
-            CUDADRV_CHECK(cuMemAllocManaged(&m_devicePointer, size, CU_MEM_ATTACH_GLOBAL));
-            m_hostPointer = reinterpret_cast<void*>(m_devicePointer);
-        }
+        m_capacityInBytes = alignUp(m_numElements * m_stride, m_allocationGranularity);
+        if (m_capacityInBytes > 0)
+            mapPhysicalMemory(0, m_capacityInBytes);
+        recordMemoryAllocation(m_cuContext, m_memoryCategory, m_capacityInBytes);
 
         m_initialized = true;
     }
 
+    void Buffer::mapPhysicalMemory(size_t offset, size_t size) {
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+
+        CUmemAllocationProp prop = {};
+        prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+        prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        prop.location.id = device;
+
+        PhysicalChunk chunk;
+        chunk.size = size;
+        CUDADRV_CHECK(cuMemCreate(&chunk.handle, chunk.size, &prop, 0));
+        CUDADRV_CHECK(cuMemMap(m_devicePointer + offset, chunk.size, 0, chunk.handle, 0));
+        m_physicalChunks.push_back(chunk);
+
+        CUmemAccessDesc accessDesc = {};
+        accessDesc.location = prop.location;
+        accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+        CUDADRV_CHECK(cuMemSetAccess(m_devicePointer + offset, chunk.size, &accessDesc, 1));
+    }
+
+    void Buffer::growStableAddressRange(size_t sizeInBytes) {
+        if (sizeInBytes <= m_capacityInBytes)
+            return;
+        if (sizeInBytes > m_reservedSizeInBytes)
+            throw std::runtime_error("Requested size exceeds the reserved address range.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: 物理メモリーの断片数を抑えるために容量を幾何級数的に増やす。
+        // EN: Grow the capacity geometrically to keep the number of physical chunks small.
+        size_t grownCapacity = m_capacityInBytes + m_capacityInBytes / 2;
+        size_t newCapacity = std::min(alignUp(std::max(sizeInBytes, grownCapacity), m_allocationGranularity),
+                                      m_reservedSizeInBytes);
+        mapPhysicalMemory(m_capacityInBytes, newCapacity - m_capacityInBytes);
+        recordMemoryRelease(m_cuContext, m_memoryCategory, m_capacityInBytes);
+        recordMemoryAllocation(m_cuContext, m_memoryCategory, newCapacity);
+        m_capacityInBytes = newCapacity;
+
+        if (m_persistentMappedMemory) {
+            delete[] m_mappedPointer;
+            m_mappedPointer = new uint8_t[m_capacityInBytes];
+        }
+    }
+
     void Buffer::finalize() {
         if (!m_initialized)
             return;
@@ -163,7 +1555,36 @@ namespace cudau {
         m_mappedPointer = nullptr;
         m_persistentMappedMemory = false;
 
-        if (m_type == BufferType::Device) {
+        if (isAccountedBufferType(m_type))
+            recordMemoryRelease(m_cuContext, m_memoryCategory, m_capacityInBytes);
+
+        if (m_arena) {
+            m_arena->deallocate(m_devicePointer, m_capacityInBytes);
+            m_devicePointer = 0;
+            m_hostPointer = nullptr;
+            m_arena = nullptr;
+        }
+        else if (m_memoryPool) {
+            m_memoryPool->deallocate(m_devicePointer, m_capacityInBytes, m_allocationStream);
+            m_devicePointer = 0;
+            m_memoryPool = nullptr;
+            m_allocationStream = 0;
+        }
+        else if (m_stableAddress) {
+            // JP: cuMemFree()と異なりアンマップは実行中の処理を待たないので明示的に同期する。
+            // EN: Unlike cuMemFree(), unmapping doesn't wait for in-flight work, so synchronize explicitly.
+            CUDADRV_CHECK(cuCtxSynchronize());
+            if (m_capacityInBytes > 0)
+                CUDADRV_CHECK(cuMemUnmap(m_devicePointer, m_capacityInBytes));
+            for (const PhysicalChunk &chunk : m_physicalChunks)
+                CUDADRV_CHECK(cuMemRelease(chunk.handle));
+            m_physicalChunks.clear();
+            CUDADRV_CHECK(cuMemAddressFree(m_devicePointer, m_reservedSizeInBytes));
+            m_devicePointer = 0;
+            m_reservedSizeInBytes = 0;
+            m_stableAddress = false;
+        }
+        else if (m_type == BufferType::Device) {
             CUDADRV_CHECK(cuMemFree(m_devicePointer));
             m_devicePointer = 0;
         }
@@ -184,46 +1605,196 @@ namespace cudau {
 
         m_stride = 0;
         m_numElements = 0;
+        m_capacityInBytes = 0;
 
         m_cuContext = nullptr;
 
         m_initialized = false;
     }
 
-    void Buffer::resize(uint32_t numElements, uint32_t stride, CUstream stream) {
+    void Buffer::resize(size_t numElements, uint32_t stride, ResizeMode mode, CUstream stream) {
         if (!m_initialized)
             throw std::runtime_error("Buffer is not initialized.");
         if (m_type == BufferType::GL_Interop)
             throw std::runtime_error("Resize for GL-interop buffer is not supported.");
         if (stride < m_stride)
             throw std::runtime_error("New stride must be >= the current stride.");
+        if (m_mapped)
+            throw std::runtime_error("Resizing a mapped buffer is not supported.");
 
         if (numElements == m_numElements && stride == m_stride)
             return;
 
-        Buffer newBuffer;
-        newBuffer.initialize(m_cuContext, m_type, numElements, stride, m_GLBufferID);
-        newBuffer.setMappedMemoryPersistent(m_persistentMappedMemory);
+        // JP: ストライドが変わらず容量に収まる場合は要素数を変えるだけで良い。
+        // EN: Just changing the number of elements is enough when the stride is unchanged
+        //     and the new size fits in the capacity.
+        size_t newSize = numElements * stride;
+        if (stride == m_stride && newSize <= m_capacityInBytes) {
+            m_numElements = numElements;
+            return;
+        }
 
-        uint32_t numElementsToCopy = std::min(m_numElements, numElements);
+        // JP: 予約済みのアドレス範囲に物理メモリーを追加するだけなのでコピーは不要。
+        // EN: No copy is required since this just adds physical memory to the reserved address range.
+        if (m_stableAddress) {
+            if (stride != m_stride)
+                throw std::runtime_error("Changing the stride of a stable-address buffer is not supported.");
+            growStableAddressRange(newSize);
+            m_numElements = numElements;
+            return;
+        }
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        size_t numReservedElements = numElements;
         if (stride == m_stride) {
-            size_t numBytesToCopy = static_cast<size_t>(numElementsToCopy) * m_stride;
-            CUDADRV_CHECK(cuMemcpyDtoD(newBuffer.m_devicePointer, m_devicePointer, numBytesToCopy));
+            size_t grownCapacity = m_capacityInBytes + m_capacityInBytes / 2;
+            numReservedElements = std::max(newSize, grownCapacity) / stride;
         }
-        else {
-            auto src = map<const uint8_t>(stream);
-            auto dst = newBuffer.map<uint8_t>(stream);
-            for (int i = 0; i < numElementsToCopy; ++i) {
-                std::memset(dst, 0, stride);
-                std::memcpy(dst, src, m_stride);
+
+        Buffer newBuffer;
+        newBuffer.m_memoryCategory = m_memoryCategory;
+        if (m_arena)
+            newBuffer.initialize(m_arena, numReservedElements, stride);
+        else if (m_memoryPool)
+            newBuffer.initialize(m_memoryPool, numReservedElements, stride, stream);
+        else
+            newBuffer.initialize(m_cuContext, m_type, numReservedElements, stride, m_GLBufferID);
+        newBuffer.m_numElements = numElements;
+        newBuffer.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        if (mode == ResizeMode::Preserve) {
+            size_t numElementsToCopy = std::min(m_numElements, numElements);
+            if (stride == m_stride) {
+                size_t numBytesToCopy = numElementsToCopy * m_stride;
+                CUDADRV_CHECK(cuMemcpyDtoDAsync(newBuffer.m_devicePointer, m_devicePointer, numBytesToCopy, stream));
+            }
+            else {
+                // JP: 各要素の先頭に以前の内容を、残りをゼロで埋める。
+                // EN: Copy the previous contents to the head of each element and fill the rest with zeros.
+                CUDA_MEMCPY2D params = {};
+                params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.srcDevice = m_devicePointer;
+                params.srcPitch = m_stride;
+                params.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.dstDevice = newBuffer.m_devicePointer;
+                params.dstPitch = stride;
+                params.WidthInBytes = m_stride;
+                params.Height = numElementsToCopy;
+                CUDADRV_CHECK(cuMemsetD8Async(newBuffer.m_devicePointer, 0, newSize, stream));
+                if (numElementsToCopy > 0)
+                    CUDADRV_CHECK(cuMemcpy2DAsync(&params, stream));
             }
-            newBuffer.unmap(stream);
-            unmap(stream);
+
+            // JP: アリーナの範囲は即座に再利用されうるので、コピーの完了を待ってから返却する。
+            //     cuMemFree()は暗黙的に同期するため通常のバッファーでは待つ必要はない。
+            // EN: A range of an arena can be reused immediately, so wait for the copy to finish before returning it.
+            //     cuMemFree() implicitly synchronizes so that a regular buffer doesn't need to wait.
+            if (m_arena)
+                CUDADRV_CHECK(cuStreamSynchronize(stream));
+        }
+
+        // JP: プールの範囲はコピーと同じストリームで解放すれば順序が保証される。
+        // EN: Freeing the pool range on the same stream as the copy guarantees the ordering.
+        if (m_memoryPool)
+            m_allocationStream = stream;
+
+        *this = std::move(newBuffer);
+    }
+
+    void Buffer::reserve(size_t numElements, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Buffer is not initialized.");
+        if (m_type == BufferType::GL_Interop)
+            throw std::runtime_error("Reserve for GL-interop buffer is not supported.");
+        if (m_mapped)
+            throw std::runtime_error("Reserving a mapped buffer is not supported.");
+
+        if (numElements * m_stride <= m_capacityInBytes)
+            return;
+
+        if (m_stableAddress) {
+            growStableAddressRange(numElements * m_stride);
+            return;
         }
 
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Buffer newBuffer;
+        newBuffer.m_memoryCategory = m_memoryCategory;
+        if (m_arena)
+            newBuffer.initialize(m_arena, numElements, m_stride);
+        else if (m_memoryPool)
+            newBuffer.initialize(m_memoryPool, numElements, m_stride, stream);
+        else
+            newBuffer.initialize(m_cuContext, m_type, numElements, m_stride, m_GLBufferID);
+        newBuffer.m_numElements = m_numElements;
+        newBuffer.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        size_t numBytesToCopy = m_numElements * m_stride;
+        CUDADRV_CHECK(cuMemcpyDtoDAsync(newBuffer.m_devicePointer, m_devicePointer, numBytesToCopy, stream));
+        if (m_arena)
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+        if (m_memoryPool)
+            m_allocationStream = stream;
+
         *this = std::move(newBuffer);
     }
 
+    void Buffer::queryManagedAccessSupport() {
+        int32_t supported;
+        CUDADRV_CHECK(cuCtxGetDevice(&m_device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(&supported, CU_DEVICE_ATTRIBUTE_CONCURRENT_MANAGED_ACCESS, m_device));
+        m_concurrentManagedAccess = supported != 0;
+    }
+
+    void Buffer::prefetch(CUstream stream, ManagedMemoryLocation location) const {
+        if (!m_initialized)
+            throw std::runtime_error("Buffer is not initialized.");
+        if (m_type != BufferType::Managed)
+            throw std::runtime_error("Prefetch is supported only for managed buffers.");
+
+        // JP: ページはドライバーによる追い出しやホストからの書き込みで移動しうるので、毎回プリフェッチを発行する。
+        // EN: Pages can move by eviction by the driver or host writes, so always issue the prefetch.
+        if (!m_concurrentManagedAccess || sizeInBytes() == 0)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUdevice dstDevice = location == ManagedMemoryLocation::Device ? m_device : CU_DEVICE_CPU;
+        CUDADRV_CHECK(cuMemPrefetchAsync(m_devicePointer, sizeInBytes(), dstDevice, stream));
+    }
+
+    void Buffer::advise(ManagedMemoryAdvice advice, ManagedMemoryLocation location, bool set) {
+        if (!m_initialized)
+            throw std::runtime_error("Buffer is not initialized.");
+        if (m_type != BufferType::Managed)
+            throw std::runtime_error("Memory advice is supported only for managed buffers.");
+
+        if (!m_concurrentManagedAccess || m_capacityInBytes == 0)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUmem_advise rawAdvice;
+        if (advice == ManagedMemoryAdvice::ReadMostly)
+            rawAdvice = set ? CU_MEM_ADVISE_SET_READ_MOSTLY : CU_MEM_ADVISE_UNSET_READ_MOSTLY;
+        else if (advice == ManagedMemoryAdvice::PreferredLocation)
+            rawAdvice = set ? CU_MEM_ADVISE_SET_PREFERRED_LOCATION : CU_MEM_ADVISE_UNSET_PREFERRED_LOCATION;
+        else // advice == ManagedMemoryAdvice::AccessedBy
+            rawAdvice = set ? CU_MEM_ADVISE_SET_ACCESSED_BY : CU_MEM_ADVISE_UNSET_ACCESSED_BY;
+        CUdevice dstDevice = location == ManagedMemoryLocation::Device ? m_device : CU_DEVICE_CPU;
+        CUDADRV_CHECK(cuMemAdvise(m_devicePointer, m_capacityInBytes, rawAdvice, dstDevice));
+    }
+
+    void Buffer::setMemoryCategory(MemoryCategory category) {
+        if (m_initialized && isAccountedBufferType(m_type)) {
+            recordMemoryRelease(m_cuContext, m_memoryCategory, m_capacityInBytes);
+            recordMemoryAllocation(m_cuContext, category, m_capacityInBytes);
+        }
+        m_memoryCategory = category;
+    }
+
     void Buffer::beginCUDAAccess(CUstream stream) {
         if (m_type != BufferType::GL_Interop)
             throw std::runtime_error("This is not an OpenGL-interop buffer.");
@@ -251,8 +1822,8 @@ namespace cudau {
 
         m_persistentMappedMemory = b;
         if (m_persistentMappedMemory && !m_mapped) {
-            size_t size = static_cast<size_t>(m_numElements) * m_stride;
-            m_mappedPointer = new uint8_t[size];
+            delete[] m_mappedPointer;
+            m_mappedPointer = new uint8_t[m_capacityInBytes];
         }
         if (!m_persistentMappedMemory && !m_mapped) {
             delete[] m_mappedPointer;
@@ -270,7 +1841,7 @@ namespace cudau {
             m_type == BufferType::GL_Interop) {
             CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
-            size_t size = static_cast<size_t>(m_numElements) * m_stride;
+            size_t size = m_numElements * m_stride;
             if (!m_persistentMappedMemory)
                 m_mappedPointer = new uint8_t[size];
 
@@ -286,49 +1857,406 @@ namespace cudau {
         }
     }
 
-    void Buffer::unmap(CUstream stream) {
-        if (!m_mapped)
-            throw std::runtime_error("This buffer is not mapped.");
+    void* Buffer::mapRange(size_t offset, size_t count, MapFlags flags, CUstream stream) {
+        if (m_mapped)
+            throw std::runtime_error("This buffer is already mapped.");
+        if (offset + count > m_numElements)
+            throw std::runtime_error("Specified range is out of bounds.");
+
+        m_mapped = true;
+        m_rangeMapped = true;
+        m_mapFlags = flags;
+        m_mappedRangeOffset = offset * m_stride;
+        m_mappedRangeSize = count * m_stride;
+
+        if (m_type == BufferType::Device ||
+            m_type == BufferType::GL_Interop) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            bool writeCombined = flags == MapFlags::WriteOnly;
+            if (m_stagingPool)
+                m_stagingBlockIndex = m_stagingPool->allocate(m_mappedRangeSize, writeCombined, &m_mappedRangePointer);
+            else
+                m_mappedRangePointer = new uint8_t[m_mappedRangeSize];
+
+            if (m_type == BufferType::GL_Interop)
+                beginCUDAAccess(stream);
+
+            if (flags == MapFlags::ReadWrite || flags == MapFlags::ReadOnly) {
+                CUDADRV_CHECK(cuMemcpyDtoHAsync(m_mappedRangePointer, m_devicePointer + m_mappedRangeOffset,
+                                                m_mappedRangeSize, stream));
+                // JP: ページロックされたメモリーへのコピーはホストに対して非同期なので完了を待つ。
+                // EN: Copy to page-locked memory is asynchronous to the host, so wait for it to complete.
+                if (m_stagingPool) {
+                    m_stagingPool->record(m_stagingBlockIndex, stream);
+                    m_stagingPool->wait(m_stagingBlockIndex);
+                }
+            }
+        }
+        else {
+            m_mappedRangePointer = reinterpret_cast<uint8_t*>(m_hostPointer) + m_mappedRangeOffset;
+        }
+
+        return m_mappedRangePointer;
+    }
+
+    void Buffer::unmap(CUstream stream) {
+        if (!m_mapped)
+            throw std::runtime_error("This buffer is not mapped.");
+
+        m_mapped = false;
+
+        if (m_rangeMapped) {
+            m_rangeMapped = false;
+            if (m_type == BufferType::Device ||
+                m_type == BufferType::GL_Interop) {
+                CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+                if (m_mapFlags != MapFlags::ReadOnly)
+                    CUDADRV_CHECK(cuMemcpyHtoDAsync(m_devicePointer + m_mappedRangeOffset, m_mappedRangePointer,
+                                                    m_mappedRangeSize, stream));
+
+                if (m_type == BufferType::GL_Interop)
+                    endCUDAAccess(stream);
+
+                // JP: ステージングブロックはコピー完了後にプールによって再利用される。
+                //     ヒープの場合cuMemcpyHtoDAsync()はソースを読み終えてから戻る。
+                // EN: The pool reuses the staging block after the copy completes.
+                //     For the heap, cuMemcpyHtoDAsync() returns after it finishes reading the source.
+                if (m_stagingPool) {
+                    m_stagingPool->release(m_stagingBlockIndex, stream);
+                    m_stagingBlockIndex = HostStagingPool::InvalidBlockIndex;
+                }
+                else {
+                    delete[] reinterpret_cast<uint8_t*>(m_mappedRangePointer);
+                }
+            }
+            m_mappedRangePointer = nullptr;
+            m_mappedRangeOffset = 0;
+            m_mappedRangeSize = 0;
+            return;
+        }
+
+        if (m_type == BufferType::Device ||
+            m_type == BufferType::GL_Interop) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            size_t size = m_numElements * m_stride;
+
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(m_devicePointer, m_mappedPointer, size, stream));
+
+            if (m_type == BufferType::GL_Interop)
+                endCUDAAccess(stream);
+
+            if (!m_persistentMappedMemory) {
+                delete[] m_mappedPointer;
+                m_mappedPointer = nullptr;
+            }
+        }
+    }
+
+    Buffer Buffer::copy() const {
+        if (m_GLBufferID != 0)
+            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+
+        Buffer ret;
+        if (m_arena)
+            ret.initialize(m_arena, m_numElements, m_stride);
+        else if (m_memoryPool)
+            ret.initialize(m_memoryPool, m_numElements, m_stride, m_allocationStream);
+        else if (m_stableAddress)
+            ret.initializeStableAddress(m_cuContext, m_numElements, m_stride, m_reservedSizeInBytes / m_stride);
+        else
+            ret.initialize(m_cuContext, m_type, m_numElements, m_stride, m_GLBufferID);
+        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        size_t size = m_numElements * m_stride;
+        if (m_type == BufferType::Device) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            // JP: プールからの確保はストリーム順序なので、コピー前に確保の完了を待つ。
+            // EN: Allocation from the pool is stream-ordered, so wait for it to complete before copying.
+            if (m_memoryPool)
+                CUDADRV_CHECK(cuStreamSynchronize(m_allocationStream));
+            CUDADRV_CHECK(cuMemcpyDtoD(ret.m_devicePointer, m_devicePointer, size));
+        }
+        else {
+            std::memcpy(ret.m_hostPointer, m_hostPointer, size);
+        }
+
+        return ret;
+    }
+
+    Buffer Buffer::copy(CUstream stream) const {
+        if (m_GLBufferID != 0)
+            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+
+        Buffer ret;
+        if (m_arena)
+            ret.initialize(m_arena, m_numElements, m_stride);
+        else if (m_memoryPool)
+            ret.initialize(m_memoryPool, m_numElements, m_stride, stream);
+        else if (m_stableAddress)
+            ret.initializeStableAddress(m_cuContext, m_numElements, m_stride, m_reservedSizeInBytes / m_stride);
+        else
+            ret.initialize(m_cuContext, m_type, m_numElements, m_stride, m_GLBufferID);
+        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: ZeroCopyやManagedのバッファーもデバイスポインターを持つのでデバイス間コピーで扱える。
+        // EN: ZeroCopy and Managed buffers also have device pointers, so a device-to-device copy handles them.
+        size_t size = m_numElements * m_stride;
+        if (size > 0)
+            CUDADRV_CHECK(cuMemcpyDtoDAsync(ret.m_devicePointer, m_devicePointer, size, stream));
+
+        return ret;
+    }
+
+
+
+    UploadBatcher::UploadBatcher() :
+        m_cuContext(nullptr), m_ring(nullptr), m_deviceRing(0), m_ringSize(0), m_scatterKernel(nullptr),
+        m_batchBegin(0), m_writeOffset(0), m_freeEnd(0), m_numPendingWrites(0),
+        m_lastFlushStats{}, m_totalStats{},
+        m_initialized(false) {
+    }
+
+    UploadBatcher::~UploadBatcher() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void UploadBatcher::initialize(CUcontext context, size_t ringSize) {
+        if (m_initialized)
+            throw std::runtime_error("UploadBatcher is already initialized.");
+        // JP: コマンドのオフセットとサイズは32bitで保持する。
+        // EN: Offsets and sizes in commands are held as 32-bit.
+        if (ringSize == 0 || ringSize > 0xFFFFFFF0)
+            throw std::runtime_error("Invalid ring buffer size.");
+
+        m_cuContext = context;
+        m_ringSize = alignUp(ringSize, UploadAlignment);
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuMemHostAlloc(reinterpret_cast<void**>(&m_ring), m_ringSize, CU_MEMHOSTALLOC_PORTABLE));
+
+        m_batchBegin = 0;
+        m_writeOffset = 0;
+        m_freeEnd = m_ringSize;
+        m_numPendingWrites = 0;
+        m_lastFlushStats = {};
+        m_totalStats = {};
+
+        m_initialized = true;
+    }
+
+    void UploadBatcher::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (const InFlightBatch &batch : m_inFlightBatches) {
+            CUDADRV_CHECK(cuEventSynchronize(batch.fence));
+            CUDADRV_CHECK(cuEventDestroy(batch.fence));
+        }
+        m_inFlightBatches.clear();
+        for (CUevent fence : m_freeFences)
+            CUDADRV_CHECK(cuEventDestroy(fence));
+        m_freeFences.clear();
+        m_commands.clear();
+
+        if (m_deviceRing)
+            CUDADRV_CHECK(cuMemFree(m_deviceRing));
+        m_deviceRing = 0;
+        m_scatterKernel = nullptr;
+        CUDADRV_CHECK(cuMemFreeHost(m_ring));
+        m_ring = nullptr;
+        m_ringSize = 0;
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    void UploadBatcher::setScatterKernel(CUmodule module, const char* name) {
+        if (!m_initialized)
+            throw std::runtime_error("UploadBatcher is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUDADRV_CHECK(cuModuleGetFunction(&m_scatterKernel, module, name));
+        // JP: デバイス側のリングはホスト側と同じオフセットを使うので、
+        //     ホスト側のフェンスがそのままデバイス側の再利用も守る。
+        // EN: The device-side ring uses the same offsets as the host side,
+        //     so the fences for the host side also guard reuse of the device side.
+        if (m_deviceRing == 0)
+            CUDADRV_CHECK(cuMemAlloc(&m_deviceRing, m_ringSize));
+    }
+
+    void UploadBatcher::retireBatches(size_t begin, size_t end) {
+        for (auto it = m_inFlightBatches.begin(); it != m_inFlightBatches.end();) {
+            if (it->begin < end && begin < it->end) {
+                CUDADRV_CHECK(cuEventSynchronize(it->fence));
+            }
+            else {
+                CUresult res = cuEventQuery(it->fence);
+                if (res == CUDA_ERROR_NOT_READY) {
+                    ++it;
+                    continue;
+                }
+                CUDADRV_CHECK(res);
+            }
+            m_freeFences.push_back(it->fence);
+            it = m_inFlightBatches.erase(it);
+        }
+
+        // JP: 残っているバッチのうち範囲の先頭以降にあるものが空き領域の終端を決める。
+        // EN: Remaining batches located at or after the head of the range determine the end of the free region.
+        m_freeEnd = m_ringSize;
+        for (const InFlightBatch &batch : m_inFlightBatches) {
+            if (batch.begin >= begin)
+                m_freeEnd = std::min(m_freeEnd, batch.begin);
+        }
+    }
+
+    size_t UploadBatcher::acquire(size_t size, bool newCommand) {
+        size_t pendingSize = m_writeOffset - m_batchBegin;
+        size_t dataOffset = newCommand ? alignUp(pendingSize, UploadAlignment) : pendingSize;
+        size_t numCommands = m_commands.size() + (newCommand ? 1 : 0);
+        size_t requiredSize = alignUp(dataOffset + size, UploadAlignment) + numCommands * sizeof(UploadCommand);
+        if (requiredSize > m_ringSize)
+            throw std::runtime_error("Pending uploads exceed the ring buffer size.");
+
+        // JP: バッチは1回のコピーで転送できるようにリング上で常に連続させる。
+        //     末尾に収まらない場合は保留中のデータをリングの先頭に移す。
+        // EN: Always keep a batch contiguous on the ring so that it can be transferred by a single copy.
+        //     Move the pending data to the head of the ring if it doesn't fit in the tail.
+        if (m_batchBegin + requiredSize <= m_freeEnd)
+            return dataOffset;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        size_t batchBegin = m_batchBegin + requiredSize <= m_ringSize ? m_batchBegin : 0;
+        retireBatches(batchBegin, batchBegin + requiredSize);
+        if (batchBegin != m_batchBegin) {
+            std::memmove(m_ring + batchBegin, m_ring + m_batchBegin, pendingSize);
+            m_batchBegin = batchBegin;
+            m_writeOffset = batchBegin + pendingSize;
+        }
 
-        m_mapped = false;
+        return dataOffset;
+    }
 
-        if (m_type == BufferType::Device ||
-            m_type == BufferType::GL_Interop) {
-            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+    void UploadBatcher::enqueue(CUdeviceptr dstAddress, const void* data, size_t size) {
+        if (!m_initialized)
+            throw std::runtime_error("UploadBatcher is not initialized.");
+        if (size == 0)
+            return;
 
-            size_t size = static_cast<size_t>(m_numElements) * m_stride;
+        // JP: 直前の書き込みとデバイス上で隣接していればコマンドを結合する。
+        // EN: Merge the command if the write is adjacent to the previous one on the device.
+        bool merge = false;
+        if (!m_commands.empty()) {
+            const UploadCommand &lastCmd = m_commands.back();
+            merge = lastCmd.dstAddress + lastCmd.size == dstAddress &&
+                lastCmd.srcOffset + lastCmd.size == m_writeOffset - m_batchBegin;
+        }
 
-            CUDADRV_CHECK(cuMemcpyHtoDAsync(m_devicePointer, m_mappedPointer, size, stream));
+        size_t dataOffset = acquire(size, !merge);
+        std::memcpy(m_ring + m_batchBegin + dataOffset, data, size);
+        m_writeOffset = m_batchBegin + dataOffset + size;
 
-            if (m_type == BufferType::GL_Interop)
-                endCUDAAccess(stream);
+        if (merge) {
+            m_commands.back().size += static_cast<uint32_t>(size);
+        }
+        else {
+            UploadCommand cmd;
+            cmd.dstAddress = dstAddress;
+            cmd.srcOffset = static_cast<uint32_t>(dataOffset);
+            cmd.size = static_cast<uint32_t>(size);
+            m_commands.push_back(cmd);
+        }
+        ++m_numPendingWrites;
+    }
 
-            if (!m_persistentMappedMemory) {
-                delete[] m_mappedPointer;
-                m_mappedPointer = nullptr;
-            }
+    static bool hasOverlappingCommands(const std::vector<UploadCommand> &commands) {
+        std::vector<std::pair<CUdeviceptr, CUdeviceptr>> ranges(commands.size());
+        for (size_t i = 0; i < commands.size(); ++i)
+            ranges[i] = std::make_pair(commands[i].dstAddress, commands[i].dstAddress + commands[i].size);
+        std::sort(ranges.begin(), ranges.end());
+        for (size_t i = 1; i < ranges.size(); ++i) {
+            if (ranges[i - 1].second > ranges[i].first)
+                return true;
         }
+        return false;
     }
 
-    Buffer Buffer::copy() const {
-        if (m_GLBufferID != 0)
-            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+    void UploadBatcher::flush(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("UploadBatcher is not initialized.");
 
-        Buffer ret;
-        ret.initialize(m_cuContext, m_type, m_numElements, m_stride, m_GLBufferID);
-        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+        m_lastFlushStats = {};
+        if (m_commands.empty())
+            return;
 
-        size_t size = static_cast<size_t>(m_numElements) * m_stride;
-        if (m_type == BufferType::Device) {
-            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
-            CUDADRV_CHECK(cuMemcpyDtoD(ret.m_devicePointer, m_devicePointer, size));
+        size_t payloadSize = m_writeOffset - m_batchBegin;
+        size_t commandsOffset = alignUp(payloadSize, UploadAlignment);
+        size_t batchSize = commandsOffset + m_commands.size() * sizeof(UploadCommand);
+        uint32_t numCommands = static_cast<uint32_t>(m_commands.size());
+
+        m_lastFlushStats.numFlushes = 1;
+        m_lastFlushStats.numWrites = m_numPendingWrites;
+        m_lastFlushStats.numCommands = numCommands;
+        m_lastFlushStats.numBytes = payloadSize;
+
+        // JP: 書き込み先が重なるとブロック間の順序が保証されないので、
+        //     その場合はストリーム順のコピーにフォールバックする。
+        // EN: Ordering between blocks is not guaranteed when destinations overlap,
+        //     so fall back to stream-ordered copies in that case.
+        if (m_scatterKernel && numCommands > 1 && !hasOverlappingCommands(m_commands)) {
+            std::memcpy(m_ring + m_batchBegin + commandsOffset, m_commands.data(),
+                        m_commands.size() * sizeof(UploadCommand));
+            CUdeviceptr batchOnDevice = m_deviceRing + m_batchBegin;
+            CUdeviceptr commandsOnDevice = batchOnDevice + commandsOffset;
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(batchOnDevice, m_ring + m_batchBegin, batchSize, stream));
+            callKernel(stream, m_scatterKernel, dim3(std::min(numCommands, 1024u)), dim3(128), 0,
+                       commandsOnDevice, numCommands, batchOnDevice);
+            m_lastFlushStats.numDriverCalls = 2;
         }
         else {
-            std::memcpy(ret.m_hostPointer, m_hostPointer, size);
+            for (const UploadCommand &cmd : m_commands)
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(cmd.dstAddress, m_ring + m_batchBegin + cmd.srcOffset, cmd.size,
+                                                stream));
+            m_lastFlushStats.numDriverCalls = numCommands;
         }
 
-        return ret;
+        InFlightBatch batch;
+        batch.begin = m_batchBegin;
+        batch.end = m_batchBegin + batchSize;
+        if (m_freeFences.empty()) {
+            CUDADRV_CHECK(cuEventCreate(&batch.fence, CU_EVENT_DISABLE_TIMING));
+        }
+        else {
+            batch.fence = m_freeFences.back();
+            m_freeFences.pop_back();
+        }
+        CUDADRV_CHECK(cuEventRecord(batch.fence, stream));
+        m_inFlightBatches.push_back(batch);
+
+        m_batchBegin = batch.end;
+        m_writeOffset = batch.end;
+        m_commands.clear();
+        m_numPendingWrites = 0;
+
+        m_totalStats.numFlushes += m_lastFlushStats.numFlushes;
+        m_totalStats.numWrites += m_lastFlushStats.numWrites;
+        m_totalStats.numCommands += m_lastFlushStats.numCommands;
+        m_totalStats.numBytes += m_lastFlushStats.numBytes;
+        m_totalStats.numDriverCalls += m_lastFlushStats.numDriverCalls;
     }
 
 
@@ -346,6 +2274,21 @@ namespace cudau {
                 elemType == cudau::ArrayElementType::BC7_UNorm);
     }
 
+    // JP: Array::initialize()と同じ変換で、作成時のピクセル単位の値を保存形式(BCは4x4ブロック単位)の値に変換する。
+    // EN: Converts the pixel-unit creation values into the storage units (4x4 blocks for BC)
+    //     with the same transform as Array::initialize().
+    static void getArrayStorageDimensions(ArrayElementType elemType,
+                                          uint32_t* numChannels, uint32_t* width, uint32_t* height) {
+        if (!isBCFormat(elemType))
+            return;
+        bool is8ByteBlock = (elemType == cudau::ArrayElementType::BC1_UNorm ||
+                             elemType == cudau::ArrayElementType::BC4_UNorm ||
+                             elemType == cudau::ArrayElementType::BC4_SNorm);
+        *numChannels = is8ByteBlock ? 2 : 4;
+        *width >>= 2;
+        *height >>= 2;
+    }
+
     static CUresourceViewFormat getResourceViewFormat(ArrayElementType elemType, uint32_t numChannels) {
 #define CUDA_UTIL_EXPR0(arrayEnum, BaseType, BitWidth) \
     case cudau::ArrayElementType::arrayEnum ## BitWidth: \
@@ -454,6 +2397,7 @@ namespace cudau {
         m_cuContext(nullptr),
         m_array(0), m_mappedPointers(nullptr), m_mappedArrays(nullptr), m_surfObjs(nullptr),
         m_GLTexID(0), m_cudaGfxResource(nullptr),
+        m_memoryCategory(MemoryCategory::Texture),
         m_surfaceLoadStore(false), m_cubemap(false), m_layered(false),
         m_initialized(false) {
     }
@@ -471,6 +2415,7 @@ namespace cudau {
         m_stride = b.m_stride;
         m_elemType = b.m_elemType;
         m_numChannels = b.m_numChannels;
+        m_numMipmapLevels = b.m_numMipmapLevels;
         if (m_numMipmapLevels > 1)
             m_mipmappedArray = b.m_mipmappedArray;
         else
@@ -480,7 +2425,9 @@ namespace cudau {
         m_surfObjs = b.m_surfObjs;
         m_GLTexID = b.m_GLTexID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_memoryCategory = b.m_memoryCategory;
         m_surfaceLoadStore = b.m_surfaceLoadStore;
+        m_useTextureGather = b.m_useTextureGather;
         m_cubemap = b.m_cubemap;
         m_layered = b.m_layered;
         m_initialized = b.m_initialized;
@@ -498,6 +2445,7 @@ namespace cudau {
         m_stride = b.m_stride;
         m_elemType = b.m_elemType;
         m_numChannels = b.m_numChannels;
+        m_numMipmapLevels = b.m_numMipmapLevels;
         if (m_numMipmapLevels > 1)
             m_mipmappedArray = b.m_mipmappedArray;
         else
@@ -507,7 +2455,9 @@ namespace cudau {
         m_surfObjs = b.m_surfObjs;
         m_GLTexID = b.m_GLTexID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_memoryCategory = b.m_memoryCategory;
         m_surfaceLoadStore = b.m_surfaceLoadStore;
+        m_useTextureGather = b.m_useTextureGather;
         m_cubemap = b.m_cubemap;
         m_layered = b.m_layered;
         m_initialized = b.m_initialized;
@@ -635,6 +2585,7 @@ namespace cudau {
                 CUDADRV_CHECK(cuMipmappedArrayCreate(&m_mipmappedArray, &arrayDesc, numMipmapLevels));
             else
                 CUDADRV_CHECK(cuArray3DCreate(&m_array, &arrayDesc));
+            recordMemoryAllocation(m_cuContext, m_memoryCategory, calcSizeInBytes());
         }
 
         m_mappedPointers = new void*[m_numMipmapLevels];
@@ -688,6 +2639,7 @@ namespace cudau {
             m_GLTexID = 0;
         }
         else {
+            recordMemoryRelease(m_cuContext, m_memoryCategory, calcSizeInBytes());
             if (m_numMipmapLevels > 1)
                 CUDADRV_CHECK(cuMipmappedArrayDestroy(m_mipmappedArray));
             else
@@ -697,6 +2649,28 @@ namespace cudau {
         m_initialized = false;
     }
 
+    size_t Array::calcSizeInBytes() const {
+        // JP: ドライバーによるパディングは含まない見積もり。
+        // EN: An estimate that doesn't include padding by the driver.
+        size_t size = 0;
+        for (uint32_t level = 0; level < std::max(m_numMipmapLevels, 1u); ++level) {
+            size_t width = std::max(m_width >> level, 1u);
+            size_t height = std::max(m_height >> level, 1u);
+            size_t depth = (m_layered || m_cubemap) ? std::max(m_depth, 1u) : std::max(m_depth >> level, 1u);
+            size += width * height * depth * m_stride;
+        }
+        return size;
+    }
+
+    void Array::setMemoryCategory(MemoryCategory category) {
+        if (m_initialized && m_GLTexID == 0) {
+            size_t size = calcSizeInBytes();
+            recordMemoryRelease(m_cuContext, m_memoryCategory, size);
+            recordMemoryAllocation(m_cuContext, category, size);
+        }
+        m_memoryCategory = category;
+    }
+
     void Array::resize(uint32_t length, CUstream stream) {
         if (m_height > 0 || m_depth > 0)
             throw std::runtime_error("Array dimension cannot be changed.");
@@ -713,6 +2687,7 @@ namespace cudau {
             return;
 
         Array newArray;
+        newArray.m_memoryCategory = m_memoryCategory;
         newArray.initialize(m_cuContext, m_elemType, m_numChannels, width, height, m_depth, m_numMipmapLevels,
                             m_surfaceLoadStore, m_useTextureGather, m_cubemap, m_layered, 0);
 
@@ -795,7 +2770,7 @@ namespace cudau {
         uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
         uint32_t depth = std::max<uint32_t>(1, m_depth);
         size_t sizePerRow = width * static_cast<size_t>(m_stride);
-        size_t size = depth * height * sizePerRow;
+        size_t size = sizePerRow * height * depth;
         m_mappedPointers[mipmapLevel] = new uint8_t[size];
 
         CUDA_MEMCPY3D params = {};
@@ -864,6 +2839,68 @@ namespace cudau {
         m_mappedPointers[mipmapLevel] = nullptr;
     }
 
+    void Array::write(const void* srcData, size_t size, uint32_t mipmapLevel, CUstream stream) {
+        if (mipmapLevel >= m_numMipmapLevels)
+            throw std::runtime_error("Specified mip-map level is out of bound.");
+        if (m_GLTexID)
+            throw std::runtime_error("Direct write to GL-interop array is not supported.");
+
+        uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
+        uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
+        uint32_t depth = std::max<uint32_t>(1, m_depth);
+        size_t sizePerRow = width * static_cast<size_t>(m_stride);
+        if (size != sizePerRow * height * depth)
+            throw std::runtime_error("Size mismatch.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUDA_MEMCPY3D params = {};
+        params.WidthInBytes = sizePerRow;
+        params.Height = height;
+        params.Depth = depth;
+
+        params.srcMemoryType = CU_MEMORYTYPE_HOST;
+        params.srcHost = srcData;
+        params.srcPitch = sizePerRow;
+        params.srcHeight = height;
+
+        params.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+        params.dstArray = getCUarray(mipmapLevel);
+
+        CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+    }
+
+    void Array::read(void* dstData, size_t size, uint32_t mipmapLevel, CUstream stream) const {
+        if (mipmapLevel >= m_numMipmapLevels)
+            throw std::runtime_error("Specified mip-map level is out of bound.");
+        if (m_GLTexID)
+            throw std::runtime_error("Direct read from GL-interop array is not supported.");
+
+        uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
+        uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
+        uint32_t depth = std::max<uint32_t>(1, m_depth);
+        size_t sizePerRow = width * static_cast<size_t>(m_stride);
+        if (size != sizePerRow * height * depth)
+            throw std::runtime_error("Size mismatch.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUDA_MEMCPY3D params = {};
+        params.WidthInBytes = sizePerRow;
+        params.Height = height;
+        params.Depth = depth;
+
+        params.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+        params.srcArray = getCUarray(mipmapLevel);
+
+        params.dstMemoryType = CU_MEMORYTYPE_HOST;
+        params.dstHost = dstData;
+        params.dstPitch = sizePerRow;
+        params.dstHeight = height;
+
+        CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+    }
+
     CUDA_RESOURCE_VIEW_DESC Array::getResourceViewDesc() const {
         CUDA_RESOURCE_VIEW_DESC ret = {};
         bool isBC = isBCFormat(m_elemType);
@@ -883,4 +2920,553 @@ namespace cudau {
 
         return ret;
     }
+
+
+
+    static void getLinearTextureFormat(ArrayElementType elemType, uint32_t numChannels,
+                                       CUarray_format* format, uint32_t* elementSize) {
+        if (numChannels != 1 && numChannels != 2 && numChannels != 4)
+            throw std::runtime_error("Textures over linear memory require 1, 2 or 4 channels.");
+
+        switch (elemType) {
+        case cudau::ArrayElementType::UInt8:
+            *format = CU_AD_FORMAT_UNSIGNED_INT8;
+            *elementSize = 1;
+            break;
+        case cudau::ArrayElementType::UInt16:
+            *format = CU_AD_FORMAT_UNSIGNED_INT16;
+            *elementSize = 2;
+            break;
+        case cudau::ArrayElementType::UInt32:
+            *format = CU_AD_FORMAT_UNSIGNED_INT32;
+            *elementSize = 4;
+            break;
+        case cudau::ArrayElementType::Int8:
+            *format = CU_AD_FORMAT_SIGNED_INT8;
+            *elementSize = 1;
+            break;
+        case cudau::ArrayElementType::Int16:
+            *format = CU_AD_FORMAT_SIGNED_INT16;
+            *elementSize = 2;
+            break;
+        case cudau::ArrayElementType::Int32:
+            *format = CU_AD_FORMAT_SIGNED_INT32;
+            *elementSize = 4;
+            break;
+        case cudau::ArrayElementType::Float16:
+            *format = CU_AD_FORMAT_HALF;
+            *elementSize = 2;
+            break;
+        case cudau::ArrayElementType::Float32:
+            *format = CU_AD_FORMAT_FLOAT;
+            *elementSize = 4;
+            break;
+        default:
+            throw std::runtime_error("Block compressed formats are not supported for textures over linear memory.");
+        }
+        *elementSize *= numChannels;
+    }
+
+    static void getTextureAlignments(CUcontext context, uint32_t* baseAlignment, uint32_t* pitchAlignment) {
+        CUDADRV_CHECK(cuCtxSetCurrent(context));
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        int32_t value;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&value, CU_DEVICE_ATTRIBUTE_TEXTURE_ALIGNMENT, device));
+        *baseAlignment = value;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&value, CU_DEVICE_ATTRIBUTE_TEXTURE_PITCH_ALIGNMENT, device));
+        *pitchAlignment = value;
+    }
+
+    uint32_t calcTexturePitch(CUcontext context, ArrayElementType elemType, uint32_t numChannels, uint32_t width) {
+        CUarray_format format;
+        uint32_t elementSize;
+        getLinearTextureFormat(elemType, numChannels, &format, &elementSize);
+        uint32_t baseAlignment, pitchAlignment;
+        getTextureAlignments(context, &baseAlignment, &pitchAlignment);
+        return (width * elementSize + pitchAlignment - 1) / pitchAlignment * pitchAlignment;
+    }
+
+    CUtexObject TextureSampler::createTextureObject(const Buffer &buffer, ArrayElementType elemType, uint32_t numChannels,
+                                                    uint32_t width, uint32_t height, uint32_t pitchInBytes) {
+        CUarray_format format;
+        uint32_t elementSize;
+        getLinearTextureFormat(elemType, numChannels, &format, &elementSize);
+        uint32_t baseAlignment, pitchAlignment;
+        getTextureAlignments(buffer.getCUcontext(), &baseAlignment, &pitchAlignment);
+        if (buffer.getCUdeviceptr() % baseAlignment != 0)
+            throw std::runtime_error("Buffer address does not satisfy the texture alignment.");
+        if (pitchInBytes % pitchAlignment != 0 || pitchInBytes < width * elementSize)
+            throw std::runtime_error("Invalid pitch, use calcTexturePitch().");
+        if (static_cast<size_t>(pitchInBytes) * height > buffer.sizeInBytes())
+            throw std::runtime_error("Buffer is too small for the specified texture.");
+
+        CUDA_RESOURCE_DESC resDesc = {};
+        resDesc.resType = CU_RESOURCE_TYPE_PITCH2D;
+        resDesc.res.pitch2D.devPtr = buffer.getCUdeviceptr();
+        resDesc.res.pitch2D.format = format;
+        resDesc.res.pitch2D.numChannels = numChannels;
+        resDesc.res.pitch2D.width = width;
+        resDesc.res.pitch2D.height = height;
+        resDesc.res.pitch2D.pitchInBytes = pitchInBytes;
+
+        CUDA_TEXTURE_DESC texDesc = m_texDesc;
+        texDesc.mipmapFilterMode = CU_TR_FILTER_MODE_POINT;
+        texDesc.minMipmapLevelClamp = 0.0f;
+        texDesc.maxMipmapLevelClamp = 0.0f;
+
+        CUtexObject texObj;
+        CUDADRV_CHECK(cuTexObjectCreate(&texObj, &resDesc, &texDesc, nullptr));
+        return texObj;
+    }
+
+    CUtexObject TextureSampler::createTextureObject(const Buffer &buffer, ArrayElementType elemType, uint32_t numChannels) {
+        CUarray_format format;
+        uint32_t elementSize;
+        getLinearTextureFormat(elemType, numChannels, &format, &elementSize);
+        uint32_t baseAlignment, pitchAlignment;
+        getTextureAlignments(buffer.getCUcontext(), &baseAlignment, &pitchAlignment);
+        if (buffer.getCUdeviceptr() % baseAlignment != 0)
+            throw std::runtime_error("Buffer address does not satisfy the texture alignment.");
+
+        CUDA_RESOURCE_DESC resDesc = {};
+        resDesc.resType = CU_RESOURCE_TYPE_LINEAR;
+        resDesc.res.linear.devPtr = buffer.getCUdeviceptr();
+        resDesc.res.linear.format = format;
+        resDesc.res.linear.numChannels = numChannels;
+        resDesc.res.linear.sizeInBytes = buffer.sizeInBytes() / elementSize * elementSize;
+
+        // JP: 線形テクスチャーは正規化座標やフィルタリングを使えない。
+        // EN: Linear textures cannot use normalized coordinates or filtering.
+        CUDA_TEXTURE_DESC texDesc = m_texDesc;
+        texDesc.flags &= ~CU_TRSF_NORMALIZED_COORDINATES;
+        texDesc.filterMode = CU_TR_FILTER_MODE_POINT;
+        texDesc.mipmapFilterMode = CU_TR_FILTER_MODE_POINT;
+
+        CUtexObject texObj;
+        CUDADRV_CHECK(cuTexObjectCreate(&texObj, &resDesc, &texDesc, nullptr));
+        return texObj;
+    }
+
+
+
+    StreamingTexture::StreamingTexture() :
+        m_cuContext(nullptr), m_texObject(0),
+        m_residentLevel(0), m_numUploadedRows(0), m_numUploadedBytes(0),
+        m_stopRequested(false),
+        m_initialized(false) {
+    }
+
+    StreamingTexture::~StreamingTexture() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void StreamingTexture::initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
+                                      uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                      const TextureSampler &sampler, const MipLoader &loader,
+                                      uint32_t maxTailSize, CUstream stream) {
+        if (m_initialized)
+            throw std::runtime_error("StreamingTexture is already initialized.");
+        if (!loader)
+            throw std::runtime_error("MipLoader must be specified.");
+
+        m_cuContext = context;
+        m_array.initialize2D(context, elemType, numChannels,
+                             ArraySurface::Disable, ArrayTextureGather::Disable,
+                             width, height, numMipmapLevels);
+        m_sampler = sampler;
+        m_loader = loader;
+        m_numUploadedRows = 0;
+        m_numUploadedBytes = 0;
+        m_stopRequested = false;
+
+        uint32_t tailBegin = m_array.getNumMipmapLevels() - 1;
+        while (tailBegin > 0 &&
+               std::max(width >> (tailBegin - 1), height >> (tailBegin - 1)) <= maxTailSize)
+            --tailBegin;
+
+        std::vector<uint8_t> data;
+        for (int level = m_array.getNumMipmapLevels() - 1; level >= static_cast<int>(tailBegin); --level) {
+            m_loader(level, &data);
+            uint32_t numRows = std::max<uint32_t>(1, m_array.getHeight() >> level);
+            if (data.size() == 0 || data.size() % numRows != 0)
+                throw std::runtime_error("Loaded mip level size mismatch.");
+            uploadRows(level, data.data(), 0, numRows, data.size() / numRows, stream);
+            m_numUploadedBytes += data.size();
+        }
+        m_residentLevel = tailBegin;
+        recreateTextureObject(stream);
+
+        if (tailBegin > 0)
+            m_loaderThread = std::thread(&StreamingTexture::loaderThreadFunc, this, tailBegin - 1);
+
+        m_initialized = true;
+    }
+
+    void StreamingTexture::finalize() {
+        if (!m_initialized)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopRequested = true;
+        }
+        m_queueCondition.notify_all();
+        if (m_loaderThread.joinable())
+            m_loaderThread.join();
+        m_loadedLevels.clear();
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_retiredTexObjects.size()) - 1; i >= 0; --i) {
+            RetiredTextureObject &retired = m_retiredTexObjects[i];
+            CUDADRV_CHECK(cuEventSynchronize(retired.fence));
+            CUDADRV_CHECK(cuEventDestroy(retired.fence));
+            CUDADRV_CHECK(cuTexObjectDestroy(retired.texObject));
+        }
+        m_retiredTexObjects.clear();
+        if (m_texObject) {
+            CUDADRV_CHECK(cuTexObjectDestroy(m_texObject));
+            m_texObject = 0;
+        }
+
+        m_array.finalize();
+        m_loader = nullptr;
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    void StreamingTexture::loaderThreadFunc(uint32_t firstLevelToLoad) {
+        for (int level = firstLevelToLoad; level >= 0; --level) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_queueCondition.wait(lock, [this]() {
+                    return m_stopRequested || m_loadedLevels.size() < MaxNumQueuedLevels;
+                });
+                if (m_stopRequested)
+                    return;
+            }
+
+            std::vector<uint8_t> data;
+            m_loader(level, &data);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stopRequested)
+                    return;
+                m_loadedLevels.push_back(std::move(data));
+            }
+        }
+    }
+
+    void StreamingTexture::uploadRows(uint32_t mipLevel, const uint8_t* data, uint32_t rowBegin, uint32_t numRows,
+                                      size_t rowSize, CUstream stream) {
+        CUDA_MEMCPY3D params = {};
+        params.WidthInBytes = rowSize;
+        params.Height = numRows;
+        params.Depth = 1;
+
+        params.srcMemoryType = CU_MEMORYTYPE_HOST;
+        params.srcHost = data + rowBegin * rowSize;
+        params.srcPitch = rowSize;
+        params.srcHeight = numRows;
+
+        params.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+        params.dstArray = m_array.getCUarray(mipLevel);
+        params.dstY = rowBegin;
+
+        CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+    }
+
+    void StreamingTexture::recreateTextureObject(CUstream stream) {
+        // JP: 古いテクスチャーオブジェクトはそれまでに発行された処理が終わるまで破棄できない。
+        // EN: The old texture object cannot be destroyed until work issued so far completes.
+        if (m_texObject) {
+            RetiredTextureObject retired;
+            retired.texObject = m_texObject;
+            CUDADRV_CHECK(cuEventCreate(&retired.fence, CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventRecord(retired.fence, stream));
+            m_retiredTexObjects.push_back(retired);
+        }
+
+        m_sampler.setMinMipmapLevelClamp(static_cast<float>(m_residentLevel));
+        m_texObject = m_sampler.createTextureObject(m_array);
+    }
+
+    bool StreamingTexture::update(CUstream stream, size_t byteBudget) {
+        if (!m_initialized)
+            throw std::runtime_error("StreamingTexture is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (auto it = m_retiredTexObjects.begin(); it != m_retiredTexObjects.end();) {
+            CUresult res = cuEventQuery(it->fence);
+            if (res == CUDA_ERROR_NOT_READY) {
+                ++it;
+                continue;
+            }
+            CUDADRV_CHECK(res);
+            CUDADRV_CHECK(cuEventDestroy(it->fence));
+            CUDADRV_CHECK(cuTexObjectDestroy(it->texObject));
+            it = m_retiredTexObjects.erase(it);
+        }
+
+        bool levelBecameResident = false;
+        size_t numUploadedBytes = 0;
+        while (m_residentLevel > 0) {
+            // JP: dequeの末尾への追加は既存要素への参照を無効化しないので、ロック外で先頭を読める。
+            // EN: Appending to a deque does not invalidate references to existing elements,
+            //     so the front can be read outside the lock.
+            const std::vector<uint8_t>* data;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_loadedLevels.empty())
+                    break;
+                data = &m_loadedLevels.front();
+            }
+
+            uint32_t level = m_residentLevel - 1;
+            uint32_t numRows = std::max<uint32_t>(1, m_array.getHeight() >> level);
+            if (data->size() == 0 || data->size() % numRows != 0)
+                throw std::runtime_error("Loaded mip level size mismatch.");
+            size_t rowSize = data->size() / numRows;
+
+            size_t remainingBudget = byteBudget > numUploadedBytes ? byteBudget - numUploadedBytes : 0;
+            uint32_t numRowsToUpload = static_cast<uint32_t>(
+                std::min<size_t>(numRows - m_numUploadedRows, remainingBudget / rowSize));
+            if (numRowsToUpload == 0) {
+                if (numUploadedBytes > 0)
+                    break;
+                numRowsToUpload = 1;
+            }
+            uploadRows(level, data->data(), m_numUploadedRows, numRowsToUpload, rowSize, stream);
+            m_numUploadedRows += numRowsToUpload;
+            numUploadedBytes += numRowsToUpload * rowSize;
+
+            if (m_numUploadedRows == numRows) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_loadedLevels.pop_front();
+                }
+                m_queueCondition.notify_one();
+                m_numUploadedRows = 0;
+                --m_residentLevel;
+                levelBecameResident = true;
+            }
+        }
+        m_numUploadedBytes += numUploadedBytes;
+
+        if (levelBecameResident)
+            recreateTextureObject(stream);
+
+        return levelBecameResident;
+    }
+
+
+
+    uint64_t TexturePool::calcContentHash(const void* data, size_t size, uint64_t seed) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    TexturePool::TexturePool() :
+        m_cuContext(nullptr), m_stats{},
+        m_initialized(false) {
+    }
+
+    TexturePool::~TexturePool() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void TexturePool::initialize(CUcontext context, BufferType type, uint32_t initialCapacity) {
+        if (m_initialized)
+            throw std::runtime_error("TexturePool is already initialized.");
+
+        m_cuContext = context;
+        m_table.initialize(context, type, initialCapacity);
+        m_table.setMemoryCategory(MemoryCategory::Texture);
+        m_stats = {};
+
+        m_initialized = true;
+    }
+
+    void TexturePool::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_table.numElements()) - 1; i >= 0; --i)
+            CUDADRV_CHECK(cuTexObjectDestroy(m_table[i]));
+        m_table.finalize();
+        m_textureIDsByKey.clear();
+        m_texObjEntries.clear();
+
+        for (int i = static_cast<int>(m_arrays.size()) - 1; i >= 0; --i)
+            m_arrays[i].finalize();
+        m_arrays.clear();
+        m_arrayIndicesByHash.clear();
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    bool TexturePool::hasSameContents(uint32_t arrayIndex,
+                                      ArrayElementType elemType, uint32_t numChannels,
+                                      uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                      const void* const* levelData, const size_t* levelSizes,
+                                      CUstream stream) const {
+        const Array &array = m_arrays[arrayIndex];
+        if (array.getElementType() != elemType || array.getNumChannels() != numChannels ||
+            array.getWidth() != width || array.getHeight() != height ||
+            array.getNumMipmapLevels() != numMipmapLevels)
+            return false;
+        for (uint32_t level = 0; level < numMipmapLevels; ++level) {
+            if (array.getLevelSizeInBytes(level) != levelSizes[level])
+                return false;
+        }
+
+        // JP: 64ビットハッシュの衝突で別のテクスチャーを共有しないように内容を読み戻して比較する。
+        // EN: Read back and compare the contents so that a 64-bit hash collision doesn't share a different texture.
+        std::vector<uint8_t> contents;
+        for (uint32_t level = 0; level < numMipmapLevels; ++level) {
+            contents.resize(levelSizes[level]);
+            array.read(contents.data(), contents.size(), level, stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            if (std::memcmp(contents.data(), levelData[level], levelSizes[level]) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t TexturePool::findArray(uint64_t contentHash,
+                                    ArrayElementType elemType, uint32_t numChannels,
+                                    uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                    const void* const* levelData, const size_t* levelSizes,
+                                    CUstream stream) const {
+        auto it = m_arrayIndicesByHash.find(contentHash);
+        if (it == m_arrayIndicesByHash.cend())
+            return InvalidIndex;
+        for (uint32_t arrayIndex : it->second) {
+            if (hasSameContents(arrayIndex, elemType, numChannels, width, height, numMipmapLevels,
+                                levelData, levelSizes, stream))
+                return arrayIndex;
+        }
+        return InvalidIndex;
+    }
+
+    uint32_t TexturePool::addArray(Array &&array, uint64_t contentHash, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("TexturePool is not initialized.");
+
+        uint32_t arrayIndex = InvalidIndex;
+        if (m_arrayIndicesByHash.count(contentHash)) {
+            uint32_t numMipmapLevels = array.getNumMipmapLevels();
+            std::vector<std::vector<uint8_t>> levelContents(numMipmapLevels);
+            std::vector<const void*> levelData(numMipmapLevels);
+            std::vector<size_t> levelSizes(numMipmapLevels);
+            for (uint32_t level = 0; level < numMipmapLevels; ++level) {
+                levelContents[level].resize(array.getLevelSizeInBytes(level));
+                array.read(levelContents[level].data(), levelContents[level].size(), level, stream);
+                levelData[level] = levelContents[level].data();
+                levelSizes[level] = levelContents[level].size();
+            }
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            arrayIndex = findArray(contentHash, array.getElementType(), array.getNumChannels(),
+                                   array.getWidth(), array.getHeight(), numMipmapLevels,
+                                   levelData.data(), levelSizes.data(), stream);
+        }
+        if (arrayIndex != InvalidIndex) {
+            array.finalize();
+            ++m_stats.numArrayDedupHits;
+            return arrayIndex;
+        }
+
+        arrayIndex = static_cast<uint32_t>(m_arrays.size());
+        m_arrays.push_back(std::move(array));
+        m_arrayIndicesByHash[contentHash].push_back(arrayIndex);
+        ++m_stats.numArrays;
+        return arrayIndex;
+    }
+
+    uint32_t TexturePool::createArray2D(ArrayElementType elemType, uint32_t numChannels,
+                                        uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                        const void* const* levelData, const size_t* levelSizes, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("TexturePool is not initialized.");
+
+        uint32_t attributes[] = {
+            static_cast<uint32_t>(elemType), numChannels, width, height, numMipmapLevels
+        };
+        uint64_t contentHash = calcContentHash(attributes, sizeof(attributes));
+        for (uint32_t level = 0; level < numMipmapLevels; ++level)
+            contentHash = calcContentHash(levelData[level], levelSizes[level], contentHash);
+
+        // JP: 登録済みのArrayのゲッターは保存形式の値を返すので、同じ単位に揃えて比較する。
+        // EN: Getters of registered arrays return values in the storage units, so compare in the same units.
+        uint32_t storageNumChannels = numChannels;
+        uint32_t storageWidth = width;
+        uint32_t storageHeight = height;
+        getArrayStorageDimensions(elemType, &storageNumChannels, &storageWidth, &storageHeight);
+        uint32_t arrayIndex = findArray(contentHash, elemType, storageNumChannels, storageWidth, storageHeight,
+                                        numMipmapLevels, levelData, levelSizes, stream);
+        if (arrayIndex != InvalidIndex) {
+            ++m_stats.numArrayDedupHits;
+            return arrayIndex;
+        }
+
+        Array array;
+        array.initialize2D(m_cuContext, elemType, numChannels,
+                           ArraySurface::Disable, ArrayTextureGather::Disable,
+                           width, height, numMipmapLevels);
+        for (uint32_t level = 0; level < array.getNumMipmapLevels(); ++level)
+            array.write(levelData[level], levelSizes[level], level, stream);
+
+        arrayIndex = static_cast<uint32_t>(m_arrays.size());
+        m_arrays.push_back(std::move(array));
+        m_arrayIndicesByHash[contentHash].push_back(arrayIndex);
+        ++m_stats.numArrays;
+        return arrayIndex;
+    }
+
+    uint32_t TexturePool::getTextureID(uint32_t arrayIndex, const TextureSampler &sampler) {
+        if (!m_initialized)
+            throw std::runtime_error("TexturePool is not initialized.");
+        if (arrayIndex >= m_arrays.size())
+            throw std::runtime_error("Array index is out of bounds.");
+
+        // JP: maxMipmapLevelClampはcreateTextureObject()がArrayに合わせて上書きするのでキーから除外する。
+        // EN: Exclude maxMipmapLevelClamp from the key since createTextureObject() overwrites it to fit the array.
+        CUDA_TEXTURE_DESC texDesc = sampler.getTextureDesc();
+        texDesc.maxMipmapLevelClamp = 0.0f;
+        std::pair<uint32_t, uint64_t> key(arrayIndex, calcContentHash(&texDesc, sizeof(texDesc)));
+
+        std::vector<uint32_t> &textureIDs = m_textureIDsByKey[key];
+        for (uint32_t textureID : textureIDs) {
+            if (std::memcmp(&m_texObjEntries[textureID].texDesc, &texDesc, sizeof(texDesc)) == 0) {
+                ++m_stats.numTextureObjectCacheHits;
+                return textureID;
+            }
+        }
+
+        TextureSampler samplerCopy = sampler;
+        CUtexObject texObj = samplerCopy.createTextureObject(m_arrays[arrayIndex]);
+        uint32_t textureID = static_cast<uint32_t>(m_table.add(texObj));
+        TextureObjectEntry entry;
+        entry.arrayIndex = arrayIndex;
+        entry.texDesc = texDesc;
+        m_texObjEntries.push_back(entry);
+        textureIDs.push_back(textureID);
+        ++m_stats.numTextureObjects;
+        return textureID;
+    }
 }
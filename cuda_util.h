@@ -52,7 +52,14 @@ typedef unsigned long long CUsurfObject;
 
 #   include <algorithm>
 #   include <vector>
+#   include <deque>
+#   include <map>
+#   include <string>
 #   include <sstream>
+#   include <functional>
+#   include <thread>
+#   include <mutex>
+#   include <condition_variable>
 
 // Enable this macro if CUDA/OpenGL interoperability is required.
 #   define CUDA_UTIL_USE_GL_INTEROP
@@ -136,6 +143,18 @@ typedef unsigned long long CUsurfObject;
 
 
 namespace cudau {
+    // JP: UploadBatcherがスキャッターに使うコマンド。
+    //     srcOffsetはデバイスにコピーされたバッチ先頭からのオフセット。
+    // EN: Command which UploadBatcher uses for scattering.
+    //     srcOffset is the offset from the head of the batch copied to the device.
+    struct UploadCommand {
+        unsigned long long dstAddress;
+        uint32_t srcOffset;
+        uint32_t size;
+    };
+
+
+
 #if !defined(__CUDA_ARCH__)
     void devPrintf(const char* fmt, ...);
 
@@ -172,24 +191,149 @@ namespace cudau {
 
 
 
+    // JP: カーネルの起動ブロックサイズを自動調整する。
+    //     (カーネル名、問題サイズのバケット)ごとに最初の数回の起動で候補のブロックサイズを順に試して計測し、
+    //     最速のものをデバイスごとにキャッシュファイルに保存する。
+    //     候補はcuOccupancyMaxPotentialBlockSize()の結果を先頭とし、計測は実際の起動そのもので行うので
+    //     カーネルが余分に実行されることはない。ストリームが記録中(CUDA Graph)の場合は計測しない。
+    // EN: Automatically tune the launch block size of kernels.
+    //     For each (kernel name, problem size bucket), the first few launches try candidate block sizes in turn
+    //     and measure them, then the fastest one is stored to a cache file per device.
+    //     Candidates start with the result of cuOccupancyMaxPotentialBlockSize(), and the measurement uses
+    //     the actual launches themselves, so kernels are never executed extra times.
+    //     Nothing is measured while the stream is being captured (CUDA Graph).
+    class KernelAutotuner {
+    public:
+        struct Measurement {
+            void* trial;
+            uint32_t candidateIndex;
+            CUevent startEvent;
+            CUevent endEvent;
+        };
+
+    private:
+        struct PendingMeasurement {
+            uint32_t candidateIndex;
+            CUevent startEvent;
+            CUevent endEvent;
+        };
+
+        struct Trial {
+            std::vector<dim3> candidates;
+            std::vector<uint32_t> numIssuedSamples;
+            std::vector<uint32_t> numResolvedSamples;
+            std::vector<float> bestTimes;
+            std::vector<PendingMeasurement> pendingMeasurements;
+            uint32_t nextCandidateIndex;
+        };
+
+        CUcontext m_cuContext;
+        std::string m_deviceName;
+        std::string m_cacheFilePath;
+        std::map<std::string, dim3> m_winners;
+        std::map<std::string, Trial> m_trials;
+        // JP: 他のデバイスのキャッシュエントリーは保存時にそのまま書き戻す。
+        // EN: Cache entries of other devices are written back as is on save.
+        std::vector<std::string> m_otherDeviceEntries;
+        std::vector<CUevent> m_freeEvents;
+        uint32_t m_generation;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        KernelAutotuner(const KernelAutotuner &) = delete;
+        KernelAutotuner &operator=(const KernelAutotuner &) = delete;
+
+        static constexpr uint32_t NumSamplesPerCandidate = 3;
+
+        CUevent getEvent();
+        void resolveMeasurements(const std::string &key, Trial* trial);
+        void loadCache();
+        void saveCache() const;
+
+    public:
+        KernelAutotuner();
+        ~KernelAutotuner();
+
+        // JP: cacheFilePathがnullptrの場合は結果を保存しない。
+        // EN: Results are not persisted when cacheFilePath is nullptr.
+        void initialize(CUcontext context, const char* cacheFilePath);
+        void finalize();
+
+        // JP: 次の起動に使うブロックサイズを返す。計測する場合はmeasurementにイベントが設定され、
+        //     起動直後にendLaunch()を呼ぶ必要がある。
+        // EN: Returns the block dimensions to use for the next launch. When measuring, events are set to
+        //     measurement and endLaunch() needs to be called right after the launch.
+        dim3 beginLaunch(CUstream stream, const std::string &kernelName, CUfunction kernel, uint32_t sharedMemSize,
+                         uint32_t dimensionality, const dim3 &numItems, const dim3 &defaultBlockDim,
+                         Measurement* measurement);
+        void endLaunch(CUstream stream, const Measurement &measurement);
+
+        uint32_t getNumTunedConfigurations() const {
+            return static_cast<uint32_t>(m_winners.size());
+        }
+        uint32_t getNumTuningConfigurations() const {
+            return static_cast<uint32_t>(m_trials.size());
+        }
+        // JP: 試行が完了してブロックサイズが確定するたびに増える。
+        //     記録済みのグラフは古いブロックサイズを持つので、値が変わったら記録し直す必要がある。
+        // EN: Increases every time a trial finishes and its block dimensions are decided.
+        //     Recorded graphs hold the old block dimensions, so they need to be recorded again when this changes.
+        uint32_t getGeneration() const {
+            return m_generation;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
     class Kernel {
         CUfunction m_kernel;
         dim3 m_blockDim;
         uint32_t m_sharedMemSize;
+        std::string m_name;
+        KernelAutotuner* m_autotuner;
+
+        template <typename... ArgTypes>
+        void launch(CUstream stream, uint32_t dimensionality, const dim3 &numItems, ArgTypes&&... args) const {
+            dim3 blockDim = m_blockDim;
+            KernelAutotuner::Measurement measurement = {};
+            if (m_autotuner)
+                blockDim = m_autotuner->beginLaunch(stream, m_name, m_kernel, m_sharedMemSize,
+                                                    dimensionality, numItems, m_blockDim, &measurement);
+            dim3 gridDim((numItems.x + blockDim.x - 1) / blockDim.x,
+                         (numItems.y + blockDim.y - 1) / blockDim.y,
+                         (numItems.z + blockDim.z - 1) / blockDim.z);
+            callKernel(stream, m_kernel, gridDim, blockDim, m_sharedMemSize, std::forward<ArgTypes>(args)...);
+            if (m_autotuner)
+                m_autotuner->endLaunch(stream, measurement);
+        }
 
     public:
-        Kernel() {}
+        Kernel() : m_kernel(nullptr), m_sharedMemSize(0), m_autotuner(nullptr) {}
         Kernel(CUmodule module, const char* name, const dim3 blockDim, uint32_t sharedMemSize) :
-            m_blockDim(blockDim), m_sharedMemSize(sharedMemSize) {
+            m_blockDim(blockDim), m_sharedMemSize(sharedMemSize), m_name(name), m_autotuner(nullptr) {
             CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
         }
 
         void set(CUmodule module, const char* name, const dim3 blockDim, uint32_t sharedMemSize) {
             m_blockDim = blockDim;
             m_sharedMemSize = sharedMemSize;
+            m_name = name;
             CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
         }
 
+        // JP: 自動調整を有効にすると、launch1D/2D/3D()はブロックサイズをautotunerに問い合わせる。
+        //     設定されたブロックサイズは候補の一つとして、またチューニング結果が無い場合に使われる。
+        // EN: When autotuning is enabled, launch1D/2D/3D() query the autotuner for the block size.
+        //     The set block size is used as one of candidates and when no tuning result is available.
+        void setAutotuner(KernelAutotuner* autotuner) {
+            m_autotuner = autotuner;
+        }
+
         void setBlockDimensions(const dim3 &blockDim) {
             m_blockDim = blockDim;
         }
@@ -217,6 +361,24 @@ namespace cudau {
         void operator()(CUstream stream, const dim3 &gridDim, ArgTypes&&... args) const {
             callKernel(stream, m_kernel, gridDim, m_blockDim, m_sharedMemSize, std::forward<ArgTypes>(args)...);
         }
+
+        // JP: アイテム数からグリッドサイズを計算して起動する。
+        //     カーネルはblockDimに依存せずに任意のブロックサイズで正しく動作する必要がある。
+        // EN: Calculate the grid size from the number of items then launch.
+        //     The kernel needs to work correctly with any block size without depending on a specific blockDim.
+        template <typename... ArgTypes>
+        void launch1D(CUstream stream, uint32_t numItemsX, ArgTypes&&... args) const {
+            launch(stream, 1, dim3(numItemsX), std::forward<ArgTypes>(args)...);
+        }
+        template <typename... ArgTypes>
+        void launch2D(CUstream stream, uint32_t numItemsX, uint32_t numItemsY, ArgTypes&&... args) const {
+            launch(stream, 2, dim3(numItemsX, numItemsY), std::forward<ArgTypes>(args)...);
+        }
+        template <typename... ArgTypes>
+        void launch3D(CUstream stream, uint32_t numItemsX, uint32_t numItemsY, uint32_t numItemsZ,
+                      ArgTypes&&... args) const {
+            launch(stream, 3, dim3(numItemsX, numItemsY, numItemsZ), std::forward<ArgTypes>(args)...);
+        }
     };
 
 
@@ -257,6 +419,289 @@ namespace cudau {
 
 
 
+    // JP: フレームごとに名前付きの区間のタイムスタンプを発行し、数フレーム後にブロックせずに解決するプール。
+    //     区間ごとに直近のフレームの時間と移動平均を提供する。
+    //     結果はcuEventQuery()でのみ確認するので同期点を追加しない。
+    //     解決される前にスロットが再利用されたフレームの結果は捨てられる。
+    //     記録中(CUDA Graph)のストリームに対する区間は無視される。
+    // EN: A pool which issues timestamps of named scopes per frame and resolves them a few frames later
+    //     without blocking.
+    //     It provides the time in the latest resolved frame and the rolling average per scope.
+    //     Results are checked only by cuEventQuery(), so it adds no sync points.
+    //     Results of a frame whose slot is reused before being resolved are dropped.
+    //     Scopes on a stream being captured (CUDA Graph) are ignored.
+    class TimestampPool {
+    public:
+        struct ScopeStats {
+            // JP: 直近に解決されたフレームでの時間[ms]。そのフレームで発行されなかった場合は0。
+            // EN: Time [ms] in the latest resolved frame. 0 if the scope wasn't issued in the frame.
+            float lastTime;
+            // JP: 発行された直近numAverageSamplesフレームの平均[ms]。
+            // EN: Average [ms] over the latest numAverageSamples frames where the scope was issued.
+            float averageTime;
+            uint64_t numSamples;
+        };
+
+    private:
+        struct Query {
+            uint32_t scopeIndex;
+            CUevent beginEvent;
+            CUevent endEvent;
+        };
+
+        struct Frame {
+            std::vector<CUevent> events;
+            uint32_t numUsedEvents;
+            std::vector<Query> queries;
+        };
+
+        struct Scope {
+            std::string name;
+            ScopeStats stats;
+            std::vector<float> history;
+            uint32_t historyPosition;
+        };
+
+        CUcontext m_cuContext;
+        std::vector<Frame> m_frames;
+        // JP: 解決待ちのフレームのスロット番号。古い順。
+        // EN: Slot indices of frames waiting for resolution, oldest first.
+        std::deque<uint32_t> m_pendingFrames;
+        std::vector<Scope> m_scopes;
+        std::map<std::string, uint32_t> m_scopeIndices;
+        std::vector<float> m_frameDurations;
+        uint32_t m_numAverageSamples;
+        uint32_t m_curFrameSlot;
+        uint64_t m_numDroppedFrames;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        TimestampPool(const TimestampPool &) = delete;
+        TimestampPool &operator=(const TimestampPool &) = delete;
+
+        CUevent acquireEvent(Frame* frame);
+        bool resolveFrame(const Frame &frame);
+
+    public:
+        TimestampPool();
+        ~TimestampPool();
+
+        // JP: numFramesはスロットを再利用するまでに解決を待つフレーム数。
+        // EN: numFrames is the number of frames to wait for resolution until reusing a slot.
+        void initialize(CUcontext context, uint32_t numFrames = 4, uint32_t numAverageSamples = 60);
+        void finalize();
+
+        // JP: 同じ名前に対しては同じインデックスを返す。
+        // EN: Returns the same index for the same name.
+        uint32_t registerScope(const char* name);
+
+        // JP: 完了したフレームを解決して新しいフレームを開始する。
+        // EN: Resolve completed frames then start a new frame.
+        void beginFrame();
+        // JP: 同じフレーム内で同じ区間を複数回発行した場合は合計時間になる。
+        // EN: When the same scope is issued multiple times in a frame, its time is the sum.
+        void begin(CUstream stream, uint32_t scopeIndex);
+        void end(CUstream stream, uint32_t scopeIndex);
+
+        uint32_t getNumScopes() const {
+            return static_cast<uint32_t>(m_scopes.size());
+        }
+        const std::string &getScopeName(uint32_t scopeIndex) const {
+            return m_scopes[scopeIndex].name;
+        }
+        const ScopeStats &getScopeStats(uint32_t scopeIndex) const {
+            return m_scopes[scopeIndex].stats;
+        }
+        uint64_t getNumDroppedFrames() const {
+            return m_numDroppedFrames;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
+    // JP: ストリームに発行された非同期処理の完了を表すイベント。
+    // EN: Event representing completion of asynchronous work issued to a stream.
+    class CompletionEvent {
+        CUcontext m_cuContext;
+        CUevent m_event;
+
+        CompletionEvent(const CompletionEvent &) = delete;
+        CompletionEvent &operator=(const CompletionEvent &) = delete;
+
+    public:
+        CompletionEvent() : m_cuContext(nullptr), m_event(nullptr) {}
+        CompletionEvent(CUcontext context, CUstream stream) : m_cuContext(context) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            CUDADRV_CHECK(cuEventCreate(&m_event, CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventRecord(m_event, stream));
+        }
+        ~CompletionEvent() {
+            if (m_event)
+                cuEventDestroy(m_event);
+        }
+
+        CompletionEvent(CompletionEvent &&b) : m_cuContext(b.m_cuContext), m_event(b.m_event) {
+            b.m_event = nullptr;
+        }
+        CompletionEvent &operator=(CompletionEvent &&b) {
+            if (m_event)
+                CUDADRV_CHECK(cuEventDestroy(m_event));
+            m_cuContext = b.m_cuContext;
+            m_event = b.m_event;
+            b.m_event = nullptr;
+            return *this;
+        }
+
+        bool isCompleted() const {
+            if (!m_event)
+                return true;
+            CUresult res = cuEventQuery(m_event);
+            if (res == CUDA_ERROR_NOT_READY)
+                return false;
+            CUDADRV_CHECK(res);
+            return true;
+        }
+        void wait() const {
+            if (m_event)
+                CUDADRV_CHECK(cuEventSynchronize(m_event));
+        }
+        // JP: 指定したストリームの後続の処理をこのイベントの完了まで待たせる。
+        // EN: Make subsequent work on the given stream wait for this event to complete.
+        void waitOnStream(CUstream stream) const {
+            if (m_event)
+                CUDADRV_CHECK(cuStreamWaitEvent(stream, m_event, 0));
+        }
+
+        CUevent getCUevent() const {
+            return m_event;
+        }
+    };
+
+
+
+    // JP: ストリームに発行される一連の処理(カーネル、optixAccelBuild、optixLaunchなど)をCUDA Graphとして記録し再生する。
+    //     実行可能グラフは処理の構成を表すアプリケーション定義のトポロジーキーごとに保持し、
+    //     キーに対応するグラフが無い場合のみ記録する。
+    //     フレームごとに変わるカーネル引数は、記録時に登録したカーネルノードの引数を書き換えて反映する。
+    //     記録中は同期、メモリ確保、グラフィクスリソースのマップ、ホストメモリからのコピーなどを行ってはならない。
+    //     記録された処理が参照するデバイスメモリーのアドレスは再生時も有効である必要がある。
+    // EN: Record a sequence of work issued to a stream (kernels, optixAccelBuild, optixLaunch and so on)
+    //     as a CUDA graph and replay it.
+    //     Executable graphs are kept per application-defined topology key representing the structure of the work,
+    //     and a capture is needed only when there is no graph for the key.
+    //     Kernel arguments varying per frame are applied by rewriting the arguments of kernel nodes
+    //     registered during the capture.
+    //     Synchronization, memory allocation, mapping graphics resources, copies from host memory and so on
+    //     must not be performed during a capture.
+    //     Addresses of device memory referenced by the recorded work need to stay valid for replays.
+    class GraphRecorder {
+    public:
+        struct Stats {
+            uint64_t numCaptures;
+            uint64_t numInstantiations;
+            // JP: 記録し直さずにカーネルノードの引数を書き換えた回数。
+            // EN: The number of times kernel node arguments were rewritten without re-capturing.
+            uint64_t numPatches;
+            uint64_t numLaunches;
+        };
+
+    private:
+        struct KernelNode {
+            uint32_t nodeID;
+            CUgraphNode node;
+            CUDA_KERNEL_NODE_PARAMS params;
+        };
+
+        struct ExecGraph {
+            uint64_t topologyKey;
+            // JP: カーネルノードの書き換えにはインスタンス化元のグラフのノードが必要なので保持する。
+            // EN: Keep the graph instantiated from since rewriting kernel nodes requires its nodes.
+            CUgraph graph;
+            CUgraphExec graphExec;
+            std::vector<KernelNode> kernelNodes;
+        };
+
+        static constexpr uint32_t InvalidExecGraphIndex = 0xFFFFFFFF;
+
+        CUcontext m_cuContext;
+        CUstream m_captureStream;
+        std::vector<ExecGraph> m_execGraphs;
+        uint64_t m_curTopologyKey;
+        uint32_t m_curExecGraphIndex;
+        std::vector<std::pair<uint32_t, CUgraphNode>> m_capturedKernelNodes;
+        Stats m_stats;
+
+        struct {
+            unsigned int m_initialized : 1;
+            unsigned int m_capturing : 1;
+        };
+
+        GraphRecorder(const GraphRecorder &) = delete;
+        GraphRecorder &operator=(const GraphRecorder &) = delete;
+
+        void destroyExecGraph(ExecGraph* execGraph);
+        void setKernelNodeParams(uint32_t nodeID, void** kernelParams);
+
+    public:
+        GraphRecorder();
+        ~GraphRecorder();
+
+        void initialize(CUcontext context);
+        void finalize();
+
+        // JP: 以降の記録と起動に使う実行可能グラフをトポロジーキーで選ぶ。
+        //     記録済みのグラフがある場合にtrueを返し、その場合は記録せずにlaunch()できる。
+        // EN: Select the executable graph used for the following capture and launch by a topology key.
+        //     Returns true when a recorded graph exists, and then launch() can be called without a capture.
+        bool select(uint64_t topologyKey);
+        // JP: 記録はこのスレッドからの発行に限られ、他のスレッドの処理(ストリーミングなど)には影響しない。
+        // EN: Capture is limited to work issued from this thread and doesn't affect other threads (streaming etc.).
+        void beginCapture(CUstream stream);
+        // JP: 直前に記録したカーネルの起動を、引数を書き換えられるノードとしてnodeIDで登録する。
+        // EN: Register the kernel launch recorded just before as a node whose arguments can be rewritten by nodeID.
+        void addKernelNode(uint32_t nodeID);
+        // JP: 記録を終了して選択中のキーの実行可能グラフを作る。
+        // EN: End the capture and instantiate the executable graph for the selected key.
+        void endCapture();
+        // JP: 選択中のグラフの登録されたカーネルノードの引数を書き換える。引数は記録時のカーネル起動と同じ型で渡す。
+        // EN: Rewrite the arguments of a registered kernel node of the selected graph.
+        //     Pass the arguments with the same types as the recorded kernel launch.
+        template <typename... ArgTypes>
+        void setKernelNodeArguments(uint32_t nodeID, ArgTypes&&... args) {
+            ConstVoidPtr argPointers[sizeof...(args)];
+            addArgPointer(argPointers, std::forward<ArgTypes>(args)...);
+            setKernelNodeParams(nodeID, const_cast<void**>(argPointers));
+        }
+        void launch(CUstream stream);
+        // JP: 全ての実行可能グラフを破棄する。記録された処理が参照するバッファーを作り直した場合などに呼ぶ。
+        // EN: Destroy all the executable graphs.
+        //     Call this e.g. when buffers referenced by the recorded work have been recreated.
+        void invalidate();
+
+        bool isCapturing() const {
+            return m_capturing;
+        }
+        bool isReady() const {
+            return m_curExecGraphIndex != InvalidExecGraphIndex;
+        }
+        const Stats &getStats() const {
+            return m_stats;
+        }
+        void resetStats() {
+            m_stats = {};
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
     enum class BufferType {
         Device = 0,
         GL_Interop = 1,
@@ -264,12 +709,307 @@ namespace cudau {
         Managed = 3, // TODO: test
     };
 
+    enum class ResizeMode {
+        Preserve = 0,
+        Discard,
+    };
+
+    // JP: ReadWrite: 範囲を読み戻し、unmap()で書き戻す。
+    //     ReadOnly: 範囲を読み戻すが、unmap()で書き戻さない。
+    //     WriteOnly: 読み戻しを行わない。ステージングメモリーはwrite-combinedなのでホストから読まないこと。
+    //     WriteDiscard: 読み戻しを行わない。範囲の以前の内容は破棄される。
+    // EN: ReadWrite: Reads back the range and writes it back at unmap().
+    //     ReadOnly: Reads back the range but doesn't write it back at unmap().
+    //     WriteOnly: Doesn't read back. Staging memory is write-combined so don't read it from the host.
+    //     WriteDiscard: Doesn't read back. Previous contents of the range are discarded.
+    enum class MapFlags {
+        ReadWrite = 0,
+        ReadOnly,
+        WriteOnly,
+        WriteDiscard,
+    };
+
+    enum class ManagedMemoryLocation {
+        Device = 0,
+        Host,
+    };
+
+    // JP: ReadMostly: 読み取り専用の複製を各プロセッサーに作ることを許す。場所の指定は無視される。
+    //     PreferredLocation: 指定した場所にページを置くことを優先する。
+    //     AccessedBy: 指定した場所から常にマップされた状態を保ちページフォールトを避ける。
+    // EN: ReadMostly: Allows read-only duplicates on each processor. The location is ignored.
+    //     PreferredLocation: Prefers placing pages at the given location.
+    //     AccessedBy: Keeps pages mapped from the given location to avoid page faults.
+    enum class ManagedMemoryAdvice {
+        ReadMostly = 0,
+        PreferredLocation,
+        AccessedBy,
+    };
+
+    // JP: デバイスメモリーの用途。メモリー使用量はコンテキストごと、用途ごとに集計される。
+    // EN: Purpose of device memory. Memory usage is accounted per context and per category.
+    enum class MemoryCategory {
+        User = 0,
+        AS,
+        ASCompacted,
+        Scratch,
+        SBT,
+        Geometry,
+        Texture,
+        Framebuffer,
+        NumCategories
+    };
+
+    struct MemoryCategoryStats {
+        size_t numLiveBytes;
+        size_t numPeakBytes;
+        uint32_t numLiveAllocations;
+        uint64_t numTotalAllocations;
+    };
+
+    const char* getMemoryCategoryName(MemoryCategory category);
+
+    // JP: Buffer/Arrayは確保・解放時に自動的に記録する。
+    //     cudau以外で確保したメモリーを集計に含めたい場合に直接呼ぶ。
+    // EN: Buffer/Array record these automatically at allocation and release.
+    //     Call these directly to include memory allocated outside of cudau in the accounting.
+    void recordMemoryAllocation(CUcontext context, MemoryCategory category, size_t size);
+    void recordMemoryRelease(CUcontext context, MemoryCategory category, size_t size);
+
+    MemoryCategoryStats getMemoryStats(CUcontext context, MemoryCategory category);
+    void resetMemoryPeaks(CUcontext context);
+    // JP: 全用途の統計をJSON文字列として出力する。
+    // EN: Output stats of all categories as a JSON string.
+    std::string dumpMemoryStatsAsJSON(CUcontext context);
+
+    // JP: 大きなスラブから整列された部分範囲を切り出して割り当てるアリーナ。
+    //     小さなバッファーを大量に確保する場合にcuMemAlloc/cuMemFreeの呼び出し回数を減らす。
+    //     解放された範囲は隣接する空き範囲と結合され、後の割り当てで再利用される。
+    // EN: Arena which sub-allocates aligned ranges from large slabs.
+    //     This reduces the number of cuMemAlloc/cuMemFree calls when allocating lots of small buffers.
+    //     A freed range is merged with adjacent free ranges and reused by later allocations.
+    class MemoryArena {
+        struct Slab {
+            CUdeviceptr base;
+            size_t size;
+            std::map<size_t, size_t> freeRanges; // offset -> size
+            size_t numFreeBytes;
+        };
+
+        CUcontext m_cuContext;
+        BufferType m_type;
+        size_t m_slabSize;
+        size_t m_alignment;
+        std::vector<Slab> m_slabs;
+        size_t m_numUsedBytes;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        MemoryArena(const MemoryArena &) = delete;
+        MemoryArena &operator=(const MemoryArena &) = delete;
+
+        void addSlab(size_t size);
+
+    public:
+        MemoryArena();
+        ~MemoryArena();
+
+        void initialize(CUcontext context, BufferType type, size_t slabSize, size_t alignment = 256);
+        void finalize();
+
+        CUdeviceptr allocate(size_t size, size_t alignment = 0);
+        void deallocate(CUdeviceptr ptr, size_t size);
+        // JP: 使われていないスラブを解放する。
+        // EN: Release slabs which have no live allocation.
+        void trim();
+
+        CUcontext getCUcontext() const {
+            return m_cuContext;
+        }
+        BufferType getBufferType() const {
+            return m_type;
+        }
+        size_t getAlignment() const {
+            return m_alignment;
+        }
+        size_t getNumSlabs() const {
+            return m_slabs.size();
+        }
+        size_t getReservedSize() const {
+            size_t ret = 0;
+            for (const Slab &slab : m_slabs)
+                ret += slab.size;
+            return ret;
+        }
+        size_t getUsedSize() const {
+            return m_numUsedBytes;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+    // JP: cuMemAllocFromPoolAsync/cuMemFreeAsyncによるストリーム順序のデバイスメモリープール。
+    //     解放されたブロックはサイズクラスごとにキャッシュされ、ドライバーに返さずに再利用される。
+    //     キャッシュからの再利用は、解放時にストリームに記録したイベントを割り当て側のストリームに待たせて順序付ける。
+    //     割り当てと解放はどちらもホストやデバイス全体を同期しない。
+    // EN: Stream-ordered device memory pool using cuMemAllocFromPoolAsync/cuMemFreeAsync.
+    //     Freed blocks are cached per size class and reused without returning them to the driver.
+    //     Reuse from the cache is ordered by making the allocating stream wait for the event recorded at free.
+    //     Neither allocation nor free synchronizes the host or the whole device.
+    class StreamOrderedMemoryPool {
+        struct CachedBlock {
+            CUdeviceptr pointer;
+            CUevent fence;
+        };
+
+        CUcontext m_cuContext;
+        CUmemoryPool m_memPool;
+        std::map<size_t, std::vector<CachedBlock>> m_cache; // size class -> blocks
+        std::vector<CUevent> m_freeFences;
+        uint64_t m_releaseThreshold;
+        size_t m_maxCachedBytes;
+        size_t m_numCachedBytes;
+        size_t m_numAllocatedBytes;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        StreamOrderedMemoryPool(const StreamOrderedMemoryPool &) = delete;
+        StreamOrderedMemoryPool &operator=(const StreamOrderedMemoryPool &) = delete;
+
+        CUevent getFence();
+
+    public:
+        StreamOrderedMemoryPool();
+        ~StreamOrderedMemoryPool();
+
+        // JP: releaseThresholdはドライバーのプールが同期時にOSへ返さずに保持するメモリー量。
+        //     maxCachedBytesはサイズクラスキャッシュが保持するブロックの合計サイズの上限。
+        // EN: releaseThreshold is the amount of memory the driver's pool keeps without returning it to the OS at sync.
+        //     maxCachedBytes is the upper bound of the total size of blocks held by the size-class cache.
+        void initialize(CUcontext context, uint64_t releaseThreshold, size_t maxCachedBytes = 64 * 1024 * 1024);
+        void finalize();
+
+        void setReleaseThreshold(uint64_t releaseThreshold);
+
+        // JP: サイズはサイズクラスに切り上げられる。
+        // EN: The size is rounded up to its size class.
+        CUdeviceptr allocate(size_t size, CUstream stream);
+        void deallocate(CUdeviceptr ptr, size_t size, CUstream stream);
+        // JP: キャッシュされたブロックをドライバーのプールに返し、プールをreleaseThresholdまで縮める。
+        // EN: Return cached blocks to the driver's pool and shrink the pool down to releaseThreshold.
+        void trim(CUstream stream);
+
+        // JP: 2のべき乗の間を4段階に分けたサイズクラス。無駄は最大25%に抑えられる。
+        // EN: Size classes which split the range between powers of two into four steps, bounding waste to 25%.
+        static size_t calcSizeClass(size_t size) {
+            constexpr size_t minSizeClass = 256;
+            if (size <= minSizeClass)
+                return minSizeClass;
+            size_t pow2 = minSizeClass;
+            while (pow2 * 2 < size)
+                pow2 *= 2;
+            size_t step = pow2 / 4;
+            return (size + step - 1) / step * step;
+        }
+
+        CUcontext getCUcontext() const {
+            return m_cuContext;
+        }
+        CUmemoryPool getCUmemoryPool() const {
+            return m_memPool;
+        }
+        uint64_t getReleaseThreshold() const {
+            return m_releaseThreshold;
+        }
+        size_t getCachedSize() const {
+            return m_numCachedBytes;
+        }
+        size_t getAllocatedSize() const {
+            return m_numAllocatedBytes;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+    // JP: 再利用可能なページロックされたホストメモリーのプール。
+    //     ブロックは解放時にストリームに記録されたイベントが完了してから再利用される。
+    // EN: Pool of reusable page-locked host memory.
+    //     A released block is reused after the event recorded to the stream at release completes.
+    class HostStagingPool {
+        struct Block {
+            uint8_t* pointer;
+            size_t size;
+            CUevent fence;
+            bool writeCombined;
+            bool inUse;
+        };
+
+        CUcontext m_cuContext;
+        std::vector<Block> m_blocks;
+        size_t m_numAllocatedBytes;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        HostStagingPool(const HostStagingPool &) = delete;
+        HostStagingPool &operator=(const HostStagingPool &) = delete;
+
+    public:
+        static constexpr uint32_t InvalidBlockIndex = 0xFFFFFFFF;
+
+        HostStagingPool();
+        ~HostStagingPool();
+
+        void initialize(CUcontext context);
+        void finalize();
+
+        uint32_t allocate(size_t size, bool writeCombined, void** pointer);
+        // JP: ブロックを使う非同期コピーを発行したストリームにフェンスを記録する。
+        // EN: Record the fence to the stream on which an asynchronous copy using the block was issued.
+        void record(uint32_t blockIndex, CUstream stream);
+        void release(uint32_t blockIndex, CUstream stream);
+        // JP: ブロックに対する直近の非同期コピーの完了を待つ。
+        // EN: Wait for the last asynchronous copy on the block to complete.
+        void wait(uint32_t blockIndex) const;
+
+        CUcontext getCUcontext() const {
+            return m_cuContext;
+        }
+        uint32_t getNumBlocks() const {
+            return static_cast<uint32_t>(m_blocks.size());
+        }
+        size_t getNumAllocatedBytes() const {
+            return m_numAllocatedBytes;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
     class Buffer {
+        struct PhysicalChunk {
+            CUmemGenericAllocationHandle handle;
+            size_t size;
+        };
+
         CUcontext m_cuContext;
         BufferType m_type;
+        MemoryArena* m_arena;
+        StreamOrderedMemoryPool* m_memoryPool;
+        CUstream m_allocationStream;
+        HostStagingPool* m_stagingPool;
+        MemoryCategory m_memoryCategory;
 
-        uint32_t m_numElements;
+        size_t m_numElements;
         uint32_t m_stride;
+        size_t m_capacityInBytes;
 
         void* m_hostPointer;
         CUdeviceptr m_devicePointer;
@@ -278,17 +1018,37 @@ namespace cudau {
         uint32_t m_GLBufferID;
         CUgraphicsResource m_cudaGfxResource;
 
+        size_t m_mappedRangeOffset;
+        size_t m_mappedRangeSize;
+        void* m_mappedRangePointer;
+        uint32_t m_stagingBlockIndex;
+        MapFlags m_mapFlags;
+
+        size_t m_reservedSizeInBytes;
+        size_t m_allocationGranularity;
+        std::vector<PhysicalChunk> m_physicalChunks;
+
+        // JP: マネージドバッファーのプリフェッチのためにデバイスと並行アクセスのサポートを確保時に問い合わせておく。
+        // EN: Query the device and the concurrent access support at allocation for prefetching a managed buffer.
+        CUdevice m_device;
+
         struct {
             unsigned int m_initialized : 1;
             unsigned int m_persistentMappedMemory : 1;
             unsigned int m_mapped : 1;
+            unsigned int m_rangeMapped : 1;
+            unsigned int m_stableAddress : 1;
+            unsigned int m_concurrentManagedAccess : 1;
         };
 
         Buffer(const Buffer &) = delete;
         Buffer &operator=(const Buffer &) = delete;
 
         void initialize(CUcontext context, BufferType type,
-                        uint32_t numElements, uint32_t stride, uint32_t glBufferID);
+                        size_t numElements, uint32_t stride, uint32_t glBufferID);
+        void queryManagedAccessSupport();
+        void mapPhysicalMemory(size_t offset, size_t size);
+        void growStableAddressRange(size_t sizeInBytes);
 
     public:
         Buffer();
@@ -298,9 +1058,30 @@ namespace cudau {
         Buffer &operator=(Buffer &&b);
 
         void initialize(CUcontext context, BufferType type,
-                        uint32_t numElements, uint32_t stride) {
+                        size_t numElements, uint32_t stride) {
             initialize(context, type, numElements, stride, 0);
         }
+        // JP: アリーナから切り出したメモリーを使うバッファーとして初期化する。
+        //     スラブ自体はアリーナが所有し、finalize()では範囲がアリーナに返却される。
+        // EN: Initialize as a buffer backed by a range sub-allocated from the arena.
+        //     The arena owns the slab itself and finalize() returns the range to the arena.
+        void initialize(MemoryArena* arena, size_t numElements, uint32_t stride);
+        // JP: ストリーム順序のプールから確保するデバイスバッファーとして初期化する。
+        //     解放は最後にinitialize()/resize()/reserve()に渡したストリーム上で順序付けられる。
+        // EN: Initialize as a device buffer allocated from the stream-ordered pool.
+        //     Free is ordered on the stream last passed to initialize()/resize()/reserve().
+        void initialize(StreamOrderedMemoryPool* pool, size_t numElements, uint32_t stride, CUstream stream);
+        // JP: maxNumElements分の仮想アドレス範囲を予約し、必要に応じて物理メモリーを末尾にマップして伸長する
+        //     デバイスバッファーとして初期化する。
+        //     maxNumElementsまではresize()/reserve()でデバイスポインターが変わらずコピーも発生しないため、
+        //     デバイス側のテーブルに埋め込んだアドレスを修正する必要がない。
+        //     ストライドの変更はサポートしない。
+        // EN: Initialize as a device buffer which reserves a virtual address range for maxNumElements
+        //     and grows by mapping physical memory to its tail as needed.
+        //     resize()/reserve() up to maxNumElements neither change the device pointer nor copy,
+        //     so addresses baked into device-side tables don't need fixing up.
+        //     Changing the stride is not supported.
+        void initializeStableAddress(CUcontext context, size_t numElements, uint32_t stride, size_t maxNumElements);
         void initializeFromGLBuffer(CUcontext context, uint32_t stride, uint32_t glBufferID) {
 #if defined(CUDA_UTIL_USE_GL_INTEROP)
             GLint currentBuffer;
@@ -321,7 +1102,17 @@ namespace cudau {
         }
         void finalize();
 
-        void resize(uint32_t numElements, uint32_t stride, CUstream stream = 0);
+        // JP: 確保済みの容量に収まる場合は再確保を行わない。
+        //     容量を超える場合は幾何級数的に容量を増やして再確保する。
+        //     ResizeMode::Discardの場合は以前の内容をコピーしない。
+        // EN: Doesn't reallocate when the new size fits in the current capacity.
+        //     Otherwise, reallocates with geometrically grown capacity.
+        //     ResizeMode::Discard skips copying the previous contents.
+        void resize(size_t numElements, uint32_t stride, ResizeMode mode, CUstream stream = 0);
+        void resize(size_t numElements, uint32_t stride, CUstream stream = 0) {
+            resize(numElements, stride, ResizeMode::Preserve, stream);
+        }
+        void reserve(size_t numElements, CUstream stream = 0);
 
         CUcontext getCUcontext() const {
             return m_cuContext;
@@ -329,11 +1120,23 @@ namespace cudau {
         BufferType getBufferType() const {
             return m_type;
         }
+        MemoryArena* getMemoryArena() const {
+            return m_arena;
+        }
+        StreamOrderedMemoryPool* getMemoryPool() const {
+            return m_memoryPool;
+        }
+        // JP: 確保済みのバッファーの用途を変えた場合は集計も移し替えられる。
+        // EN: Changing the category of an allocated buffer moves its accounting as well.
+        void setMemoryCategory(MemoryCategory category);
+        MemoryCategory getMemoryCategory() const {
+            return m_memoryCategory;
+        }
 
         CUdeviceptr getCUdeviceptr() const {
             return m_devicePointer;
         }
-        CUdeviceptr getCUdeviceptrAt(uint32_t idx) const {
+        CUdeviceptr getCUdeviceptrAt(size_t idx) const {
             return m_devicePointer + static_cast<uintptr_t>(m_stride) * idx;
         }
         size_t sizeInBytes() const {
@@ -345,6 +1148,18 @@ namespace cudau {
         size_t numElements() const {
             return m_numElements;
         }
+        size_t capacity() const {
+            return m_stride > 0 ? m_capacityInBytes / m_stride : 0;
+        }
+        size_t capacityInBytes() const {
+            return m_capacityInBytes;
+        }
+        bool hasStableAddress() const {
+            return m_stableAddress;
+        }
+        size_t reservedSizeInBytes() const {
+            return m_stableAddress ? m_reservedSizeInBytes : m_capacityInBytes;
+        }
         bool isInitialized() const {
             return m_initialized;
         }
@@ -353,11 +1168,39 @@ namespace cudau {
         void endCUDAAccess(CUstream stream);
 
         void setMappedMemoryPersistent(bool b);
+
+        // JP: マネージドバッファーの内容をストリーム上で指定した場所へ移動し、最初のアクセス時のページフォールトを避ける。
+        //     デバイスがマネージドメモリーへの並行アクセスをサポートしない場合(例: Windows)は何もしない。
+        // EN: Migrate the contents of a managed buffer to the given location on the stream
+        //     to avoid page faults on the first touch.
+        //     This does nothing when the device doesn't support concurrent managed access (e.g. Windows).
+        void prefetch(CUstream stream, ManagedMemoryLocation location = ManagedMemoryLocation::Device) const;
+        // JP: マネージドバッファーの配置ヒントを設定(set = falseで解除)する。
+        //     resize()/reserve()による再確保後はヒントを設定し直す必要がある。
+        // EN: Set (or unset with set = false) a placement hint of a managed buffer.
+        //     Hints need to be set again after reallocation by resize()/reserve().
+        void advise(ManagedMemoryAdvice advice, ManagedMemoryLocation location = ManagedMemoryLocation::Device,
+                    bool set = true);
+
+        // JP: mapRange()のステージングメモリーを確保するプールを設定する。
+        //     設定されていない場合はホストヒープを使用する。
+        // EN: Set the pool to allocate staging memory for mapRange() from.
+        //     Host heap is used when the pool is not set.
+        void setStagingPool(HostStagingPool* pool) {
+            m_stagingPool = pool;
+        }
         void* map(CUstream stream = 0);
         template <typename T>
         T* map(CUstream stream = 0) {
             return reinterpret_cast<T*>(map(stream));
         }
+        // JP: offsetからcount個の要素の範囲のみをマップする。
+        // EN: Map only the range of count elements from offset.
+        void* mapRange(size_t offset, size_t count, MapFlags flags, CUstream stream = 0);
+        template <typename T>
+        T* mapRange(size_t offset, size_t count, MapFlags flags, CUstream stream = 0) {
+            return reinterpret_cast<T*>(mapRange(offset, count, flags, stream));
+        }
         void unmap(CUstream stream = 0);
         void* getMappedPointer() const {
             return m_mappedPointer;
@@ -367,7 +1210,7 @@ namespace cudau {
             return reinterpret_cast<T*>(m_mappedPointer);
         }
         template <typename T>
-        void transfer(const T* srcValues, uint32_t numValues, CUstream stream = 0) {
+        void transfer(const T* srcValues, size_t numValues, CUstream stream = 0) {
             if (sizeof(T) * numValues > static_cast<size_t>(m_stride) * m_numElements)
                 throw std::runtime_error("Too large transfer.");
             auto dstValues = map<T>(stream);
@@ -383,6 +1226,9 @@ namespace cudau {
         }
 
         Buffer copy() const;
+        // JP: ストリーム上でコピーする。返り値のバッファーは同じストリームの後続の処理から使用できる。
+        // EN: Copy on the stream. The returned buffer can be used by subsequent work on the same stream.
+        Buffer copy(CUstream stream) const;
     };
 
 
@@ -391,28 +1237,28 @@ namespace cudau {
     class TypedBuffer : public Buffer {
     public:
         TypedBuffer() {}
-        TypedBuffer(CUcontext context, BufferType type, int32_t numElements) {
+        TypedBuffer(CUcontext context, BufferType type, size_t numElements) {
             Buffer::initialize(context, type, numElements, sizeof(T));
         }
-        TypedBuffer(CUcontext context, BufferType type, int32_t numElements, const T &value) {
+        TypedBuffer(CUcontext context, BufferType type, size_t numElements, const T &value) {
             Buffer::initialize(context, type, numElements, sizeof(T));
             T* values = (T*)map();
-            for (int i = 0; i < numElements; ++i)
+            for (size_t i = 0; i < numElements; ++i)
                 values[i] = value;
             unmap();
         }
 
-        void initialize(CUcontext context, BufferType type, int32_t numElements) {
+        void initialize(CUcontext context, BufferType type, size_t numElements) {
             Buffer::initialize(context, type, numElements, sizeof(T));
         }
-        void initialize(CUcontext context, BufferType type, int32_t numElements, const T &value) {
+        void initialize(CUcontext context, BufferType type, size_t numElements, const T &value) {
             Buffer::initialize(context, type, numElements, sizeof(T));
             T* values = (T*)Buffer::map();
-            for (int i = 0; i < numElements; ++i)
+            for (size_t i = 0; i < numElements; ++i)
                 values[i] = value;
             Buffer::unmap();
         }
-        void initialize(CUcontext context, BufferType type, const T* v, uint32_t numElements) {
+        void initialize(CUcontext context, BufferType type, const T* v, size_t numElements) {
             initialize(context, type, numElements);
             CUDADRV_CHECK(cuMemcpyHtoD(Buffer::getCUdeviceptr(), v, numElements * sizeof(T)));
         }
@@ -420,35 +1266,83 @@ namespace cudau {
             initialize(context, type, v.size());
             CUDADRV_CHECK(cuMemcpyHtoD(Buffer::getCUdeviceptr(), v.data(), v.size() * sizeof(T)));
         }
+        // JP: ストリーム上で非同期に転送する。ソースは返り値のイベントが完了するまで有効である必要がある。
+        //     ページロックされたソースを渡すと転送がCPUの処理と重なる。
+        // EN: Transfer asynchronously on the stream. The source must stay valid until the returned event completes.
+        //     Passing a page-locked source lets the transfer overlap with CPU work.
+        CompletionEvent initialize(CUcontext context, BufferType type, const T* v, size_t numElements, CUstream stream) {
+            initialize(context, type, numElements);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(Buffer::getCUdeviceptr(), v, numElements * sizeof(T), stream));
+            return CompletionEvent(context, stream);
+        }
+        template <typename Alloc>
+        CompletionEvent initialize(CUcontext context, BufferType type, const std::vector<T, Alloc> &v, CUstream stream) {
+            return initialize(context, type, v.data(), v.size(), stream);
+        }
+        void initialize(MemoryArena* arena, size_t numElements) {
+            Buffer::initialize(arena, numElements, sizeof(T));
+        }
+        void initialize(MemoryArena* arena, const T* v, size_t numElements) {
+            initialize(arena, numElements);
+            CUDADRV_CHECK(cuMemcpyHtoD(Buffer::getCUdeviceptr(), v, numElements * sizeof(T)));
+        }
+        void initialize(MemoryArena* arena, const std::vector<T> &v) {
+            initialize(arena, v.size());
+            CUDADRV_CHECK(cuMemcpyHtoD(Buffer::getCUdeviceptr(), v.data(), v.size() * sizeof(T)));
+        }
+        void initialize(StreamOrderedMemoryPool* pool, size_t numElements, CUstream stream) {
+            Buffer::initialize(pool, numElements, sizeof(T), stream);
+        }
+        CompletionEvent initialize(MemoryArena* arena, const T* v, size_t numElements, CUstream stream) {
+            initialize(arena, numElements);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(Buffer::getCUdeviceptr(), v, numElements * sizeof(T), stream));
+            return CompletionEvent(arena->getCUcontext(), stream);
+        }
+        template <typename Alloc>
+        CompletionEvent initialize(MemoryArena* arena, const std::vector<T, Alloc> &v, CUstream stream) {
+            return initialize(arena, v.data(), v.size(), stream);
+        }
+        void initializeStableAddress(CUcontext context, size_t numElements, size_t maxNumElements) {
+            Buffer::initializeStableAddress(context, numElements, sizeof(T), maxNumElements);
+        }
         void finalize() {
             Buffer::finalize();
         }
 
-        void resize(int32_t numElements) {
-            Buffer::resize(numElements, sizeof(T));
+        void resize(size_t numElements, ResizeMode mode, CUstream stream = 0) {
+            Buffer::resize(numElements, sizeof(T), mode, stream);
+        }
+        void resize(size_t numElements, CUstream stream = 0) {
+            Buffer::resize(numElements, sizeof(T), ResizeMode::Preserve, stream);
+        }
+        void reserve(size_t numElements, CUstream stream = 0) {
+            Buffer::reserve(numElements, stream);
         }
 
         T* getDevicePointer() const {
             return reinterpret_cast<T*>(getCUdeviceptr());
         }
-        T* getDevicePointerAt(uint32_t idx) const {
+        T* getDevicePointerAt(size_t idx) const {
             return reinterpret_cast<T*>(getCUdeviceptrAt(idx));
         }
 
         T* map(CUstream stream = 0) {
             return Buffer::map<T>(stream);
         }
+        T* mapRange(size_t offset, size_t count, MapFlags flags, CUstream stream = 0) {
+            return Buffer::mapRange<T>(offset, count, flags, stream);
+        }
         T* getMappedPointer() const {
             return Buffer::getMappedPointer<T>();
         }
-        void transfer(const T* srcValues, uint32_t numValues, CUstream stream = 0) {
+        void transfer(const T* srcValues, size_t numValues, CUstream stream = 0) {
             Buffer::transfer<T>(srcValues, numValues, stream);
         }
         void fill(const T &value, CUstream stream = 0) {
             Buffer::fill<T>(value, stream);
         }
 
-        T operator[](uint32_t idx) {
+        T operator[](size_t idx) {
             const T* values = map();
             T ret = values[idx];
             unmap();
@@ -461,11 +1355,47 @@ namespace cudau {
             *reinterpret_cast<Buffer*>(&ret) = Buffer::copy();
             return ret;
         }
+        TypedBuffer<T> copy(CUstream stream) const {
+            TypedBuffer<T> ret;
+            *reinterpret_cast<Buffer*>(&ret) = Buffer::copy(stream);
+            return ret;
+        }
     };
 
+
+
+    // JP: std::vectorなどでページロックされたホストメモリーを使うためのアロケーター。
+    // EN: Allocator to use page-locked host memory with std::vector and so on.
     template <typename T>
+    struct PinnedHostAllocator {
+        using value_type = T;
+
+        PinnedHostAllocator() {}
+        template <typename U>
+        PinnedHostAllocator(const PinnedHostAllocator<U> &) {}
+
+        T* allocate(size_t n) {
+            void* p;
+            CUDADRV_CHECK(cuMemHostAlloc(&p, n * sizeof(T), CU_MEMHOSTALLOC_PORTABLE));
+            return reinterpret_cast<T*>(p);
+        }
+        void deallocate(T* p, size_t) {
+            cuMemFreeHost(p);
+        }
+
+        template <typename U>
+        bool operator==(const PinnedHostAllocator<U> &) const {
+            return true;
+        }
+        template <typename U>
+        bool operator!=(const PinnedHostAllocator<U> &) const {
+            return false;
+        }
+    };
+
+    template <typename T, typename Alloc = std::allocator<T>>
     class TypedHostBuffer {
-        std::vector<T> m_values;
+        std::vector<T, Alloc> m_values;
 
     public:
         TypedHostBuffer() {}
@@ -476,6 +1406,19 @@ namespace cudau {
             b.unmap();
         }
 
+        // JP: ストリーム上で非同期に読み戻す。値は返り値のイベントの完了後に有効になる。
+        //     AllocにPinnedHostAllocatorを使うと読み戻しがCPUの処理と重なる。
+        // EN: Read back asynchronously on the stream. Values become valid after the returned event completes.
+        //     Using PinnedHostAllocator as Alloc lets the readback overlap with CPU work.
+        CompletionEvent readback(const TypedBuffer<T> &b, CUstream stream) {
+            if (b.getBufferType() == BufferType::GL_Interop)
+                throw std::runtime_error("Asynchronous readback of GL-interop buffer is not supported.");
+            CUDADRV_CHECK(cuCtxSetCurrent(b.getCUcontext()));
+            m_values.resize(b.numElements());
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(m_values.data(), b.getCUdeviceptr(), b.sizeInBytes(), stream));
+            return CompletionEvent(b.getCUcontext(), stream);
+        }
+
         T* getPointer() {
             return m_values.data();
         }
@@ -483,16 +1426,322 @@ namespace cudau {
             return m_values.size();
         }
 
-        const T &operator[](uint32_t idx) const {
+        const T &operator[](size_t idx) const {
             return m_values[idx];
         }
-        T &operator[](uint32_t idx) {
+        T &operator[](size_t idx) {
             return m_values[idx];
         }
     };
 
 
 
+    // JP: ホスト側の複製と要素ごとのダーティビットを持つデバイス上のテーブル。
+    //     ホスト側で編集した要素はsync()時に連続するダーティ範囲ごとにまとめて転送される。
+    //     要素数は必要に応じて増え、再確保時はクリーンな要素をデバイス上でコピーする。
+    //     再確保でデバイスポインターが変わりうるので、sync()の後にgetDevicePointer()を取得すること。
+    // EN: Device table with a host-side copy and a per-element dirty bit.
+    //     Elements edited on the host are transferred at sync() per contiguous dirty range.
+    //     The number of elements grows on demand and clean elements are copied on the device at reallocation.
+    //     Reallocation can change the device pointer, so get getDevicePointer() after sync().
+    template <typename T>
+    class MirroredTable {
+    public:
+        struct Stats {
+            uint64_t numRanges;
+            uint64_t numBytes;
+        };
+
+    private:
+        TypedBuffer<T> m_deviceBuffer;
+        std::vector<T> m_hostValues;
+        std::vector<uint64_t> m_dirtyFlags;
+        size_t m_dirtyBegin;
+        size_t m_dirtyEnd;
+        Stats m_lastSyncStats;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        MirroredTable(const MirroredTable &) = delete;
+        MirroredTable &operator=(const MirroredTable &) = delete;
+
+        void uploadRange(size_t begin, size_t end, CUstream stream) {
+            // JP: 縮小前のダーティな要素が範囲に含まれても現在の要素数を超えて転送しない。
+            // EN: Don't transfer beyond the current number of elements even if a run includes dirty elements
+            //     from before a shrink.
+            end = std::min(end, m_hostValues.size());
+            if (begin >= end)
+                return;
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(m_deviceBuffer.getCUdeviceptrAt(begin), &m_hostValues[begin],
+                                            (end - begin) * sizeof(T), stream));
+            ++m_lastSyncStats.numRanges;
+            m_lastSyncStats.numBytes += (end - begin) * sizeof(T);
+        }
+
+    public:
+        MirroredTable() : m_dirtyBegin(0), m_dirtyEnd(0), m_lastSyncStats{}, m_initialized(false) {}
+        ~MirroredTable() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, BufferType type, size_t initialCapacity = 16) {
+            if (m_initialized)
+                throw std::runtime_error("Mirrored table is already initialized.");
+            if (type == BufferType::GL_Interop)
+                throw std::runtime_error("GL-interop buffer cannot be used for a mirrored table.");
+            m_deviceBuffer.initialize(context, type, std::max<size_t>(initialCapacity, 1));
+            m_deviceBuffer.resize(0);
+            m_hostValues.reserve(initialCapacity);
+            m_dirtyBegin = 0;
+            m_dirtyEnd = 0;
+            m_initialized = true;
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+            m_dirtyFlags.clear();
+            m_hostValues.clear();
+            m_deviceBuffer.finalize();
+            m_initialized = false;
+        }
+
+        void setMemoryCategory(MemoryCategory category) {
+            m_deviceBuffer.setMemoryCategory(category);
+        }
+
+        // JP: 増えた要素は既定値で初期化されダーティになる。
+        // EN: Added elements are default-initialized and become dirty.
+        void resize(size_t numElements) {
+            size_t prevNumElements = m_hostValues.size();
+            m_hostValues.resize(numElements);
+            m_dirtyFlags.resize((numElements + 63) / 64, 0);
+            // JP: 縮小した場合は最後のワードに残る範囲外のダーティビットを消す。
+            // EN: Clear out-of-range dirty bits left in the last word when shrinking.
+            if (numElements % 64 != 0)
+                m_dirtyFlags.back() &= (1ull << (numElements % 64)) - 1;
+            if (numElements > prevNumElements)
+                markDirty(prevNumElements, numElements - prevNumElements);
+            m_dirtyEnd = std::min(m_dirtyEnd, numElements);
+            m_dirtyBegin = std::min(m_dirtyBegin, m_dirtyEnd);
+        }
+        size_t add(const T &value) {
+            size_t idx = m_hostValues.size();
+            resize(idx + 1);
+            m_hostValues[idx] = value;
+            return idx;
+        }
+        void set(size_t idx, const T &value) {
+            m_hostValues[idx] = value;
+            markDirty(idx);
+        }
+        // JP: 要素をダーティにしたうえでホスト側の参照を返す。
+        // EN: Mark the element dirty then return the host-side reference.
+        T &edit(size_t idx) {
+            markDirty(idx);
+            return m_hostValues[idx];
+        }
+        void markDirty(size_t idx, size_t count = 1) {
+            if (count == 0)
+                return;
+            if (idx + count > m_hostValues.size())
+                throw std::runtime_error("Dirty range is out of bounds.");
+            if (m_dirtyBegin == m_dirtyEnd) {
+                m_dirtyBegin = idx;
+                m_dirtyEnd = idx + count;
+            }
+            else {
+                m_dirtyBegin = std::min(m_dirtyBegin, idx);
+                m_dirtyEnd = std::max(m_dirtyEnd, idx + count);
+            }
+            for (size_t i = idx; i < idx + count; ++i)
+                m_dirtyFlags[i / 64] |= 1ull << (i % 64);
+        }
+
+        // JP: 必要ならデバイス側を伸長し、ダーティな範囲のみを転送する。
+        //     転送元はページング可能なホストメモリーなので、戻った後にホスト側を編集しても良い。
+        // EN: Grow the device side if necessary, then transfer only the dirty ranges.
+        //     The source is pageable host memory, so editing the host side after return is fine.
+        void sync(CUstream stream) {
+            m_lastSyncStats = Stats{};
+            CUDADRV_CHECK(cuCtxSetCurrent(m_deviceBuffer.getCUcontext()));
+            if (m_hostValues.size() != m_deviceBuffer.numElements())
+                m_deviceBuffer.resize(m_hostValues.size(), ResizeMode::Preserve, stream);
+            if (m_dirtyBegin == m_dirtyEnd)
+                return;
+
+            // JP: ダーティ範囲の外接範囲だけを走査し、連続するダーティな要素を1回のコピーにまとめる。
+            // EN: Scan only the bounding range of dirty elements and merge contiguous dirty elements into a single copy.
+            size_t runBegin = SIZE_MAX;
+            size_t wordIdx = m_dirtyBegin / 64;
+            size_t endWordIdx = (m_dirtyEnd + 63) / 64;
+            for (; wordIdx < endWordIdx; ++wordIdx) {
+                uint64_t word = m_dirtyFlags[wordIdx];
+                m_dirtyFlags[wordIdx] = 0;
+                size_t baseIdx = wordIdx * 64;
+                if (word == 0 || word == ~0ull) {
+                    if (word == 0 && runBegin != SIZE_MAX) {
+                        uploadRange(runBegin, baseIdx, stream);
+                        runBegin = SIZE_MAX;
+                    }
+                    else if (word != 0 && runBegin == SIZE_MAX) {
+                        runBegin = baseIdx;
+                    }
+                    continue;
+                }
+                for (uint32_t bit = 0; bit < 64; ++bit) {
+                    bool dirty = ((word >> bit) & 0x1) != 0;
+                    if (dirty && runBegin == SIZE_MAX) {
+                        runBegin = baseIdx + bit;
+                    }
+                    else if (!dirty && runBegin != SIZE_MAX) {
+                        uploadRange(runBegin, baseIdx + bit, stream);
+                        runBegin = SIZE_MAX;
+                    }
+                }
+            }
+            if (runBegin != SIZE_MAX)
+                uploadRange(runBegin, wordIdx * 64, stream);
+
+            m_dirtyBegin = 0;
+            m_dirtyEnd = 0;
+        }
+
+        T* getDevicePointer() const {
+            return m_deviceBuffer.getDevicePointer();
+        }
+        const TypedBuffer<T> &getBuffer() const {
+            return m_deviceBuffer;
+        }
+        size_t numElements() const {
+            return m_hostValues.size();
+        }
+        const T &operator[](size_t idx) const {
+            return m_hostValues[idx];
+        }
+        const Stats &getLastSyncStats() const {
+            return m_lastSyncStats;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
+    // JP: 小さなホストからデバイスへの書き込みをピン留めされたリングバッファーに記録し、
+    //     フラッシュ時にまとめて転送する。
+    //     スキャッターカーネルが設定されている場合はリング上のバッチ全体を1回でデバイスにコピーし、
+    //     カーネルで各書き込み先に分配する。
+    //     設定されていない場合は隣接する書き込みを結合したうえで個別にコピーを発行する。
+    // EN: Record small host-to-device writes into a pinned ring buffer and transfer them together at flush.
+    //     If a scatter kernel is set, the whole batch on the ring is copied to the device at once
+    //     then the kernel distributes it to each destination.
+    //     Otherwise, adjacent writes are merged then each is issued as an individual copy.
+    class UploadBatcher {
+    public:
+        struct Stats {
+            uint64_t numFlushes;
+            // JP: enqueue()の呼び出し回数。
+            // EN: The number of enqueue() calls.
+            uint64_t numWrites;
+            // JP: 隣接する書き込みを結合した後のコマンド数。
+            // EN: The number of commands after merging adjacent writes.
+            uint64_t numCommands;
+            // JP: 実際に発行したドライバーのコピーとカーネル起動の数。
+            // EN: The number of actually issued driver copies and kernel launches.
+            uint64_t numDriverCalls;
+            uint64_t numBytes;
+        };
+
+    private:
+        struct InFlightBatch {
+            size_t begin;
+            size_t end;
+            CUevent fence;
+        };
+
+        CUcontext m_cuContext;
+        uint8_t* m_ring;
+        CUdeviceptr m_deviceRing;
+        size_t m_ringSize;
+        CUfunction m_scatterKernel;
+
+        size_t m_batchBegin;
+        size_t m_writeOffset;
+        size_t m_freeEnd;
+        std::vector<UploadCommand> m_commands;
+        uint32_t m_numPendingWrites;
+        std::vector<InFlightBatch> m_inFlightBatches;
+        std::vector<CUevent> m_freeFences;
+
+        Stats m_lastFlushStats;
+        Stats m_totalStats;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        UploadBatcher(const UploadBatcher &) = delete;
+        UploadBatcher &operator=(const UploadBatcher &) = delete;
+
+        static constexpr size_t UploadAlignment = 16;
+
+        void retireBatches(size_t begin, size_t end);
+        size_t acquire(size_t size, bool newCommand);
+
+    public:
+        UploadBatcher();
+        ~UploadBatcher();
+
+        void initialize(CUcontext context, size_t ringSize = 1024 * 1024);
+        void finalize();
+
+        // JP: デバイス側でcudau::scatterUploads()を呼ぶカーネルを設定する。
+        // EN: Set a kernel which calls cudau::scatterUploads() on the device side.
+        void setScatterKernel(CUmodule module, const char* name);
+
+        // JP: データはリングバッファーにコピーされるので呼び出し後すぐに再利用できる。
+        // EN: The data is copied into the ring buffer, so it can be reused immediately after the call.
+        void enqueue(CUdeviceptr dstAddress, const void* data, size_t size);
+        void enqueue(const Buffer &buffer, size_t offsetInBytes, const void* data, size_t size) {
+            if (offsetInBytes + size > buffer.sizeInBytes())
+                throw std::runtime_error("Upload range is out of bounds.");
+            enqueue(buffer.getCUdeviceptr() + offsetInBytes, data, size);
+        }
+        template <typename T>
+        void enqueue(const TypedBuffer<T> &buffer, size_t idx, const T &value) {
+            enqueue(buffer, idx * sizeof(T), &value, sizeof(T));
+        }
+        template <typename T>
+        void enqueue(CUdeviceptr dstAddress, const T &value) {
+            enqueue(dstAddress, &value, sizeof(T));
+        }
+
+        void flush(CUstream stream);
+
+        uint32_t getNumPendingWrites() const {
+            return m_numPendingWrites;
+        }
+        const Stats &getLastFlushStats() const {
+            return m_lastFlushStats;
+        }
+        const Stats &getTotalStats() const {
+            return m_totalStats;
+        }
+        void resetStats() {
+            m_lastFlushStats = {};
+            m_totalStats = {};
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
     enum class ArrayElementType {
         UInt8,
         Int8,
@@ -550,6 +1799,8 @@ namespace cudau {
         uint32_t m_GLTexID;
         CUgraphicsResource m_cudaGfxResource;
 
+        MemoryCategory m_memoryCategory;
+
         struct {
             unsigned int m_surfaceLoadStore : 1;
             unsigned int m_useTextureGather : 1;
@@ -564,6 +1815,7 @@ namespace cudau {
         void initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
                         uint32_t width, uint32_t height, uint32_t depth, uint32_t numMipmapLevels,
                         bool writable, bool useTextureGather, bool cubemap, bool layered, uint32_t glTexID);
+        size_t calcSizeInBytes() const;
 
     public:
         Array();
@@ -660,6 +1912,22 @@ namespace cudau {
         uint32_t getNumMipmapLevels() const {
             return m_numMipmapLevels;
         }
+        ArrayElementType getElementType() const {
+            return m_elemType;
+        }
+        uint32_t getNumChannels() const {
+            return m_numChannels;
+        }
+        size_t getLevelSizeInBytes(uint32_t mipmapLevel) const {
+            uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
+            uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
+            uint32_t depth = std::max<uint32_t>(1, m_depth);
+            return static_cast<size_t>(m_stride) * width * height * depth;
+        }
+        void setMemoryCategory(MemoryCategory category);
+        MemoryCategory getMemoryCategory() const {
+            return m_memoryCategory;
+        }
         bool isInitialized() const {
             return m_initialized;
         }
@@ -673,12 +1941,24 @@ namespace cudau {
             return reinterpret_cast<T*>(map(mipmapLevel, stream));
         }
         void unmap(uint32_t mipmapLevel = 0, CUstream stream = 0);
+        // JP: 詰められたレベルの内容をステージング無しでホストメモリーから直接コピーする。
+        //     srcDataがページロックされている(例: cuMemHostRegister済み)場合は非同期DMAになるので、
+        //     コピーが完了するまでsrcDataを保持する必要がある。
+        // EN: Copies tightly packed contents of a level directly from host memory without staging.
+        //     This is an asynchronous DMA when srcData is page-locked (e.g. registered by cuMemHostRegister),
+        //     so srcData must be kept until the copy completes.
+        void write(const void* srcData, size_t size, uint32_t mipmapLevel = 0, CUstream stream = 0);
+        // JP: レベルの内容を詰めた形でホストメモリーへ直接コピーする。
+        //     dstDataがページロックされている場合は非同期なので、ストリームの同期後に読むこと。
+        // EN: Copies contents of a level directly to host memory tightly packed.
+        //     This is asynchronous when dstData is page-locked, so read it after synchronizing the stream.
+        void read(void* dstData, size_t size, uint32_t mipmapLevel = 0, CUstream stream = 0) const;
         template <typename T>
-        void transfer(const T* srcValues, uint32_t numValues, uint32_t mipmapLevel = 0, CUstream stream = 0) {
+        void transfer(const T* srcValues, size_t numValues, uint32_t mipmapLevel = 0, CUstream stream = 0) {
             uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
             uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
             uint32_t depth = std::max<uint32_t>(1, m_depth);
-            size_t size = static_cast<size_t>(m_stride) * depth * height * width;
+            size_t size = static_cast<size_t>(m_stride) * width * height * depth;
             if (sizeof(T) * numValues > size)
                 throw std::runtime_error("Too large transfer.");
             auto dstValues = map<T>(mipmapLevel, stream);
@@ -690,7 +1970,7 @@ namespace cudau {
             uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
             uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
             uint32_t depth = std::max<uint32_t>(1, m_depth);
-            size_t size = static_cast<size_t>(m_stride) * depth * height * width;
+            size_t size = static_cast<size_t>(m_stride) * width * height * depth;
             size_t numValues = size / sizeof(T);
             auto dstValues = map<T>(mipmapLevel, stream);
             std::fill_n(dstValues, numValues, value);
@@ -786,6 +2066,12 @@ namespace cudau {
         NormalizedFloat_sRGB
     };
     
+    // JP: 線形メモリ上のテクスチャーの行ピッチをCU_DEVICE_ATTRIBUTE_TEXTURE_PITCH_ALIGNMENTに揃えて返す。
+    //     バッファーは例えばBuffer::initialize(context, type, height, pitch)のように行単位で確保する。
+    // EN: Returns the row pitch of a texture over linear memory aligned to CU_DEVICE_ATTRIBUTE_TEXTURE_PITCH_ALIGNMENT.
+    //     Allocate the buffer per row, e.g. Buffer::initialize(context, type, height, pitch).
+    uint32_t calcTexturePitch(CUcontext context, ArrayElementType elemType, uint32_t numChannels, uint32_t width);
+
     class TextureSampler {
         CUDA_TEXTURE_DESC m_texDesc;
 
@@ -818,6 +2104,11 @@ namespace cudau {
             else
                 m_texDesc.flags |= CU_TRSF_NORMALIZED_COORDINATES;
         }
+        // JP: これより細かいミップレベルはサンプルされない。
+        // EN: Mip levels finer than this are never sampled.
+        void setMinMipmapLevelClamp(float level) {
+            m_texDesc.minMipmapLevelClamp = level;
+        }
         void setReadMode(TextureReadMode mode) {
             if (mode == TextureReadMode::ElementType)
                 m_texDesc.flags |= CU_TRSF_READ_AS_INTEGER;
@@ -830,6 +2121,20 @@ namespace cudau {
                 m_texDesc.flags &= ~CU_TRSF_SRGB;
         }
 
+        const CUDA_TEXTURE_DESC &getTextureDesc() const {
+            return m_texDesc;
+        }
+
+        // JP: ピッチ付き線形メモリ上のテクスチャー。カーネルがバッファーに直接書いた内容をコピー無しでサンプルできる。
+        //     ミップマップは持てない。
+        // EN: Texture over pitched linear memory. Contents written directly into the buffer by a kernel
+        //     can be sampled without copies. Mipmaps are not available.
+        CUtexObject createTextureObject(const Buffer &buffer, ArrayElementType elemType, uint32_t numChannels,
+                                        uint32_t width, uint32_t height, uint32_t pitchInBytes);
+        // JP: 線形メモリ上の1Dテクスチャー。整数座標によるフェッチ(tex1Dfetch)のみ可能。
+        // EN: 1D texture over linear memory. Only fetches with integer coordinates (tex1Dfetch) are available.
+        CUtexObject createTextureObject(const Buffer &buffer, ArrayElementType elemType, uint32_t numChannels);
+
         CUtexObject createTextureObject(const Array &array) {
             CUDA_RESOURCE_DESC resDesc = {};
             CUDA_RESOURCE_VIEW_DESC resViewDesc = {};
@@ -850,6 +2155,203 @@ namespace cudau {
         }
     };
 
+    // JP: 粗いミップテールを初期化時に転送し、細かいレベルはバックグラウンドスレッドで読み込んで
+    //     update()毎にバイト予算内で転送するテクスチャー。
+    //     テクスチャーオブジェクトは常駐している最も細かいレベルにクランプされ、レベルが常駐するたびに作り直される。
+    // EN: Texture that uploads the coarse mip tail at initialization, loads finer levels on a background thread
+    //     and uploads them within a byte budget per update().
+    //     The texture object is clamped to the finest resident level and recreated each time a level becomes resident.
+    class StreamingTexture {
+    public:
+        // JP: バックグラウンドスレッド(ミップテールは初期化を呼んだスレッド)から呼ばれる。
+        //     Array::transfer()と同じレイアウトでミップレベルの内容を詰めて返す。
+        // EN: Called on the background thread (on the thread calling initialize() for the mip tail).
+        //     Returns the tightly packed contents of a mip level in the same layout as Array::transfer().
+        using MipLoader = std::function<void(uint32_t mipLevel, std::vector<uint8_t>* data)>;
+
+    private:
+        struct RetiredTextureObject {
+            CUtexObject texObject;
+            CUevent fence;
+        };
+
+        // JP: 読み込み済みで未転送のレベルをこれ以上溜めない。
+        // EN: Do not keep more loaded but not yet uploaded levels than this.
+        static constexpr uint32_t MaxNumQueuedLevels = 2;
+
+        CUcontext m_cuContext;
+        Array m_array;
+        TextureSampler m_sampler;
+        MipLoader m_loader;
+        CUtexObject m_texObject;
+        std::vector<RetiredTextureObject> m_retiredTexObjects;
+        uint32_t m_residentLevel;
+        uint32_t m_numUploadedRows;
+        uint64_t m_numUploadedBytes;
+
+        std::thread m_loaderThread;
+        std::mutex m_mutex;
+        std::condition_variable m_queueCondition;
+        // JP: 先頭が次に転送するレベル(m_residentLevel - 1)。
+        // EN: The front is the level to be uploaded next (m_residentLevel - 1).
+        std::deque<std::vector<uint8_t>> m_loadedLevels;
+        bool m_stopRequested;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        StreamingTexture(const StreamingTexture &) = delete;
+        StreamingTexture &operator=(const StreamingTexture &) = delete;
+
+        void loaderThreadFunc(uint32_t firstLevelToLoad);
+        void uploadRows(uint32_t mipLevel, const uint8_t* data, uint32_t rowBegin, uint32_t numRows,
+                        size_t rowSize, CUstream stream);
+        void recreateTextureObject(CUstream stream);
+
+    public:
+        StreamingTexture();
+        ~StreamingTexture();
+
+        // JP: 最大辺がmaxTailSize以下のレベルをミップテールとして同期的に読み込んで転送する。
+        // EN: Synchronously loads and uploads the levels whose larger dimension is maxTailSize or less as the mip tail.
+        void initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
+                        uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                        const TextureSampler &sampler, const MipLoader &loader,
+                        uint32_t maxTailSize = 64, CUstream stream = 0);
+        void finalize();
+
+        // JP: 読み込み済みのレベルを粗い順にbyteBudgetまで転送する。予算が1行にも満たなくても1行は転送する。
+        //     テクスチャーオブジェクトが作り直された場合はtrueを返すので、呼び出し側はテーブルを更新する。
+        // EN: Uploads loaded levels from coarse to fine up to byteBudget. At least one row is uploaded
+        //     even if the budget is smaller than that.
+        //     Returns true when the texture object was recreated so that the caller can update its table.
+        bool update(CUstream stream, size_t byteBudget);
+
+        CUtexObject getTextureObject() const {
+            return m_texObject;
+        }
+        const Array &getArray() const {
+            return m_array;
+        }
+        uint32_t getResidentLevel() const {
+            return m_residentLevel;
+        }
+        bool isFullyResident() const {
+            return m_residentLevel == 0;
+        }
+        uint64_t getNumUploadedBytes() const {
+            return m_numUploadedBytes;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
+    // JP: 内容のハッシュで重複を排除したArrayと、(Array, サンプラー状態)毎にキャッシュしたテクスチャーオブジェクトを管理する。
+    //     テクスチャーオブジェクトはデバイス側のテーブルに並び、マテリアルは32ビットのIDで参照する。
+    // EN: Manages arrays deduplicated by content hash and texture objects cached per (array, sampler state).
+    //     Texture objects are laid out in a device-side table that materials reference by 32-bit ID.
+    class TexturePool {
+    public:
+        struct Stats {
+            uint32_t numArrays;
+            uint32_t numArrayDedupHits;
+            uint32_t numTextureObjects;
+            uint32_t numTextureObjectCacheHits;
+        };
+
+    private:
+        struct TextureObjectEntry {
+            uint32_t arrayIndex;
+            CUDA_TEXTURE_DESC texDesc;
+        };
+
+        CUcontext m_cuContext;
+        std::vector<Array> m_arrays;
+        std::map<uint64_t, std::vector<uint32_t>> m_arrayIndicesByHash;
+        std::vector<TextureObjectEntry> m_texObjEntries;
+        std::map<std::pair<uint32_t, uint64_t>, std::vector<uint32_t>> m_textureIDsByKey;
+        MirroredTable<CUtexObject> m_table;
+        Stats m_stats;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        TexturePool(const TexturePool &) = delete;
+        TexturePool &operator=(const TexturePool &) = delete;
+
+        // JP: numChannels, width, heightはArrayの保存形式の値(BCフォーマットでは4x4ブロック単位)。
+        // EN: numChannels, width and height are in the storage units of Array (4x4 blocks for BC formats).
+        bool hasSameContents(uint32_t arrayIndex,
+                             ArrayElementType elemType, uint32_t numChannels,
+                             uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                             const void* const* levelData, const size_t* levelSizes, CUstream stream) const;
+        uint32_t findArray(uint64_t contentHash,
+                           ArrayElementType elemType, uint32_t numChannels,
+                           uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                           const void* const* levelData, const size_t* levelSizes, CUstream stream) const;
+
+    public:
+        static constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+
+        // JP: FNV-1aでハッシュを計算する。seedに前回の結果を渡すと複数のデータを連結したハッシュになる。
+        // EN: Calculates FNV-1a hash. Passing the previous result as seed hashes concatenated data.
+        static uint64_t calcContentHash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+        TexturePool();
+        ~TexturePool();
+
+        void initialize(CUcontext context, BufferType type, uint32_t initialCapacity = 64);
+        void finalize();
+
+        // JP: 呼び出し側で初期化したArrayを登録する。同じ内容のArrayが登録済みの場合は渡したArrayを破棄する。
+        //     ハッシュが一致した場合はフォーマット、サイズと内容を比較するため、Arrayの内容を読み戻す。
+        // EN: Registers an array initialized by the caller. The passed array is discarded
+        //     if an array with the same contents is already registered.
+        //     On a hash match, the contents of the arrays are read back to compare format, size and bytes.
+        uint32_t addArray(Array &&array, uint64_t contentHash, CUstream stream = 0);
+        // JP: 各ミップレベルの内容からハッシュを計算し、未登録の場合のみArrayを生成して転送する。
+        //     ハッシュが一致したArrayはフォーマット、サイズと内容が全て同じ場合のみ再利用する。
+        // EN: Calculates the hash from the contents of each mip level and creates and fills an array
+        //     only when it is not registered yet.
+        //     An array with a matching hash is reused only when its format, size and contents are all identical.
+        uint32_t createArray2D(ArrayElementType elemType, uint32_t numChannels,
+                               uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                               const void* const* levelData, const size_t* levelSizes, CUstream stream = 0);
+
+        // JP: (Array, サンプラー状態)に対応するテクスチャーIDを返す。初出の組み合わせではテクスチャーオブジェクトを生成する。
+        //     新しいIDはsync()を呼ぶまでデバイス側に反映されない。
+        // EN: Returns the texture ID for an (array, sampler state) pair. Creates a texture object for a new pair.
+        //     New IDs are not visible on the device until sync() is called.
+        uint32_t getTextureID(uint32_t arrayIndex, const TextureSampler &sampler);
+
+        void sync(CUstream stream) {
+            m_table.sync(stream);
+        }
+
+        const Array &getArray(uint32_t arrayIndex) const {
+            return m_arrays[arrayIndex];
+        }
+        CUtexObject getTextureObject(uint32_t textureID) const {
+            return m_table[textureID];
+        }
+        CUtexObject* getTableDevicePointer() const {
+            return m_table.getDevicePointer();
+        }
+        const Stats &getStats() const {
+            return m_stats;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+
+
     template <uint32_t NumBuffers>
     class InteropTextureObjectHolder {
         Array* m_arrays;
@@ -899,4 +2401,29 @@ namespace cudau {
         }
     };
 #endif // #if !defined(__CUDA_ARCH__)
+
+
+
+#if defined(__CUDA_ARCH__)
+    // JP: UploadBatcherのスキャッターカーネルから呼ぶ。1ブロックが1コマンドを処理する。
+    // EN: Call this from a scatter kernel for UploadBatcher. A block processes a command.
+    CUDA_DEVICE_FUNCTION void scatterUploads(const UploadCommand* commands, uint32_t numCommands,
+                                             const uint8_t* batch) {
+        for (uint32_t cmdIdx = blockIdx.x; cmdIdx < numCommands; cmdIdx += gridDim.x) {
+            const UploadCommand &cmd = commands[cmdIdx];
+            const uint8_t* src = batch + cmd.srcOffset;
+            uint8_t* dst = reinterpret_cast<uint8_t*>(cmd.dstAddress);
+            if (((cmd.dstAddress | reinterpret_cast<unsigned long long>(src) | cmd.size) & 0x3) == 0) {
+                const uint32_t* src32 = reinterpret_cast<const uint32_t*>(src);
+                uint32_t* dst32 = reinterpret_cast<uint32_t*>(dst);
+                for (uint32_t i = threadIdx.x; i < cmd.size / 4; i += blockDim.x)
+                    dst32[i] = src32[i];
+            }
+            else {
+                for (uint32_t i = threadIdx.x; i < cmd.size; i += blockDim.x)
+                    dst[i] = src[i];
+            }
+        }
+    }
+#endif
 } // namespace cudau
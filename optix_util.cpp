@@ -30,6 +30,23 @@ namespace optixu {
 
 
 
+    static void prefetchIfManaged(const Buffer* buffer, CUstream stream) {
+        if (buffer && buffer->isInitialized() && buffer->getBufferType() == BufferType::Managed)
+            buffer->prefetch(stream);
+    }
+
+    // JP: ホストメモリーからの転送、プリフェッチ、ホストから待つイベントはCUDA Graphに記録できないため、
+    //     記録中のストリームではそれらを発行しないか、エラーとする。
+    // EN: Copies from host memory, prefetches and events waited on the host can't be recorded into a CUDA graph,
+    //     so either skip them or raise an error on a capturing stream.
+    static bool isStreamCapturing(CUstream stream) {
+        CUstreamCaptureStatus captureStatus;
+        CUDADRV_CHECK(cuStreamIsCapturing(stream, &captureStatus));
+        return captureStatus != CU_STREAM_CAPTURE_STATUS_NONE;
+    }
+
+
+
     Context Context::create(CUcontext cudaContext) {
         return (new _Context(cudaContext))->getPublicType();
     }
@@ -59,11 +76,15 @@ namespace optixu {
 
 
 
-    void Material::Priv::setRecordData(const _Pipeline* pipeline, uint32_t rayType, HitGroupSBTRecord* record) const {
-        Key key{ pipeline, rayType };
-        const _ProgramGroup* hitGroup = programs.at(key);
-        hitGroup->packHeader(record->header);
-        record->data.materialData = userData;
+    const SBTRecordHeader* Material::Priv::getHitGroupHeaders(const _Pipeline* pipeline, uint32_t numRayTypes) const {
+        auto it = std::find_if(hitGroupSets.cbegin(), hitGroupSets.cend(),
+                               [pipeline](const HitGroupSet &set) {
+                                   return set.pipeline == pipeline;
+                               });
+        THROW_RUNTIME_ERROR(it != hitGroupSets.cend(), "No hit group is set for pipeline %p.", pipeline);
+        THROW_RUNTIME_ERROR(numRayTypes <= it->numValidRayTypes,
+                            "Hit group is not set for ray type %u.", it->numValidRayTypes);
+        return it->headers.data();
     }
     
     void Material::destroy() {
@@ -75,41 +96,258 @@ namespace optixu {
         auto _pipeline = extract(hitGroup)->getPipeline();
         THROW_RUNTIME_ERROR(_pipeline, "Invalid pipeline: %p.", _pipeline);
 
-        _Material::Key key{ _pipeline, rayType };
-        m->programs[key] = extract(hitGroup);
+        auto it = std::find_if(m->hitGroupSets.begin(), m->hitGroupSets.end(),
+                               [_pipeline](const _Material::HitGroupSet &set) {
+                                   return set.pipeline == _pipeline;
+                               });
+        if (it == m->hitGroupSets.end()) {
+            _Material::HitGroupSet set = {};
+            set.pipeline = _pipeline;
+            m->hitGroupSets.push_back(set);
+            it = m->hitGroupSets.end() - 1;
+        }
+        if (rayType >= it->programs.size()) {
+            it->programs.resize(rayType + 1, nullptr);
+            it->headers.resize(rayType + 1, SBTRecordHeader{});
+        }
+        it->programs[rayType] = extract(hitGroup);
+        it->headers[rayType] = extract(hitGroup)->getPackedHeader();
+        it->numValidRayTypes = 0;
+        while (it->numValidRayTypes < it->programs.size() && it->programs[it->numValidRayTypes])
+            ++it->numValidRayTypes;
+        m->sbtRevision = m->context->advanceSBTRevision();
     }
     
     void Material::setUserData(uint32_t data) const {
+        if (data == m->userData)
+            return;
         m->userData = data;
+        m->sbtRevision = m->context->advanceSBTRevision();
     }
 
 
 
     
-    void Scene::Priv::markSBTLayoutDirty() {
-        sbtLayoutIsUpToDate = false;
+    uint32_t Scene::Priv::allocateSBTRange(uint32_t numRecords) {
+        // JP: 解放済みの範囲から先頭適合で探し、無ければ末尾に追加する。
+        // EN: Search the released ranges with first fit, otherwise append to the end.
+        for (auto it = freeSBTRanges.begin(); it != freeSBTRanges.end(); ++it) {
+            if (it->numRecords < numRecords)
+                continue;
+            uint32_t offset = it->offset;
+            it->offset += numRecords;
+            it->numRecords -= numRecords;
+            if (it->numRecords == 0)
+                freeSBTRanges.erase(it);
+            return offset;
+        }
+
+        uint32_t offset = numSBTRecords;
+        numSBTRecords += numRecords;
+        return offset;
+    }
+
+    bool Scene::Priv::tryExtendSBTRange(SBTRange* range, uint32_t numRecords) {
+        uint32_t end = range->offset + range->numRecords;
+        uint32_t numExtraRecords = numRecords - range->numRecords;
+        // JP: 末尾の範囲はそのまま伸ばせる。
+        // EN: The last range can simply be extended.
+        if (end == numSBTRecords) {
+            numSBTRecords += numExtraRecords;
+            range->numRecords = numRecords;
+            return true;
+        }
+
+        // JP: 直後の解放済み範囲が十分大きければそこから取る。
+        // EN: Take from the released range right after this one if it is large enough.
+        auto it = std::lower_bound(freeSBTRanges.begin(), freeSBTRanges.end(), end,
+                                   [](const SBTRange &a, uint32_t offset) {
+                                       return a.offset < offset;
+                                   });
+        if (it == freeSBTRanges.end() || it->offset != end || it->numRecords < numExtraRecords)
+            return false;
+        it->offset += numExtraRecords;
+        it->numRecords -= numExtraRecords;
+        if (it->numRecords == 0)
+            freeSBTRanges.erase(it);
+        range->numRecords = numRecords;
+        return true;
+    }
 
-        for (_InstanceAccelerationStructure* _ias : instASs)
-            _ias->markDirty();
+    void Scene::Priv::releaseSBTRange(const SBTRange &range) {
+        if (range.numRecords == 0)
+            return;
+
+        auto it = std::lower_bound(freeSBTRanges.begin(), freeSBTRanges.end(), range,
+                                   [](const SBTRange &a, const SBTRange &b) {
+                                       return a.offset < b.offset;
+                                   });
+        it = freeSBTRanges.insert(it, range);
+        // Coalesce with the following and the preceding ranges.
+        auto next = it + 1;
+        if (next != freeSBTRanges.end() && it->offset + it->numRecords == next->offset) {
+            it->numRecords += next->numRecords;
+            freeSBTRanges.erase(next);
+        }
+        if (it != freeSBTRanges.begin()) {
+            auto prev = it - 1;
+            if (prev->offset + prev->numRecords == it->offset) {
+                prev->numRecords += it->numRecords;
+                it = freeSBTRanges.erase(it) - 1;
+            }
+        }
+        // Give a trailing free range back.
+        if (it + 1 == freeSBTRanges.end() && it->offset + it->numRecords == numSBTRecords) {
+            numSBTRecords = it->offset;
+            freeSBTRanges.erase(it);
+        }
+    }
+
+    void Scene::Priv::removeGAS(_GeometryAccelerationStructure* gas) {
+        geomASs.erase(std::find(geomASs.begin(), geomASs.end(), gas));
+        for (auto it = sbtRanges.begin(); it != sbtRanges.end();) {
+            if (it->first.gas == gas) {
+                releaseSBTRange(it->second);
+                it = sbtRanges.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    void Scene::Priv::markIASsDirty(const _GeometryAccelerationStructure* gas) {
+        for (_InstanceAccelerationStructure* _ias : instASs) {
+            if (_ias->hasChildOf(gas))
+                _ias->markDirty();
+        }
+    }
+
+    void Scene::Priv::generateSBTLayout() {
+        // JP: 存在しなくなったマテリアルセットの範囲を解放する。
+        // EN: Release the ranges of material sets which no longer exist.
+        for (auto it = sbtRanges.begin(); it != sbtRanges.end();) {
+            if (it->first.matSetIndex >= it->first.gas->getNumMaterialSets()) {
+                releaseSBTRange(it->second);
+                it = sbtRanges.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        // JP: レコード数が変わらない(GAS, マテリアルセット)のオフセットは維持する。
+        //     縮んだ範囲はその場で縮め、伸びた範囲だけを再割り当てする。
+        //     オフセットが変わったGASを参照するIASだけをdirty状態にする。
+        // EN: Keep the offsets of (GAS, material set) pairs whose number of records are unchanged.
+        //     Shrink a range in place and reallocate only grown ranges.
+        //     Mark dirty only IASs referencing a GAS whose offset has changed.
+        for (_GeometryAccelerationStructure* gas : geomASs) {
+            bool resized = false;
+            bool moved = false;
+            uint32_t numMatSets = gas->getNumMaterialSets();
+            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                uint32_t gasNumSBTRecords = gas->calcNumSBTRecords(matSetIdx);
+                SBTOffsetKey key = { gas, matSetIdx };
+                auto it = sbtRanges.find(key);
+                if (it != sbtRanges.end()) {
+                    SBTRange &range = it->second;
+                    if (gasNumSBTRecords == range.numRecords)
+                        continue;
+                    if (gasNumSBTRecords < range.numRecords) {
+                        releaseSBTRange(SBTRange{ range.offset + gasNumSBTRecords, range.numRecords - gasNumSBTRecords });
+                        range.numRecords = gasNumSBTRecords;
+                        resized = true;
+                        continue;
+                    }
+
+                    // JP: まずその場で伸ばすことを試みる。
+                    //     再割り当ての先頭適合はより前の空きを返しうるので、その場合はオフセットが変わる。
+                    // EN: Try extending in place first.
+                    //     First fit in the reallocation can return an earlier hole, in which case the offset changes.
+                    if (tryExtendSBTRange(&range, gasNumSBTRecords)) {
+                        resized = true;
+                        continue;
+                    }
+
+                    SBTRange prevRange = range;
+                    releaseSBTRange(prevRange);
+                    range.offset = allocateSBTRange(gasNumSBTRecords);
+                    range.numRecords = gasNumSBTRecords;
+                    moved |= range.offset != prevRange.offset;
+                }
+                else {
+                    SBTRange range;
+                    range.offset = allocateSBTRange(gasNumSBTRecords);
+                    range.numRecords = gasNumSBTRecords;
+                    sbtRanges[key] = range;
+                }
+                resized = true;
+            }
+
+            // JP: レコード数が変わると範囲内のレコードもずれるので、GASの全レコードを次のローンチ時に書き直す。
+            // EN: A change in the number of records also shifts records inside the range,
+            //     so all the records of the GAS are rewritten at the next launch.
+            if (resized)
+                gas->markSBTRecordsDirty();
+            if (moved)
+                markIASsDirty(gas);
+        }
+
+        sbtLayoutIsUpToDate = true;
     }
 
     void Scene::Priv::setupHitGroupSBT(CUstream stream, const _Pipeline* pipeline, Buffer* sbt) {
         THROW_RUNTIME_ERROR(sbt->sizeInBytes() >= sizeof(HitGroupSBTRecord) * numSBTRecords,
                             "Shader binding table size is not enough.");
 
-        auto records = sbt->map<HitGroupSBTRecord>(stream);
+        // JP: 全レコードを書き直すので読み戻しは不要。
+        // EN: Reading back is not required since all the records are rewritten.
+        auto records = sbt->mapRange<HitGroupSBTRecord>(0, sbt->numElements(), cudau::MapFlags::WriteOnly, stream);
 
         for (_GeometryAccelerationStructure* gas : geomASs) {
             uint32_t numMatSets = gas->getNumMaterialSets();
-            for (int j = 0; j < numMatSets; ++j) {
-                uint32_t numRecords = gas->fillSBTRecords(pipeline, j, records);
-                records += numRecords;
-            }
+            for (uint32_t j = 0; j < numMatSets; ++j)
+                gas->fillSBTRecords(pipeline, j, records + getSBTOffset(gas, j));
         }
 
         sbt->unmap(stream);
     }
 
+    void Scene::Priv::updateHitGroupSBT(CUstream stream, const _Pipeline* pipeline, Buffer* sbt, uint64_t sinceRevision,
+                                        cudau::HostStagingPool* stagingPool) {
+        THROW_RUNTIME_ERROR(sbt->sizeInBytes() >= sizeof(HitGroupSBTRecord) * numSBTRecords,
+                            "Shader binding table size is not enough.");
+
+        dirtySBTRecordRuns.clear();
+        uint32_t numDirtyRecords = 0;
+        for (_GeometryAccelerationStructure* gas : geomASs) {
+            uint32_t numMatSets = gas->getNumMaterialSets();
+            for (uint32_t j = 0; j < numMatSets; ++j)
+                gas->collectDirtySBTRecordRuns(j, sinceRevision, getSBTOffset(gas, j), &dirtySBTRecordRuns);
+        }
+        for (const HitGroupSBTRecordRun &run : dirtySBTRecordRuns)
+            numDirtyRecords += run.numRecords;
+        if (numDirtyRecords == 0)
+            return;
+
+        // JP: dirtyなレコードを1つのページロックされたブロックに集めてから、範囲ごとに非同期コピーを発行する。
+        // EN: Gather the dirty records into a single page-locked block, then issue an asynchronous copy per run.
+        void* stagingMemory;
+        uint32_t stagingBlock = stagingPool->allocate(sizeof(HitGroupSBTRecord) * numDirtyRecords, true, &stagingMemory);
+        HitGroupSBTRecord* records = reinterpret_cast<HitGroupSBTRecord*>(stagingMemory);
+        for (const HitGroupSBTRecordRun &run : dirtySBTRecordRuns)
+            records += run.gas->fillSBTRecords(pipeline, run, records);
+
+        records = reinterpret_cast<HitGroupSBTRecord*>(stagingMemory);
+        for (const HitGroupSBTRecordRun &run : dirtySBTRecordRuns) {
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(sbt->getCUdeviceptr() + sizeof(HitGroupSBTRecord) * run.sbtOffset, records,
+                                            sizeof(HitGroupSBTRecord) * run.numRecords, stream));
+            records += run.numRecords;
+        }
+        stagingPool->release(stagingBlock, stream);
+    }
+
     bool Scene::Priv::isReady() {
         for (_GeometryAccelerationStructure* _gas : geomASs) {
             if (!_gas->isReady()) {
@@ -129,6 +367,13 @@ namespace optixu {
         return true;
     }
 
+    void Scene::Priv::prefetchBuffers(CUstream stream) const {
+        for (const _GeometryAccelerationStructure* _gas : geomASs)
+            _gas->prefetchBuffers(stream);
+        for (const _InstanceAccelerationStructure* _ias : instASs)
+            _ias->prefetchBuffers(stream);
+    }
+
     void Scene::destroy() {
         delete m;
         m = nullptr;
@@ -150,31 +395,30 @@ namespace optixu {
         return (new _InstanceAccelerationStructure(m))->getPublicType();
     }
 
-    void Scene::generateShaderBindingTableLayout(size_t* memorySize) const {
-        if (m->sbtLayoutIsUpToDate) {
-            *memorySize = sizeof(HitGroupSBTRecord) * std::max(m->numSBTRecords, 1u);
-            return;
-        }
+    void Scene::setManagedMemoryAutoPrefetch(bool enable) const {
+        m->autoPrefetch = enable;
+    }
 
-        uint32_t sbtOffset = 0;
-        m->sbtOffsets.clear();
-        for (_GeometryAccelerationStructure* gas : m->geomASs) {
-            uint32_t numMatSets = gas->getNumMaterialSets();
-            for (int matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
-                uint32_t gasNumSBTRecords = gas->calcNumSBTRecords(matSetIdx);
-                _Scene::SBTOffsetKey key = { gas, matSetIdx };
-                m->sbtOffsets[key] = sbtOffset;
-                sbtOffset += gasNumSBTRecords;
-            }
-        }
-        m->numSBTRecords = sbtOffset;
-        m->sbtLayoutIsUpToDate = true;
+    void Scene::generateShaderBindingTableLayout(size_t* memorySize) const {
+        if (!m->sbtLayoutIsUpToDate)
+            m->generateSBTLayout();
 
         *memorySize = sizeof(HitGroupSBTRecord) * std::max(m->numSBTRecords, 1u);
     }
 
 
 
+    void GeometryInstance::Priv::prefetchBuffers(CUstream stream) const {
+        if (forCustomPrimitives) {
+            prefetchIfManaged(primitiveAABBBuffer, stream);
+        }
+        else {
+            prefetchIfManaged(vertexBuffer, stream);
+            prefetchIfManaged(triangleBuffer, stream);
+        }
+        prefetchIfManaged(materialIndexOffsetBuffer, stream);
+    }
+
     void GeometryInstance::Priv::fillBuildInput(OptixBuildInput* input, CUdeviceptr preTransform) const {
         *input = OptixBuildInput{};
 
@@ -275,6 +519,18 @@ namespace optixu {
         return static_cast<uint32_t>(buildInputFlags.size());
     }
 
+    bool GeometryInstance::Priv::sbtRecordsAreDirty(uint32_t matSetIdx, uint64_t sinceRevision) const {
+        if (sbtRevision > sinceRevision || matSetIdx >= materialSets.size())
+            return true;
+        for (const _Material* mat : materialSets[matSetIdx]) {
+            // JP: マテリアルが未設定の場合は書き込み時にエラーとして報告させる。
+            // EN: Let the write report a missing material as an error.
+            if (!mat || mat->getSBTRevision() > sinceRevision)
+                return true;
+        }
+        return false;
+    }
+
     uint32_t GeometryInstance::Priv::fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, uint32_t gasUserData, uint32_t numRayTypes,
                                                     HitGroupSBTRecord* records) const {
         THROW_RUNTIME_ERROR(matSetIdx < materialSets.size(),
@@ -286,8 +542,11 @@ namespace optixu {
         for (int matIdx = 0; matIdx < numMaterials; ++matIdx) {
             const _Material* mat = materialSet[matIdx];
             THROW_RUNTIME_ERROR(mat, "No material set for %u-%u.", matSetIdx, matIdx);
+            const SBTRecordHeader* headers = mat->getHitGroupHeaders(pipeline, numRayTypes);
+            uint32_t matUserData = mat->getUserData();
             for (int rIdx = 0; rIdx < numRayTypes; ++rIdx) {
-                mat->setRecordData(pipeline, rIdx, recordPtr);
+                std::memcpy(recordPtr->header, headers[rIdx].data, OPTIX_SBT_RECORD_HEADER_SIZE);
+                recordPtr->data.materialData = matUserData;
                 recordPtr->data.geomInstData = userData;
                 recordPtr->data.gasData = gasUserData;
                 ++recordPtr;
@@ -302,25 +561,31 @@ namespace optixu {
         m = nullptr;
     }
 
-    void GeometryInstance::setVertexBuffer(const Buffer* vertexBuffer, uint32_t offsetInBytes, uint32_t numVertices) const {
+    void GeometryInstance::setVertexBuffer(const Buffer* vertexBuffer, size_t offsetInBytes, uint32_t numVertices) const {
         THROW_RUNTIME_ERROR(!m->forCustomPrimitives, "This geometry instance was created for custom primitives.");
+        THROW_RUNTIME_ERROR(offsetInBytes <= vertexBuffer->sizeInBytes(), "Offset is out of bounds.");
         m->vertexBuffer = vertexBuffer;
         m->offsetInBytesForVertices = offsetInBytes;
-        m->numVertices = std::min<uint32_t>(vertexBuffer->numElements(), numVertices);
+        size_t numAvailableVertices = (vertexBuffer->sizeInBytes() - offsetInBytes) / vertexBuffer->stride();
+        m->numVertices = static_cast<uint32_t>(std::min<size_t>(numAvailableVertices, numVertices));
     }
 
-    void GeometryInstance::setTriangleBuffer(const Buffer* triangleBuffer, uint32_t offsetInBytes, uint32_t numPrimitives) const {
+    void GeometryInstance::setTriangleBuffer(const Buffer* triangleBuffer, size_t offsetInBytes, uint32_t numPrimitives) const {
         THROW_RUNTIME_ERROR(!m->forCustomPrimitives, "This geometry instance was created for custom primitives.");
+        THROW_RUNTIME_ERROR(offsetInBytes <= triangleBuffer->sizeInBytes(), "Offset is out of bounds.");
         m->triangleBuffer = triangleBuffer;
         m->offsetInBytesForPrimitives = offsetInBytes;
-        m->numPrimitives = std::min<uint32_t>(triangleBuffer->numElements(), numPrimitives);
+        size_t numAvailablePrimitives = (triangleBuffer->sizeInBytes() - offsetInBytes) / triangleBuffer->stride();
+        m->numPrimitives = static_cast<uint32_t>(std::min<size_t>(numAvailablePrimitives, numPrimitives));
     }
 
-    void GeometryInstance::setCustomPrimitiveAABBBuffer(const Buffer* primitiveAABBBuffer, uint32_t offsetInBytes, uint32_t numPrimitives) const {
+    void GeometryInstance::setCustomPrimitiveAABBBuffer(const Buffer* primitiveAABBBuffer, size_t offsetInBytes, uint32_t numPrimitives) const {
         THROW_RUNTIME_ERROR(m->forCustomPrimitives, "This geometry instance was created for triangles.");
+        THROW_RUNTIME_ERROR(offsetInBytes <= primitiveAABBBuffer->sizeInBytes(), "Offset is out of bounds.");
         m->primitiveAABBBuffer = primitiveAABBBuffer;
         m->offsetInBytesForPrimitives = offsetInBytes;
-        m->numPrimitives = std::min<uint32_t>(primitiveAABBBuffer->numElements(), numPrimitives);;
+        size_t numAvailablePrimitives = (primitiveAABBBuffer->sizeInBytes() - offsetInBytes) / primitiveAABBBuffer->stride();
+        m->numPrimitives = static_cast<uint32_t>(std::min<size_t>(numAvailablePrimitives, numPrimitives));
     }
 
     void GeometryInstance::setPrimitiveIndexOffset(uint32_t offset) const {
@@ -331,7 +596,17 @@ namespace optixu {
         THROW_RUNTIME_ERROR(numMaterials > 0, "Invalid number of materials %u.", numMaterials);
         THROW_RUNTIME_ERROR((numMaterials == 1) != (matIdxOffsetBuffer != nullptr),
                             "Material index offset buffer must be provided when multiple materials are used.");
-        m->buildInputFlags.resize(numMaterials, OPTIX_GEOMETRY_FLAG_NONE);
+        if (numMaterials != m->buildInputFlags.size()) {
+            m->buildInputFlags.resize(numMaterials, OPTIX_GEOMETRY_FLAG_NONE);
+            for (std::vector<const _Material*> &materialSet : m->materialSets)
+                materialSet.resize(numMaterials, nullptr);
+            // JP: レコード数が変わるのでSBTレイアウトを再生成させる。
+            //     GASのレコード数の変化によって後続のレコードも書き直される。
+            // EN: The number of records changes, so let the SBT layout be regenerated.
+            //     The change in the number of records of the GAS also rewrites the following records.
+            m->sbtRevision = m->scene->advanceSBTRevision();
+            m->scene->markSBTLayoutDirty();
+        }
         m->materialIndexOffsetBuffer = matIdxOffsetBuffer;
     }
 
@@ -355,10 +630,14 @@ namespace optixu {
                 m->materialSets[i].resize(numMaterials, nullptr);
         }
         m->materialSets[matSetIdx][matIdx] = extract(mat);
+        m->sbtRevision = m->scene->advanceSBTRevision();
     }
 
     void GeometryInstance::setUserData(uint32_t data) const {
+        if (data == m->userData)
+            return;
         m->userData = data;
+        m->sbtRevision = m->scene->advanceSBTRevision();
     }
 
 
@@ -389,13 +668,71 @@ namespace optixu {
         return sumRecords;
     }
 
+    uint32_t GeometryAccelerationStructure::Priv::fillSBTRecords(const _Pipeline* pipeline, const HitGroupSBTRecordRun &run,
+                                                                 HitGroupSBTRecord* records) const {
+        uint32_t numRayTypes = numRayTypesPerMaterialSet[run.matSetIdx];
+        uint32_t sumRecords = 0;
+        for (uint32_t childIdx = run.beginChildIdx; childIdx < run.endChildIdx; ++childIdx) {
+            uint32_t numRecords = children[childIdx].geomInst->fillSBTRecords(pipeline, run.matSetIdx, userData, numRayTypes, records);
+            records += numRecords;
+            sumRecords += numRecords;
+        }
+
+        return sumRecords;
+    }
+
+    void GeometryAccelerationStructure::Priv::collectDirtySBTRecordRuns(uint32_t matSetIdx, uint64_t sinceRevision, uint32_t sbtOffset,
+                                                                        std::vector<HitGroupSBTRecordRun>* runs) const {
+        uint32_t numRayTypes = numRayTypesPerMaterialSet[matSetIdx];
+        bool gasIsDirty = sbtRevision > sinceRevision;
+
+        // JP: dirtyな子の連続する範囲を1つにまとめる。
+        // EN: Merge each run of consecutive dirty children into one.
+        HitGroupSBTRecordRun run = { this, matSetIdx, 0, 0, sbtOffset, 0 };
+        uint32_t recordOffset = sbtOffset;
+        for (uint32_t childIdx = 0; childIdx < children.size(); ++childIdx) {
+            const _GeometryInstance* geomInst = children[childIdx].geomInst;
+            uint32_t numRecords = geomInst->getNumSBTRecords() * numRayTypes;
+            if (gasIsDirty || geomInst->sbtRecordsAreDirty(matSetIdx, sinceRevision)) {
+                if (run.numRecords == 0) {
+                    run.beginChildIdx = childIdx;
+                    run.sbtOffset = recordOffset;
+                }
+                run.endChildIdx = childIdx + 1;
+                run.numRecords += numRecords;
+            }
+            else if (run.numRecords > 0) {
+                runs->push_back(run);
+                run.numRecords = 0;
+            }
+            recordOffset += numRecords;
+        }
+        if (run.numRecords > 0)
+            runs->push_back(run);
+    }
+
     void GeometryAccelerationStructure::Priv::markDirty() {
         readyToBuild = false;
         available = false;
         readyToCompact = false;
         compactedAvailable = false;
 
+        markSBTRecordsDirty();
         scene->markSBTLayoutDirty();
+        scene->markIASsDirty(this);
+    }
+
+    void GeometryAccelerationStructure::Priv::prefetchInputBuffers(CUstream stream) const {
+        for (const Child &child : children)
+            child.geomInst->prefetchBuffers(stream);
+    }
+
+    void GeometryAccelerationStructure::Priv::prefetchBuffers(CUstream stream) const {
+        prefetchInputBuffers(stream);
+        if (available)
+            prefetchIfManaged(accelBuffer, stream);
+        if (compactedAvailable)
+            prefetchIfManaged(compactedAccelBuffer, stream);
     }
     
     void GeometryAccelerationStructure::destroy() {
@@ -458,6 +795,7 @@ namespace optixu {
     void GeometryAccelerationStructure::setNumMaterialSets(uint32_t numMatSets) const {
         m->numRayTypesPerMaterialSet.resize(numMatSets, 0);
 
+        m->markSBTRecordsDirty();
         m->scene->markSBTLayoutDirty();
     }
 
@@ -467,6 +805,7 @@ namespace optixu {
                             matSetIdx, static_cast<uint32_t>(m->numRayTypesPerMaterialSet.size()));
         m->numRayTypesPerMaterialSet[matSetIdx] = numRayTypes;
 
+        m->markSBTRecordsDirty();
         m->scene->markSBTLayoutDirty();
     }
 
@@ -501,6 +840,9 @@ namespace optixu {
                             "Size of the given scratch buffer is not enough.");
 
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+        bool capturing = isStreamCapturing(stream);
+        THROW_RUNTIME_ERROR(!capturing || !m->scene->autoPrefetchEnabled(),
+                            "Managed memory auto prefetch can't be recorded into a CUDA graph.");
 
         // JP: アップデートの意味でリビルドするときはprepareForBuild()を呼ばないため
         //     ビルド入力を更新する処理をここにも書いておく必要がある。
@@ -510,6 +852,14 @@ namespace optixu {
         for (const Priv::Child &child : m->children)
             child.geomInst->updateBuildInput(&m->buildInputs[childIdx++], child.preTransform);
 
+        // JP: ビルド中のページフォールトを避けるため、入力と出力のマネージドバッファーを先にデバイスへ移動する。
+        // EN: Migrate managed input and output buffers to the device first to avoid page faults during the build.
+        if (m->scene->autoPrefetchEnabled()) {
+            m->prefetchInputBuffers(stream);
+            prefetchIfManaged(&accelBuffer, stream);
+            prefetchIfManaged(&scratchBuffer, stream);
+        }
+
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
         OPTIX_CHECK(optixAccelBuild(m->getRawContext(), stream,
                                     &m->buildOptions, m->buildInputs.data(), m->buildInputs.size(),
@@ -518,7 +868,11 @@ namespace optixu {
                                     &m->handle,
                                     compactionEnabled ? &m->propertyCompactedSize : nullptr,
                                     compactionEnabled ? 1 : 0));
-        CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
+        // JP: 記録中に記録したイベントはホストから待てないので記録しない。
+        // EN: An event recorded during a capture can't be waited on the host, so don't record it.
+        if (!capturing)
+            CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
+        m->builtInCapture = capturing;
 
         m->accelBuffer = &accelBuffer;
         m->available = true;
@@ -533,6 +887,7 @@ namespace optixu {
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
         THROW_RUNTIME_ERROR(compactionEnabled, "This AS does not allow compaction.");
         THROW_RUNTIME_ERROR(m->available, "Uncompacted AS has not been built yet.");
+        THROW_RUNTIME_ERROR(!m->builtInCapture, "Compaction of an AS built in a CUDA graph is not supported.");
 
         if (m->compactedAvailable)
             return;
@@ -554,6 +909,7 @@ namespace optixu {
         THROW_RUNTIME_ERROR(m->available, "Uncompacted AS has not been built yet.");
         THROW_RUNTIME_ERROR(compactedAccelBuffer.sizeInBytes() >= m->compactedSize,
                             "Size of the given buffer is not enough.");
+        THROW_RUNTIME_ERROR(!isStreamCapturing(stream), "Compaction can't be recorded into a CUDA graph.");
 
         OPTIX_CHECK(optixAccelCompact(m->getRawContext(), stream,
                                       m->handle, compactedAccelBuffer.getCUdeviceptr(), compactedAccelBuffer.sizeInBytes(),
@@ -604,7 +960,10 @@ namespace optixu {
     }
 
     void GeometryAccelerationStructure::setUserData(uint32_t data) const {
+        if (data == m->userData)
+            return;
         m->userData = data;
+        m->markSBTRecordsDirty();
     }
 
     bool GeometryAccelerationStructure::isReady() const {
@@ -664,11 +1023,30 @@ namespace optixu {
 
 
     void InstanceAccelerationStructure::Priv::markDirty() {
+        uploadedInstanceBuffer = nullptr;
         readyToBuild = false;
         available = false;
         readyToCompact = false;
         compactedAvailable = false;
     }
+
+    void InstanceAccelerationStructure::Priv::prefetchBuffers(CUstream stream) const {
+        if (available) {
+            prefetchIfManaged(instanceBuffer, stream);
+            prefetchIfManaged(accelBuffer, stream);
+        }
+        if (compactedAvailable)
+            prefetchIfManaged(compactedAccelBuffer, stream);
+    }
+
+    void InstanceAccelerationStructure::Priv::uploadInstances(CUstream stream, const TypedBuffer<OptixInstance> &dstBuffer) {
+        uint32_t childIdx = 0;
+        for (const _Instance* child : children)
+            child->updateInstance(&instances[childIdx++]);
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(dstBuffer.getCUdeviceptr(), instances.data(),
+                                        instances.size() * sizeof(OptixInstance),
+                                        stream));
+    }
     
     void InstanceAccelerationStructure::destroy() {
         delete m;
@@ -758,14 +1136,17 @@ namespace optixu {
 
         // JP: アップデートの意味でリビルドするときはprepareForBuild()を呼ばないため
         //     インスタンス情報を更新する処理をここにも書いておく必要がある。
+        //     記録中はページング可能なメモリーからの転送を記録できないので、事前のuploadInstances()を要求する。
         // EN: User is not required to call prepareForBuild() when performing rebuild
         //     for purpose of update so updating instance information should be here.
-        uint32_t childIdx = 0;
-        for (const _Instance* child : m->children)
-            child->updateInstance(&m->instances[childIdx++]);
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(instanceBuffer.getCUdeviceptr(), m->instances.data(),
-                                        instanceBuffer.sizeInBytes(),
-                                        stream));
+        //     A copy from pageable memory can't be recorded during a capture, so require uploadInstances() beforehand.
+        bool capturing = isStreamCapturing(stream);
+        if (capturing)
+            THROW_RUNTIME_ERROR(m->uploadedInstanceBuffer == &instanceBuffer,
+                                "Call uploadInstances() before recording rebuild() into a CUDA graph.");
+        else
+            m->uploadInstances(stream, instanceBuffer);
+        m->uploadedInstanceBuffer = nullptr;
         m->buildInput.instanceArray.instances = instanceBuffer.getCUdeviceptr();
 
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
@@ -777,7 +1158,9 @@ namespace optixu {
                                     &m->handle,
                                     compactionEnabled ? &m->propertyCompactedSize : nullptr,
                                     compactionEnabled ? 1 : 0));
-        CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
+        if (!capturing)
+            CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
+        m->builtInCapture = capturing;
 
         m->instanceBuffer = &instanceBuffer;
         m->accelBuffer = &accelBuffer;
@@ -793,6 +1176,7 @@ namespace optixu {
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
         THROW_RUNTIME_ERROR(compactionEnabled, "This AS does not allow compaction.");
         THROW_RUNTIME_ERROR(m->available, "Uncompacted AS has not been built yet.");
+        THROW_RUNTIME_ERROR(!m->builtInCapture, "Compaction of an AS built in a CUDA graph is not supported.");
 
         if (m->compactedAvailable)
             return;
@@ -814,6 +1198,7 @@ namespace optixu {
         THROW_RUNTIME_ERROR(m->available, "Uncompacted AS has not been built yet.");
         THROW_RUNTIME_ERROR(compactedAccelBuffer.sizeInBytes() >= m->compactedSize,
                             "Size of the given buffer is not enough.");
+        THROW_RUNTIME_ERROR(!isStreamCapturing(stream), "Compaction can't be recorded into a CUDA graph.");
 
         OPTIX_CHECK(optixAccelCompact(m->getRawContext(), stream,
                                       m->handle, compactedAccelBuffer.getCUdeviceptr(), compactedAccelBuffer.sizeInBytes(),
@@ -845,12 +1230,12 @@ namespace optixu {
         THROW_RUNTIME_ERROR(scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempUpdateSizeInBytes,
                             "Size of the given scratch buffer is not enough.");
 
-        uint32_t childIdx = 0;
-        for (const _Instance* child : m->children)
-            child->updateInstance(&m->instances[childIdx++]);
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(m->instanceBuffer->getCUdeviceptr(), m->instances.data(),
-                                        m->instanceBuffer->sizeInBytes(),
-                                        stream));
+        if (isStreamCapturing(stream))
+            THROW_RUNTIME_ERROR(m->uploadedInstanceBuffer == m->instanceBuffer,
+                                "Call uploadInstances() before recording update() into a CUDA graph.");
+        else
+            m->uploadInstances(stream, *m->instanceBuffer);
+        m->uploadedInstanceBuffer = nullptr;
 
         const Buffer* accelBuffer = m->compactedAvailable ? m->compactedAccelBuffer : m->accelBuffer;
         OptixTraversableHandle &handle = m->compactedAvailable ? m->compactedHandle : m->handle;
@@ -866,6 +1251,16 @@ namespace optixu {
         return handle;
     }
 
+    void InstanceAccelerationStructure::uploadInstances(CUstream stream, const TypedBuffer<OptixInstance> &instanceBuffer) const {
+        THROW_RUNTIME_ERROR(m->readyToBuild, "You need to call prepareForBuild() before uploading instances.");
+        THROW_RUNTIME_ERROR(instanceBuffer.numElements() >= m->instances.size(),
+                            "Size of the given instance buffer is not enough.");
+        THROW_RUNTIME_ERROR(!isStreamCapturing(stream), "Instances can't be uploaded during a CUDA graph capture.");
+
+        m->uploadInstances(stream, instanceBuffer);
+        m->uploadedInstanceBuffer = &instanceBuffer;
+    }
+
     bool InstanceAccelerationStructure::isReady() const {
         return m->isReady();
     }
@@ -956,8 +1351,15 @@ namespace optixu {
                 sbt.callablesRecordCount = callablePrograms.size();
             }
 
+            hitGroupSbtRevision = context->getSBTRevision();
             sbtIsUpToDate = true;
         }
+        else if (context->getSBTRevision() > hitGroupSbtRevision) {
+            // JP: 前回の書き込み以降に変更されたマテリアル、ジオメトリインスタンス、GASのレコードのみを書き直す。
+            // EN: Rewrite only the records of materials, geometry instances and GASs changed since the last write.
+            scene->updateHitGroupSBT(stream, this, hitGroupSbt, hitGroupSbtRevision, &sbtStagingPool);
+            hitGroupSbtRevision = context->getSBTRevision();
+        }
     }
 
     void Pipeline::destroy() {
@@ -1261,12 +1663,36 @@ namespace optixu {
                                               maxTraversableGraphDepth));
     }
 
-    void Pipeline::launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const {
+    void Pipeline::updateShaderBindingTable(CUstream stream) const {
         THROW_RUNTIME_ERROR(m->scene, "Scene is not set.");
         THROW_RUNTIME_ERROR(m->scene->isReady(), "Scene is not ready.");
         THROW_RUNTIME_ERROR(m->hitGroupSbt, "Hitgroup shader binding table is not set.");
+        THROW_RUNTIME_ERROR(!isStreamCapturing(stream), "Shader binding table can't be written during a CUDA graph capture.");
 
         m->setupShaderBindingTable(stream);
+    }
+
+    void Pipeline::launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const {
+        THROW_RUNTIME_ERROR(m->scene, "Scene is not set.");
+        THROW_RUNTIME_ERROR(m->scene->isReady(), "Scene is not ready.");
+        THROW_RUNTIME_ERROR(m->hitGroupSbt, "Hitgroup shader binding table is not set.");
+
+        // JP: SBTの書き込みとプリフェッチは記録できないので、記録中はそれらが不要な場合のみ受け付ける。
+        // EN: SBT writes and prefetches can't be recorded, so accept a capture only when they are not needed.
+        if (isStreamCapturing(stream)) {
+            THROW_RUNTIME_ERROR(!m->hasPendingSBTWrites(),
+                                "Call updateShaderBindingTable() before recording launch() into a CUDA graph.");
+            THROW_RUNTIME_ERROR(!m->scene->autoPrefetchEnabled(),
+                                "Managed memory auto prefetch can't be recorded into a CUDA graph.");
+        }
+        else {
+            m->setupShaderBindingTable(stream);
+
+            if (m->scene->autoPrefetchEnabled()) {
+                m->scene->prefetchBuffers(stream);
+                prefetchIfManaged(m->hitGroupSbt, stream);
+            }
+        }
 
         OPTIX_CHECK(optixLaunch(m->rawPipeline, stream, plpOnDevice, m->sizeOfPipelineLaunchParams,
                                 &m->sbt, dimX, dimY, dimZ));
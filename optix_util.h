@@ -124,6 +124,7 @@ namespace optixu {
     using cudau::BufferType;
     using cudau::Buffer;
     using cudau::TypedBuffer;
+    using cudau::MemoryCategory;
 #endif
 
 #ifdef _DEBUG
@@ -345,7 +346,7 @@ namespace optixu {
             m_height = b.m_height;
             m_numXBlocks = b.m_numXBlocks;
             m_mappedPointer = b.m_mappedPointer;
-            m_rawBuffer = std::move(b);
+            m_rawBuffer = std::move(b.m_rawBuffer);
         }
         HostBlockBuffer2D &operator=(HostBlockBuffer2D &&b) {
             m_rawBuffer.finalize();
@@ -366,14 +367,20 @@ namespace optixu {
             constexpr uint32_t mask = blockWidth - 1;
             m_numXBlocks = ((width + mask) & ~mask) >> log2BlockWidth;
             uint32_t numYBlocks = ((height + mask) & ~mask) >> log2BlockWidth;
-            uint32_t numElements = numYBlocks * m_numXBlocks * blockWidth * blockWidth;
+            size_t numElements = static_cast<size_t>(numYBlocks) * m_numXBlocks * blockWidth * blockWidth;
             m_rawBuffer.initialize(context, type, numElements);
         }
         void finalize() {
             m_rawBuffer.finalize();
         }
 
-        void resize(uint32_t width, uint32_t height) {
+        void setMemoryCategory(MemoryCategory category) {
+            m_rawBuffer.setMemoryCategory(category);
+        }
+
+        // JP: ブロック行ごとのコピーを1回の2次元コピーとしてストリームに発行する。
+        // EN: Issue copies of block rows to the stream as a single 2D copy.
+        void resize(uint32_t width, uint32_t height, CUstream stream = 0) {
             if (!m_rawBuffer.isInitialized())
                 throw std::runtime_error("Buffer is not initialized.");
 
@@ -381,6 +388,7 @@ namespace optixu {
                 return;
 
             HostBlockBuffer2D newBuffer;
+            newBuffer.setMemoryCategory(m_rawBuffer.getMemoryCategory());
             newBuffer.initialize(m_rawBuffer.getCUcontext(), m_rawBuffer.getBufferType(), width, height);
 
             constexpr uint32_t blockWidth = 1 << log2BlockWidth;
@@ -389,21 +397,19 @@ namespace optixu {
             uint32_t numDstYBlocks = ((height + mask) & ~mask) >> log2BlockWidth;
             uint32_t numXBlocksToCopy = std::min(m_numXBlocks, newBuffer.m_numXBlocks);
             uint32_t numYBlocksToCopy = std::min(numSrcYBlocks, numDstYBlocks);
-            if (numXBlocksToCopy == m_numXBlocks) {
-                size_t numBytesToCopy = (numXBlocksToCopy * numYBlocksToCopy * blockWidth * blockWidth) * sizeof(T);
-                CUDADRV_CHECK(cuMemcpyDtoD(newBuffer.m_rawBuffer.getCUdeviceptr(),
-                                           m_rawBuffer.getCUdeviceptr(),
-                                           numBytesToCopy));
-            }
-            else {
-                for (int yb = 0; yb < numYBlocksToCopy; ++yb) {
-                    size_t srcOffset = (m_numXBlocks * blockWidth * blockWidth * yb) * sizeof(T);
-                    size_t dstOffset = (newBuffer.m_numXBlocks * blockWidth * blockWidth * yb) * sizeof(T);
-                    size_t numBytesToCopy = (numXBlocksToCopy * blockWidth * blockWidth) * sizeof(T);
-                    CUDADRV_CHECK(cuMemcpyDtoD(newBuffer.m_rawBuffer.getCUdeviceptr() + dstOffset,
-                                               m_rawBuffer.getCUdeviceptr() + srcOffset,
-                                               numBytesToCopy));
-                }
+            if (numXBlocksToCopy > 0 && numYBlocksToCopy > 0) {
+                constexpr size_t blockRowSizeInBytes = blockWidth * blockWidth * sizeof(T);
+                CUDA_MEMCPY2D params = {};
+                params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.srcDevice = m_rawBuffer.getCUdeviceptr();
+                params.srcPitch = m_numXBlocks * blockRowSizeInBytes;
+                params.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.dstDevice = newBuffer.m_rawBuffer.getCUdeviceptr();
+                params.dstPitch = newBuffer.m_numXBlocks * blockRowSizeInBytes;
+                params.WidthInBytes = numXBlocksToCopy * blockRowSizeInBytes;
+                params.Height = numYBlocksToCopy;
+                CUDADRV_CHECK(cuCtxSetCurrent(m_rawBuffer.getCUcontext()));
+                CUDADRV_CHECK(cuMemcpy2DAsync(&params, stream));
             }
 
             *this = std::move(newBuffer);
@@ -805,10 +811,8 @@ private: \
         void destroy();
         OPTIX_COMMON_FUNCTIONS(Material);
 
-        // JP: 以下のAPIを呼んだ場合はシェーダーバインディングテーブルを更新する必要がある。
-        //     パイプラインのmarkHitGroupShaderBindingTableDirty()を呼べばローンチ時にセットアップされる。
-        // EN: Updating a shader binding table is required when calling the following APIs.
-        //     Calling pipeline's markHitGroupShaderBindingTableDirty() triggers re-setup of the table at launch.
+        // JP: 以下のAPIによる変更は、次のローンチ時に影響するヒットグループレコードのみを書き直して反映される。
+        // EN: Changes by the following APIs are applied at the next launch by rewriting only the affected hit group records.
         void setHitGroup(uint32_t rayType, ProgramGroup hitGroup);
         void setUserData(uint32_t data) const;
     };
@@ -827,7 +831,22 @@ private: \
         Instance createInstance() const;
         InstanceAccelerationStructure createInstanceAccelerationStructure() const;
 
+        // JP: レイアウトは差分で更新され、レコード数が変わらない(GAS, マテリアルセット)のオフセットは維持される。
+        //     新たな範囲は解放済みの範囲を再利用するか末尾に追加され、割り当て順はGASの作成順で決まる。
+        //     オフセットが変わったGASを参照するIASのみがdirty状態になる。
+        // EN: The layout is updated incrementally and keeps the offsets of (GAS, material set) pairs
+        //     whose number of records are unchanged.
+        //     New ranges reuse released ranges or are appended, in the creation order of GASs.
+        //     Only IASs referencing a GAS whose offset has changed are marked dirty.
         void generateShaderBindingTableLayout(size_t* memorySize) const;
+
+        // JP: 有効にすると、GASのrebuild()とPipelineのlaunch()の前に、
+        //     それらが参照するマネージドバッファーをストリーム上でデバイスへプリフェッチする。
+        //     プリフェッチはCUDA Graphに記録できないので、有効な間はそれらを記録できない。
+        // EN: When enabled, managed buffers referenced by GAS rebuild() and Pipeline launch()
+        //     are prefetched to the device on the stream before them.
+        //     Prefetches can't be recorded into a CUDA graph, so they can't be recorded while enabled.
+        void setManagedMemoryAutoPrefetch(bool enable) const;
     };
 
 
@@ -842,17 +861,15 @@ private: \
         // JP: 以下のAPIを呼んだ場合は所属するGASのmarkDirty()を呼ぶ必要がある。
         // EN: Calling markDirty() of a GAS to which the geometry instance belongs is
         //     required when calling the following APIs.
-        void setVertexBuffer(const Buffer* vertexBuffer, uint32_t offsetInBytes = 0, uint32_t numVertices = UINT32_MAX) const;
-        void setTriangleBuffer(const Buffer* triangleBuffer, uint32_t offsetInBytes = 0, uint32_t numPrimitives = UINT32_MAX) const;
-        void setCustomPrimitiveAABBBuffer(const Buffer* primitiveAABBBuffer, uint32_t offsetInBytes = 0, uint32_t numPrimitives = UINT32_MAX) const;
+        void setVertexBuffer(const Buffer* vertexBuffer, size_t offsetInBytes = 0, uint32_t numVertices = UINT32_MAX) const;
+        void setTriangleBuffer(const Buffer* triangleBuffer, size_t offsetInBytes = 0, uint32_t numPrimitives = UINT32_MAX) const;
+        void setCustomPrimitiveAABBBuffer(const Buffer* primitiveAABBBuffer, size_t offsetInBytes = 0, uint32_t numPrimitives = UINT32_MAX) const;
         void setPrimitiveIndexOffset(uint32_t offset) const;
         void setNumMaterials(uint32_t numMaterials, const TypedBuffer<uint32_t>* matIdxOffsetBuffer) const;
         void setGeometryFlags(uint32_t matIdx, OptixGeometryFlags flags) const;
 
-        // JP: 以下のAPIを呼んだ場合はシェーダーバインディングテーブルを更新する必要がある。
-        //     パイプラインのmarkHitGroupShaderBindingTableDirty()を呼べばローンチ時にセットアップされる。
-        // EN: Updating a shader binding table is required when calling the following APIs.
-        //     Calling pipeline's markHitGroupShaderBindingTableDirty() triggers re-setup of the table at launch.
+        // JP: 以下のAPIによる変更は、次のローンチ時に影響するヒットグループレコードのみを書き直して反映される。
+        // EN: Changes by the following APIs are applied at the next launch by rewriting only the affected hit group records.
         void setMaterial(uint32_t matSetIdx, uint32_t matIdx, Material mat) const;
         void setUserData(uint32_t data) const;
     };
@@ -887,10 +904,8 @@ private: \
         void removeUncompacted() const;
         OptixTraversableHandle update(CUstream stream, const Buffer &scratchBuffer) const;
 
-        // JP: 以下のAPIを呼んだ場合はシェーダーバインディングテーブルを更新する必要がある。
-        //     パイプラインのmarkHitGroupShaderBindingTableDirty()を呼べばローンチ時にセットアップされる。
-        // EN: Updating a shader binding table is required when calling the following APIs.
-        //     Calling pipeline's markHitGroupShaderBindingTableDirty() triggers re-setup of the table at launch.
+        // JP: 以下のAPIによる変更は、次のローンチ時に影響するヒットグループレコードのみを書き直して反映される。
+        // EN: Changes by the following APIs are applied at the next launch by rewriting only the affected hit group records.
         void setUserData(uint32_t userData) const;
 
         bool isReady() const;
@@ -946,6 +961,13 @@ private: \
         OptixTraversableHandle compact(CUstream stream, const Buffer &compactedAccelBuffer) const;
         void removeUncompacted() const;
         OptixTraversableHandle update(CUstream stream, const Buffer &scratchBuffer) const;
+        // JP: 現在のインスタンス情報をインスタンスバッファーに書き込む。
+        //     rebuild()/update()は通常自身で書き込むが、CUDA Graphに記録する場合は記録前にこれを呼ぶ必要がある。
+        //     呼んだ後のインスタンスの変更は次のビルドに反映されない。
+        // EN: Write the current instance information to the instance buffer.
+        //     rebuild()/update() usually write it by themselves, but this needs to be called before the capture
+        //     when recording them into a CUDA graph. Instance changes after this call are not reflected to the next build.
+        void uploadInstances(CUstream stream, const TypedBuffer<OptixInstance> &instanceBuffer) const;
 
         bool isReady() const;
         void markDirty() const;
@@ -988,6 +1010,8 @@ private: \
 
         void setScene(const Scene &scene) const;
         void setHitGroupShaderBindingTable(Buffer* shaderBindingTable) const;
+        // JP: ヒットグループのシェーダーバインディングテーブル全体を次のローンチ時に書き直す。
+        // EN: Rewrite the entire hit group shader binding table at the next launch.
         void markHitGroupShaderBindingTableDirty() const;
 
         void setStackSize(uint32_t directCallableStackSizeFromTraversal,
@@ -995,6 +1019,11 @@ private: \
                           uint32_t continuationStackSize,
                           uint32_t maxTraversableGraphDepth) const;
 
+        // JP: 保留中のSBTの書き込みを行う。launch()は通常自身で行うが、
+        //     CUDA Graphに記録する場合は記録前にこれを呼ぶ必要がある。
+        // EN: Perform pending writes of the SBT. launch() usually does it by itself,
+        //     but this needs to be called before the capture when recording it into a CUDA graph.
+        void updateShaderBindingTable(CUstream stream) const;
         void launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const;
     };
 
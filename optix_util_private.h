@@ -155,21 +155,39 @@ namespace optixu {
 
 
 
+    struct SBTRecordHeader {
+        uint8_t data[OPTIX_SBT_RECORD_HEADER_SIZE];
+    };
+
     struct alignas(OPTIX_SBT_RECORD_ALIGNMENT) HitGroupSBTRecord {
         uint8_t header[OPTIX_SBT_RECORD_HEADER_SIZE];
         HitGroupSBTRecordData data;
     };
 
+    // JP: 書き直しが必要な、GAS中の連続する子のレコードの範囲。
+    // EN: Run of records of consecutive children in a GAS that need to be rewritten.
+    struct HitGroupSBTRecordRun {
+        const _GeometryAccelerationStructure* gas;
+        uint32_t matSetIdx;
+        uint32_t beginChildIdx;
+        uint32_t endChildIdx;
+        uint32_t sbtOffset;
+        uint32_t numRecords;
+    };
+
 
 
     class Context::Priv {
         CUcontext cudaContext;
         OptixDeviceContext rawContext;
+        // JP: ヒットグループレコードの内容に影響する変更ごとに進むリビジョン。
+        // EN: Revision advanced on each change which affects the contents of hit group records.
+        uint64_t sbtRevision;
 
     public:
         OPTIX_OPAQUE_BRIDGE(Context);
 
-        Priv(CUcontext cuContext) : cudaContext(cuContext) {
+        Priv(CUcontext cuContext) : cudaContext(cuContext), sbtRevision(0) {
             OPTIX_CHECK(optixInit());
 
             OptixDeviceContextOptions options = {};
@@ -187,60 +205,52 @@ namespace optixu {
         OptixDeviceContext getRawContext() const {
             return rawContext;
         }
+
+        uint64_t advanceSBTRevision() {
+            return ++sbtRevision;
+        }
+        uint64_t getSBTRevision() const {
+            return sbtRevision;
+        }
     };
 
 
 
     class Material::Priv {
-        struct Key {
+        // JP: パイプラインごとにレイタイプ順のパック済みヘッダーを保持し、SBTの書き込みをコピーのみにする。
+        // EN: Hold packed headers in ray type order per pipeline so that writing the SBT becomes plain copies.
+        struct HitGroupSet {
             const _Pipeline* pipeline;
-            uint32_t rayType;
-
-            bool operator<(const Key &rKey) const {
-                if (pipeline < rKey.pipeline) {
-                    return true;
-                }
-                else if (pipeline == rKey.pipeline) {
-                    if (rayType < rKey.rayType)
-                        return true;
-                }
-                return false;
-            }
-
-            struct Hash {
-                typedef std::size_t result_type;
-
-                std::size_t operator()(const Key& key) const {
-                    size_t seed = 0;
-                    auto hash0 = std::hash<const _Pipeline*>()(key.pipeline);
-                    auto hash1 = std::hash<uint32_t>()(key.rayType);
-                    seed ^= hash0 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-                    seed ^= hash1 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-                    return seed;
-                }
-            };
-            bool operator==(const Key &rKey) const {
-                return pipeline == rKey.pipeline && rayType == rKey.rayType;
-            }
+            std::vector<const _ProgramGroup*> programs;
+            std::vector<SBTRecordHeader> headers;
+            uint32_t numValidRayTypes; // leading ray types with a hit group
         };
 
         _Context* context;
         uint32_t userData;
+        uint64_t sbtRevision;
 
-        std::unordered_map<Key, const _ProgramGroup*, Key::Hash> programs;
+        std::vector<HitGroupSet> hitGroupSets;
 
     public:
         OPTIX_OPAQUE_BRIDGE(Material);
 
         Priv(_Context* ctxt) :
-            context(ctxt), userData(0) {}
+            context(ctxt), userData(0), sbtRevision(0) {}
         ~Priv() {}
 
         OptixDeviceContext getRawContext() const {
             return context->getRawContext();
         }
 
-        void setRecordData(const _Pipeline* pipeline, uint32_t rayType, HitGroupSBTRecord* record) const;
+        uint64_t getSBTRevision() const {
+            return sbtRevision;
+        }
+
+        uint32_t getUserData() const {
+            return userData;
+        }
+        const SBTRecordHeader* getHitGroupHeaders(const _Pipeline* pipeline, uint32_t numRayTypes) const;
     };
 
 
@@ -278,19 +288,29 @@ namespace optixu {
             }
         };
 
-        const _Context* context;
-        std::unordered_set<_GeometryAccelerationStructure*> geomASs;
-        std::unordered_map<SBTOffsetKey, uint32_t, SBTOffsetKey::Hash> sbtOffsets;
+        struct SBTRange {
+            uint32_t offset;
+            uint32_t numRecords;
+        };
+
+        _Context* context;
+        // JP: SBTレイアウトの割り当て順を実行ごとに一定にするため、GASは作成順に保持する。
+        // EN: Hold GASs in the creation order to make the allocation order of the SBT layout deterministic.
+        std::vector<_GeometryAccelerationStructure*> geomASs;
+        std::unordered_map<SBTOffsetKey, SBTRange, SBTOffsetKey::Hash> sbtRanges;
+        std::vector<SBTRange> freeSBTRanges; // sorted by offset, coalesced
         uint32_t numSBTRecords;
+        std::vector<HitGroupSBTRecordRun> dirtySBTRecordRuns;
         std::unordered_set<_InstanceAccelerationStructure*> instASs;
         struct {
             unsigned int sbtLayoutIsUpToDate : 1;
+            unsigned int autoPrefetch : 1;
         };
 
     public:
         OPTIX_OPAQUE_BRIDGE(Scene);
 
-        Priv(const _Context* ctxt) : context(ctxt), numSBTRecords(0), sbtLayoutIsUpToDate(false) {}
+        Priv(_Context* ctxt) : context(ctxt), numSBTRecords(0), sbtLayoutIsUpToDate(false), autoPrefetch(false) {}
         ~Priv() {}
 
         CUcontext getCUDAContext() const {
@@ -299,15 +319,20 @@ namespace optixu {
         OptixDeviceContext getRawContext() const {
             return context->getRawContext();
         }
+        uint64_t advanceSBTRevision() {
+            return context->advanceSBTRevision();
+        }
 
 
 
+        uint32_t allocateSBTRange(uint32_t numRecords);
+        bool tryExtendSBTRange(SBTRange* range, uint32_t numRecords);
+        void releaseSBTRange(const SBTRange &range);
+
         void addGAS(_GeometryAccelerationStructure* gas) {
-            geomASs.insert(gas);
-        }
-        void removeGAS(_GeometryAccelerationStructure* gas) {
-            geomASs.erase(gas);
+            geomASs.push_back(gas);
         }
+        void removeGAS(_GeometryAccelerationStructure* gas);
         void addIAS(_InstanceAccelerationStructure* ias) {
             instASs.insert(ias);
         }
@@ -318,14 +343,25 @@ namespace optixu {
         bool sbtLayoutGenerationDone() const {
             return sbtLayoutIsUpToDate;
         }
-        void markSBTLayoutDirty();
+        void markSBTLayoutDirty() {
+            sbtLayoutIsUpToDate = false;
+        }
+        void markIASsDirty(const _GeometryAccelerationStructure* gas);
+        void generateSBTLayout();
         uint32_t getSBTOffset(_GeometryAccelerationStructure* gas, uint32_t matSetIdx) {
-            return sbtOffsets.at(SBTOffsetKey{ gas, matSetIdx });
+            return sbtRanges.at(SBTOffsetKey{ gas, matSetIdx }).offset;
         }
 
         void setupHitGroupSBT(CUstream stream, const _Pipeline* pipeline, Buffer* sbt);
+        void updateHitGroupSBT(CUstream stream, const _Pipeline* pipeline, Buffer* sbt, uint64_t sinceRevision,
+                               cudau::HostStagingPool* stagingPool);
 
         bool isReady();
+
+        bool autoPrefetchEnabled() const {
+            return autoPrefetch;
+        }
+        void prefetchBuffers(CUstream stream) const;
     };
 
 
@@ -333,6 +369,7 @@ namespace optixu {
     class GeometryInstance::Priv {
         _Scene* scene;
         uint32_t userData;
+        uint64_t sbtRevision;
 
         // TODO: support deformation blur (multiple vertex buffers)
         union {
@@ -340,7 +377,7 @@ namespace optixu {
                 CUdeviceptr* vertexBufferArray;
                 const Buffer* vertexBuffer;
                 const Buffer* triangleBuffer;
-                uint32_t offsetInBytesForVertices;
+                size_t offsetInBytesForVertices;
                 uint32_t numVertices;
             };
             struct {
@@ -348,7 +385,7 @@ namespace optixu {
                 const Buffer* primitiveAABBBuffer;
             };
         };
-        uint32_t offsetInBytesForPrimitives;
+        size_t offsetInBytesForPrimitives;
         uint32_t numPrimitives;
         uint32_t primitiveIndexOffset;
         const TypedBuffer<uint32_t>* materialIndexOffsetBuffer;
@@ -366,6 +403,7 @@ namespace optixu {
         Priv(_Scene* _scene, bool _forCustomPrimitives) :
             scene(_scene),
             userData(0),
+            sbtRevision(0),
             offsetInBytesForPrimitives(0),
             numPrimitives(0),
             primitiveIndexOffset(0),
@@ -408,8 +446,11 @@ namespace optixu {
         void updateBuildInput(OptixBuildInput* input, CUdeviceptr preTransform) const;
 
         uint32_t getNumSBTRecords() const;
+        bool sbtRecordsAreDirty(uint32_t matSetIdx, uint64_t sinceRevision) const;
         uint32_t fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, uint32_t gasUserData, uint32_t numRayTypes,
                                 HitGroupSBTRecord* records) const;
+
+        void prefetchBuffers(CUstream stream) const;
     };
 
 
@@ -426,6 +467,7 @@ namespace optixu {
 
         _Scene* scene;
         uint32_t userData;
+        uint64_t sbtRevision;
 
         std::vector<uint32_t> numRayTypesPerMaterialSet;
 
@@ -454,6 +496,9 @@ namespace optixu {
             unsigned int available : 1;
             unsigned int readyToCompact : 1;
             unsigned int compactedAvailable : 1;
+            // JP: 最後のビルドがCUDA Graphの記録中に行われ、finishEventが記録されていない。
+            // EN: The last build was made during a CUDA graph capture and finishEvent hasn't been recorded.
+            unsigned int builtInCapture : 1;
         };
 
     public:
@@ -462,12 +507,13 @@ namespace optixu {
         Priv(_Scene* _scene, bool _forCustomPrimitives) :
             scene(_scene),
             userData(0),
+            sbtRevision(0),
             handle(0), compactedHandle(0),
             accelBuffer(nullptr), compactedAccelBuffer(nullptr),
             forCustomPrimitives(_forCustomPrimitives),
             preferFastTrace(true), allowUpdate(false), allowCompaction(false), allowRandomVertexAccess(false),
             readyToBuild(false), available(false), 
-            readyToCompact(false), compactedAvailable(false) {
+            readyToCompact(false), compactedAvailable(false), builtInCapture(false) {
             scene->addGAS(this);
 
             CUDADRV_CHECK(cuEventCreate(&finishEvent,
@@ -506,6 +552,12 @@ namespace optixu {
 
         uint32_t calcNumSBTRecords(uint32_t matSetIdx) const;
         uint32_t fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, HitGroupSBTRecord* records) const;
+        uint32_t fillSBTRecords(const _Pipeline* pipeline, const HitGroupSBTRecordRun &run, HitGroupSBTRecord* records) const;
+        void collectDirtySBTRecordRuns(uint32_t matSetIdx, uint64_t sinceRevision, uint32_t sbtOffset,
+                                       std::vector<HitGroupSBTRecordRun>* runs) const;
+        void markSBTRecordsDirty() {
+            sbtRevision = scene->advanceSBTRevision();
+        }
         
         void markDirty();
         bool isReady() const {
@@ -520,6 +572,9 @@ namespace optixu {
                 return handle;
             return 0;
         }
+
+        void prefetchInputBuffers(CUstream stream) const;
+        void prefetchBuffers(CUstream stream) const;
     };
 
 
@@ -566,6 +621,10 @@ namespace optixu {
 
 
 
+        const _GeometryAccelerationStructure* getGAS() const {
+            return type == InstanceType::GAS ? gas : nullptr;
+        }
+
         void fillInstance(OptixInstance* instance) const;
         void updateInstance(OptixInstance* instance) const;
     };
@@ -590,6 +649,9 @@ namespace optixu {
         OptixTraversableHandle handle;
         OptixTraversableHandle compactedHandle;
         const TypedBuffer<OptixInstance>* instanceBuffer;
+        // JP: 次のビルドのためにuploadInstances()でインスタンスを書き込んだバッファー。
+        // EN: Buffer to which instances have been written by uploadInstances() for the next build.
+        const TypedBuffer<OptixInstance>* uploadedInstanceBuffer;
         const Buffer* accelBuffer;
         const Buffer* compactedAccelBuffer;
         struct {
@@ -600,6 +662,7 @@ namespace optixu {
             unsigned int available : 1;
             unsigned int readyToCompact : 1;
             unsigned int compactedAvailable : 1;
+            unsigned int builtInCapture : 1;
         };
 
     public:
@@ -608,10 +671,11 @@ namespace optixu {
         Priv(_Scene* _scene) :
             scene(_scene),
             handle(0), compactedHandle(0),
-            instanceBuffer(nullptr), accelBuffer(nullptr), compactedAccelBuffer(nullptr),
+            instanceBuffer(nullptr), uploadedInstanceBuffer(nullptr),
+            accelBuffer(nullptr), compactedAccelBuffer(nullptr),
             preferFastTrace(true), allowUpdate(false), allowCompaction(false),
             readyToBuild(false), available(false),
-            readyToCompact(false), compactedAvailable(false) {
+            readyToCompact(false), compactedAvailable(false), builtInCapture(false) {
             scene->addIAS(this);
 
             CUDADRV_CHECK(cuEventCreate(&finishEvent,
@@ -641,6 +705,14 @@ namespace optixu {
 
 
 
+        bool hasChildOf(const _GeometryAccelerationStructure* gas) const {
+            for (const _Instance* child : children) {
+                if (child->getGAS() == gas)
+                    return true;
+            }
+            return false;
+        }
+
         void markDirty();
         bool isReady() const {
             return available || compactedAvailable;
@@ -655,6 +727,9 @@ namespace optixu {
             optixAssert_ShouldNotBeCalled();
             return 0;
         }
+
+        void prefetchBuffers(CUstream stream) const;
+        void uploadInstances(CUstream stream, const TypedBuffer<OptixInstance> &dstBuffer);
     };
 
 
@@ -682,7 +757,13 @@ namespace optixu {
         Buffer callableRecords;
 
         Buffer* hitGroupSbt;
+        // JP: ヒットグループのSBTを最後に書き込んだ時点のコンテキストのリビジョン。
+        // EN: Revision of the context at the time the hit group SBT was last written.
+        uint64_t hitGroupSbtRevision;
         OptixShaderBindingTable sbt;
+        // JP: 変更されたヒットグループレコードを集めて転送するためのページロックされたメモリー。
+        // EN: Page-locked memory to gather and upload changed hit group records.
+        cudau::HostStagingPool sbtStagingPool;
 
         struct {
             unsigned int pipelineLinked : 1;
@@ -691,6 +772,9 @@ namespace optixu {
         };
 
         void setupShaderBindingTable(CUstream stream);
+        bool hasPendingSBTWrites() const {
+            return !sbtAllocDone || !sbtIsUpToDate || context->getSBTRevision() > hitGroupSbtRevision;
+        }
 
     public:
         OPTIX_OPAQUE_BRIDGE(Pipeline);
@@ -699,7 +783,7 @@ namespace optixu {
             context(ctxt), rawPipeline(nullptr),
             maxTraceDepth(0), sizeOfPipelineLaunchParams(0),
             scene(nullptr), numMissRayTypes(0),
-            rayGenProgram(nullptr), exceptionProgram(nullptr), hitGroupSbt(nullptr),
+            rayGenProgram(nullptr), exceptionProgram(nullptr), hitGroupSbt(nullptr), hitGroupSbtRevision(0),
             pipelineLinked(false), sbtAllocDone(false), sbtIsUpToDate(false) {
             rayGenRecord.initialize(context->getCUDAContext(), s_BufferType, 1, OPTIX_SBT_RECORD_HEADER_SIZE);
             rayGenRecord.setMappedMemoryPersistent(true);
@@ -709,11 +793,13 @@ namespace optixu {
             missRecords.setMappedMemoryPersistent(true);
             callableRecords.initialize(context->getCUDAContext(), s_BufferType, 1, OPTIX_SBT_RECORD_HEADER_SIZE);
             callableRecords.setMappedMemoryPersistent(true);
+            sbtStagingPool.initialize(context->getCUDAContext());
         }
         ~Priv() {
             if (pipelineLinked)
                 optixPipelineDestroy(rawPipeline);
 
+            sbtStagingPool.finalize();
             callableRecords.finalize();
             missRecords.finalize();
             exceptionRecord.finalize();
@@ -761,12 +847,17 @@ namespace optixu {
     class ProgramGroup::Priv {
         _Pipeline* pipeline;
         OptixProgramGroup rawGroup;
+        SBTRecordHeader packedHeader;
 
     public:
         OPTIX_OPAQUE_BRIDGE(ProgramGroup);
 
         Priv(_Pipeline* pl, OptixProgramGroup _rawGroup) :
-            pipeline(pl), rawGroup(_rawGroup) {}
+            pipeline(pl), rawGroup(_rawGroup) {
+            // JP: ヘッダーはプログラムグループのみに依存するので作成時に一度だけパックする。
+            // EN: The header depends only on the program group, so pack it once at creation.
+            OPTIX_CHECK(optixSbtRecordPackHeader(rawGroup, packedHeader.data));
+        }
 
 
 
@@ -778,8 +869,11 @@ namespace optixu {
             return rawGroup;
         }
 
+        const SBTRecordHeader &getPackedHeader() const {
+            return packedHeader;
+        }
         void packHeader(uint8_t* record) const {
-            OPTIX_CHECK(optixSbtRecordPackHeader(rawGroup, record));
+            std::memcpy(record, packedHeader.data, OPTIX_SBT_RECORD_HEADER_SIZE);
         }
     };
 }
@@ -153,6 +153,10 @@ struct OptiXEnv {
     optixu::Context context;
     optixu::Material material;
     optixu::Scene scene;
+    cudau::MemoryArena geometryArena;
+    cudau::StreamOrderedMemoryPool memoryPool;
+    cudau::UploadBatcher uploadBatcher;
+    cudau::HostStagingPool stagingPool;
     cudau::TypedBuffer<Shared::GeometryData> geometryDataBuffer;
     SlotFinder geometryInstSlotFinder;
     cudau::TypedBuffer<Shared::GASData> gasDataBuffer;
@@ -202,7 +206,7 @@ void Group::finalize(Group* p) {
 
 
 
-void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv) {
+void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv, CUstream stream) {
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(filepath.string(),
                                              aiProcess_Triangulate |
@@ -215,10 +219,31 @@ void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv) {
 
     std::string basename = filepath.stem().string();
 
+    // JP: ページロックされたステージングブロックの小さなリングから非同期に転送し、次のメッシュの変換と重ねる。
+    //     スロットを再利用する前にはそのスロットの直前の転送のみを待つ。
+    // EN: Transfer asynchronously from a small ring of page-locked staging blocks
+    //     to overlap with converting the next mesh.
+    //     Wait only for the previous transfer of a slot before reusing it.
+    constexpr uint32_t numStagingSlots = 3;
+    uint32_t stagingBlocks[numStagingSlots];
+    std::fill_n(stagingBlocks, numStagingSlots, cudau::HostStagingPool::InvalidBlockIndex);
+    uint32_t lastStagingSlot = 0;
+
     for (int meshIdx = 0; meshIdx < scene->mNumMeshes; ++meshIdx) {
         const aiMesh* mesh = scene->mMeshes[meshIdx];
 
-        std::vector<Shared::Vertex> vertices(mesh->mNumVertices);
+        uint32_t stagingSlot = meshIdx % numStagingSlots;
+        if (stagingBlocks[stagingSlot] != cudau::HostStagingPool::InvalidBlockIndex)
+            optixEnv->stagingPool.wait(stagingBlocks[stagingSlot]);
+
+        size_t verticesSize = sizeof(Shared::Vertex) * mesh->mNumVertices;
+        size_t trianglesOffset = (verticesSize + 15) & ~static_cast<size_t>(15);
+        size_t trianglesSize = sizeof(Shared::Triangle) * mesh->mNumFaces;
+        void* stagingMemory;
+        uint32_t stagingBlock = optixEnv->stagingPool.allocate(trianglesOffset + trianglesSize, true, &stagingMemory);
+        auto vertices = reinterpret_cast<Shared::Vertex*>(stagingMemory);
+        auto triangles = reinterpret_cast<Shared::Triangle*>(reinterpret_cast<uint8_t*>(stagingMemory) + trianglesOffset);
+
         for (int vIdx = 0; vIdx < mesh->mNumVertices; ++vIdx) {
             Shared::Vertex vtx;
             vtx.position = *reinterpret_cast<float3*>(&mesh->mVertices[vIdx]);
@@ -230,7 +255,6 @@ void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv) {
             vertices[vIdx] = vtx;
         }
 
-        std::vector<Shared::Triangle> triangles(mesh->mNumFaces);
         for (int fIdx = 0; fIdx < mesh->mNumFaces; ++fIdx) {
             const aiFace &face = mesh->mFaces[fIdx];
 
@@ -247,19 +271,36 @@ void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv) {
                 p->finalize();
                 delete p;
             });
-        vertexBuffer->initialize(optixEnv->cuContext, g_bufferType, vertices);
+        vertexBuffer->setMemoryCategory(cudau::MemoryCategory::Geometry);
+        vertexBuffer->initialize(&optixEnv->geometryArena, mesh->mNumVertices);
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(vertexBuffer->getCUdeviceptr(), vertices, verticesSize, stream));
 
         char name[256];
         sprintf_s(name, "%s-%d", basename.c_str(), meshIdx);
         GeometryInstanceRef geomInst = make_shared_with_deleter<GeometryInstance>(GeometryInstance::finalize);
         uint32_t geomInstIndex = optixEnv->geometryInstSlotFinder.getFirstAvailableSlot();
         optixEnv->geometryInstSlotFinder.setInUse(geomInstIndex);
+        if (geomInstIndex >= optixEnv->geometryDataBuffer.numElements())
+            optixEnv->geometryDataBuffer.resize(geomInstIndex + 1);
         geomInst->optixEnv = optixEnv;
         geomInst->geomInstIndex = geomInstIndex;
         geomInst->serialID = optixEnv->geomInstSerialID++;
         geomInst->name = name;
         geomInst->vertexBuffer = vertexBuffer;
-        geomInst->triangleBuffer.initialize(optixEnv->cuContext, g_bufferType, triangles);
+        geomInst->triangleBuffer.setMemoryCategory(cudau::MemoryCategory::Geometry);
+        geomInst->triangleBuffer.initialize(&optixEnv->geometryArena, mesh->mNumFaces);
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(geomInst->triangleBuffer.getCUdeviceptr(), triangles, trianglesSize, stream));
+        // JP: ブロックのフェンスを転送の後に記録し、スロットの再利用時に待てるようにする。
+        // EN: Record the block's fence after the transfers so that reusing the slot can wait for it.
+        optixEnv->stagingPool.release(stagingBlock, stream);
+        stagingBlocks[stagingSlot] = stagingBlock;
+        lastStagingSlot = stagingSlot;
+        // JP: 読み込んだメッシュは以降読み取り専用なので、各プロセッサーに複製を置くことを許す。
+        // EN: Loaded meshes are read-only afterwards, so allow duplicates on each processor.
+        if (g_bufferType == cudau::BufferType::Managed) {
+            vertexBuffer->advise(cudau::ManagedMemoryAdvice::ReadMostly);
+            geomInst->triangleBuffer.advise(cudau::ManagedMemoryAdvice::ReadMostly);
+        }
         geomInst->optixGeomInst = optixEnv->scene.createGeometryInstance();
         geomInst->optixGeomInst.setVertexBuffer(&*vertexBuffer);
         geomInst->optixGeomInst.setTriangleBuffer(&geomInst->triangleBuffer);
@@ -270,6 +311,11 @@ void loadFile(const std::filesystem::path &filepath, OptiXEnv* optixEnv) {
 
         optixEnv->geomInsts[geomInst->serialID] = geomInst;
     }
+
+    // JP: 転送は同じストリームに順に発行されているので最後のイベントを待てば十分。
+    // EN: Waiting for the last event is enough since transfers are issued to the same stream in order.
+    if (stagingBlocks[lastStagingSlot] != cudau::HostStagingPool::InvalidBlockIndex)
+        optixEnv->stagingPool.wait(stagingBlocks[lastStagingSlot]);
 }
 
 
@@ -920,6 +966,13 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
     CUDADRV_CHECK(cuStreamCreate(&cuStream[0], 0));
     CUDADRV_CHECK(cuStreamCreate(&cuStream[1], 0));
+    // JP: ストリーム順序で解放されたメモリーをもう一方のストリームの前フレームが使っている可能性があるので、
+    //     各フレームの処理をもう一方のストリームの前フレームの完了に順序付ける。
+    // EN: Memory freed in stream order might still be in use by the previous frame on the other stream,
+    //     so order each frame's work after the previous frame on the other stream.
+    CUevent frameFinishEvents[2];
+    CUDADRV_CHECK(cuEventCreate(&frameFinishEvents[0], CU_EVENT_DISABLE_TIMING));
+    CUDADRV_CHECK(cuEventCreate(&frameFinishEvents[1], CU_EVENT_DISABLE_TIMING));
 
     optixu::Context optixContext = optixu::Context::create(cuContext);
 
@@ -992,14 +1045,35 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     constexpr uint32_t MaxNumGASs = 512;
     
     optixEnv.scene = optixContext.createScene();
-    optixEnv.geometryDataBuffer.initialize(cuContext, g_bufferType, MaxNumGeometryInstances);
+    // JP: g_bufferTypeをManagedにした場合に、ビルドやレンダリング中のページフォールトを避ける。
+    // EN: Avoid page faults during builds and rendering when g_bufferType is set to Managed.
+    optixEnv.scene.setManagedMemoryAutoPrefetch(true);
+    // JP: 読み込んだメッシュの頂点・三角形バッファーは大きなスラブから切り出して割り当てる。
+    // EN: Sub-allocate vertex/triangle buffers of loaded meshes from large slabs.
+    optixEnv.geometryArena.initialize(cuContext, g_bufferType, 64 * 1024 * 1024);
+    // JP: 編集のたびに確保・解放を繰り返すASやプリトランスフォーム用のメモリーはストリーム順序のプールから取る。
+    // EN: Take memory for ASs and pre-transforms, which are allocated and freed on every edit,
+    //     from a stream-ordered pool.
+    optixEnv.memoryPool.initialize(cuContext, 256 * 1024 * 1024);
+    // JP: ジオメトリデータやプリトランスフォームなどの小さな書き込みをまとめて転送する。
+    // EN: Transfer small writes like geometry data and pre-transforms together.
+    optixEnv.uploadBatcher.initialize(cuContext);
+    // JP: メッシュ読み込み時の転送元となるページロックされたメモリー。
+    // EN: Page-locked memory used as the transfer source when loading meshes.
+    optixEnv.stagingPool.initialize(cuContext);
+    // JP: アドレスがplpに埋め込まれるので、伸長してもアドレスが変わらないバッファーを使う。
+    // EN: Use buffers whose address doesn't change on growth since the addresses are baked into plp.
+    optixEnv.geometryDataBuffer.setMemoryCategory(cudau::MemoryCategory::Geometry);
+    optixEnv.geometryDataBuffer.initializeStableAddress(cuContext, 0, MaxNumGeometryInstances);
     optixEnv.geometryInstSlotFinder.initialize(MaxNumGeometryInstances);
-    optixEnv.gasDataBuffer.initialize(cuContext, g_bufferType, MaxNumGASs);
+    optixEnv.gasDataBuffer.setMemoryCategory(cudau::MemoryCategory::Geometry);
+    optixEnv.gasDataBuffer.initializeStableAddress(cuContext, 0, MaxNumGASs);
     optixEnv.gasSlotFinder.initialize(MaxNumGASs);
     optixEnv.geomInstSerialID = 0;
     optixEnv.gasSerialID = 0;
     optixEnv.instSerialID = 0;
     optixEnv.iasSerialID = 0;
+    optixEnv.asScratchBuffer.setMemoryCategory(cudau::MemoryCategory::Scratch);
     optixEnv.asScratchBuffer.initialize(cuContext, g_bufferType, 32 * 1024 * 1024, 1);
 
     // END: Setup a scene.
@@ -1189,6 +1263,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         // JP: 前フレームの処理が完了するのを待つ。
         // EN: Wait the previous frame processing to finish.
         CUDADRV_CHECK(cuStreamSynchronize(curCuStream));
+        if (frameIndex > 0)
+            CUDADRV_CHECK(cuStreamWaitEvent(curCuStream, frameFinishEvents[(bufferIndex + 1) % 2], 0));
 
 
 
@@ -1224,7 +1300,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                 static std::vector<std::filesystem::directory_entry> entries;
                 fileDialog.calcEntries(&entries);
                 
-                loadFile(entries[0], &optixEnv);
+                loadFile(entries[0], &optixEnv, curCuStream);
             }
 
             if (ImGui::Combo("Target", &travIndex,
@@ -1267,6 +1343,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                             GeometryGroupRef geomGroup = make_shared_with_deleter<GeometryGroup>(GeometryGroup::finalize);
                             uint32_t gasIndex = optixEnv.gasSlotFinder.getFirstAvailableSlot();
                             optixEnv.gasSlotFinder.setInUse(gasIndex);
+                            if (gasIndex >= optixEnv.gasDataBuffer.numElements())
+                                optixEnv.gasDataBuffer.resize(gasIndex + 1);
                             char name[256];
                             sprintf_s(name, "GAS-%u", serialID);
                             geomGroup->optixEnv = &optixEnv;
@@ -1278,11 +1356,12 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                             geomGroup->optixGAS.setNumMaterialSets(1);
                             geomGroup->optixGAS.setNumRayTypes(0, Shared::NumRayTypes);
                             geomGroup->optixGAS.setUserData(gasIndex);
-                            geomGroup->preTransformBuffer.initialize(optixEnv.cuContext, g_bufferType, geomInstList.getNumSelected());
+                            geomGroup->preTransformBuffer.setMemoryCategory(cudau::MemoryCategory::Geometry);
+                            geomGroup->preTransformBuffer.initialize(&optixEnv.memoryPool, geomInstList.getNumSelected(), curCuStream);
                             geomGroup->dataTransfered = false;
 
                             geomInstList.loopForSelected(
-                                [&optixEnv, &geomGroup, &curCuStream](uint32_t idx, const GeometryInstanceRef &geomInst) {
+                                [&optixEnv, &geomGroup](uint32_t idx, const GeometryInstanceRef &geomInst) {
                                     geomGroup->geomInsts.push_back(geomInst);
                                     geomGroup->preTransforms.emplace_back();
                                     geomGroup->optixGAS.addChild(geomInst->optixGeomInst, geomGroup->preTransformBuffer.getCUdeviceptrAt(idx));
@@ -1290,16 +1369,14 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                                         Shared::GeometryData geomData;
                                         geomData.vertexBuffer = geomInst->vertexBuffer->getDevicePointer();
                                         geomData.triangleBuffer = geomInst->triangleBuffer.getDevicePointer();
-                                        CUDADRV_CHECK(cuMemcpyHtoDAsync(optixEnv.geometryDataBuffer.getCUdeviceptrAt(geomInst->geomInstIndex),
-                                                                        &geomData, sizeof(geomData), curCuStream));
+                                        optixEnv.uploadBatcher.enqueue(optixEnv.geometryDataBuffer, geomInst->geomInstIndex, geomData);
                                         geomInst->dataTransfered = true;
                                     }
                                     return true;
                                 });
-                            CUDADRV_CHECK(cuMemcpyHtoDAsync(geomGroup->preTransformBuffer.getCUdeviceptr(),
-                                                            geomGroup->preTransforms.data(),
-                                                            geomGroup->preTransformBuffer.sizeInBytes(),
-                                                            curCuStream));
+                            optixEnv.uploadBatcher.enqueue(geomGroup->preTransformBuffer, 0,
+                                                           geomGroup->preTransforms.data(),
+                                                           geomGroup->preTransformBuffer.sizeInBytes());
 
                             sbtLayoutUpdated = true;
                             traversablesUpdated = true;
@@ -1379,10 +1456,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                             if (!geomGroup->dataTransfered) {
                                 Shared::GASData gasData;
                                 gasData.preTransforms = geomGroup->preTransformBuffer.getDevicePointer();
-                                CUDADRV_CHECK(cuMemcpyHtoDAsync(optixEnv.gasDataBuffer.getCUdeviceptrAt(geomGroup->gasIndex),
-                                                                &gasData,
-                                                                sizeof(gasData),
-                                                                curCuStream));
+                                optixEnv.uploadBatcher.enqueue(optixEnv.gasDataBuffer, geomGroup->gasIndex, gasData);
                                 geomGroup->dataTransfered = true;
                             }
 
@@ -1676,6 +1750,10 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
             ImGui::End();
         }
 
+        // JP: プリトランスフォームはGASのビルドで参照されるのでビルド前に転送する。
+        // EN: Transfer before building GASs since pre-transforms are referenced by the builds.
+        optixEnv.uploadBatcher.flush(curCuStream);
+
 
 
         for (const auto &kv : optixEnv.geomGroups) {
@@ -1687,11 +1765,16 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
             OptixAccelBufferSizes bufferSizes;
             geomGroup->optixGAS.prepareForBuild(&bufferSizes);
             if (bufferSizes.tempSizeInBytes >= optixEnv.asScratchBuffer.sizeInBytes())
-                optixEnv.asScratchBuffer.resize(bufferSizes.tempSizeInBytes, 1, curCuStream);
-            if (geomGroup->optixGasMem.isInitialized())
-                geomGroup->optixGasMem.resize(bufferSizes.outputSizeInBytes, 1, curCuStream);
-            else
-                geomGroup->optixGasMem.initialize(optixEnv.cuContext, g_bufferType, bufferSizes.outputSizeInBytes, 1);
+                optixEnv.asScratchBuffer.resize(bufferSizes.tempSizeInBytes, 1, cudau::ResizeMode::Discard, curCuStream);
+            // JP: リビルドによって全て上書きされるので以前の内容をコピーする必要はない。
+            // EN: No need to copy the previous contents since the rebuild overwrites everything.
+            if (geomGroup->optixGasMem.isInitialized()) {
+                geomGroup->optixGasMem.resize(bufferSizes.outputSizeInBytes, 1, cudau::ResizeMode::Discard, curCuStream);
+            }
+            else {
+                geomGroup->optixGasMem.setMemoryCategory(cudau::MemoryCategory::AS);
+                geomGroup->optixGasMem.initialize(&optixEnv.memoryPool, bufferSizes.outputSizeInBytes, 1, curCuStream);
+            }
             geomGroup->optixGAS.rebuild(curCuStream, geomGroup->optixGasMem, optixEnv.asScratchBuffer);
         }
 
@@ -1701,10 +1784,13 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
             size_t sbtSize;
             optixEnv.scene.generateShaderBindingTableLayout(&sbtSize);
-            if (curShaderBindingTable->isInitialized())
-                curShaderBindingTable->resize(sbtSize, 1, curCuStream);
-            else
+            if (curShaderBindingTable->isInitialized()) {
+                curShaderBindingTable->resize(sbtSize, 1, cudau::ResizeMode::Discard, curCuStream);
+            }
+            else {
+                curShaderBindingTable->setMemoryCategory(cudau::MemoryCategory::SBT);
                 curShaderBindingTable->initialize(cuContext, g_bufferType, sbtSize, 1);
+            }
             pipeline.setHitGroupShaderBindingTable(curShaderBindingTable);
             sbtLayoutUpdated = false;
         }
@@ -1720,14 +1806,16 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
             uint32_t numInstances;
             group->optixIAS.prepareForBuild(&bufferSizes, &numInstances);
             if (bufferSizes.tempSizeInBytes >= optixEnv.asScratchBuffer.sizeInBytes())
-                optixEnv.asScratchBuffer.resize(bufferSizes.tempSizeInBytes, 1, curCuStream);
+                optixEnv.asScratchBuffer.resize(bufferSizes.tempSizeInBytes, 1, cudau::ResizeMode::Discard, curCuStream);
             if (group->optixIasMem.isInitialized()) {
-                group->optixIasMem.resize(bufferSizes.outputSizeInBytes, 1, curCuStream);
-                group->optixInstanceBuffer.resize(numInstances);
+                group->optixIasMem.resize(bufferSizes.outputSizeInBytes, 1, cudau::ResizeMode::Discard, curCuStream);
+                group->optixInstanceBuffer.resize(numInstances, cudau::ResizeMode::Discard, curCuStream);
             }
             else {
-                group->optixIasMem.initialize(optixEnv.cuContext, g_bufferType, bufferSizes.outputSizeInBytes, 1);
-                group->optixInstanceBuffer.initialize(optixEnv.cuContext, g_bufferType, numInstances);
+                group->optixIasMem.setMemoryCategory(cudau::MemoryCategory::AS);
+                group->optixIasMem.initialize(&optixEnv.memoryPool, bufferSizes.outputSizeInBytes, 1, curCuStream);
+                group->optixInstanceBuffer.setMemoryCategory(cudau::MemoryCategory::AS);
+                group->optixInstanceBuffer.initialize(&optixEnv.memoryPool, numInstances, curCuStream);
             }
             group->optixIAS.rebuild(curCuStream, group->optixInstanceBuffer, group->optixIasMem, optixEnv.asScratchBuffer);
         }
@@ -1763,10 +1851,12 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         plp.travHandle = curTravHandle;
         plp.resultBuffer = outputBufferSurfaceHolder.getNext();
 
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), curCuStream));
+        optixEnv.uploadBatcher.enqueue(plpOnDevice, plp);
+        optixEnv.uploadBatcher.flush(curCuStream);
         pipeline.launch(curCuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
 
         outputBufferSurfaceHolder.endCUDAAccess(curCuStream);
+        CUDADRV_CHECK(cuEventRecord(frameFinishEvents[bufferIndex], curCuStream));
 
 
 
@@ -1820,6 +1910,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     outputArray.finalize();
     outputTexture.finalize();
 
+    optixEnv.stagingPool.finalize();
+    optixEnv.uploadBatcher.finalize();
     optixEnv.asScratchBuffer.finalize();
     optixEnv.shaderBindingTable[1].finalize();
     optixEnv.shaderBindingTable[0].finalize();
@@ -1827,6 +1919,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     optixEnv.gasDataBuffer.finalize();
     optixEnv.geometryInstSlotFinder.finalize();
     optixEnv.geometryDataBuffer.finalize();
+    optixEnv.geometryArena.finalize();
+    optixEnv.memoryPool.finalize();
     optixEnv.scene.destroy();
 
     optixEnv.material.destroy();
@@ -1841,6 +1935,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
     optixContext.destroy();
 
+    CUDADRV_CHECK(cuEventDestroy(frameFinishEvents[1]));
+    CUDADRV_CHECK(cuEventDestroy(frameFinishEvents[0]));
     CUDADRV_CHECK(cuStreamDestroy(cuStream[1]));
     CUDADRV_CHECK(cuStreamDestroy(cuStream[0]));
     CUDADRV_CHECK(cuCtxDestroy(cuContext));
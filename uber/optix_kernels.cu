@@ -15,6 +15,9 @@ struct SearchRayPayload {
     float3 contribution;
     float3 origin;
     float3 direction;
+    // JP: テクスチャーのミップレベル選択に使うレイコーンの起点での幅。
+    // EN: Width of the ray cone at the origin, used to select texture mip levels.
+    float coneWidth;
     struct {
         unsigned int pathLength : 30;
         bool specularBounce : 1;
@@ -50,6 +53,7 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(pathtracing)() {
     SearchRayPayload payload;
     payload.alpha = make_float3(1.0f, 1.0f, 1.0f);
     payload.contribution = make_float3(0.0f, 0.0f, 0.0f);
+    payload.coneWidth = 0.0f;
     payload.pathLength = 1;
     payload.terminate = false;
     SearchRayPayload* payloadPtr = &payload;
@@ -95,22 +99,49 @@ CUDA_DEVICE_KERNEL void RT_MS_NAME(searchRay)() {
     //     However pass the null pointer as the first payload because we don't need the first payload here.
     SearchRayPayload* payload;
     optixu::getPayloads<SearchRayPayloadSignature>(nullptr, nullptr, &payload);
-    payload->contribution = payload->contribution + payload->alpha * make_float3(0.01f, 0.01f, 0.01f);
+    float3 envValue = make_float3(0.01f, 0.01f, 0.01f);
+    if (plp.envTexID != 0xFFFFFFFF) {
+        // JP: 正距円筒図法の環境マップをレイの方向で参照する。
+        // EN: Look up the equirectangular environment map with the ray direction.
+        float3 direction = optixGetWorldRayDirection();
+        float phi = atan2f(direction.x, direction.z);
+        float theta = acosf(fminf(fmaxf(direction.y, -1.0f), 1.0f));
+        float u = 0.5f + phi / (2 * M_PI);
+        float v = theta / M_PI;
+        float4 texValue = tex2DLod<float4>(plp.textures[plp.envTexID], u, v, 0.0f);
+        envValue = make_float3(texValue.x, texValue.y, texValue.z);
+    }
+    payload->contribution = payload->contribution + payload->alpha * envValue;
     payload->terminate = true;
 }
 
 
 
-using ProgSampleTexture = optixu::DirectCallableProgramID<float3(uint32_t, float2)>;
+// JP: 1ピクセルあたりのレイコーンの広がり角を使い、ヒット点までの距離からコーンの幅を求める。
+//     幅を面の傾きとテクスチャー座標の密度でテクスチャー空間のフットプリントに変換する。
+// EN: Compute the cone width at the hit point from the distance using the ray cone spread angle per pixel.
+//     Convert the width into a footprint in texture space by the surface slant and the texture coordinate density.
+CUDA_DEVICE_FUNCTION float computeTexCoordFootprint(SearchRayPayload* payload, const float3 &vOut, const float3 &sn,
+                                                     float texCoordDensity) {
+    float spreadAngle = 2 * std::tan(plp.camera.fovY * 0.5f) / plp.imageSize.y;
+    float coneWidth = payload->coneWidth + spreadAngle * optixGetRayTmax();
+    payload->coneWidth = coneWidth;
+    return coneWidth / fmaxf(std::fabs(dot(vOut, sn)), 0.1f) * texCoordDensity;
+}
+
+using ProgSampleTexture = optixu::DirectCallableProgramID<float3(uint32_t, float2, float)>;
 
-RT_CALLABLE_PROGRAM float3 RT_DC_NAME(sampleTexture)(uint32_t texID, float2 texCoord) {
+RT_CALLABLE_PROGRAM float3 RT_DC_NAME(sampleTexture)(uint32_t texID, float2 texCoord, float footprint) {
     CUtexObject texture = plp.textures[texID];
-    float4 texValue = tex2DLod<float4>(texture, texCoord.x, texCoord.y, 0.0f);
+    // JP: フットプリントを等方的な勾配として渡し、ハードウェアにミップレベルを選ばせる。
+    // EN: Pass the footprint as isotropic gradients to let the hardware select the mip level.
+    float4 texValue = tex2DGrad<float4>(texture, texCoord.x, texCoord.y,
+                                        make_float2(footprint, 0.0f), make_float2(0.0f, footprint));
     return make_float3(texValue.x, texValue.y, texValue.z);
 }
 
 RT_CALLABLE_PROGRAM void RT_DC_NAME(decodeHitPointTriangle)(const HitPointParameter &hitPointParam, const GeometryData &geom,
-                                                            float3* p, float3* sn, float2* texCoord) {
+                                                            float3* p, float3* sn, float2* texCoord, float* texCoordDensity) {
     const Triangle &tri = geom.triangleBuffer[hitPointParam.primIndex];
     const Vertex &v0 = geom.vertexBuffer[tri.index0];
     const Vertex &v1 = geom.vertexBuffer[tri.index1];
@@ -121,6 +152,12 @@ RT_CALLABLE_PROGRAM void RT_DC_NAME(decodeHitPointTriangle)(const HitPointParame
     *p = b0 * v0.position + b1 * v1.position + b2 * v2.position;
     *sn = b0 * v0.normal + b1 * v1.normal + b2 * v2.normal;
     *texCoord = b0 * v0.texCoord + b1 * v1.texCoord + b2 * v2.texCoord;
+
+    float2 dt1 = v1.texCoord - v0.texCoord;
+    float2 dt2 = v2.texCoord - v0.texCoord;
+    float texCoordArea = std::fabs(dt1.x * dt2.y - dt1.y * dt2.x);
+    float area = length(cross(v1.position - v0.position, v2.position - v0.position));
+    *texCoordDensity = area > 0.0f ? std::sqrt(texCoordArea / area) : 0.0f;
 }
 
 
@@ -146,9 +183,11 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(shading_diffuse)() {
     float3 p;
     float3 sn;
     float2 texCoord;
-    geom.decodeHitPoint(HitPointParameter::get(), &p, &sn, &texCoord);
+    float texCoordDensity;
+    geom.decodeHitPoint(HitPointParameter::get(), &p, &sn, &texCoord, &texCoordDensity);
 
     float3 vOut = -optixGetWorldRayDirection();
+    float texCoordFootprint = computeTexCoordFootprint(payload, vOut, sn, texCoordDensity);
     bool isFrontFace = dot(vOut, sn) > 0;
     if (!isFrontFace)
         sn = -sn;
@@ -163,7 +202,7 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(shading_diffuse)() {
     if (mat.misc != 0xFFFFFFFF) {
         // Demonstrate how to use texture sampling and direct callable program.
         ProgSampleTexture sampleTexture(mat.program);
-        albedo = sampleTexture(mat.texID, texCoord);
+        albedo = sampleTexture(mat.texID, texCoord, texCoordFootprint);
     }
 
     const float3 LightRadiance = make_float3(20, 20, 20);
@@ -261,7 +300,11 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(shading_specular)() {
     float3 p;
     float3 sn;
     float2 texCoord;
-    geom.decodeHitPoint(HitPointParameter::get(), &p, &sn, &texCoord);
+    float texCoordDensity;
+    geom.decodeHitPoint(HitPointParameter::get(), &p, &sn, &texCoord, &texCoordDensity);
+
+    float3 vOut = -optixGetWorldRayDirection();
+    float texCoordFootprint = computeTexCoordFootprint(payload, vOut, sn, texCoordDensity);
 
     p = p + sn * 0.001f;
 
@@ -273,11 +316,9 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(shading_specular)() {
     float3 albedo = mat.albedo;
     if (mat.misc != 0xFFFFFFFF) {
         // Demonstrate how to use texture sampling and direct callable program.
-        albedo = optixDirectCall<float3>(mat.program, mat.texID, texCoord);
+        albedo = optixDirectCall<float3>(mat.program, mat.texID, texCoord, texCoordFootprint);
     }
 
-    float3 vOut = -optixGetWorldRayDirection();
-
     // Sampling incoming direction (delta distribution).
     float3 vIn = normalize(2 * dot(vOut, sn) * sn - vOut);
     payload->alpha = payload->alpha * albedo;
@@ -333,7 +374,7 @@ CUDA_DEVICE_KERNEL void RT_IS_NAME(custom_primitive)() {
 }
 
 RT_CALLABLE_PROGRAM void RT_DC_NAME(decodeHitPointSphere)(const HitPointParameter &hitPointParam, const GeometryData &geom,
-                                                          float3* p, float3* sn, float2* texCoord) {
+                                                          float3* p, float3* sn, float2* texCoord, float* texCoordDensity) {
     const SphereParameter &param = geom.paramBuffer[hitPointParam.primIndex];
     float theta = hitPointParam.b0;
     float phi = hitPointParam.b1;
@@ -342,6 +383,10 @@ RT_CALLABLE_PROGRAM void RT_DC_NAME(decodeHitPointSphere)(const HitPointParamete
     *p = param.center + np * param.radius;
     *sn = np;
     *texCoord = make_float2(theta / Pi, phi / (2 * Pi)) * param.texCoordMultiplier;
+    // JP: θ方向とφ方向の密度の相乗平均。極付近で発散しないようにsinθを制限する。
+    // EN: Geometric mean of the densities along theta and phi. Clamp sin(theta) to avoid divergence near the poles.
+    *texCoordDensity = param.texCoordMultiplier /
+        (Pi * param.radius * std::sqrt(2 * std::fmax(sinTheta, 1e-3f)));
 }
 
 
@@ -0,0 +1,8 @@
+﻿#pragma once
+
+#include "uber_shared.h"
+
+CUDA_DEVICE_KERNEL void scatterUploads(const cudau::UploadCommand* commands, uint32_t numCommands,
+                                       const uint8_t* batch) {
+    cudau::scatterUploads(commands, numCommands, batch);
+}
@@ -11,6 +11,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../ext/stb_image.h"
 #include "../common/dds_loader.h"
+#include "../common/mipmap_generator.h"
+#include "../common/bc_encoder.h"
+#include "../common/hdr_loader.h"
+#include "../common/profiler.h"
 
 
 
@@ -75,8 +79,7 @@ constexpr cudau::BufferType g_bufferType = cudau::BufferType::Device;
 struct SceneContext {
     optixu::Scene optixScene;
     Shared::ProgDecodeHitPoint decodeHitPointTriangle;
-    cudau::TypedBuffer<Shared::GeometryData> geometryDataBuffer;
-    uint32_t geometryID;
+    cudau::MirroredTable<Shared::GeometryData> geometryDataTable;
 };
 
 class TriangleMesh {
@@ -111,6 +114,7 @@ public:
     }
 
     void setVertexBuffer(const Shared::Vertex* vertices, uint32_t numVertices) {
+        m_vertexBuffer.setMemoryCategory(cudau::MemoryCategory::Geometry);
         m_vertexBuffer.initialize(m_cuContext, g_bufferType, numVertices);
         m_vertexBuffer.transfer(vertices, numVertices);
     }
@@ -126,26 +130,25 @@ public:
 
         auto triangleBuffer = new cudau::TypedBuffer<Shared::Triangle>();
         group.triangleBuffer = triangleBuffer;
+        triangleBuffer->setMemoryCategory(cudau::MemoryCategory::Geometry);
         triangleBuffer->initialize(m_cuContext, g_bufferType, numTriangles);
         triangleBuffer->transfer(triangles, numTriangles);
 
         group.material = material;
 
-        Shared::GeometryData* geomDataPtr = m_sceneContext->geometryDataBuffer.map();
-        Shared::GeometryData &recordData = geomDataPtr[m_sceneContext->geometryID];
+        Shared::GeometryData recordData;
         recordData.vertexBuffer = m_vertexBuffer.getDevicePointer();
         recordData.triangleBuffer = triangleBuffer->getDevicePointer();
         recordData.decodeHitPointFunc = m_sceneContext->decodeHitPointTriangle;
-        m_sceneContext->geometryDataBuffer.unmap();
+        uint32_t geometryID = static_cast<uint32_t>(m_sceneContext->geometryDataTable.add(recordData));
 
         optixu::GeometryInstance geomInst = m_sceneContext->optixScene.createGeometryInstance();
         geomInst.setVertexBuffer(&m_vertexBuffer);
         geomInst.setTriangleBuffer(triangleBuffer);
-        geomInst.setUserData(m_sceneContext->geometryID);
+        geomInst.setUserData(geometryID);
         geomInst.setNumMaterials(1, nullptr);
         geomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
         geomInst.setMaterial(0, 0, material);
-        ++m_sceneContext->geometryID;
 
         group.geometryInstance = geomInst;
 
@@ -175,7 +178,173 @@ static void glfw_error_callback(int32_t error, const char* description) {
 
 
 
+// JP: 8ビット画像を読み込んでミップチェインを生成し、テクスチャープールに登録する。
+//     圧縮する場合は各レベルをBC1にエンコードし、結果は実行ファイル横のキャッシュに保存する。
+// EN: Loads an 8-bit image, generates its mip chain and registers it to the texture pool.
+//     When compressing, each level is encoded to BC1 and the result is stored in a cache next to the executable.
+static uint32_t loadTextureWithMipmaps(cudau::TexturePool* texturePool, const char* filepath, bool compress) {
+    PROFILER_ZONE("Load Texture");
+    int32_t width, height, n;
+    uint8_t* linearImageData = stbi_load(filepath, &width, &height, &n, 4);
+    std::vector<mipmap::Level> mipLevels;
+    mipmap::generate(linearImageData, width, height, true, mipmap::Filter::Box, 0, &mipLevels);
+    stbi_image_free(linearImageData);
+
+    const uint32_t numLevels = static_cast<uint32_t>(mipLevels.size());
+    std::vector<const void*> levelData(numLevels);
+    std::vector<size_t> levelSizes(numLevels);
+
+    // JP: BCフォーマットのArrayは4の倍数のサイズを要求する。
+    // EN: BC format arrays require sizes that are multiples of 4.
+    compress &= width % 4 == 0 && height % 4 == 0;
+    if (compress) {
+        // JP: BCフォーマットのArrayは4x4ブロック単位で確保されるため、ミップチェインの長さは
+        //     ブロック単位のサイズで決まる。ピクセル単位のレベルのブロック数が一致するレベルまでを使用する。
+        // EN: BC format arrays are allocated in units of 4x4 blocks, so the length of the mip chain is
+        //     determined by the size in blocks. Use levels up to where the block counts of the pixel levels match.
+        const uint32_t numBlocksX = width / 4;
+        const uint32_t numBlocksY = height / 4;
+        uint32_t numBCLevels = 0;
+        while (numBCLevels < numLevels) {
+            const mipmap::Level &level = mipLevels[numBCLevels];
+            if ((numBlocksX >> numBCLevels) == 0 && (numBlocksY >> numBCLevels) == 0)
+                break;
+            if ((level.width + 3) / 4 != std::max(numBlocksX >> numBCLevels, 1u) ||
+                (level.height + 3) / 4 != std::max(numBlocksY >> numBCLevels, 1u))
+                break;
+            ++numBCLevels;
+        }
+
+        const std::filesystem::path cacheDir = getExecutableDirectory() / "bc_cache";
+        constexpr bc::Format format = bc::Format::BC1;
+        std::vector<std::vector<uint8_t>> levelBlocks(numBCLevels);
+        for (uint32_t i = 0; i < numBCLevels; ++i) {
+            const mipmap::Level &level = mipLevels[i];
+            bc::encodeCached(cacheDir, level.data.data(), level.width, level.height,
+                             format, bc::Quality::Normal, 0, &levelBlocks[i]);
+            levelData[i] = levelBlocks[i].data();
+            levelSizes[i] = levelBlocks[i].size();
+        }
+        return texturePool->createArray2D(bc::getArrayElementType(format), 1, width, height, numBCLevels,
+                                          levelData.data(), levelSizes.data());
+    }
+    else {
+        for (uint32_t i = 0; i < numLevels; ++i) {
+            levelData[i] = mipLevels[i].data.data();
+            levelSizes[i] = mipLevels[i].data.size();
+        }
+        return texturePool->createArray2D(cudau::ArrayElementType::UInt8, 4, width, height, numLevels,
+                                          levelData.data(), levelSizes.data());
+    }
+}
+
+
+
+// JP: 縮小前のダーティな要素が縮小後の同期で転送されないことを確かめる。
+// EN: Verify that dirty elements from before a shrink are not transferred by a sync after the shrink.
+static bool testMirroredTableShrink(CUcontext cuContext, CUstream stream) {
+    cudau::MirroredTable<uint32_t> table;
+    table.initialize(cuContext, cudau::BufferType::Device, 128);
+    table.resize(128);
+    for (uint32_t i = 0; i < 128; ++i)
+        table.set(i, i);
+    table.sync(stream);
+
+    table.set(90, 1000);
+    table.resize(70);
+    table.set(65, 2000);
+    table.sync(stream);
+    const cudau::MirroredTable<uint32_t>::Stats stats = table.getLastSyncStats();
+
+    std::vector<uint32_t> values(table.numElements());
+    CUDADRV_CHECK(cuStreamSynchronize(stream));
+    CUDADRV_CHECK(cuMemcpyDtoH(values.data(), table.getBuffer().getCUdeviceptr(), values.size() * sizeof(uint32_t)));
+    table.finalize();
+
+    bool success = stats.numRanges == 1 && stats.numBytes == sizeof(uint32_t);
+    for (uint32_t i = 0; i < values.size(); ++i)
+        success &= values[i] == (i == 65 ? 2000 : i);
+    hpprintf("MirroredTable shrink then sync: %s (%llu ranges, %llu bytes)\n",
+             success ? "OK" : "NG", stats.numRanges, stats.numBytes);
+    return success;
+}
+
+// JP: 同じ内容のBCテクスチャーを2回作成した場合にArrayが共有されることを確かめる。
+// EN: Verify that creating a BC texture with the same contents twice shares the array.
+static bool testTexturePoolBCDedup(CUcontext cuContext, CUstream stream) {
+    constexpr uint32_t width = 16;
+    constexpr uint32_t height = 8;
+    std::vector<uint8_t> image(width * height * 4);
+    for (uint32_t i = 0; i < image.size(); ++i)
+        image[i] = static_cast<uint8_t>(i * 37);
+
+    bool success = true;
+    for (bc::Format format : { bc::Format::BC1, bc::Format::BC7 }) {
+        std::vector<uint8_t> blocks;
+        bc::encode(image.data(), width, height, format, bc::Quality::Normal, 0, &blocks);
+        const void* levelData[] = { blocks.data() };
+        size_t levelSizes[] = { blocks.size() };
+
+        cudau::TexturePool texturePool;
+        texturePool.initialize(cuContext, cudau::BufferType::Device, 4);
+        uint32_t arrayIndexA = texturePool.createArray2D(bc::getArrayElementType(format), 1, width, height, 1,
+                                                         levelData, levelSizes, stream);
+        uint32_t arrayIndexB = texturePool.createArray2D(bc::getArrayElementType(format), 1, width, height, 1,
+                                                         levelData, levelSizes, stream);
+        const cudau::TexturePool::Stats stats = texturePool.getStats();
+        texturePool.finalize();
+
+        bool formatSuccess = arrayIndexA == arrayIndexB && stats.numArrays == 1 && stats.numArrayDedupHits == 1;
+        hpprintf("TexturePool %s dedup: %s (%u arrays, %u hits)\n", bc::getFormatName(format),
+                 formatSuccess ? "OK" : "NG", stats.numArrays, stats.numArrayDedupHits);
+        success &= formatSuccess;
+    }
+    return success;
+}
+
+// JP: 共通モジュールとCUDAユーティリティーのセルフテストを実行する。
+// EN: Run the self-tests of the common modules and the CUDA utilities.
+static bool runSelfTests() {
+    bool success = true;
+    hpprintf("---- BC encoder ----\n");
+    success &= bc::runSelfTest();
+    hpprintf("---- HDR loader ----\n");
+    success &= hdr::runSelfTest();
+    hpprintf("---- Mipmap generator ----\n");
+    success &= mipmap::runSelfTest();
+
+    hpprintf("---- CUDA utilities ----\n");
+    CUcontext cuContext;
+    CUstream cuStream;
+    CUDADRV_CHECK(cuInit(0));
+    CUDADRV_CHECK(cuCtxCreate(&cuContext, 0, 0));
+    CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
+    CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
+    success &= testMirroredTableShrink(cuContext, cuStream);
+    success &= testTexturePoolBCDedup(cuContext, cuStream);
+    CUDADRV_CHECK(cuStreamDestroy(cuStream));
+    CUDADRV_CHECK(cuCtxDestroy(cuContext));
+
+    hpprintf("Self-test %s.\n", success ? "passed" : "failed");
+    return success;
+}
+
+
+
 int32_t mainFunc(int32_t argc, const char* argv[]) {
+    // JP: "--self-test"が指定された場合はセルフテストのみを実行して終了する。
+    //     "--env <file>"で環境マップを指定できる。
+    // EN: Run only the self-tests and exit when "--self-test" is given.
+    //     "--env <file>" specifies an environment map.
+    const char* envMapPath = nullptr;
+    for (int32_t i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--self-test")
+            return runSelfTests() ? 0 : -1;
+        else if (arg == "--env" && i + 1 < argc)
+            envMapPath = argv[++i];
+    }
+
     // ----------------------------------------------------------------
     // JP: OpenGL, GLFWの初期化。
     // EN: Initialize OpenGL and GLFW.
@@ -364,48 +533,39 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
 
-    hpprintf("Setup OptiX context and pipeline.\n");
+    profiler::setThreadName("Main");
 
-    struct GPUTimer {
-        cudau::Timer frame;
-        cudau::Timer deform;
-        cudau::Timer updateGAS;
-        cudau::Timer updateIAS;
-        cudau::Timer render;
-        cudau::Timer postProcess;
-        bool animated;
-
-        void initialize(CUcontext context) {
-            frame.initialize(context);
-            deform.initialize(context);
-            updateGAS.initialize(context);
-            updateIAS.initialize(context);
-            render.initialize(context);
-            postProcess.initialize(context);
-            animated = false;
-        }
-        void finalize() {
-            postProcess.finalize();
-            render.finalize();
-            updateIAS.finalize();
-            updateGAS.finalize();
-            deform.finalize();
-            frame.finalize();
-        }
-    };
+    hpprintf("Setup OptiX context and pipeline.\n");
+    profiler::Zone setupPipelineZone("Setup Pipeline");
 
     CUcontext cuContext;
     int32_t cuDeviceCount;
     CUstream cuStream[2];
-    GPUTimer gpuTimer[2];
+    cudau::GraphRecorder graphRecorder[2];
     CUDADRV_CHECK(cuInit(0));
     CUDADRV_CHECK(cuDeviceGetCount(&cuDeviceCount));
     CUDADRV_CHECK(cuCtxCreate(&cuContext, 0, 0));
     CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
     CUDADRV_CHECK(cuStreamCreate(&cuStream[0], 0));
     CUDADRV_CHECK(cuStreamCreate(&cuStream[1], 0));
-    gpuTimer[0].initialize(cuContext);
-    gpuTimer[1].initialize(cuContext);
+    graphRecorder[0].initialize(cuContext);
+    graphRecorder[1].initialize(cuContext);
+
+    // JP: GPU時間の計測。結果は数フレーム後にブロックせずに取得する。
+    // EN: GPU time measurement. Results are obtained a few frames later without blocking.
+    cudau::TimestampPool timestampPool;
+    timestampPool.initialize(cuContext);
+    const uint32_t frameScope = timestampPool.registerScope("Frame");
+    const uint32_t deformScope = timestampPool.registerScope("Deform");
+    const uint32_t updateGASScope = timestampPool.registerScope("Update GAS");
+    const uint32_t updateIASScope = timestampPool.registerScope("Update IAS");
+    const uint32_t renderScope = timestampPool.registerScope("Render");
+    const uint32_t postProcessScope = timestampPool.registerScope("Post Process");
+
+    // JP: 毎フレームの小さな書き込みをまとめて転送する。
+    // EN: Transfer small per-frame writes together.
+    cudau::UploadBatcher uploadBatcher;
+    uploadBatcher.initialize(cuContext);
 
     optixu::Context optixContext = optixu::Context::create(cuContext);
 
@@ -515,10 +675,30 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     cudau::Kernel kernelAccumulateVertexNormals(moduleDeform, "accumulateVertexNormals", cudau::dim3(32), 0);
     cudau::Kernel kernelNormalizeVertexNormals(moduleDeform, "normalizeVertexNormals", cudau::dim3(32), 0);
 
+    // JP: 毎フレーム実行するカーネルのブロックサイズを自動調整し、結果を実行ファイル横のキャッシュに保存する。
+    // EN: Autotune the block sizes of kernels executed every frame and store the results in a cache next to the executable.
+    cudau::KernelAutotuner kernelAutotuner;
+    kernelAutotuner.initialize(cuContext, (getExecutableDirectory() / "kernel_autotune_cache.txt").string().c_str());
+    kernelPostProcess.setAutotuner(&kernelAutotuner);
+    kernelDeform.setAutotuner(&kernelAutotuner);
+    kernelAccumulateVertexNormals.setAutotuner(&kernelAutotuner);
+    kernelNormalizeVertexNormals.setAutotuner(&kernelAutotuner);
+    // JP: グラフを記録したときのオートチューナーの世代。
+    // EN: Generation of the autotuner at the time each graph recorder recorded its graphs.
+    uint32_t graphAutotunerGenerations[2] = {
+        kernelAutotuner.getGeneration(), kernelAutotuner.getGeneration()
+    };
+
     CUmodule moduleBoundingBoxProgram;
     CUDADRV_CHECK(cuModuleLoad(&moduleBoundingBoxProgram, (getExecutableDirectory() / "uber/ptxes/sphere_bounding_box.ptx").string().c_str()));
     cudau::Kernel kernelCalculateBoundingBoxesForSpheres(moduleBoundingBoxProgram, "calculateBoundingBoxesForSpheres", cudau::dim3(32), 0);
 
+    CUmodule moduleScatterUploads;
+    CUDADRV_CHECK(cuModuleLoad(&moduleScatterUploads, (getExecutableDirectory() / "uber/ptxes/scatter_uploads.ptx").string().c_str()));
+    uploadBatcher.setScatterKernel(moduleScatterUploads, "scatterUploads");
+
+    setupPipelineZone.end();
+
     // END: Settings for OptiX context and pipeline.
     // ----------------------------------------------------------------
 
@@ -529,102 +709,115 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     // EN: Setup materials.
 
     hpprintf("Setup materials.\n");
+    profiler::Zone setupMaterialsZone("Setup Materials");
 
-    cudau::TypedBuffer<CUtexObject> textureObjectBuffer;
-    textureObjectBuffer.initialize(cuContext, g_bufferType, 128);
-    uint32_t textureID = 0;
+    // JP: 同じ内容のArrayと同じ(Array, サンプラー)のテクスチャーオブジェクトはプール内で共有される。
+    // EN: Arrays with the same contents and texture objects for the same (array, sampler) are shared in the pool.
+    cudau::TexturePool texturePool;
+    texturePool.initialize(cuContext, g_bufferType, 128);
 
 #define USE_BLOCK_COMPRESSED_TEXTURE
 
-    CUtexObject* textureObjects = textureObjectBuffer.map();
-
     cudau::TextureSampler texSampler;
     texSampler.setFilterMode(cudau::TextureFilterMode::Point,
                              cudau::TextureFilterMode::Point);
     texSampler.setIndexingMode(cudau::TextureIndexingMode::NormalizedCoordinates);
     texSampler.setReadMode(cudau::TextureReadMode::NormalizedFloat_sRGB);
 
-    cudau::Array arrayCheckerBoard;
+    uint32_t arrayCheckerBoardIndex;
     {
 #if defined(USE_BLOCK_COMPRESSED_TEXTURE)
-        int32_t width, height, mipCount;
-        size_t* sizes;
-        dds::Format format;
-        uint8_t** ddsData = dds::load("../data/checkerboard_line.DDS", &width, &height, &mipCount, &sizes, &format);
-
-        arrayCheckerBoard.initialize2D(cuContext, cudau::ArrayElementType::BC1_UNorm, 1,
-                                       cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                                       width, height, 1/*mipCount*/);
-        for (int i = 0; i < arrayCheckerBoard.getNumMipmapLevels(); ++i)
-            arrayCheckerBoard.transfer<uint8_t>(ddsData[i], sizes[i], i);
-
-        dds::free(ddsData, mipCount, sizes);
+        // JP: マップしたファイルを登録してミップレベルを直接DMAする。
+        // EN: Register the mapped file and DMA the mip levels directly.
+        dds::MappedImage ddsImage;
+        ddsImage.open("../data/checkerboard_line.DDS");
+        ddsImage.registerHostMemory();
+        const dds::Subresource &mip0 = ddsImage.getSubresource(0, 0, 0);
+        const void* levelData[] = { mip0.data };
+        size_t levelSizes[] = { mip0.size };
+
+        arrayCheckerBoardIndex = texturePool.createArray2D(cudau::ArrayElementType::BC1_UNorm, 1,
+                                                           ddsImage.getWidth(), ddsImage.getHeight(), 1/*mipCount*/,
+                                                           levelData, levelSizes);
+        // JP: 転送元のマッピングを閉じる前にコピーの完了を待つ。
+        // EN: Wait for the copy before closing the source mapping.
+        CUDADRV_CHECK(cuStreamSynchronize(0));
 #else
-        int32_t width, height, n;
-        uint8_t* linearImageData = stbi_load("../data/checkerboard_line.png", &width, &height, &n, 4);
-        arrayCheckerBoard.initialize2D(cuContext, cudau::ArrayElementType::UInt8, 4,
-                                       cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                                       width, height, 1);
-        arrayCheckerBoard.transfer<uint8_t>(linearImageData, width * height * 4);
-        stbi_image_free(linearImageData);
+        arrayCheckerBoardIndex = loadTextureWithMipmaps(&texturePool, "../data/checkerboard_line.png", true);
 #endif
     }
-    uint32_t texCheckerBoardIndex = textureID++;
-    textureObjects[texCheckerBoardIndex] = texSampler.createTextureObject(arrayCheckerBoard);
+    uint32_t texCheckerBoardIndex = texturePool.getTextureID(arrayCheckerBoardIndex, texSampler);
 
-    cudau::Array arrayGrid;
+    uint32_t arrayGridIndex;
     {
 #if defined(USE_BLOCK_COMPRESSED_TEXTURE)
-        int32_t width, height, mipCount;
-        size_t* sizes;
-        dds::Format format;
-        uint8_t** ddsData = dds::load("../data/grid.DDS", &width, &height, &mipCount, &sizes, &format);
-
-        arrayGrid.initialize2D(cuContext, cudau::ArrayElementType::BC1_UNorm, 1,
-                               cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                               width, height, 1/*mipCount*/);
-        for (int i = 0; i < arrayGrid.getNumMipmapLevels(); ++i)
-            arrayGrid.transfer<uint8_t>(ddsData[i], sizes[i], i);
-
-        dds::free(ddsData, mipCount, sizes);
+        // JP: マップしたファイルを登録してミップレベルを直接DMAする。
+        // EN: Register the mapped file and DMA the mip levels directly.
+        dds::MappedImage ddsImage;
+        ddsImage.open("../data/grid.DDS");
+        ddsImage.registerHostMemory();
+        const dds::Subresource &mip0 = ddsImage.getSubresource(0, 0, 0);
+        const void* levelData[] = { mip0.data };
+        size_t levelSizes[] = { mip0.size };
+
+        arrayGridIndex = texturePool.createArray2D(cudau::ArrayElementType::BC1_UNorm, 1,
+                                                   ddsImage.getWidth(), ddsImage.getHeight(), 1/*mipCount*/,
+                                                   levelData, levelSizes);
+        // JP: 転送元のマッピングを閉じる前にコピーの完了を待つ。
+        // EN: Wait for the copy before closing the source mapping.
+        CUDADRV_CHECK(cuStreamSynchronize(0));
 #else
-        int32_t width, height, n;
-        uint8_t* linearImageData = stbi_load("../data/grid.png", &width, &height, &n, 4);
-        arrayGrid.initialize2D(cuContext, cudau::ArrayElementType::UInt8, 4,
-                               cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                               width, height, 1);
-        arrayGrid.transfer<uint8_t>(linearImageData, width * height * 4);
-        stbi_image_free(linearImageData);
+        arrayGridIndex = loadTextureWithMipmaps(&texturePool, "../data/grid.png", true);
 #endif
     }
-    uint32_t texGridIndex = textureID++;
-    textureObjects[texGridIndex] = texSampler.createTextureObject(arrayGrid);
+    uint32_t texGridIndex = texturePool.getTextureID(arrayGridIndex, texSampler);
+
+    // JP: 環境マップはRGBA16Fで読み込み、探索レイのミスで参照する。
+    // EN: Load the environment map as RGBA16F and look it up on search ray misses.
+    uint32_t texEnvIndex = 0xFFFFFFFF;
+    if (envMapPath) {
+        uint32_t envWidth, envHeight;
+        std::vector<uint16_t> envRGBA16F;
+        if (hdr::loadRGBA16F(envMapPath, &envWidth, &envHeight, &envRGBA16F)) {
+            cudau::Array envArray;
+            hdr::createArray(cuContext, envRGBA16F.data(), envWidth, envHeight, &envArray);
+            uint64_t envHash = cudau::TexturePool::calcContentHash(envRGBA16F.data(),
+                                                                   sizeof(uint16_t) * envRGBA16F.size());
+            uint32_t arrayEnvIndex = texturePool.addArray(std::move(envArray), envHash);
+
+            cudau::TextureSampler envSampler;
+            envSampler.setFilterMode(cudau::TextureFilterMode::Linear,
+                                     cudau::TextureFilterMode::Point);
+            envSampler.setWrapMode(0, cudau::TextureWrapMode::Repeat);
+            envSampler.setWrapMode(1, cudau::TextureWrapMode::Clamp);
+            envSampler.setIndexingMode(cudau::TextureIndexingMode::NormalizedCoordinates);
+            envSampler.setReadMode(cudau::TextureReadMode::ElementType);
+            texEnvIndex = texturePool.getTextureID(arrayEnvIndex, envSampler);
+        }
+    }
 
     const char* textureNames[] = {
         "Checkerboard",
         "Grid"
     };
 
-    textureObjectBuffer.unmap();
-
-
 
-    cudau::TypedBuffer<Shared::MaterialData> materialDataBuffer;
-    materialDataBuffer.initialize(cuContext, g_bufferType, 128);
-    uint32_t materialID = 0;
 
-    Shared::MaterialData* matData = materialDataBuffer.map();
+    // JP: ホスト側で編集したマテリアルのみがsync()時に転送される。
+    // EN: Only materials edited on the host are transferred at sync().
+    cudau::MirroredTable<Shared::MaterialData> materialDataTable;
+    materialDataTable.initialize(cuContext, g_bufferType);
 
-    uint32_t matGrayWallIndex = materialID++;
+    uint32_t matGrayWallIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matGray = optixContext.createMaterial();
     matGray.setHitGroup(Shared::RayType_Search, searchRayDiffuseHitProgramGroup);
     matGray.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matGray.setUserData(matGrayWallIndex);
     Shared::MaterialData matGrayWallData;
     matGrayWallData.albedo = make_float3(sRGB_degamma_s(0.75), sRGB_degamma_s(0.75), sRGB_degamma_s(0.75));
-    matData[matGrayWallIndex] = matGrayWallData;
+    materialDataTable.set(matGrayWallIndex, matGrayWallData);
 
-    uint32_t matFloorIndex = materialID++;
+    uint32_t matFloorIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matFloor = optixContext.createMaterial();
     matFloor.setHitGroup(Shared::RayType_Search, searchRayDiffuseHitProgramGroup);
     matFloor.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
@@ -633,54 +826,54 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     matFloorData.albedo = make_float3(0, 0, 0);
     matFloorData.program = callableProgramSampleTextureIndex;
     matFloorData.texID = texCheckerBoardIndex;
-    matData[matFloorIndex] = matFloorData;
+    materialDataTable.set(matFloorIndex, matFloorData);
 
-    uint32_t matLeftWallIndex = materialID++;
+    uint32_t matLeftWallIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matLeft = optixContext.createMaterial();
     matLeft.setHitGroup(Shared::RayType_Search, searchRayDiffuseHitProgramGroup);
     matLeft.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matLeft.setUserData(matLeftWallIndex);
     Shared::MaterialData matLeftWallData;
     matLeftWallData.albedo = make_float3(sRGB_degamma_s(0.75), sRGB_degamma_s(0.25), sRGB_degamma_s(0.25));
-    matData[matLeftWallIndex] = matLeftWallData;
+    materialDataTable.set(matLeftWallIndex, matLeftWallData);
 
-    uint32_t matRightWallIndex = materialID++;
+    uint32_t matRightWallIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matRight = optixContext.createMaterial();
     matRight.setHitGroup(Shared::RayType_Search, searchRayDiffuseHitProgramGroup);
     matRight.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matRight.setUserData(matRightWallIndex);
     Shared::MaterialData matRightWallData;
     matRightWallData.albedo = make_float3(sRGB_degamma_s(0.25), sRGB_degamma_s(0.25), sRGB_degamma_s(0.75));
-    matData[matRightWallIndex] = matRightWallData;
+    materialDataTable.set(matRightWallIndex, matRightWallData);
 
-    uint32_t matLightIndex = materialID++;
+    uint32_t matLightIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matLight = optixContext.createMaterial();
     matLight.setHitGroup(Shared::RayType_Search, searchRayDiffuseHitProgramGroup);
     matLight.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matLight.setUserData(matLightIndex);
     Shared::MaterialData matLightData;
     matLightData.albedo = make_float3(1, 1, 1);
-    matData[matLightIndex] = matLightData;
+    materialDataTable.set(matLightIndex, matLightData);
 
-    uint32_t matObject0Index = materialID++;
+    uint32_t matObject0Index = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matObject0 = optixContext.createMaterial();
     matObject0.setHitGroup(Shared::RayType_Search, searchRaySpecularHitProgramGroup);
     matObject0.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matObject0.setUserData(matObject0Index);
     Shared::MaterialData matObject0Data;
     matObject0Data.albedo = make_float3(1, 0.5f, 0);
-    matData[matObject0Index] = matObject0Data;
+    materialDataTable.set(matObject0Index, matObject0Data);
 
-    uint32_t matObject1Index = materialID++;
+    uint32_t matObject1Index = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matObject1 = optixContext.createMaterial();
     matObject1.setHitGroup(Shared::RayType_Search, searchRaySpecularHitProgramGroup);
     matObject1.setHitGroup(Shared::RayType_Visibility, visibilityRayHitProgramGroup);
     matObject1.setUserData(matObject1Index);
     Shared::MaterialData matObject1Data;
     matObject1Data.albedo = make_float3(0, 0.5f, 1);
-    matData[matObject1Index] = matObject1Data;
+    materialDataTable.set(matObject1Index, matObject1Data);
 
-    uint32_t matCustomPrimObjectIndex = materialID++;
+    uint32_t matCustomPrimObjectIndex = static_cast<uint32_t>(materialDataTable.add(Shared::MaterialData()));
     optixu::Material matCustomPrimObject = optixContext.createMaterial();
     matCustomPrimObject.setHitGroup(Shared::RayType_Search, searchRayDiffuseCustomHitProgramGroup);
     matCustomPrimObject.setHitGroup(Shared::RayType_Visibility, visibilityRayCustomHitProgramGroup);
@@ -688,9 +881,9 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     Shared::MaterialData matCustomPrimObjectData;
     matCustomPrimObjectData.program = callableProgramSampleTextureIndex;
     matCustomPrimObjectData.texID = texGridIndex;
-    matData[matCustomPrimObjectIndex] = matCustomPrimObjectData;
+    materialDataTable.set(matCustomPrimObjectIndex, matCustomPrimObjectData);
 
-    materialDataBuffer.unmap();
+    setupMaterialsZone.end();
 
     // END: Setup materials.
     // ----------------------------------------------------------------
@@ -702,14 +895,14 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     // EN: Setup a scene.
 
     hpprintf("Setup a scene.\n");
+    profiler::Zone setupSceneZone("Setup Scene");
 
     optixu::Scene scene = optixContext.createScene();
     
     SceneContext sceneContext;
     sceneContext.optixScene = scene;
     sceneContext.decodeHitPointTriangle = static_cast<Shared::ProgDecodeHitPoint>(callableProgramDecodeHitPointTriangleIndex);
-    sceneContext.geometryDataBuffer.initialize(cuContext, g_bufferType, 128);
-    sceneContext.geometryID = 0;
+    sceneContext.geometryDataTable.initialize(cuContext, g_bufferType);
     
     TriangleMesh meshCornellBox(cuContext, &sceneContext);
     {
@@ -918,16 +1111,12 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         customPrimInstance.setCustomPrimitiveAABBBuffer(reinterpret_cast<cudau::TypedBuffer<OptixAabb>*>(&customPrimAABBs));
         customPrimInstance.setNumMaterials(1, nullptr);
         customPrimInstance.setMaterial(0, 0, matCustomPrimObject);
-        customPrimInstance.setUserData(sceneContext.geometryID);
 
-        Shared::GeometryData* geomDataPtr = sceneContext.geometryDataBuffer.map();
-        Shared::GeometryData &recordData = geomDataPtr[sceneContext.geometryID];
+        Shared::GeometryData recordData;
         recordData.aabbBuffer = customPrimAABBs.getDevicePointer();
         recordData.paramBuffer = customPrimParameters.getDevicePointer();
         recordData.decodeHitPointFunc = static_cast<Shared::ProgDecodeHitPoint>(callableProgramDecodeHitPointSphereIndex);
-        sceneContext.geometryDataBuffer.unmap();
-
-        ++sceneContext.geometryID;
+        customPrimInstance.setUserData(static_cast<uint32_t>(sceneContext.geometryDataTable.add(recordData)));
     }
 
 
@@ -954,6 +1143,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     gasCornellBox.setNumRayTypes(0, Shared::NumRayTypes);
     meshCornellBox.addToGAS(&gasCornellBox);
     gasCornellBox.prepareForBuild(&asMemReqs);
+    gasCornellBoxMem.setMemoryCategory(cudau::MemoryCategory::AS);
     gasCornellBoxMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
 
@@ -966,6 +1156,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     gasAreaLight.setNumRayTypes(0, Shared::NumRayTypes);
     meshAreaLight.addToGAS(&gasAreaLight);
     gasAreaLight.prepareForBuild(&asMemReqs);
+    gasAreaLightMem.setMemoryCategory(cudau::MemoryCategory::AS);
     gasAreaLightMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
 
@@ -978,6 +1169,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     gasObject.setNumRayTypes(1, Shared::NumRayTypes);
     meshObject.addToGAS(&gasObject);
     gasObject.prepareForBuild(&asMemReqs);
+    gasObjectMem.setMemoryCategory(cudau::MemoryCategory::AS);
     gasObjectMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, 
                                       std::max(asMemReqs.tempSizeInBytes, asMemReqs.tempUpdateSizeInBytes));
@@ -992,6 +1184,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     gasCustomPrimObject.setNumRayTypes(0, Shared::NumRayTypes);
     gasCustomPrimObject.addChild(customPrimInstance);
     gasCustomPrimObject.prepareForBuild(&asMemReqs);
+    gasCustomPrimObjectMem.setMemoryCategory(cudau::MemoryCategory::AS);
     gasCustomPrimObjectMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer,
                                       std::max(asMemReqs.tempSizeInBytes, asMemReqs.tempUpdateSizeInBytes));
@@ -1006,6 +1199,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     //     スクラッチバッファーは共用する。
     // EN: Build geometry acceleration structures.
     //     Share the scratch buffer among them.
+    asBuildScratchMem.setMemoryCategory(cudau::MemoryCategory::Scratch);
     asBuildScratchMem.initialize(cuContext, g_bufferType, maxSizeOfScratchBuffer, 1);
     travHandles[gasCornellBoxIndex] = gasCornellBox.rebuild(cuStream[0], gasCornellBoxMem, asBuildScratchMem);
     travHandles[gasAreaLightIndex] = gasAreaLight.rebuild(cuStream[0], gasAreaLightMem, asBuildScratchMem);
@@ -1016,19 +1210,29 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     // EN: Perform compaction for static meshes.
     size_t compactedASSize;
     gasCornellBox.prepareForCompact(&compactedASSize);
+    gasCornellBoxCompactedMem.setMemoryCategory(cudau::MemoryCategory::ASCompacted);
     gasCornellBoxCompactedMem.initialize(cuContext, cudau::BufferType::Device, compactedASSize, 1);
     gasAreaLight.prepareForCompact(&compactedASSize);
+    gasAreaLightCompactedMem.setMemoryCategory(cudau::MemoryCategory::ASCompacted);
     gasAreaLightCompactedMem.initialize(cuContext, cudau::BufferType::Device, compactedASSize, 1);
     travHandles[gasCornellBoxIndex] = gasCornellBox.compact(cuStream[0], gasCornellBoxCompactedMem);
     travHandles[gasAreaLightIndex] = gasAreaLight.compact(cuStream[0], gasAreaLightCompactedMem);
     gasCornellBox.removeUncompacted();
     gasAreaLight.removeUncompacted();
+    // JP: コンパクション前のメモリーはもう使われないので解放する。
+    // EN: Release the memory before compaction since it is no longer used.
+    gasCornellBoxMem.finalize();
+    gasAreaLightMem.finalize();
 
 
 
     cudau::Buffer shaderBindingTable;
     size_t sbtSize;
-    scene.generateShaderBindingTableLayout(&sbtSize);
+    {
+        PROFILER_ZONE("Generate SBT Layout");
+        scene.generateShaderBindingTableLayout(&sbtSize);
+    }
+    shaderBindingTable.setMemoryCategory(cudau::MemoryCategory::SBT);
     shaderBindingTable.initialize(cuContext, g_bufferType, sbtSize, 1);
     
     // JP: GASからインスタンスを作成する。
@@ -1080,7 +1284,9 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     iasScene.addChild(instObject1);
     iasScene.addChild(instCustomPrimObject);
     iasScene.prepareForBuild(&asMemReqs, &numInstances);
+    instanceBuffer.setMemoryCategory(cudau::MemoryCategory::AS);
     instanceBuffer.initialize(cuContext, g_bufferType, numInstances);
+    iasSceneMem.setMemoryCategory(cudau::MemoryCategory::AS);
     iasSceneMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     size_t tempBufferForIAS = std::max(asMemReqs.tempSizeInBytes, asMemReqs.tempUpdateSizeInBytes);
     if (tempBufferForIAS >= asBuildScratchMem.sizeInBytes()) {
@@ -1095,12 +1301,15 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     travHandleBuffer.unmap();
     CUDADRV_CHECK(cuStreamSynchronize(cuStream[0]));
 
+    setupSceneZone.end();
+
     // END: Setup a scene.
     // ----------------------------------------------------------------
 
 
 
     hpprintf("Setup resources for composite.\n");
+    profiler::Zone setupCompositeZone("Setup Composite");
     
     // JP: OpenGL用バッファーオブジェクトからCUDAバッファーを生成する。
     // EN: Create a CUDA buffer from an OpenGL buffer instObject0.
@@ -1149,6 +1358,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
 
     optixu::HostBlockBuffer2D<Shared::PCG32RNG, 1> rngBuffer;
+    rngBuffer.setMemoryCategory(cudau::MemoryCategory::Framebuffer);
     rngBuffer.initialize(cuContext, g_bufferType, renderTargetSizeX, renderTargetSizeY);
     const auto initializeRNGSeeds = [&renderTargetSizeX, &renderTargetSizeY](optixu::HostBlockBuffer2D<Shared::PCG32RNG, 1> &buffer) {
         std::mt19937_64 rng(591842031321323413);
@@ -1163,11 +1373,13 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
     cudau::Array arrayAccumBuffer;
+    arrayAccumBuffer.setMemoryCategory(cudau::MemoryCategory::Framebuffer);
     arrayAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
                                   cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
                                   renderTargetSizeX, renderTargetSizeY, 1);
 #else
     optixu::HostBlockBuffer2D<float4, 1> accumBuffer;
+    accumBuffer.setMemoryCategory(cudau::MemoryCategory::Framebuffer);
     accumBuffer.initialize(cuContext, g_bufferType, renderTargetSizeX, renderTargetSizeY);
 #endif
 
@@ -1175,8 +1387,6 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
     Shared::PipelineLaunchParameters plp;
     plp.travHandles = travHandleBuffer.getDevicePointer();
-    plp.materialData = materialDataBuffer.getDevicePointer();
-    plp.geomInstData = sceneContext.geometryDataBuffer.getDevicePointer();
     plp.travIndex = iasSceneIndex;
     plp.imageSize.x = renderTargetSizeX;
     plp.imageSize.y = renderTargetSizeY;
@@ -1190,7 +1400,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     plp.camera.fovY = 50 * M_PI / 180;
     plp.camera.aspect = (float)renderTargetSizeX / renderTargetSizeY;
     plp.matLightIndex = matLightIndex;
-    plp.textures = textureObjectBuffer.getDevicePointer();
+    plp.envTexID = texEnvIndex;
 
     pipeline.setScene(scene);
     pipeline.setHitGroupShaderBindingTable(&shaderBindingTable);
@@ -1198,6 +1408,8 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     CUdeviceptr plpOnDevice;
     CUDADRV_CHECK(cuMemAlloc(&plpOnDevice, sizeof(plp)));
 
+    setupCompositeZone.end();
+
 
 
     hpprintf("Render loop.\n");
@@ -1205,7 +1417,6 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     cudau::InteropSurfaceObjectHolder<2> outputBufferSurfaceHolder;
     outputBufferSurfaceHolder.initialize(&outputArray);
     
-    StopWatchHiRes<> sw;
     std::mt19937_64 rng(3092384202);
     std::uniform_real_distribution<float> u01;
     
@@ -1242,9 +1453,9 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     while (true) {
         CPUTimeRecord &cpuTimeRecord = cpuTimeRecords[cpuTimeRecordIndex];
 
-        sw.start();
+        profiler::Zone frameZone("Frame");
 
-        sw.start(); // Frame Begin
+        profiler::Zone frameBeginZone("Frame Begin");
         uint32_t bufferIndex = frameIndex % 2;
 
         if (glfwWindowShouldClose(window))
@@ -1276,9 +1487,9 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
             arrayAccumBuffer.resize(renderTargetSizeX, renderTargetSizeY);
 #else
-            accumBuffer.resize(renderTargetSizeX, renderTargetSizeY);
+            accumBuffer.resize(renderTargetSizeX, renderTargetSizeY, cuStream[bufferIndex]);
 #endif
-            rngBuffer.resize(renderTargetSizeX, renderTargetSizeY);
+            rngBuffer.resize(renderTargetSizeX, renderTargetSizeY, cuStream[bufferIndex]);
             initializeRNGSeeds(rngBuffer);
 
             // EN: update the pipeline parameters.
@@ -1293,6 +1504,11 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 #endif
             plp.camera.aspect = (float)renderTargetSizeX / renderTargetSizeY;
 
+            // JP: 記録されたグラフは起動サイズと作り直したバッファーを参照しているので破棄する。
+            // EN: Recorded graphs refer to the launch size and the recreated buffers, so discard them.
+            graphRecorder[0].invalidate();
+            graphRecorder[1].invalidate();
+
             resized = true;
         }
 
@@ -1300,7 +1516,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        cpuTimeRecord.frameBeginTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.frameBeginTime = frameBeginZone.end();
 
 
 
@@ -1382,42 +1598,66 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
 
         CUstream &curCuStream = cuStream[bufferIndex];
-        GPUTimer &curGPUTimer = gpuTimer[bufferIndex];
+        cudau::GraphRecorder &curGraphRecorder = graphRecorder[bufferIndex];
         
         // JP: 前フレームの処理が完了するのを待つ。
         // EN: Wait the previous frame processing to finish.
-        sw.start(); // Sync
+        profiler::Zone syncZone("Sync");
         CUDADRV_CHECK(cuStreamSynchronize(curCuStream));
-        cpuTimeRecord.syncTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        timestampPool.beginFrame();
+        cpuTimeRecord.syncTime = syncZone.end();
 
         // JP: 非同期実行を確かめるためにCPU側にダミー負荷を与える。
         // EN: Have dummy load on CPU to verify asynchronous execution.
         static float cpuDummyLoad = 15.0f;
         static float dummyProb = 0.0f;
-        sw.start(); // Dummy Load
+        profiler::Zone dummyZone("Dummy Load");
         if (cpuDummyLoad > 0.0f && u01(rng) < dummyProb * 0.01f)
             std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(cpuDummyLoad * 1000)));
-        cpuTimeRecord.dummyTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.dummyTime = dummyZone.end();
 
 
 
-        sw.start(); // ImGui
+        profiler::Zone imGuiZone("ImGui");
         {
             ImGui::Begin("Stats", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
-            float cudaFrameTime = frameIndex >= 2 ? curGPUTimer.frame.report() : 0.0f;
-            float deformTime = (frameIndex >= 2 && curGPUTimer.animated) ? curGPUTimer.deform.report() : 0.0f;
-            float updateGASTime = (frameIndex >= 2 && curGPUTimer.animated) ? curGPUTimer.updateGAS.report() : 0.0f;
-            float updateIASTime = (frameIndex >= 2 && curGPUTimer.animated) ? curGPUTimer.updateIAS.report() : 0.0f;
-            float renderTime = frameIndex >= 2 ? curGPUTimer.render.report() : 0.0f;
-            float postProcessTime = frameIndex >= 2 ? curGPUTimer.postProcess.report() : 0.0f;
+            // JP: CUDA Graphで実行したフレームは記録中の区間が無視されるので内訳が0になる。
+            // EN: Breakdown is 0 for frames executed by CUDA Graph since scopes during a capture are ignored.
+            const cudau::TimestampPool::ScopeStats &frameStats = timestampPool.getScopeStats(frameScope);
+            float cudaFrameTime = frameStats.lastTime;
             //ImGui::SetNextItemWidth(100.0f);
-            ImGui::Text("CUDA/OptiX GPU %.3f [ms]:", cudaFrameTime);
-            ImGui::Text("  Deform: %.3f [ms]", deformTime);
-            ImGui::Text("  Update GAS: %.3f [ms]", updateGASTime);
-            ImGui::Text("  Update IAS: %.3f [ms]", updateIASTime);
-            ImGui::Text("  Render: %.3f [ms]", renderTime);
-            ImGui::Text("  Post Process: %.3f [ms]", postProcessTime);
+            ImGui::Text("CUDA/OptiX GPU %.3f [ms] (avg. %.3f):", cudaFrameTime, frameStats.averageTime);
+            for (uint32_t scopeIdx = 0; scopeIdx < timestampPool.getNumScopes(); ++scopeIdx) {
+                if (scopeIdx == frameScope)
+                    continue;
+                const cudau::TimestampPool::ScopeStats &scopeStats = timestampPool.getScopeStats(scopeIdx);
+                ImGui::Text("  %s: %.3f [ms] (avg. %.3f)", timestampPool.getScopeName(scopeIdx).c_str(),
+                            scopeStats.lastTime, scopeStats.averageTime);
+            }
+            const cudau::GraphRecorder::Stats &graphStats = curGraphRecorder.getStats();
+            ImGui::Text("CUDA Graph: %llu captures, %llu patches, %llu launches",
+                        graphStats.numCaptures, graphStats.numPatches, graphStats.numLaunches);
+            const cudau::UploadBatcher::Stats &uploadStats = uploadBatcher.getLastFlushStats();
+            ImGui::Text("Uploads: %llu writes, %llu commands, %llu bytes",
+                        uploadStats.numWrites, uploadStats.numCommands, uploadStats.numBytes);
+            const cudau::MirroredTable<Shared::MaterialData>::Stats &matTableStats = materialDataTable.getLastSyncStats();
+            ImGui::Text("Material Table Sync: %llu ranges, %llu bytes",
+                        matTableStats.numRanges, matTableStats.numBytes);
+            const cudau::TexturePool::Stats &texPoolStats = texturePool.getStats();
+            ImGui::Text("Texture Pool: %u arrays (%u dedup), %u tex objs (%u cached)",
+                        texPoolStats.numArrays, texPoolStats.numArrayDedupHits,
+                        texPoolStats.numTextureObjects, texPoolStats.numTextureObjectCacheHits);
+            ImGui::Text("Device Memory (live / peak [KiB]):");
+            for (uint32_t i = 0; i < static_cast<uint32_t>(cudau::MemoryCategory::NumCategories); ++i) {
+                auto category = static_cast<cudau::MemoryCategory>(i);
+                cudau::MemoryCategoryStats memStats = cudau::getMemoryStats(cuContext, category);
+                ImGui::Text("  %s: %.1f / %.1f (%u)", cudau::getMemoryCategoryName(category),
+                            memStats.numLiveBytes / 1024.0f, memStats.numPeakBytes / 1024.0f,
+                            memStats.numLiveAllocations);
+            }
+            if (ImGui::Button("Dump Memory Stats"))
+                hpprintf("%s", cudau::dumpMemoryStatsAsJSON(cuContext).c_str());
             {
                 static float times[100];
                 constexpr uint32_t numTimes = lengthof(times);
@@ -1481,6 +1721,20 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                     hpprintf("  Dummy: %.3f [ms]\n", record.dummyTime);
                 }
             }
+            // JP: セットアップと直近のフレームのCPU時間の内訳をゾーンごとに出力する。
+            //     トレースはchrome://tracingやPerfettoで開ける。
+            // EN: Output the CPU time breakdown of the setup and the recent frames per zone.
+            //     The trace can be opened with chrome://tracing or Perfetto.
+            if (ImGui::Button("Print Zone Stats"))
+                profiler::printStatsTable(profiler::aggregate());
+            ImGui::SameLine();
+            if (ImGui::Button("Export CPU Trace")) {
+                const std::filesystem::path tracePath = getExecutableDirectory() / "uber_cpu_trace.json";
+                if (profiler::exportChromeTrace(tracePath))
+                    hpprintf("Exported CPU trace: %s\n", tracePath.string().c_str());
+                else
+                    hpprintf("Failed to export CPU trace: %s\n", tracePath.string().c_str());
+            }
 
             ImGui::SliderFloat("Dummy CPU Load", &cpuDummyLoad, 0.0f, 33.3333f);
             ImGui::SliderFloat("Probability", &dummyProb, 0.0f, 100.0f);
@@ -1494,6 +1748,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         static int32_t gasRebuildInterval = 30;
         static bool enablePeriodicIASRebuild = true;
         static int32_t iasRebuildInterval = 30;
+        static bool useCudaGraph = false;
         {
             ImGui::Begin("Settings", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
@@ -1501,6 +1756,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
             ImGui::SliderInt("GAS Rebuild Interval", &gasRebuildInterval, 1, 60);
             ImGui::Checkbox("Enable IAS Rebuild", &enablePeriodicIASRebuild);
             ImGui::SliderInt("IAS Rebuild Interval", &iasRebuildInterval, 1, 60);
+            ImGui::Checkbox("Use CUDA Graph", &useCudaGraph);
 
             ImGui::End();
         }
@@ -1547,100 +1803,56 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
             if (ImGui::ColorEdit3("Left Wall", reinterpret_cast<float*>(&matLeftWallData.albedo),
                                   ImGuiColorEditFlags_DisplayHSV |
                                   ImGuiColorEditFlags_Float)) {
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matLeftWallIndex),
-                                                &matLeftWallData, sizeof(matLeftWallData),
-                                                curCuStream));
+                materialDataTable.set(matLeftWallIndex, matLeftWallData);
                 sceneEdited = true;
             }
             if (ImGui::ColorEdit3("Right Wall", reinterpret_cast<float*>(&matRightWallData.albedo),
                                   ImGuiColorEditFlags_DisplayHSV |
                                   ImGuiColorEditFlags_Float)) {
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matRightWallIndex),
-                                                &matRightWallData, sizeof(matRightWallData),
-                                                curCuStream));
+                materialDataTable.set(matRightWallIndex, matRightWallData);
                 sceneEdited = true;
             }
             if (ImGui::ColorEdit3("Other Walls", reinterpret_cast<float*>(&matGrayWallData.albedo),
                                   ImGuiColorEditFlags_DisplayHSV |
                                   ImGuiColorEditFlags_Float)) {
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matGrayWallIndex),
-                                                &matGrayWallData, sizeof(matGrayWallData),
-                                                curCuStream));
+                materialDataTable.set(matGrayWallIndex, matGrayWallData);
                 sceneEdited = true;
             }
             if (ImGui::ColorEdit3("Object 0", reinterpret_cast<float*>(&matObject0Data.albedo),
                                   ImGuiColorEditFlags_DisplayHSV |
                                   ImGuiColorEditFlags_Float)) {
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matObject0Index),
-                                                &matObject0Data, sizeof(matObject0Data),
-                                                curCuStream));
+                materialDataTable.set(matObject0Index, matObject0Data);
                 sceneEdited = true;
             }
             if (ImGui::ColorEdit3("Object 1", reinterpret_cast<float*>(&matObject1Data.albedo),
                                   ImGuiColorEditFlags_DisplayHSV |
                                   ImGuiColorEditFlags_Float)) {
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matObject1Index),
-                                                &matObject1Data, sizeof(matObject1Data),
-                                                curCuStream));
+                materialDataTable.set(matObject1Index, matObject1Data);
                 sceneEdited = true;
             }
             static int32_t floorTexID;
             floorTexID = matFloorData.texID;
             if (ImGui::Combo("Floor", &floorTexID, textureNames, lengthof(textureNames))) {
                 matFloorData.texID = floorTexID;
-                CUDADRV_CHECK(cuMemcpyHtoDAsync(materialDataBuffer.getCUdeviceptrAt(matFloorIndex),
-                                                &matFloorData, sizeof(matFloorData),
-                                                curCuStream));
+                materialDataTable.set(matFloorIndex, matFloorData);
                 sceneEdited = true;
             }
 
             ImGui::End();
         }
 
-        cpuTimeRecord.imGuiTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
-
+        cpuTimeRecord.imGuiTime = imGuiZone.end();
 
 
-        curGPUTimer.frame.start(curCuStream);
 
-        sw.start();
-        curGPUTimer.animated = false;
-        if (play || playStep) {
-            curGPUTimer.animated = true;
+        timestampPool.begin(curCuStream, frameScope);
 
-            // JP: ジオメトリの非剛体変形。
-            // EN: Non-rigid deformation of a geometry.
-            curGPUTimer.deform.start(curCuStream);
-            cudau::dim3 dimDeform = kernelDeform.calcGridDim(orgObjectVertexBuffer.numElements());
-            kernelDeform(curCuStream, dimDeform,
-                         orgObjectVertexBuffer.getDevicePointer(), meshObject.getVertexBuffer().getDevicePointer(), orgObjectVertexBuffer.numElements(),
-                         0.5f * std::sinf(2 * M_PI * (animFrameIndex % 690) / 690.0f));
-            const cudau::TypedBuffer<Shared::Triangle> &triangleBuffer = meshObject.getTriangleBuffer(objectMatGroupIndex);
-            cudau::dim3 dimAccum = kernelAccumulateVertexNormals.calcGridDim(triangleBuffer.numElements());
-            kernelAccumulateVertexNormals(curCuStream, dimAccum,
-                                          meshObject.getVertexBuffer().getDevicePointer(),
-                                          triangleBuffer.getDevicePointer(), triangleBuffer.numElements());
-            kernelNormalizeVertexNormals(curCuStream, dimDeform,
-                                         meshObject.getVertexBuffer().getDevicePointer(), orgObjectVertexBuffer.numElements());
-            curGPUTimer.deform.stop(curCuStream);
-
-            // JP: 変形したジオメトリを基にGASをアップデート。
-            //     たまにリビルドを実行するが、ここでは頂点情報以外変化しないため、
-            //     メモリサイズの再計算や再確保は不要。
-            // EN: Update the GAS based on the deformed geometry.
-            //     It sometimes performs rebuild, but all the information except for vertices doesn't change here
-            //     so neither recalculation of nor reallocating memory is not required.
-            curGPUTimer.updateGAS.start(curCuStream);
-            OptixTraversableHandle gasHandle;
-            if (enablePeriodicGASRebuild && animFrameIndex % gasRebuildInterval == 0)
-                gasHandle = gasObject.rebuild(curCuStream, gasObjectMem, asBuildScratchMem);
-            else
-                gasHandle = gasObject.update(curCuStream, asBuildScratchMem);
-            curGPUTimer.updateGAS.stop(curCuStream);
-            CUDADRV_CHECK(cuMemcpyHtoDAsync(travHandleBuffer.getCUdeviceptrAt(gasObjectIndex),
-                                            &gasHandle, sizeof(gasHandle),
-                                            curCuStream));
+        const bool updateScene = play || playStep;
+        const bool rebuildGAS = updateScene && enablePeriodicGASRebuild && animFrameIndex % gasRebuildInterval == 0;
+        const bool rebuildIAS = updateScene && enablePeriodicIASRebuild && animFrameIndex % iasRebuildInterval == 0;
+        const float deformAmount = 0.5f * std::sinf(2 * M_PI * (animFrameIndex % 690) / 690.0f);
 
+        if (updateScene) {
             // JP: インスタンスのトランスフォーム。
             // EN: Transform instances.
 
@@ -1667,60 +1879,182 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
                 sr1.m02, sr1.m12, sr1.m22, 0.5f * std::cosf(2 * M_PI * (animFrameIndex % 180) / 180.0f + M_PI)
             };
             instObject1.setTransform(tfObject1);
+        }
+
+        // JP: CUDA Graphを使う場合はフレームの処理を1回のグラフの起動で実行する。
+        //     実行可能グラフは処理の構成(シーン更新の有無、GAS/IASのリビルドかアップデートか)ごとに保持し、
+        //     構成が初めて現れたときのみ記録する。それ以外のフレームではフレームごとに変わるカーネル引数のみを
+        //     書き換えて記録済みのグラフを起動する。
+        //     記録できない処理(テーブルの同期、インスタンスとSBTの書き込み、インターロップリソースのマップ)は
+        //     記録前に行い、小さな書き込みの転送はグラフの起動前に行う。
+        // EN: When using CUDA Graph, execute the frame's work by a single graph launch.
+        //     Executable graphs are kept per structure of the work (scene update or not, rebuild or update of GAS/IAS),
+        //     and a capture happens only when a structure appears for the first time. Other frames launch
+        //     the recorded graph after rewriting only the kernel arguments varying per frame.
+        //     Perform work which can't be recorded (table sync, writing instances and the SBT,
+        //     mapping the interop resource) before the capture, and flush small writes before launching the graph.
+        constexpr uint32_t deformNodeID = 0;
+        constexpr uint32_t postProcessNodeID = 1;
+        // JP: 記録中のストリームではブロックサイズを計測できないので、チューニング中はグラフを使わない。
+        //     チューニングが完了したら古いブロックサイズで記録したグラフを破棄する。
+        // EN: Block sizes can't be measured on a stream being captured, so don't use graphs while tuning.
+        //     Discard graphs recorded with old block sizes once a tuning finishes.
+        const bool useGraph = useCudaGraph && kernelAutotuner.getNumTuningConfigurations() == 0;
+        if (graphAutotunerGenerations[bufferIndex] != kernelAutotuner.getGeneration()) {
+            curGraphRecorder.invalidate();
+            graphAutotunerGenerations[bufferIndex] = kernelAutotuner.getGeneration();
+        }
+        bool recordGraph = false;
+        if (useGraph) {
+            materialDataTable.sync(curCuStream);
+            sceneContext.geometryDataTable.sync(curCuStream);
+            texturePool.sync(curCuStream);
+            if (updateScene)
+                iasScene.uploadInstances(curCuStream, instanceBuffer);
+            pipeline.updateShaderBindingTable(curCuStream);
+            outputBufferSurfaceHolder.beginCUDAAccess(curCuStream);
+
+            const uint64_t topologyKey = (updateScene ? 1 : 0) | (rebuildGAS ? 2 : 0) | (rebuildIAS ? 4 : 0);
+            recordGraph = !curGraphRecorder.select(topologyKey);
+            if (recordGraph)
+                curGraphRecorder.beginCapture(curCuStream);
+        }
+        // JP: 記録済みのグラフを再生する場合はストリームに処理を発行しない。
+        // EN: Don't issue work to the stream when replaying a recorded graph.
+        const bool issueWork = !useGraph || recordGraph;
+
+        profiler::Zone updateZone("Update");
+        if (updateScene) {
+            // JP: ジオメトリの非剛体変形。
+            // EN: Non-rigid deformation of a geometry.
+            timestampPool.begin(curCuStream, deformScope);
+            if (issueWork) {
+                kernelDeform.launch1D(curCuStream, orgObjectVertexBuffer.numElements(),
+                                      orgObjectVertexBuffer.getDevicePointer(), meshObject.getVertexBuffer().getDevicePointer(), orgObjectVertexBuffer.numElements(),
+                                      deformAmount);
+                if (recordGraph)
+                    curGraphRecorder.addKernelNode(deformNodeID);
+                const cudau::TypedBuffer<Shared::Triangle> &triangleBuffer = meshObject.getTriangleBuffer(objectMatGroupIndex);
+                kernelAccumulateVertexNormals.launch1D(curCuStream, triangleBuffer.numElements(),
+                                                       meshObject.getVertexBuffer().getDevicePointer(),
+                                                       triangleBuffer.getDevicePointer(), triangleBuffer.numElements());
+                kernelNormalizeVertexNormals.launch1D(curCuStream, orgObjectVertexBuffer.numElements(),
+                                                      meshObject.getVertexBuffer().getDevicePointer(), orgObjectVertexBuffer.numElements());
+            }
+            else {
+                curGraphRecorder.setKernelNodeArguments(deformNodeID,
+                                                        orgObjectVertexBuffer.getDevicePointer(), meshObject.getVertexBuffer().getDevicePointer(), orgObjectVertexBuffer.numElements(),
+                                                        deformAmount);
+            }
+            timestampPool.end(curCuStream, deformScope);
+
+            // JP: 変形したジオメトリを基にGASをアップデート。
+            //     たまにリビルドを実行するが、ここでは頂点情報以外変化しないため、
+            //     メモリサイズの再計算や再確保は不要。
+            // EN: Update the GAS based on the deformed geometry.
+            //     It sometimes performs rebuild, but all the information except for vertices doesn't change here
+            //     so neither recalculation of nor reallocating memory is not required.
+            profiler::Zone updateGASZone("Update GAS");
+            timestampPool.begin(curCuStream, updateGASScope);
+            OptixTraversableHandle gasHandle = gasObject.getHandle();
+            if (issueWork) {
+                if (rebuildGAS)
+                    gasHandle = gasObject.rebuild(curCuStream, gasObjectMem, asBuildScratchMem);
+                else
+                    gasHandle = gasObject.update(curCuStream, asBuildScratchMem);
+            }
+            timestampPool.end(curCuStream, updateGASScope);
+            updateGASZone.end();
+            uploadBatcher.enqueue(travHandleBuffer, gasObjectIndex, gasHandle);
 
             // JP: IASをアップデート。
             // EN: Update the IAS.
-            curGPUTimer.updateIAS.start(curCuStream);
-            OptixTraversableHandle iasHandle;
-            if (enablePeriodicIASRebuild && animFrameIndex % iasRebuildInterval == 0)
-                iasHandle = iasScene.rebuild(curCuStream, instanceBuffer, iasSceneMem, asBuildScratchMem);
-            else
-                iasHandle = iasScene.update(curCuStream, asBuildScratchMem);
-            curGPUTimer.updateIAS.stop(curCuStream);
-            CUDADRV_CHECK(cuMemcpyHtoDAsync(travHandleBuffer.getCUdeviceptrAt(iasSceneIndex),
-                                            &iasHandle, sizeof(iasHandle),
-                                            curCuStream));
+            profiler::Zone updateIASZone("Update IAS");
+            timestampPool.begin(curCuStream, updateIASScope);
+            OptixTraversableHandle iasHandle = iasScene.getHandle();
+            if (issueWork) {
+                if (rebuildIAS)
+                    iasHandle = iasScene.rebuild(curCuStream, instanceBuffer, iasSceneMem, asBuildScratchMem);
+                else
+                    iasHandle = iasScene.update(curCuStream, asBuildScratchMem);
+            }
+            timestampPool.end(curCuStream, updateIASScope);
+            updateIASZone.end();
+            uploadBatcher.enqueue(travHandleBuffer, iasSceneIndex, iasHandle);
 
             ++animFrameIndex;
         }
-        cpuTimeRecord.updateIASTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.updateIASTime = updateZone.end();
 
 
 
-        if (play || playStep || sceneEdited || cameraIsActuallyMoving)
+        if (updateScene || sceneEdited || cameraIsActuallyMoving)
             plp.numAccumFrames = 1;
 
         // Render
-        sw.start();
-        curGPUTimer.render.start(curCuStream);
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), curCuStream));
-        pipeline.launch(curCuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
-        curGPUTimer.render.stop(curCuStream);
-        cpuTimeRecord.renderCmdTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        profiler::Zone renderCmdZone("Render Cmd");
+        timestampPool.begin(curCuStream, renderScope);
+        if (!useGraph) {
+            materialDataTable.sync(curCuStream);
+            sceneContext.geometryDataTable.sync(curCuStream);
+            texturePool.sync(curCuStream);
+        }
+        // JP: テーブルは伸長時に再確保されうるので、同期後のポインターをplpに設定する。
+        // EN: Tables can be reallocated on growth, so set the pointers after sync to plp.
+        plp.materialData = materialDataTable.getDevicePointer();
+        plp.textures = texturePool.getTableDevicePointer();
+        plp.geomInstData = sceneContext.geometryDataTable.getDevicePointer();
+        uploadBatcher.enqueue(plpOnDevice, plp);
+        if (!useGraph)
+            uploadBatcher.flush(curCuStream);
+        if (issueWork)
+            pipeline.launch(curCuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        timestampPool.end(curCuStream, renderScope);
+        cpuTimeRecord.renderCmdTime = renderCmdZone.end();
 
         // Post Process
-        sw.start();
-        curGPUTimer.postProcess.start(curCuStream);
-        cudau::dim3 dimPostProcess = kernelPostProcess.calcGridDim(renderTargetSizeX, renderTargetSizeY);
-        outputBufferSurfaceHolder.beginCUDAAccess(curCuStream);
-        kernelPostProcess(curCuStream, dimPostProcess,
+        profiler::Zone postProcessCmdZone("Post Process Cmd");
+        timestampPool.begin(curCuStream, postProcessScope);
+        if (!useGraph)
+            outputBufferSurfaceHolder.beginCUDAAccess(curCuStream);
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
-                          arrayAccumBuffer.getSurfaceObject(0),
+        const auto postProcessAccumBuffer = arrayAccumBuffer.getSurfaceObject(0);
 #else
-                          accumBuffer.getBlockBuffer2D(),
+        const auto postProcessAccumBuffer = accumBuffer.getBlockBuffer2D();
 #endif
-                          renderTargetSizeX, renderTargetSizeY, plp.numAccumFrames,
-                          outputBufferSurfaceHolder.getNext());
-        outputBufferSurfaceHolder.endCUDAAccess(curCuStream);
-        curGPUTimer.postProcess.stop(curCuStream);
-        cpuTimeRecord.postProcessCmdTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        if (issueWork) {
+            kernelPostProcess.launch2D(curCuStream, renderTargetSizeX, renderTargetSizeY,
+                                       postProcessAccumBuffer,
+                                       renderTargetSizeX, renderTargetSizeY, plp.numAccumFrames,
+                                       outputBufferSurfaceHolder.getNext());
+            if (recordGraph)
+                curGraphRecorder.addKernelNode(postProcessNodeID);
+        }
+        else {
+            curGraphRecorder.setKernelNodeArguments(postProcessNodeID,
+                                                    postProcessAccumBuffer,
+                                                    renderTargetSizeX, renderTargetSizeY, plp.numAccumFrames,
+                                                    outputBufferSurfaceHolder.getNext());
+        }
+        if (!useGraph)
+            outputBufferSurfaceHolder.endCUDAAccess(curCuStream);
+        timestampPool.end(curCuStream, postProcessScope);
+        cpuTimeRecord.postProcessCmdTime = postProcessCmdZone.end();
         ++plp.numAccumFrames;
 
-        curGPUTimer.frame.stop(curCuStream);
+        if (useGraph) {
+            if (recordGraph)
+                curGraphRecorder.endCapture();
+            uploadBatcher.flush(curCuStream);
+            curGraphRecorder.launch(curCuStream);
+            outputBufferSurfaceHolder.endCUDAAccess(curCuStream);
+        }
 
+        timestampPool.end(curCuStream, frameScope);
 
 
-        sw.start();
+
+        profiler::Zone guiCmdZone("GUI Cmd");
 
         {
             ImGui::Render();
@@ -1784,17 +2118,16 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
         // END: scaling
         // ----------------------------------------------------------------
 
-        cpuTimeRecord.guiCmdTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.guiCmdTime = guiCmdZone.end();
 
-        sw.start();
+        profiler::Zone swapZone("Swap");
         glfwSwapBuffers(window);
-        cpuTimeRecord.swapTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.swapTime = swapZone.end();
 
         ++frameIndex;
-        cpuTimeRecord.frameTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
+        cpuTimeRecord.frameTime = frameZone.end();
 
         cpuTimeRecordIndex = (cpuTimeRecordIndex + 1) % lengthof(cpuTimeRecords);
-        sw.clearAllMeasurements();
     }
 
     outputBufferSurfaceHolder.finalize();
@@ -1859,7 +2192,7 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     meshAreaLight.destroy();
     meshCornellBox.destroy();
 
-    sceneContext.geometryDataBuffer.finalize();
+    sceneContext.geometryDataTable.finalize();
 
     scene.destroy();
 
@@ -1871,17 +2204,11 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
     matFloor.destroy();
     matGray.destroy();
 
-    materialDataBuffer.finalize();
-
-    textureObjects = textureObjectBuffer.map();
-    for (int i = textureID - 1; i >= 0; --i)
-        CUDADRV_CHECK(cuTexObjectDestroy(textureObjects[i]));
-    textureObjectBuffer.unmap();
-    arrayGrid.finalize();
-    arrayCheckerBoard.finalize();
+    materialDataTable.finalize();
 
-    textureObjectBuffer.finalize();
+    texturePool.finalize();
 
+    CUDADRV_CHECK(cuModuleUnload(moduleScatterUploads));
     CUDADRV_CHECK(cuModuleUnload(moduleBoundingBoxProgram));
     CUDADRV_CHECK(cuModuleUnload(moduleDeform));
     CUDADRV_CHECK(cuModuleUnload(modulePostProcess));
@@ -1907,8 +2234,13 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 
     optixContext.destroy();
 
-    gpuTimer[1].finalize();
-    gpuTimer[0].finalize();
+    kernelAutotuner.finalize();
+
+    uploadBatcher.finalize();
+
+    timestampPool.finalize();
+    graphRecorder[1].finalize();
+    graphRecorder[0].finalize();
     CUDADRV_CHECK(cuStreamDestroy(cuStream[1]));
     CUDADRV_CHECK(cuStreamDestroy(cuStream[0]));
     CUDADRV_CHECK(cuCtxDestroy(cuContext));
@@ -1925,12 +2257,13 @@ int32_t mainFunc(int32_t argc, const char* argv[]) {
 }
 
 int32_t main(int32_t argc, const char* argv[]) {
+    int32_t ret = 0;
     try {
-        mainFunc(argc, argv);
+        ret = mainFunc(argc, argv);
     }
     catch (const std::exception &ex) {
         hpprintf("Error: %s\n", ex.what());
     }
 
-    return 0;
+    return ret;
 }
@@ -102,7 +102,9 @@ namespace Shared {
     
     struct GeometryData;
     
-    using ProgDecodeHitPoint = optixu::DirectCallableProgramID<void(const HitPointParameter &, const GeometryData &, float3*, float3*, float2*)>;
+    // JP: texCoordDensityはオブジェクト空間の単位長さあたりのテクスチャー座標の変化量(等方的な近似)。
+    // EN: texCoordDensity is the change of texture coordinates per unit length in object space (isotropic approximation).
+    using ProgDecodeHitPoint = optixu::DirectCallableProgramID<void(const HitPointParameter &, const GeometryData &, float3*, float3*, float2*, float*)>;
     
     struct GeometryData {
         union {
@@ -119,10 +121,16 @@ namespace Shared {
 
 #if defined(__CUDA_ARCH__) || defined(__INTELLISENSE__)
         CUDA_DEVICE_FUNCTION void decodeHitPoint(const HitPointParameter &hitPointParam,
-                                        float3* p, float3* sn, float2* texCoord) const {
-            decodeHitPointFunc(hitPointParam, *this, p, sn, texCoord);
+                                        float3* p, float3* sn, float2* texCoord, float* texCoordDensity) const {
+            decodeHitPointFunc(hitPointParam, *this, p, sn, texCoord, texCoordDensity);
             *p = optixTransformPointFromObjectToWorldSpace(*p);
-            *sn = normalize(optixTransformNormalFromObjectToWorldSpace(*sn));
+            // JP: 法線の変換による長さの変化からワールド空間のスケールを求める(一様スケールでは正確)。
+            // EN: Derive the scale into world space from the length change of the transformed normal
+            //     (exact for uniform scaling).
+            float3 worldSn = optixTransformNormalFromObjectToWorldSpace(normalize(*sn));
+            float worldSnLength = length(worldSn);
+            *sn = worldSn / worldSnLength;
+            *texCoordDensity *= worldSnLength;
         }
 #endif
     };
@@ -160,5 +168,8 @@ namespace Shared {
         PerspectiveCamera camera;
         uint32_t matLightIndex;
         CUtexObject* textures;
+        // JP: 環境マップのテクスチャーID。無い場合は0xFFFFFFFF。
+        // EN: Texture ID of the environment map. 0xFFFFFFFF when there is none.
+        uint32_t envTexID;
     };
 }